@@ -15,6 +15,21 @@ sudo mkdir -p /usr/libexec/gnome-vpn-sso/core
 sudo cp python/vpn-sso-auth.py /usr/libexec/gnome-vpn-sso/vpn-sso-auth
 sudo cp python/core/*.py /usr/libexec/gnome-vpn-sso/core/
 sudo chmod +x /usr/libexec/gnome-vpn-sso/vpn-sso-auth
+sudo cp python/vpn-sso-preauth.py /usr/libexec/gnome-vpn-sso/vpn-sso-preauth
+sudo chmod +x /usr/libexec/gnome-vpn-sso/vpn-sso-preauth
+sed 's|@LIBEXECDIR@|/usr/libexec|' data/gnome-vpn-sso-preauth.service.in | \
+    sudo tee /usr/lib/systemd/user/gnome-vpn-sso-preauth.service > /dev/null
+
+# Install the system unit D-Bus activation starts the service with
+sed 's|@LIBEXECDIR@|/usr/libexec|' data/NetworkManager-vpn-sso.service.in | \
+    sudo tee /usr/lib/systemd/system/NetworkManager-vpn-sso.service > /dev/null
+sudo systemctl daemon-reload
+
+# Install native WebKitGTK SSO helper (sso-helper=webkit), if built with
+# -Dwebkit_helper=true
+if [ -f builddir/src/sso-webkit/vpn-sso-webkit ]; then
+    sudo cp builddir/src/sso-webkit/vpn-sso-webkit /usr/libexec/gnome-vpn-sso/
+fi
 
 # Install editor plugins
 sudo cp builddir/src/editor/libnm-vpn-plugin-vpn-sso-editor.so /usr/lib/x86_64-linux-gnu/NetworkManager/
@@ -9,7 +9,9 @@
 , glib
 , libadwaita
 , libsecret
+, gnutls
 , webkitgtk_6_0
+, libsoup_3
 , openconnect
 , vpnc-scripts
 , writeShellScriptBin
@@ -43,13 +45,16 @@ python3Packages.buildPythonApplication rec {
     glib
     libadwaita
     libsecret
+    gnutls
     webkitgtk_6_0
+    libsoup_3
     playwright-driver
   ];
 
   pythonPath = with python3Packages; [
     playwright
     pyotp
+    pygobject3
   ];
 
   mesonFlags = [
@@ -3,22 +3,175 @@
 from __future__ import annotations
 
 import base64
+import hashlib
 import json
 import os
 import re
+import socket
 import ssl
 import threading
 import time
 import urllib.parse
 import urllib.request
 import xml.etree.ElementTree as ET
-from typing import Optional
+from typing import Callable, Optional
 
+from playwright.sync_api import TimeoutError as PlaywrightTimeoutError
 from playwright.sync_api import sync_playwright
 
+from .http_login import FlowDeviation, LoginFailed, http_saml_login
+from .progress import Progress
+from .request_filter import RequestFilter
 from .totp import generate_totp
 
 
+USERNAME_SELECTORS = [
+    "input[type='email']",
+    "input[name='loginfmt']",
+    "input[name='login']",
+    "input[id='i0116']",
+    "input[autocomplete='username']",
+]
+PASSWORD_SELECTORS = [
+    "input[type='password']",
+    "input[name='passwd']",
+    "input[id='i0118']",
+    "input[autocomplete='current-password']",
+]
+OTP_SELECTORS = [
+    "input[name='otc']",
+    "input[id='otc']",
+    "input[name='code']",
+    "input[type='tel']",
+    "input[autocomplete='one-time-code']",
+]
+
+# How often conditions are re-checked while a wait lets Playwright
+# deliver browser events
+EVENT_SLICE_MS = 100
+
+
+# Finds the first visible element matching any of the CSS selectors, or
+# else whose text contains any of the (lower-case) texts, in priority
+# order, and marks it so a locator can act on it. Visible has Playwright's
+# meaning: a non-empty bounding box and no visibility:hidden.
+_PROBE_JS = """
+({selectors, texts, mark}) => {
+    const visible = (el) => {
+        const r = el.getBoundingClientRect();
+        return r.width > 0 && r.height > 0 && getComputedStyle(el).visibility !== "hidden";
+    };
+    const norm = (s) => (s || "").replace(/\\s+/g, " ").toLowerCase();
+    const hasText = (el, t) => norm(el.textContent).includes(t);
+    const found = (el) => {
+        document.querySelectorAll("[data-vpn-sso-probe]").forEach((e) => e.removeAttribute("data-vpn-sso-probe"));
+        el.setAttribute("data-vpn-sso-probe", mark);
+        return mark;
+    };
+
+    for (const sel of selectors) {
+        let els;
+        try { els = document.querySelectorAll(sel); } catch (e) { continue; }
+        for (const el of els)
+            if (visible(el))
+                return found(el);
+    }
+
+    if (!texts.length || !document.body)
+        return null;
+    const all = Array.from(document.body.querySelectorAll("*"))
+        .filter((el) => !["SCRIPT", "STYLE", "NOSCRIPT", "TEMPLATE"].includes(el.tagName));
+    for (const t of texts) {
+        for (const el of all) {
+            const isButton = el.tagName === "INPUT" && ["submit", "button"].includes(el.type);
+            if (isButton ? !norm(el.value).includes(t) : !hasText(el, t))
+                continue;
+            // The innermost element carrying the text, as get_by_text() picks
+            if (!isButton && Array.from(el.children).some((c) => hasText(c, t)))
+                continue;
+            if (visible(el))
+                return found(el);
+        }
+    }
+    return null;
+}
+"""
+
+_probe_count = 0
+
+
+def _probe(page, selectors: list[str] = (), texts: list[str] = ()):
+    """Return a locator for the first visible match of selectors or texts.
+
+    Selectors are tried before texts, in list order, frame by frame. Each
+    frame costs one evaluation instead of a count() and is_visible() round
+    trip per candidate.
+    """
+    global _probe_count
+    _probe_count += 1
+    mark = str(_probe_count)
+    args = {"selectors": list(selectors), "texts": [t.lower() for t in texts], "mark": mark}
+    for frame in page.frames:
+        try:
+            if frame.evaluate(_PROBE_JS, args):
+                return frame.locator(f"[data-vpn-sso-probe='{mark}']").first
+        except Exception:
+            continue
+    return None
+
+
+class _StepTimer:
+    """Prints how long each step of a login took, and reports it as progress."""
+
+    def __init__(self, progress: Optional[Progress] = None) -> None:
+        self.start = self.last = time.monotonic()
+        self.steps: list[tuple[str, float]] = []
+        self.progress = progress or Progress()
+
+    def begin(self, step: str) -> None:
+        self.progress.phase_started(step)
+
+    def mark(self, step: str) -> None:
+        now = time.monotonic()
+        self.steps.append((step, now - self.last))
+        self.last = now
+        print(f"  [time] {step}: {self.steps[-1][1] * 1000:.0f} ms")
+        self.progress.phase_done(step, self.steps[-1][1] * 1000)
+
+    def record(self, step: str, seconds: float) -> None:
+        """Record a step that ran alongside the others."""
+        self.steps.append((step, seconds))
+        print(f"  [time] {step}: {seconds * 1000:.0f} ms (in parallel)")
+        self.progress.phase_done(step, seconds * 1000)
+
+    def summary(self) -> None:
+        total = (time.monotonic() - self.start) * 1000
+        steps = ", ".join(f"{name} {secs * 1000:.0f}" for name, secs in self.steps)
+        print(f"  [time] total: {total:.0f} ms ({steps})")
+
+
+def _wait_for_first(page, conditions: dict[str, Callable[[], bool]], timeout_ms: float) -> Optional[str]:
+    """Wait until one of the conditions holds and return its name.
+
+    The sync Playwright API only delivers events (requests, responses,
+    navigations) while a Playwright call runs, so the wait is made of short
+    page.wait_for_timeout() slices; each condition is checked as soon as the
+    events of a slice have been handled. None after timeout_ms.
+    """
+    deadline = time.monotonic() + timeout_ms / 1000.0
+    while True:
+        for name, condition in conditions.items():
+            try:
+                if condition():
+                    return name
+            except Exception:
+                continue
+        remaining = (deadline - time.monotonic()) * 1000
+        if remaining <= 0:
+            return None
+        page.wait_for_timeout(min(EVENT_SLICE_MS, remaining))
+
+
 def _detect_desktop_user() -> Optional[str]:
     """Detect the active desktop user when running as root."""
     import glob
@@ -72,14 +225,133 @@ def _detect_desktop_user() -> Optional[str]:
     return None
 
 
+def _discover_session(debug: bool = False) -> tuple[str, str]:
+    """Return (user, home) of the desktop session when run without a context."""
+    real_user = os.environ.get("SUDO_USER", os.environ.get("USER", "root"))
+    home = os.path.expanduser("~")
+    if real_user == "root":
+        detected_user = _detect_desktop_user()
+        if detected_user:
+            real_user = detected_user
+            if debug:
+                print(f"    [DEBUG] Detected desktop user: {real_user}")
+    if real_user != "root":
+        try:
+            import pwd
+            home = pwd.getpwnam(real_user).pw_dir
+            os.environ.setdefault("PLAYWRIGHT_BROWSERS_PATH", f"{home}/.cache/ms-playwright")
+        except Exception:
+            pass
+    else:
+        for pw_path in ["/var/cache/ms-playwright", "/opt/ms-playwright", "/usr/share/ms-playwright"]:
+            if os.path.isdir(pw_path):
+                os.environ.setdefault("PLAYWRIGHT_BROWSERS_PATH", pw_path)
+                break
+    return real_user, home
+
+
+# Seconds a cached prelogin response (SAML request URL, server IP) is reused
+PRELOGIN_CACHE_TTL = 600
+
+_ssl_context: Optional[ssl.SSLContext] = None
+
+
+def _get_ssl_context() -> ssl.SSLContext:
+    """Return a shared SSL context; loading the CA store is not free."""
+    global _ssl_context
+    if _ssl_context is None:
+        _ssl_context = ssl.create_default_context()
+    return _ssl_context
+
+
+def get_server_cert_fingerprint(server: str, timeout: float = 10, debug: bool = False) -> Optional[str]:
+    """Return the gateway certificate as an openconnect --servercert value.
+
+    The handshake is validated against the system CA store, so the result
+    is safe to pin.
+    """
+    try:
+        parsed = urllib.parse.urlparse(server if "://" in server else f"//{server}")
+        host = parsed.hostname or server
+        port = parsed.port or 443
+        with socket.create_connection((host, port), timeout=timeout) as sock:
+            with _get_ssl_context().wrap_socket(sock, server_hostname=host) as tls:
+                der = tls.getpeercert(binary_form=True)
+    except (OSError, ValueError) as exc:
+        if debug:
+            print(f"[DEBUG] certificate fetch from {server} failed: {exc}")
+        return None
+    if not der:
+        return None
+    return "sha256:" + hashlib.sha256(der).hexdigest()
+
+
+def _prelogin_cache_path(real_user: str, home: str, cache_base: Optional[str] = None) -> str:
+    if cache_base:
+        return os.path.join(cache_base, "prelogin.json")
+    if real_user != "root":
+        return os.path.join(home, ".cache", "gnome-vpn-sso", "prelogin.json")
+    return os.path.join("/var/cache", "gnome-vpn-sso", "prelogin.json")
+
+
+def _load_prelogin_cache(path: str, server: str, ttl: int, debug: bool = False) -> Optional[tuple[str, Optional[str]]]:
+    """Return (saml_request, gateway_ip) cached for server if younger than ttl."""
+    if ttl <= 0:
+        return None
+    try:
+        with open(path, "r", encoding="utf-8") as f:
+            entry = json.load(f).get(server)
+    except (OSError, ValueError, AttributeError):
+        return None
+    if not isinstance(entry, dict) or not entry.get("saml_request"):
+        return None
+    age = time.time() - float(entry.get("fetched_at", 0))
+    if age < 0 or age > ttl:
+        if debug:
+            print(f"    [DEBUG] Cached prelogin for {server} expired ({int(age)}s old)")
+        return None
+    return entry["saml_request"], entry.get("server_ip")
+
+
+def _update_prelogin_cache(path: str, server: str, entry: Optional[dict], debug: bool = False) -> None:
+    """Set (or with entry=None, drop) the cached prelogin for server."""
+    try:
+        with open(path, "r", encoding="utf-8") as f:
+            entries = json.load(f)
+        if not isinstance(entries, dict):
+            entries = {}
+    except (OSError, ValueError):
+        entries = {}
+
+    now = time.time()
+    entries = {
+        k: v for k, v in entries.items()
+        if isinstance(v, dict) and now - float(v.get("fetched_at", 0)) < 86400
+    }
+    if entry is None:
+        entries.pop(server, None)
+    else:
+        entries[server] = dict(entry, fetched_at=now)
+
+    try:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmp = f"{path}.{os.getpid()}.tmp"
+        fd = os.open(tmp, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o600)
+        with os.fdopen(fd, "w", encoding="utf-8") as f:
+            json.dump(entries, f)
+        os.replace(tmp, path)
+    except OSError as exc:
+        if debug:
+            print(f"    [DEBUG] Could not write prelogin cache {path}: {exc}")
+
+
 def _get_gp_prelogin(server: str, debug: bool = False) -> tuple[Optional[str], Optional[str], Optional[str]]:
     """Get prelogin-cookie and SAML request for GlobalProtect."""
     url = f"https://{server}/global-protect/prelogin.esp?tmp=tmp&clientVer=4100&clientos=Linux"
     try:
-        ctx = ssl.create_default_context()
         req = urllib.request.Request(url)
         req.add_header("User-Agent", "PAN GlobalProtect")
-        with urllib.request.urlopen(req, timeout=10, context=ctx) as resp:
+        with urllib.request.urlopen(req, timeout=10, context=_get_ssl_context()) as resp:
             if resp.status != 200:
                 return None, None, None
             content = resp.read().decode("utf-8")
@@ -101,6 +373,142 @@ def _get_gp_prelogin(server: str, debug: bool = False) -> tuple[Optional[str], O
         return None, None, None
 
 
+class _Background:
+    """Runs fn(*args) on a thread; result() waits for its return value."""
+
+    def __init__(self, fn: Callable, *args) -> None:
+        self._result = None
+        self.seconds = 0.0
+        self._thread = threading.Thread(target=self._run, args=(fn, args), daemon=True)
+        self._thread.start()
+
+    def _run(self, fn: Callable, args: tuple) -> None:
+        start = time.monotonic()
+        try:
+            self._result = fn(*args)
+        finally:
+            self.seconds = time.monotonic() - start
+
+    def result(self):
+        self._thread.join()
+        return self._result
+
+
+def _fanout_start_url(protocol: str, server: str, prelogin_cache: Optional[str], prelogin_ttl: int, debug: bool) -> tuple[Optional[str], Optional[str]]:
+    """Return (start URL, GlobalProtect server IP) for a fan-out target."""
+    netloc = urllib.parse.urlparse(server if "://" in server else f"//{server}").netloc or server
+    if protocol != "gp":
+        return f"https://{netloc}/+CSCOE+/saml/sp/login?tgname=DefaultWEBVPNGroup", None
+
+    cached = _load_prelogin_cache(prelogin_cache, server, prelogin_ttl, debug) if prelogin_cache else None
+    if cached:
+        saml_request, server_ip = cached
+    else:
+        _, saml_request, server_ip = _get_gp_prelogin(server, debug)
+        if saml_request and prelogin_cache and prelogin_ttl > 0:
+            _update_prelogin_cache(prelogin_cache, server, {"saml_request": saml_request, "server_ip": server_ip}, debug)
+    if not saml_request:
+        return None, server_ip
+    try:
+        start_url = base64.b64decode(saml_request).decode("utf-8")
+    except Exception:
+        return None, server_ip
+    return (start_url if start_url.startswith("http") else None), server_ip
+
+
+def _collect_fanout_cookies(
+    context,
+    targets: list[tuple[str, str]],
+    prelogin_cache: Optional[str],
+    prelogin_ttl: int,
+    debug: bool = False,
+    timeout_s: float = 45,
+) -> dict[tuple[str, str], dict]:
+    """Log in to further gateways that trust the same IdP, one tab each.
+
+    Runs after the first login, so the IdP session in the shared browser
+    context normally lets every tab complete without interaction. Targets
+    that do not reach their VPN callback before the deadline are left out.
+    """
+    tabs = []
+    for protocol, server in targets:
+        start_url, server_ip = _fanout_start_url(protocol, server, prelogin_cache, prelogin_ttl, debug)
+        if not start_url:
+            print(f"  -> {server}: no SAML start URL, skipping")
+            continue
+
+        host = urllib.parse.urlparse(server if "://" in server else f"//{server}").hostname or server
+        hosts = {host} | ({server_ip} if server_ip else set())
+        captured: dict = {}
+
+        def on_request(request, hosts=hosts, captured=captured):
+            if (urllib.parse.urlparse(request.url).hostname or "") not in hosts:
+                return
+            captured.setdefault("_reached", True)
+            try:
+                params = urllib.parse.parse_qs(request.post_data or "")
+            except Exception:
+                return
+            for key in ("SAMLResponse", "prelogin-cookie"):
+                if key in params:
+                    captured[key] = params[key][0]
+
+        def on_response(response, hosts=hosts, captured=captured):
+            if (urllib.parse.urlparse(response.url).hostname or "") not in hosts:
+                return
+            try:
+                headers = response.headers
+            except Exception:
+                return
+            for key in ("prelogin-cookie", "saml-username", "portal-userauthcookie"):
+                if key in headers:
+                    captured[key] = headers[key]
+
+        page = context.new_page()
+        page.on("request", on_request)
+        page.on("response", on_response)
+        try:
+            page.goto(start_url, timeout=30000, wait_until="commit")
+        except Exception as exc:
+            if debug:
+                print(f"    [DEBUG] fan-out {server}: {exc}")
+            page.close()
+            continue
+        tabs.append((protocol, server, host, server_ip, page, captured))
+
+    results: dict[tuple[str, str], dict] = {}
+    deadline = time.monotonic() + timeout_s
+    callback_keys = ("SAMLResponse", "prelogin-cookie", "portal-userauthcookie")
+    for protocol, server, host, server_ip, page, captured in tabs:
+        def session_cookie(host=host) -> bool:
+            return any(c["name"] in ("webvpn", "SVPNCOOKIE") and c.get("value")
+                       for c in context.cookies(f"https://{host}/"))
+
+        if protocol == "gp":
+            conditions = {"callback": lambda captured=captured: any(k in captured for k in callback_keys)}
+        else:
+            # The AnyConnect session cookie is set by the callback's response
+            conditions = {"cookie": session_cookie}
+        _wait_for_first(page, conditions, max(0.0, deadline - time.monotonic()) * 1000)
+
+        cookies = {}
+        for c in context.cookies(f"https://{host}/"):
+            if c.get("value"):
+                cookies[c["name"]] = c["value"]
+        cookies.update({k: v for k, v in captured.items() if not k.startswith("_")})
+        if server_ip:
+            cookies["_gateway_ip"] = server_ip
+        page.close()
+
+        if any(k in cookies for k in callback_keys + ("webvpn", "SVPNCOOKIE")):
+            results[(protocol, server)] = cookies
+            print(f"  -> {server}: signed in through shared IdP session")
+        else:
+            print(f"  -> {server}: no VPN cookie before deadline, skipping")
+
+    return results
+
+
 def do_saml_auth(
     vpn_server: str,
     username: str,
@@ -111,8 +519,38 @@ def do_saml_auth(
     headless: bool = True,
     debug: bool = False,
     vpn_server_ip: Optional[str] = None,
+    prelogin_ttl: int = PRELOGIN_CACHE_TTL,
+    fanout_targets: Optional[list[tuple[str, str]]] = None,
+    fanout_results: Optional[dict] = None,
+    session_name: Optional[str] = None,
+    request_filter: bool = True,
+    http_login: bool = True,
+    session_context: Optional[dict] = None,
+    progress: Optional[Progress] = None,
+    on_cookies: Optional[Callable[[dict], None]] = None,
 ):
-    """Complete Microsoft SAML authentication and return cookies."""
+    """Complete Microsoft SAML authentication and return cookies.
+
+    With fanout_targets ([(protocol, server), ...]), gateways that trust the
+    same IdP are signed in afterwards from the same browser context, and
+    their cookies are put into fanout_results keyed by (protocol, server).
+
+    session_name selects a separate persistent browser profile, for runs
+    alongside another helper (Chromium locks its profile directory).
+
+    Headless runs skip images, fonts and telemetry unless request_filter
+    is False (see core.request_filter). With a password and TOTP secret,
+    Entra ID logins are first tried without a browser unless http_login
+    is False (see core.http_login).
+
+    session_context is the context the service passes on stdin (user,
+    home, browsers_path, cache_dir, gateway_ip). With it, the desktop user
+    and cache directories are taken as given instead of being detected.
+
+    Steps are reported to progress as they start and finish, and
+    on_cookies gets the primary gateway's cookies as soon as they are
+    known, before the fan-out and the browser shutdown.
+    """
     vpn_server_raw = vpn_server
     try:
         parsed_server = urllib.parse.urlparse(vpn_server_raw if "://" in vpn_server_raw else f"//{vpn_server_raw}")
@@ -123,45 +561,132 @@ def do_saml_auth(
         vpn_server_netloc = vpn_server_raw
 
     vpn_url = f"https://{vpn_server_netloc}"
+    timer = _StepTimer(progress)
+
+    session_context = session_context or {}
+    cache_base = session_context.get("cache_dir")
+    if not vpn_server_ip:
+        vpn_server_ip = session_context.get("gateway_ip")
+
+    if session_context.get("user"):
+        real_user = session_context["user"]
+        home = session_context.get("home") or os.path.expanduser("~")
+        if session_context.get("browsers_path"):
+            os.environ["PLAYWRIGHT_BROWSERS_PATH"] = session_context["browsers_path"]
+    else:
+        real_user, home = _discover_session(debug)
 
     gp_prelogin_cookie, gp_saml_request, gp_gateway_ip = None, None, None
+    prelogin_fetch: Optional[_Background] = None
+    prelogin_cache, cached_prelogin = _prelogin_cache_path(real_user, home, cache_base), None
     if protocol == "gp":
-        print("  [1/6] Getting GlobalProtect prelogin info...")
-        gp_prelogin_cookie, gp_saml_request, gp_gateway_ip = _get_gp_prelogin(vpn_server, debug)
+        cached_prelogin = _load_prelogin_cache(prelogin_cache, vpn_server, prelogin_ttl, debug)
+        if cached_prelogin:
+            print("  [1/6] Using cached GlobalProtect prelogin info...")
+            gp_saml_request, gp_gateway_ip = cached_prelogin
+            timer.mark("prelogin")
+        else:
+            # Runs while Chromium starts; picked up by _await_prelogin()
+            print("  [1/6] Getting GlobalProtect prelogin info...")
+            timer.begin("prelogin")
+            prelogin_fetch = _Background(_get_gp_prelogin, vpn_server, debug)
+    else:
+        print("  [1/6] Using AnyConnect SAML URL...")
+
+    def _await_prelogin() -> None:
+        nonlocal gp_prelogin_cookie, gp_saml_request, gp_gateway_ip, prelogin_fetch
+        if prelogin_fetch is None:
+            return
+        gp_prelogin_cookie, gp_saml_request, gp_gateway_ip = prelogin_fetch.result()
+        timer.record("prelogin", prelogin_fetch.seconds)
+        prelogin_fetch = None
+        if gp_saml_request and prelogin_ttl > 0:
+            _update_prelogin_cache(
+                prelogin_cache, vpn_server,
+                {"saml_request": gp_saml_request, "server_ip": gp_gateway_ip}, debug,
+            )
         if debug:
             print(f"    [DEBUG] prelogin-cookie: {gp_prelogin_cookie[:20] if gp_prelogin_cookie else None}...")
             print(f"    [DEBUG] gateway_ip: {gp_gateway_ip}")
-    else:
-        print("  [1/6] Using AnyConnect SAML URL...")
 
-    real_user = os.environ.get("SUDO_USER", os.environ.get("USER", "root"))
-    home = os.path.expanduser("~")
-    if real_user == "root":
-        detected_user = _detect_desktop_user()
-        if detected_user:
-            real_user = detected_user
-            if debug:
-                print(f"    [DEBUG] Detected desktop user: {real_user}")
-    if real_user != "root":
-        try:
-            import pwd
-            home = pwd.getpwnam(real_user).pw_dir
-            os.environ.setdefault("PLAYWRIGHT_BROWSERS_PATH", f"{home}/.cache/ms-playwright")
-        except Exception:
-            pass
-    else:
-        for pw_path in ["/var/cache/ms-playwright", "/opt/ms-playwright", "/usr/share/ms-playwright"]:
-            if os.path.isdir(pw_path):
-                os.environ.setdefault("PLAYWRIGHT_BROWSERS_PATH", pw_path)
-                break
+    req_filter: Optional[RequestFilter] = None
+
+    def _finish(context, cookies: dict) -> dict:
+        if on_cookies:
+            on_cookies(cookies)
+        if fanout_targets and fanout_results is not None:
+            print(f"  -> Signing in to {len(fanout_targets)} more gateway(s) with the same IdP session...")
+            timer.begin("fan-out")
+            try:
+                fanout_results.update(
+                    _collect_fanout_cookies(context, fanout_targets, prelogin_cache, prelogin_ttl, debug)
+                )
+            except Exception as exc:
+                print(f"  -> Fan-out failed: {exc}")
+            timer.mark("fan-out")
+        context.close()
+        if req_filter:
+            req_filter.summary()
+        if debug:
+            print(f"    [DEBUG] {_probe_count} DOM probes")
+        timer.summary()
+        return cookies
 
+    # Everything needed to answer a known IdP is at hand: try without a
+    # browser first. The fan-out needs the browser's IdP session.
+    if http_login and password and totp_secret and auto_totp and not fanout_targets:
+        _await_prelogin()
+        http_start = None
+        if protocol == "gp" and gp_saml_request:
+            try:
+                http_start = base64.b64decode(gp_saml_request).decode("utf-8")
+            except Exception:
+                pass
+        elif protocol == "anyconnect":
+            http_start = f"https://{vpn_server_netloc}/+CSCOE+/saml/sp/login?tgname=DefaultWEBVPNGroup"
+
+        if http_start:
+            print("  -> Signing in without a browser...")
+            timer.begin("http login")
+            vpn_hosts = {vpn_server_host} | {h for h in (gp_gateway_ip, vpn_server_ip) if h}
+            try:
+                http_cookies = http_saml_login(
+                    http_start, protocol, vpn_hosts, username, password, totp_secret,
+                    _get_ssl_context(), debug,
+                )
+            except FlowDeviation as exc:
+                print(f"  -> Browserless login stopped ({exc}), using the browser")
+                timer.mark("http login")
+            except LoginFailed as exc:
+                # The browser would send the same password or code again
+                print(f"  -> Browserless login failed ({exc})")
+                timer.mark("http login")
+                raise
+            else:
+                if gp_prelogin_cookie and "prelogin-cookie" not in http_cookies:
+                    http_cookies["prelogin-cookie"] = gp_prelogin_cookie
+                if gp_gateway_ip:
+                    http_cookies["_gateway_ip"] = gp_gateway_ip
+                timer.mark("http login")
+                timer.summary()
+                if on_cookies:
+                    on_cookies(http_cookies)
+                return http_cookies
+
+    session_dir = "browser-session"
+    if session_name:
+        session_dir += "-" + re.sub(r"[^A-Za-z0-9_.-]", "_", session_name)
+
+    timer.begin("browser")
     with sync_playwright() as p:
-        if real_user != "root":
-            cache_dir = os.path.join(home, ".cache", "gnome-vpn-sso", "browser-session")
+        if cache_base:
+            cache_dir = os.path.join(cache_base, session_dir)
+        elif real_user != "root":
+            cache_dir = os.path.join(home, ".cache", "gnome-vpn-sso", session_dir)
         else:
             cache_dir = None
             for base in ["/var/cache", "/tmp"]:
-                test_dir = os.path.join(base, "gnome-vpn-sso", "browser-session")
+                test_dir = os.path.join(base, "gnome-vpn-sso", session_dir)
                 try:
                     os.makedirs(test_dir, exist_ok=True)
                     test_file = os.path.join(test_dir, ".write-test")
@@ -173,7 +698,7 @@ def do_saml_auth(
                 except Exception:
                     continue
             if not cache_dir:
-                cache_dir = f"/tmp/gnome-vpn-sso-{os.getpid()}/browser-session"
+                cache_dir = f"/tmp/gnome-vpn-sso-{os.getpid()}/{session_dir}"
         os.makedirs(cache_dir, exist_ok=True)
 
         context = p.chromium.launch_persistent_context(
@@ -183,6 +708,8 @@ def do_saml_auth(
             user_agent="Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36",
         )
         page = context.pages[0] if context.pages else context.new_page()
+        timer.mark("browser")
+        _await_prelogin()
 
         saml_result = {
             "prelogin_cookie": None,
@@ -197,6 +724,14 @@ def do_saml_auth(
         if vpn_server_ip:
             allowed_hosts.add(vpn_server_ip)
 
+        if headless and request_filter:
+            fanout_hosts = {
+                urllib.parse.urlparse(server if "://" in server else f"//{server}").hostname
+                for _, server in fanout_targets or []
+            }
+            req_filter = RequestFilter(allowed_hosts | fanout_hosts, debug=debug)
+            req_filter.install(context)
+
         def _is_vpn_url(url: str) -> bool:
             try:
                 host = urllib.parse.urlparse(url).hostname or ""
@@ -216,19 +751,32 @@ def do_saml_auth(
 
         vpn_request_event = threading.Event()
 
+        def _callback_seen() -> bool:
+            return bool(
+                saml_result.get("saml_response")
+                or saml_result.get("prelogin_cookie")
+                or saml_result.get("portal_userauthcookie")
+                or vpn_request_event.is_set()
+                or _is_vpn_url(page.url)
+            )
+
         def _wait_for_vpn_callback(timeout_ms: int = 60000) -> None:
-            if _is_vpn_url(page.url):
-                return
-            if saml_result.get("saml_response") or saml_result.get("prelogin_cookie") or saml_result.get("portal_userauthcookie"):
+            """Block until the IdP sends the browser back to the VPN server.
+
+            Waits for the request itself (in any tab of the context), then
+            for its response, which carries the GlobalProtect cookies.
+            """
+            if _callback_seen():
                 return
-            deadline = time.time() + (timeout_ms / 1000.0)
-            while time.time() < deadline:
-                if saml_result.get("saml_response") or saml_result.get("prelogin_cookie") or saml_result.get("portal_userauthcookie"):
-                    return
-                if _is_vpn_url(page.url):
-                    return
-                if vpn_request_event.wait(timeout=0.25):
-                    return
+            try:
+                request = context.wait_for_event(
+                    "request", predicate=lambda r: _is_vpn_url(r.url), timeout=timeout_ms,
+                )
+                response = request.response()
+                if response:
+                    handle_response(response)
+            except PlaywrightTimeoutError:
+                pass
 
         def handle_request(request):
             if _is_vpn_url(request.url):
@@ -277,39 +825,25 @@ def do_saml_auth(
         page.on("response", handle_response)
 
         def _find_visible_in_frames(selectors: list[str]):
-            for frame in page.frames:
-                for sel in selectors:
-                    loc = frame.locator(sel)
-                    try:
-                        if loc.count() > 0 and loc.first.is_visible():
-                            return loc.first
-                    except Exception:
-                        continue
-            return None
+            return _probe(page, selectors=selectors)
+
+        def _find_text_in_frames(texts: list[str]):
+            return _probe(page, texts=texts)
+
+        def _click(loc) -> bool:
+            if loc is None:
+                return False
+            try:
+                loc.click()
+                return True
+            except Exception:
+                return False
 
         def _click_first_text(texts: list[str]):
-            for frame in page.frames:
-                for t in texts:
-                    loc = frame.get_by_text(t, exact=False)
-                    try:
-                        if loc.count() > 0 and loc.first.is_visible():
-                            loc.first.click()
-                            return True
-                    except Exception:
-                        continue
-            return False
+            return _click(_find_text_in_frames(texts))
 
         def _click_first_selector(selectors: list[str]):
-            for frame in page.frames:
-                for sel in selectors:
-                    loc = frame.locator(sel)
-                    try:
-                        if loc.count() > 0 and loc.first.is_visible():
-                            loc.first.click()
-                            return True
-                    except Exception:
-                        continue
-            return False
+            return _click(_find_visible_in_frames(selectors))
 
         try:
             if protocol == "gp" and gp_saml_request:
@@ -325,9 +859,12 @@ def do_saml_auth(
                 start_url = vpn_url
 
             print("  [1/6] Opening SAML portal...")
+            timer.begin("portal")
             for attempt in range(3):
                 try:
-                    page.goto(start_url, timeout=30000, wait_until="networkidle")
+                    # IdP pages with analytics beacons can take many seconds
+                    # to go network-idle; what comes next is waited for below
+                    page.goto(start_url, timeout=30000, wait_until="commit")
                     break
                 except Exception as exc:
                     if "ERR_NETWORK_CHANGED" in str(exc):
@@ -337,11 +874,27 @@ def do_saml_auth(
                         continue
                     raise
 
+            # Either a login form shows up, or a valid IdP session sends the
+            # browser straight back to the VPN server
+            landed = _wait_for_first(page, {
+                "callback": _callback_seen,
+                "form": lambda: _find_visible_in_frames(USERNAME_SELECTORS + PASSWORD_SELECTORS) is not None,
+                "account picker": lambda: _find_text_in_frames(
+                    ["Pick an account", "Use another account", "Sign in with another account"]) is not None,
+            }, 30000)
+            timer.mark("portal")
             if debug:
+                print(f"    [DEBUG] Portal landed on: {landed}")
                 page.screenshot(path="/tmp/vpn-step1-portal.png")
                 print("    [DEBUG] Screenshot: /tmp/vpn-step1-portal.png")
 
-            time.sleep(1)
+            if landed == "callback" and not _is_vpn_url(page.url):
+                _wait_for_vpn_callback(10000)
+            if _is_vpn_url(page.url) and protocol != "gp":
+                # The AnyConnect session cookie is set by the callback response
+                _wait_for_first(page, {"cookie": lambda: any(
+                    c["name"] in ("webvpn", "SVPNCOOKIE") and _cookie_domain_matches(c.get("domain", ""))
+                    for c in context.cookies())}, 5000)
             if _is_vpn_url(page.url):
                 all_cookies = context.cookies()
                 session_cookies = {}
@@ -369,59 +922,51 @@ def do_saml_auth(
                         session_cookies["prelogin-cookie"] = gp_prelogin_cookie
                     if gp_gateway_ip:
                         session_cookies["_gateway_ip"] = gp_gateway_ip
-                    context.close()
-                    return session_cookies
+                    return _finish(context, session_cookies)
 
             # Step 2: account selection
             _click_first_text(["Use another account", "Sign in with another account"])
             if username:
-                account_tile = None
-                for frame in page.frames:
-                    try:
-                        loc = frame.locator(f"text={username}")
-                        if loc.count() > 0 and loc.first.is_visible():
-                            account_tile = loc.first
-                            break
-                    except Exception:
-                        continue
-                if account_tile:
-                    account_tile.click()
+                _click(_find_text_in_frames([username]))
 
             # Step 3: username field
-            user_loc = _find_visible_in_frames([
-                "input[type='email']",
-                "input[name='loginfmt']",
-                "input[name='login']",
-                "input[id='i0116']",
-                "input[autocomplete='username']",
-            ])
+            user_loc = _find_visible_in_frames(USERNAME_SELECTORS)
             if user_loc and username:
                 user_loc.fill(username)
                 _click_first_text(["Next", "Weiter", "Suivant", "Avanti", "Weiter >", "Continue"])
+                # The password page replaces the form without a full load
+                _wait_for_first(page, {
+                    "callback": _callback_seen,
+                    "password": lambda: _find_visible_in_frames(PASSWORD_SELECTORS) is not None,
+                }, 15000)
+                timer.mark("username")
 
             # Step 4: password field
-            pass_loc = _find_visible_in_frames([
-                "input[type='password']",
-                "input[name='passwd']",
-                "input[id='i0118']",
-                "input[autocomplete='current-password']",
-            ])
+            pass_loc = _find_visible_in_frames(PASSWORD_SELECTORS)
             if pass_loc and password:
                 pass_loc.fill(password)
                 _click_first_text(["Sign in", "Anmelden", "Connexion", "Accedi", "Continue", "Next"])
+                # Wait for whatever follows: MFA, "Stay signed in?" or the callback
+                _wait_for_first(page, {
+                    "callback": _callback_seen,
+                    "otp": lambda: _find_visible_in_frames(OTP_SELECTORS) is not None,
+                    "prompt": lambda: _find_visible_in_frames(
+                        ["input[id='idSIButton9']", "button#idSIButton9"]) is not None,
+                    "password gone": lambda: _find_visible_in_frames(PASSWORD_SELECTORS) is None,
+                }, 15000)
+                timer.mark("password")
 
             # Step 5: OTP / MFA
             if totp_secret and auto_totp:
-                otp_loc = _find_visible_in_frames([
-                    "input[name='otc']",
-                    "input[id='otc']",
-                    "input[name='code']",
-                    "input[type='tel']",
-                    "input[autocomplete='one-time-code']",
-                ])
+                otp_loc = _find_visible_in_frames(OTP_SELECTORS)
                 if otp_loc:
                     otp_loc.fill(generate_totp(totp_secret))
                     _click_first_text(["Verify", "Überprüfen", "Continue", "Next", "Anmelden"])
+                    _wait_for_first(page, {
+                        "callback": _callback_seen,
+                        "otp gone": lambda: _find_visible_in_frames(OTP_SELECTORS) is None,
+                    }, 15000)
+                    timer.mark("otp")
 
             # Try "Send notification" / MFA prompt
             _click_first_text(["Send notification", "Send push", "Approve", "Verify", "Continue"])
@@ -435,6 +980,12 @@ def do_saml_auth(
             _click_first_selector(["input[id='idSIButton9']", "button#idSIButton9"])
 
             _wait_for_vpn_callback(90000)
+            timer.mark("callback")
+
+            # A reused SAML request that never reached the portal callback may
+            # have been refused by the IdP; fetch a fresh one next time
+            if cached_prelogin and not any(saml_result.values()):
+                _update_prelogin_cache(prelogin_cache, vpn_server, None, debug)
 
             # Collect cookies
             all_cookies = context.cookies()
@@ -474,8 +1025,7 @@ def do_saml_auth(
                 except Exception:
                     pass
 
-            context.close()
-            return vpn_cookies
+            return _finish(context, vpn_cookies)
         except Exception:
             if debug:
                 try:
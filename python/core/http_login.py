@@ -0,0 +1,349 @@
+"""Browserless SAML login for Microsoft Entra ID.
+
+With a saved password and TOTP secret, an Entra ID login is a fixed series
+of form posts, so it can be done with plain HTTPS requests in a few hundred
+milliseconds instead of starting Chromium. The steps follow the $Config
+object every Entra page embeds:
+
+  ConvergedSignIn   username and password
+  ConvergedTFA      BeginAuth / EndAuth with the TOTP code, then ProcessAuth
+  KmsiInterrupt     "Stay signed in?"
+
+and end with the auto-submitting form that posts the SAMLResponse to the
+VPN server. Before the password goes out, GetCredentialType tells whether
+Entra checks it at all.
+
+Anything unexpected before the password is sent (another IdP, federation,
+an unknown user, an error page) raises FlowDeviation, and the caller falls
+back to the browser. Once the password or the one-time code is out, a
+retry in the browser would count as another failed sign-in towards the
+lockout, or send the same code again, so the login fails instead: with
+CredentialsRejected when Entra turned them down and LoginFailed for
+anything else (push-only MFA, a password change, an unknown page).
+"""
+
+from __future__ import annotations
+
+import http.cookiejar
+import json
+import re
+import ssl
+import urllib.error
+import urllib.parse
+import urllib.request
+from html.parser import HTMLParser
+from typing import Optional
+
+from .totp import generate_totp
+
+ENTRA_HOSTS = ("login.microsoftonline.com", "login.microsoft.com", "login.windows.net")
+
+# MFA method ids Entra uses for authenticator-app (TOTP) codes
+TOTP_METHODS = ("PhoneAppOTP", "SoftwareTokenBasedTOTP")
+
+USER_AGENT = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36"
+MAX_STEPS = 12
+
+_CONFIG_RE = re.compile(r"\$Config\s*=\s*(\{.*?\});\s*(?:\n|//|</script>)", re.DOTALL)
+
+
+class FlowDeviation(Exception):
+    """The login did not go the way the fast path expects."""
+
+
+class LoginFailed(Exception):
+    """The login went wrong after the password or code was sent; do not retry."""
+
+
+class CredentialsRejected(LoginFailed):
+    """Entra ID turned down the password or the one-time code."""
+
+
+class _FormParser(HTMLParser):
+    def __init__(self) -> None:
+        super().__init__(convert_charrefs=True)
+        self.forms: list[dict] = []
+
+    def handle_starttag(self, tag, attrs):
+        attrs = dict(attrs)
+        if tag == "form":
+            self.forms.append({
+                "action": attrs.get("action") or "",
+                "method": (attrs.get("method") or "get").lower(),
+                "fields": {},
+            })
+        elif tag == "input" and self.forms and attrs.get("name"):
+            self.forms[-1]["fields"][attrs["name"]] = attrs.get("value") or ""
+
+
+def _forms(body: str) -> list[dict]:
+    parser = _FormParser()
+    try:
+        parser.feed(body)
+    except Exception:
+        return []
+    return parser.forms
+
+
+def _entra_config(body: str) -> Optional[dict]:
+    match = _CONFIG_RE.search(body)
+    if not match:
+        return None
+    try:
+        return json.loads(match.group(1))
+    except ValueError:
+        return None
+
+
+class _Session:
+    """Cookie-keeping HTTPS client that remembers VPN server headers."""
+
+    def __init__(self, vpn_hosts: set[str], ssl_context: ssl.SSLContext, debug: bool, timeout: float) -> None:
+        session = self
+
+        class RedirectHandler(urllib.request.HTTPRedirectHandler):
+            def redirect_request(self, req, fp, code, msg, headers, newurl):
+                session._record(req.full_url, headers)
+                return super().redirect_request(req, fp, code, msg, headers, newurl)
+
+        self.vpn_hosts = vpn_hosts
+        self.debug = debug
+        self.timeout = timeout
+        self.jar = http.cookiejar.CookieJar()
+        self.vpn_headers: dict[str, str] = {}
+        self.opener = urllib.request.build_opener(
+            urllib.request.HTTPSHandler(context=ssl_context),
+            urllib.request.HTTPCookieProcessor(self.jar),
+            RedirectHandler(),
+        )
+
+    def _record(self, url: str, headers) -> None:
+        if (urllib.parse.urlparse(url).hostname or "") not in self.vpn_hosts:
+            return
+        for key in ("prelogin-cookie", "saml-username", "portal-userauthcookie"):
+            if headers.get(key):
+                self.vpn_headers[key] = headers[key]
+
+    def request(self, url: str, form: Optional[dict] = None, json_body: Optional[dict] = None) -> tuple[str, str]:
+        """Return (final URL, body) after following redirects."""
+        data, headers = None, {"User-Agent": USER_AGENT}
+        if form is not None:
+            data = urllib.parse.urlencode(form).encode()
+            headers["Content-Type"] = "application/x-www-form-urlencoded"
+        elif json_body is not None:
+            data = json.dumps(json_body).encode()
+            headers["Content-Type"] = "application/json"
+            headers["Accept"] = "application/json"
+        if self.debug:
+            print(f"    [DEBUG] HTTP {'POST' if data else 'GET'} {url[:80]}")
+        try:
+            with self.opener.open(urllib.request.Request(url, data, headers), timeout=self.timeout) as resp:
+                self._record(resp.url, resp.headers)
+                charset = resp.headers.get_content_charset() or "utf-8"
+                return resp.url, resp.read().decode(charset, "replace")
+        except urllib.error.HTTPError as exc:
+            raise FlowDeviation(f"HTTP {exc.code} from {urllib.parse.urlparse(url).hostname}") from None
+        except (OSError, ValueError) as exc:
+            raise FlowDeviation(str(exc)) from None
+
+    def submit(self, form: dict, base_url: str) -> tuple[str, str]:
+        url = urllib.parse.urljoin(base_url, form["action"] or base_url)
+        if form["method"] == "post":
+            return self.request(url, form=form["fields"])
+        query = urllib.parse.urlencode(form["fields"])
+        return self.request(f"{url}{'&' if '?' in url else '?'}{query}")
+
+    def cookies_for(self, host: str) -> dict[str, str]:
+        cookies = {}
+        for cookie in self.jar:
+            domain = cookie.domain.lstrip(".")
+            if cookie.value and (host == domain or host.endswith("." + domain)):
+                cookies[cookie.name] = cookie.value
+        return cookies
+
+
+def _entra_step(
+    session: _Session, url: str, config: dict, username: str, password: str, totp_secret: str, sent: set[str],
+) -> tuple[str, str]:
+    """Answer one Entra ID page; return the next (URL, body).
+
+    Adds "password" and "one-time code" to sent as they go out.
+    """
+    page = config.get("pgid", "")
+    post_url = urllib.parse.urljoin(url, config.get("urlPost", ""))
+    common = {
+        "ctx": config.get("sCtx", ""),
+        "flowToken": config.get("sFT", ""),
+        "canary": config.get("canary", ""),
+        "hpgrequestid": config.get("sessionId", ""),
+    }
+
+    if config.get("sErrorCode"):
+        error = f"Entra ID error {config['sErrorCode']} on {page}"
+        if sent:
+            raise CredentialsRejected(f"{error} after the {_describe(sent)} was sent")
+        raise FlowDeviation(error)
+
+    # The same page again without an error code: turned down all the same
+    if (page == "ConvergedSignIn" and "password" in sent) or (page == "ConvergedTFA" and "one-time code" in sent):
+        raise CredentialsRejected(f"{page} shown again after the {_describe(sent)} was sent")
+
+    if page == "ConvergedSignIn":
+        if not (username and password):
+            raise FlowDeviation("no username or password")
+        if config.get("urlGetCredentialType"):
+            _check_credential_type(session, urllib.parse.urljoin(url, config["urlGetCredentialType"]),
+                                   username, common)
+        sent.add("password")
+        return session.request(post_url, form=dict(
+            common, login=username, loginfmt=username, passwd=password,
+            type="11", LoginOptions="3", i13="0", ps="2", NewUser="1", fspost="0", i21="0",
+        ))
+
+    if page == "ConvergedTFA":
+        methods = [p.get("authMethodId") for p in config.get("arrUserProofs", [])]
+        method = next((m for m in TOTP_METHODS if m in methods), None)
+        if not method:
+            raise FlowDeviation(f"no TOTP method among {methods}")
+
+        begin = _json_call(session, urllib.parse.urljoin(url, config["urlBeginAuth"]), {
+            "AuthMethodId": method, "Method": "BeginAuth",
+            "ctx": common["ctx"], "flowToken": common["flowToken"],
+        })
+        code = generate_totp(totp_secret)
+        sent.add("one-time code")
+        try:
+            end = _json_call(session, urllib.parse.urljoin(url, config["urlEndAuth"]), {
+                "AuthMethodId": method, "Method": "EndAuth", "SessionId": begin.get("SessionId"),
+                "FlowToken": begin.get("FlowToken"), "Ctx": begin.get("Ctx"),
+                "AdditionalAuthData": code, "PollCount": 1,
+            })
+        except FlowDeviation as exc:
+            raise CredentialsRejected(f"one-time code not accepted ({exc})") from None
+        return session.request(post_url, form={
+            "type": "19", "GeneralVerify": "false", "request": end.get("Ctx", ""),
+            "mfaAuthMethod": method, "otc": code, "login": username,
+            "flowToken": end.get("FlowToken", ""), "hpgrequestid": common["hpgrequestid"],
+            "canary": common["canary"], "hideSmsInMfaProofs": "false",
+        })
+
+    if page == "KmsiInterrupt":
+        return session.request(post_url, form=dict(common, LoginOptions="1", type="28"))
+
+    raise FlowDeviation(f"unsupported Entra ID page {page or '(unknown)'}")
+
+
+def _describe(sent: set[str]) -> str:
+    return " and ".join(sorted(sent, key=["password", "one-time code"].index))
+
+
+def _check_credential_type(session: _Session, url: str, username: str, common: dict) -> None:
+    """Make sure Entra itself will check the password for username."""
+    result = _json_request(session, url, {
+        "username": username, "isOtherIdpSupported": True, "checkPhones": False,
+        "isRemoteNGCSupported": True, "isCookieBannerShown": False, "isFidoSupported": True,
+        "originalRequest": common["ctx"], "flowToken": common["flowToken"],
+    })
+    credentials = result.get("Credentials") or {}
+    if credentials.get("FederationRedirectUrl"):
+        host = urllib.parse.urlparse(credentials["FederationRedirectUrl"]).hostname
+        raise FlowDeviation(f"federated to {host}")
+    # 0: known to the tenant, 6: also as a personal account
+    if result.get("IfExistsResult") not in (0, 6, None):
+        raise FlowDeviation(f"unknown user (IfExistsResult {result['IfExistsResult']})")
+    if credentials.get("HasPassword") is False:
+        raise FlowDeviation("no password for this account")
+
+
+def _json_request(session: _Session, url: str, body: dict) -> dict:
+    _, text = session.request(url, json_body=body)
+    try:
+        return json.loads(text)
+    except ValueError:
+        raise FlowDeviation(f"no JSON from {urllib.parse.urlparse(url).path}") from None
+
+
+def _json_call(session: _Session, url: str, body: dict) -> dict:
+    result = _json_request(session, url, body)
+    if not result.get("Success"):
+        raise FlowDeviation(f"{body['Method']} failed: {result.get('Message') or result.get('ResultValue')}")
+    return result
+
+
+def http_saml_login(
+    start: str,
+    protocol: str,
+    vpn_hosts: set[str],
+    username: str,
+    password: str,
+    totp_secret: str,
+    ssl_context: ssl.SSLContext,
+    debug: bool = False,
+    timeout: float = 10,
+) -> dict:
+    """Log in without a browser and return what the browser path would.
+
+    start is the SAML start URL, or the HTML page of a POST-binding SAML
+    request. Raises FlowDeviation if the login cannot be completed here
+    and the browser may try, LoginFailed (or CredentialsRejected) if the
+    password or code was already sent and it must not.
+    """
+    session = _Session(vpn_hosts, ssl_context, debug, timeout)
+    sent: set[str] = set()
+    try:
+        return _login(session, start, protocol, vpn_hosts, username, password, totp_secret, sent)
+    except FlowDeviation as exc:
+        if not sent:
+            raise
+        raise LoginFailed(f"{exc}, after the {_describe(sent)} was sent") from None
+
+
+def _login(
+    session: _Session,
+    start: str,
+    protocol: str,
+    vpn_hosts: set[str],
+    username: str,
+    password: str,
+    totp_secret: str,
+    sent: set[str],
+) -> dict:
+    result: dict = {}
+
+    if start.startswith("http"):
+        url, body = session.request(start)
+    else:
+        forms = _forms(start)
+        if not forms:
+            raise FlowDeviation("SAML request is neither a URL nor a form")
+        url, body = session.submit(forms[0], "")
+
+    for _ in range(MAX_STEPS):
+        host = urllib.parse.urlparse(url).hostname or ""
+        if host in vpn_hosts:
+            break
+
+        saml_form = next((f for f in _forms(body) if "SAMLResponse" in f["fields"]), None)
+        if saml_form:
+            result["SAMLResponse"] = saml_form["fields"]["SAMLResponse"]
+            url, body = session.submit(saml_form, url)
+            continue
+
+        config = _entra_config(body)
+        if host not in ENTRA_HOSTS or config is None:
+            raise FlowDeviation(f"unknown page at {host}")
+        url, body = _entra_step(session, url, config, username, password, totp_secret, sent)
+    else:
+        raise FlowDeviation("too many steps")
+
+    result.update(session.vpn_headers)
+    for vpn_host in vpn_hosts:
+        result.update(session.cookies_for(vpn_host))
+
+    if protocol == "gp":
+        done = any(k in result for k in ("prelogin-cookie", "portal-userauthcookie", "SAMLResponse"))
+    else:
+        done = any(k in result for k in ("webvpn", "SVPNCOOKIE", "acSamlv2Token"))
+    if not done:
+        raise FlowDeviation("VPN server returned no session")
+    return result
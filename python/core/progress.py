@@ -0,0 +1,78 @@
+"""Progress events for the VPN service.
+
+With --progress-fd, the helper reports what it is doing as one JSON object
+per line on that descriptor (see src/service/sso-progress.h):
+
+    {"event":"phase-started","phase":"browser"}
+    {"event":"phase-done","phase":"browser","ms":812}
+    {"event":"cookie","cookie":"...","usergroup":"...","username":"...","fingerprint":"..."}
+    {"event":"error","class":"network","message":"..."}
+
+The cookie event goes out as soon as the login is done, so the service can
+start openconnect while the browser is still shutting down. stdout keeps
+the KEY=VALUE output for other callers.
+"""
+
+from __future__ import annotations
+
+import json
+import os
+import socket
+import ssl
+import threading
+import urllib.error
+from typing import Optional
+
+from .http_login import LoginFailed
+
+ERROR_CLASSES = ("network", "timeout", "login", "browser", "internal")
+
+
+class Progress:
+    """Writes progress events to a descriptor; does nothing without one."""
+
+    def __init__(self, fd: Optional[int] = None) -> None:
+        self._file = None
+        self._lock = threading.Lock()
+        if fd is not None:
+            try:
+                self._file = os.fdopen(fd, "w", encoding="utf-8", buffering=1)
+            except OSError as exc:
+                print(f"  -> No progress events: {exc}")
+
+    def _emit(self, **event) -> None:
+        if self._file is None:
+            return
+        line = json.dumps({k: v for k, v in event.items() if v is not None}, separators=(",", ":"))
+        with self._lock:
+            try:
+                self._file.write(line + "\n")
+                self._file.flush()
+            except (OSError, ValueError):
+                # The service went away or closed its end; carry on silently
+                self._file = None
+
+    def phase_started(self, phase: str) -> None:
+        self._emit(event="phase-started", phase=phase)
+
+    def phase_done(self, phase: str, ms: float) -> None:
+        self._emit(event="phase-done", phase=phase, ms=round(ms))
+
+    def cookie(self, cookie: str, usergroup: Optional[str], username: Optional[str], fingerprint: Optional[str]) -> None:
+        self._emit(event="cookie", cookie=cookie, usergroup=usergroup, username=username or None, fingerprint=fingerprint)
+
+    def error(self, error_class: str, message: str) -> None:
+        self._emit(event="error", **{"class": error_class, "message": message})
+
+
+def classify_error(exc: BaseException) -> str:
+    """Map an exception from the login to one of ERROR_CLASSES."""
+    if isinstance(exc, (TimeoutError, socket.timeout)) or type(exc).__name__ == "TimeoutError":
+        return "timeout"
+    if isinstance(exc, (urllib.error.URLError, ConnectionError, socket.gaierror, ssl.SSLError)):
+        return "network"
+    if type(exc).__module__.startswith("playwright"):
+        return "browser"
+    if isinstance(exc, LoginFailed):
+        return "login"
+    return "internal"
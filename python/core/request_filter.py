@@ -0,0 +1,144 @@
+"""Request filtering for headless logins.
+
+Background images, web fonts and telemetry are never needed to fill in a
+login form, so in headless mode they are aborted before they leave the
+browser. Document loads and requests to the VPN server always go through.
+
+Some IdPs do need one of them (an image challenge, say). The policy can be
+relaxed per IdP in /etc/gnome-vpn-sso/request-filter.conf, where a section
+applies to pages on that host and its subdomains, and [*] to all:
+
+    [login.contoso.com]
+    # Resource types to let through, or * to turn the filter off
+    allow-types = image font
+    # Hosts never blocked, even when listed as telemetry
+    allow-hosts = cdn.contoso.com
+
+Routing requests turns off Chromium's HTTP cache for the browser context,
+which is why the filter is only used for headless runs.
+"""
+
+from __future__ import annotations
+
+import configparser
+import urllib.parse
+from collections import Counter
+from typing import Optional
+
+CONFIG_PATH = "/etc/gnome-vpn-sso/request-filter.conf"
+
+# Playwright resource types a login form works without
+BLOCKED_TYPES = frozenset({"image", "media", "font", "texttrack", "manifest", "ping"})
+
+# Analytics and telemetry endpoints seen on IdP login pages (and subdomains)
+TELEMETRY_HOSTS = (
+    "events.data.microsoft.com",
+    "js.monitor.azure.com",
+    "dc.services.visualstudio.com",
+    "clarity.ms",
+    "google-analytics.com",
+    "googletagmanager.com",
+    "doubleclick.net",
+    "hotjar.com",
+    "segment.io",
+    "nr-data.net",
+    "js-agent.newrelic.com",
+    "mixpanel.com",
+    "fullstory.com",
+    "ingest.sentry.io",
+)
+
+
+def _host(url: str) -> str:
+    try:
+        return urllib.parse.urlparse(url).hostname or ""
+    except Exception:
+        return ""
+
+
+def _host_matches(host: str, domains) -> bool:
+    return any(host == d or host.endswith("." + d) for d in domains)
+
+
+class _Override:
+    def __init__(self, types: set[str], hosts: set[str]) -> None:
+        self.types = types
+        self.hosts = hosts
+
+
+def _load_overrides(path: str, debug: bool = False) -> dict[str, _Override]:
+    parser = configparser.ConfigParser(interpolation=None)
+    try:
+        parser.read(path)
+    except configparser.Error as exc:
+        print(f"  -> Ignoring {path}: {exc}")
+        return {}
+
+    overrides = {}
+    for section in parser.sections():
+        overrides[section.lower()] = _Override(
+            set(parser.get(section, "allow-types", fallback="").split()),
+            {h.lower() for h in parser.get(section, "allow-hosts", fallback="").split()},
+        )
+    if debug and overrides:
+        print(f"    [DEBUG] Request filter overrides for: {', '.join(sorted(overrides))}")
+    return overrides
+
+
+class RequestFilter:
+    """Aborts requests a headless login does not need.
+
+    keep_hosts (the VPN server's names and addresses) are never blocked.
+    """
+
+    def __init__(self, keep_hosts, config_path: str = CONFIG_PATH, debug: bool = False) -> None:
+        self.keep_hosts = {h for h in keep_hosts if h}
+        self.overrides = _load_overrides(config_path, debug)
+        self.debug = debug
+        self.blocked: Counter = Counter()
+
+    def install(self, context) -> None:
+        context.route("**/*", self._route)
+
+    def _override_for(self, page_host: str) -> Optional[_Override]:
+        for domain, override in self.overrides.items():
+            if domain != "*" and _host_matches(page_host, (domain,)):
+                return override
+        return self.overrides.get("*")
+
+    def should_block(self, resource_type: str, url: str, page_url: str) -> Optional[str]:
+        """Return why the request is blocked, or None to let it through."""
+        if resource_type == "document":
+            return None
+        host = _host(url)
+        if host in self.keep_hosts:
+            return None
+
+        override = self._override_for(_host(page_url) or host)
+        if override:
+            if "*" in override.types or _host_matches(host, override.hosts):
+                return None
+        if _host_matches(host, TELEMETRY_HOSTS):
+            return "telemetry"
+        if resource_type in BLOCKED_TYPES and not (override and resource_type in override.types):
+            return resource_type
+        return None
+
+    def _route(self, route, request) -> None:
+        try:
+            page_url = request.frame.page.main_frame.url
+        except Exception:
+            page_url = ""
+        reason = self.should_block(request.resource_type, request.url, page_url)
+        if reason is None:
+            route.continue_()
+            return
+        self.blocked[reason] += 1
+        if self.debug:
+            print(f"    [DEBUG] Blocked {reason}: {request.url[:80]}")
+        route.abort("blockedbyclient")
+
+    def summary(self) -> None:
+        if self.blocked:
+            counts = ", ".join(f"{n} {reason}" for reason, n in self.blocked.most_common())
+            print(f"  -> Request filter skipped {sum(self.blocked.values())} requests ({counts})")
@@ -4,14 +4,18 @@
 from __future__ import annotations
 
 import argparse
+import json
 import os
 import sys
+import threading
+import time
 from pathlib import Path
 
 SCRIPT_DIR = Path(__file__).resolve().parent
 sys.path.insert(0, str(SCRIPT_DIR))
 
-from core.auth import do_saml_auth  # noqa: E402
+from core.auth import PRELOGIN_CACHE_TTL, do_saml_auth, get_server_cert_fingerprint  # noqa: E402
+from core.progress import Progress, classify_error  # noqa: E402
 
 
 def _build_cookie(protocol: str, cookies: dict) -> tuple[str | None, str | None]:
@@ -33,6 +37,45 @@ def _build_cookie(protocol: str, cookies: dict) -> tuple[str | None, str | None]
     return (combined if combined else None), None
 
 
+def _normalize_protocol(protocol: str) -> str | None:
+    protocol = protocol.lower().strip()
+    if protocol in ("globalprotect", "gp"):
+        return "gp"
+    if protocol in ("anyconnect", "ac"):
+        return "anyconnect"
+    return None
+
+
+def _print_credentials(protocol: str, cookies: dict, username: str, fingerprint: str | None) -> bool:
+    cookie_value, usergroup = _build_cookie(protocol, cookies)
+    if not cookie_value:
+        return False
+
+    if protocol == "gp" and usergroup:
+        print(f"USERGROUP={usergroup}")
+
+    if not username:
+        username = cookies.get("saml-username", "")
+    if username:
+        print(f"USERNAME={username}")
+
+    if fingerprint:
+        print(f"FINGERPRINT={fingerprint}")
+
+    print(f"COOKIE={cookie_value}")
+    return True
+
+
+def _read_context() -> dict:
+    """Read the one-line JSON context the service writes to our stdin."""
+    try:
+        context = json.loads(sys.stdin.readline() or "{}")
+    except ValueError as exc:
+        print(f"ERROR: Invalid context on stdin: {exc}", file=sys.stderr)
+        return {}
+    return context if isinstance(context, dict) else {}
+
+
 def main() -> int:
     parser = argparse.ArgumentParser(description="GNOME VPN SSO SAML auth helper")
     parser.add_argument("--protocol", required=True, help="anyconnect|gp|globalprotect")
@@ -43,22 +86,58 @@ def main() -> int:
     parser.add_argument("--headless", action="store_true", help="Run browser headless")
     parser.add_argument("--headful", action="store_true", help="Run browser with UI")
     parser.add_argument("--debug", action="store_true", help="Enable debug logging")
+    parser.add_argument(
+        "--context-stdin", action="store_true",
+        help="Read session paths and secrets as one JSON line from stdin",
+    )
+    parser.add_argument(
+        "--progress-fd", type=int, metavar="FD",
+        help="Write progress events as JSON lines to this file descriptor",
+    )
     parser.add_argument("--no-auto-totp", action="store_true", help="Disable auto TOTP")
+    parser.add_argument(
+        "--also", action="append", default=[], metavar="PROTOCOL:GATEWAY",
+        help="Also sign in to this gateway with the same IdP session (repeatable)",
+    )
+    parser.add_argument(
+        "--session-name", metavar="NAME",
+        help="Use a separate persistent browser profile (for concurrent runs)",
+    )
+    parser.add_argument(
+        "--no-request-filter", action="store_true",
+        help="Load images, fonts and telemetry in headless mode too",
+    )
+    parser.add_argument(
+        "--no-http-login", action="store_true",
+        help="Always use the browser, even where a browserless login is possible",
+    )
+    parser.add_argument(
+        "--prelogin-ttl", type=int, default=PRELOGIN_CACHE_TTL,
+        help=f"Seconds to reuse a GlobalProtect prelogin response, 0 disables (default {PRELOGIN_CACHE_TTL})",
+    )
 
     args = parser.parse_args()
+    progress = Progress(args.progress_fd)
 
-    protocol = args.protocol.lower().strip()
-    if protocol in ("globalprotect", "gp"):
-        protocol = "gp"
-    elif protocol in ("anyconnect", "ac"):
-        protocol = "anyconnect"
-    else:
+    protocol = _normalize_protocol(args.protocol)
+    if not protocol:
         print(f"ERROR: Unknown protocol '{args.protocol}'", file=sys.stderr)
         return 2
 
+    fanout_targets = []
+    for target in args.also:
+        target_protocol, _, target_gateway = target.partition(":")
+        target_protocol = _normalize_protocol(target_protocol)
+        if not target_protocol or not target_gateway:
+            print(f"ERROR: Invalid --also '{target}'", file=sys.stderr)
+            return 2
+        fanout_targets.append((target_protocol, target_gateway))
+
+    context = _read_context() if args.context_stdin else {}
+
     username = args.username or os.environ.get("VPN_SSO_USERNAME") or ""
-    password = args.password or os.environ.get("VPN_SSO_PASSWORD") or ""
-    totp_secret = args.totp_secret or os.environ.get("VPN_SSO_TOTP_SECRET")
+    password = args.password or context.get("password") or os.environ.get("VPN_SSO_PASSWORD") or ""
+    totp_secret = args.totp_secret or context.get("totp_secret") or os.environ.get("VPN_SSO_TOTP_SECRET")
 
     if args.headful:
         headless = False
@@ -67,6 +146,34 @@ def main() -> int:
     else:
         headless = bool(password or totp_secret)
 
+    # Fetch the gateway certificate while the browser logs in, so the
+    # service can pin it for openconnect --servercert
+    fingerprints: dict = {}
+    fingerprint_threads = {}
+    for target_protocol, target_gateway in [(protocol, args.gateway)] + fanout_targets:
+        if target_protocol != "anyconnect":
+            continue
+        thread = threading.Thread(
+            target=lambda gw=target_gateway: fingerprints.update({gw: get_server_cert_fingerprint(gw, debug=args.debug)}),
+            daemon=True,
+        )
+        thread.start()
+        fingerprint_threads[target_gateway] = thread
+
+    fanout_results: dict = {}
+    cookie_reported = False
+
+    # Hand the service our cookie before the fan-out and browser shutdown
+    def _report_cookies(cookies: dict) -> None:
+        nonlocal cookie_reported
+        cookie_value, usergroup = _build_cookie(protocol, cookies)
+        if not cookie_value or cookie_reported:
+            return
+        if args.gateway in fingerprint_threads:
+            fingerprint_threads[args.gateway].join(timeout=10)
+        progress.cookie(cookie_value, usergroup, username or cookies.get("saml-username"), fingerprints.get(args.gateway))
+        cookie_reported = True
+
     try:
         cookies = do_saml_auth(
             vpn_server=args.gateway,
@@ -77,29 +184,41 @@ def main() -> int:
             auto_totp=not args.no_auto_totp,
             headless=headless,
             debug=args.debug,
+            prelogin_ttl=args.prelogin_ttl,
+            fanout_targets=fanout_targets,
+            fanout_results=fanout_results,
+            session_name=args.session_name,
+            request_filter=not args.no_request_filter,
+            http_login=not args.no_http_login,
+            session_context=context,
+            progress=progress,
+            on_cookies=_report_cookies,
         )
     except Exception as exc:
         print(f"ERROR: {exc}", file=sys.stderr)
+        progress.error(classify_error(exc), str(exc))
         return 1
 
     if not cookies:
         print("ERROR: SAML authentication returned no cookies", file=sys.stderr)
+        progress.error("login", "SAML authentication returned no cookies")
         return 1
 
-    cookie_value, usergroup = _build_cookie(protocol, cookies)
-    if not cookie_value:
+    deadline = time.monotonic() + 10
+    for thread in fingerprint_threads.values():
+        thread.join(timeout=max(0, deadline - time.monotonic()))
+
+    if not _print_credentials(protocol, cookies, username, fingerprints.get(args.gateway)):
         print("ERROR: No valid auth cookie extracted", file=sys.stderr)
+        progress.error("login", "No valid auth cookie extracted")
         return 1
+    _report_cookies(cookies)
 
-    if protocol == "gp" and usergroup:
-        print(f"USERGROUP={usergroup}")
+    # Further gateways follow the primary credentials, one section each
+    for (target_protocol, target_gateway), target_cookies in fanout_results.items():
+        print(f"TARGET={'globalprotect' if target_protocol == 'gp' else 'anyconnect'}:{target_gateway}")
+        _print_credentials(target_protocol, target_cookies, username, fingerprints.get(target_gateway))
 
-    if not username:
-        username = cookies.get("saml-username", "")
-    if username:
-        print(f"USERNAME={username}")
-
-    print(f"COOKIE={cookie_value}")
     return 0
 
 
@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+"""Login-time pre-authentication of autoconnect GNOME VPN SSO profiles.
+
+Runs in the user session (see gnome-vpn-sso-preauth.service). Every
+autoconnect VPN SSO profile that can sign in headless and has nothing in
+the service's credential cache is authenticated now, a few at a time, so
+that NetworkManager's activation later finds a warm cookie and starts
+openconnect without a browser.
+"""
+
+from __future__ import annotations
+
+import argparse
+import json
+import os
+import queue
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+from dataclasses import dataclass, field
+from pathlib import Path
+
+import gi
+
+gi.require_version("NM", "1.0")
+from gi.repository import GLib, Gio, NM  # noqa: E402
+
+SCRIPT_DIR = Path(__file__).resolve().parent
+
+SERVICE_TYPE = "org.freedesktop.NetworkManager.vpn-sso"
+PREAUTH_PATH = "/org/freedesktop/NetworkManager/VpnSso/Preauth"
+PREAUTH_IFACE = "org.freedesktop.NetworkManager.VpnSso.Preauth"
+
+DEFAULT_JOBS = 2
+HELPER_TIMEOUT = 180
+
+
+@dataclass
+class Profile:
+    uuid: str
+    name: str
+    gateway: str
+    protocol: str
+    username: str = ""
+    group: str = ""
+    secrets: dict = field(default_factory=dict)
+
+
+def _helper_path() -> Path:
+    for name in ("vpn-sso-auth", "vpn-sso-auth.py"):
+        path = SCRIPT_DIR / name
+        if path.exists():
+            return path
+    raise FileNotFoundError(f"vpn-sso-auth not found in {SCRIPT_DIR}")
+
+
+def _secrets(connection) -> dict:
+    try:
+        variant = connection.get_secrets("vpn", None)
+    except GLib.Error:
+        return {}
+    if not variant:
+        return {}
+    return dict(variant.unpack().get("vpn", {}).get("secrets", {}))
+
+
+def _autoconnect_profiles(client, debug: bool) -> list[Profile]:
+    """VPN SSO profiles that come up on their own and can sign in headless."""
+    connections = client.get_connections()
+    active = {ac.get_uuid() for ac in client.get_active_connections()}
+    secondaries = set()
+    for connection in connections:
+        s_con = connection.get_setting_connection()
+        if s_con:
+            secondaries.update(s_con.get_property("secondaries") or [])
+
+    profiles = []
+    for connection in connections:
+        s_con = connection.get_setting_connection()
+        s_vpn = connection.get_setting_vpn()
+        if not s_con or not s_vpn or s_vpn.get_service_type() != SERVICE_TYPE:
+            continue
+
+        uuid = connection.get_uuid()
+        if not (s_con.get_autoconnect() or uuid in secondaries) or uuid in active:
+            continue
+
+        gateway = s_vpn.get_data_item("gateway") or ""
+        protocol = s_vpn.get_data_item("protocol") or ""
+        if not gateway or protocol not in ("globalprotect", "anyconnect"):
+            continue
+
+        # Same rule as the service: headless when asked to, or when there
+        # are credentials to type in
+        headless = (s_vpn.get_data_item("headless") or "").lower()
+        secrets = _secrets(connection)
+        if headless in ("false", "0") or (
+            headless not in ("true", "1") and not (secrets.get("password") or secrets.get("totp-secret"))
+        ):
+            if debug:
+                print(f"[DEBUG] {connection.get_id()}: needs an interactive login, skipping")
+            continue
+
+        profiles.append(Profile(
+            uuid=uuid,
+            name=connection.get_id(),
+            gateway=gateway,
+            protocol=protocol,
+            username=s_vpn.get_data_item("username") or "",
+            group=s_vpn.get_data_item("sso-group") or "",
+            secrets=secrets,
+        ))
+
+    return profiles
+
+
+def _has_credentials(bus, profile: Profile) -> bool:
+    reply = bus.call_sync(
+        SERVICE_TYPE, PREAUTH_PATH, PREAUTH_IFACE, "HasCredentials",
+        GLib.Variant("(ss)", (profile.gateway, profile.protocol)),
+        GLib.VariantType.new("(b)"), Gio.DBusCallFlags.NONE, -1, None,
+    )
+    return reply.unpack()[0]
+
+
+def _parse_helper_output(output: str, primary: Profile) -> list[dict]:
+    """Split helper stdout into one credential record per gateway."""
+    records = [{"protocol": primary.protocol, "gateway": primary.gateway}]
+    for line in output.splitlines():
+        line = line.strip()
+        if line.startswith("TARGET="):
+            protocol, _, gateway = line[7:].partition(":")
+            records.append({"protocol": protocol, "gateway": gateway})
+            continue
+        key, sep, value = line.partition("=")
+        # The service does not take certificate pins from here
+        if sep and key in ("COOKIE", "USERGROUP", "USERNAME"):
+            records[-1][key.lower()] = value
+    return [r for r in records if r.get("cookie")]
+
+
+def _authenticate(bus, members: list[Profile], slots: queue.Queue, debug: bool) -> int:
+    primary = members[0]
+    names = ", ".join(p.name for p in members)
+    argv = [sys.executable, str(_helper_path()),
+            "--protocol", primary.protocol, "--gateway", primary.gateway, "--headless", "--context-stdin"]
+    if primary.username:
+        argv += ["--username", primary.username]
+    for peer in members[1:]:
+        argv += ["--also", f"{peer.protocol}:{peer.gateway}"]
+    if debug:
+        argv.append("--debug")
+
+    # Secrets go to the helper on stdin, not through its environment
+    env = dict(os.environ, PYTHONUNBUFFERED="1")
+    context = {
+        "password": primary.secrets.get("password"),
+        "totp_secret": primary.secrets.get("totp-secret"),
+    }
+    context_line = json.dumps({k: v for k, v in context.items() if v}) + "\n"
+
+    # Chromium locks its profile directory; the first slot shares the
+    # browser session of interactive logins, the others get their own
+    slot = slots.get()
+    try:
+        if slot > 0:
+            argv += ["--session-name", f"preauth-{slot}"]
+        print(f"Pre-authenticating {names}...")
+        result = subprocess.run(
+            argv, env=env, input=context_line,
+            capture_output=True, text=True, timeout=HELPER_TIMEOUT,
+        )
+    except subprocess.TimeoutExpired:
+        print(f"{names}: helper timed out", file=sys.stderr)
+        return 0
+    finally:
+        slots.put(slot)
+
+    if result.returncode != 0:
+        print(f"{names}: helper failed ({result.returncode}): {result.stderr.strip()[-500:]}", file=sys.stderr)
+        return 0
+
+    stored = 0
+    known = {(p.protocol, p.gateway) for p in members}
+    for record in _parse_helper_output(result.stdout, primary):
+        if (record["protocol"], record["gateway"]) not in known:
+            continue
+        try:
+            bus.call_sync(
+                SERVICE_TYPE, PREAUTH_PATH, PREAUTH_IFACE, "StoreCredentials",
+                GLib.Variant("(a{sv})", ({k: GLib.Variant("s", v) for k, v in record.items()},)),
+                None, Gio.DBusCallFlags.NONE, -1, None,
+            )
+            stored += 1
+            print(f"  -> {record['gateway']}: credentials cached")
+        except GLib.Error as exc:
+            print(f"  -> {record['gateway']}: service refused credentials: {exc.message}", file=sys.stderr)
+    return stored
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Pre-authenticate autoconnect VPN SSO profiles at login")
+    parser.add_argument(
+        "--jobs", type=int, default=DEFAULT_JOBS,
+        help=f"Helpers to run at the same time (default {DEFAULT_JOBS})",
+    )
+    parser.add_argument("--debug", action="store_true", help="Enable debug logging")
+    args = parser.parse_args()
+
+    try:
+        client = NM.Client.new(None)
+        bus = Gio.bus_get_sync(Gio.BusType.SYSTEM, None)
+    except GLib.Error as exc:
+        print(f"ERROR: {exc.message}", file=sys.stderr)
+        return 1
+
+    missing = []
+    for profile in _autoconnect_profiles(client, args.debug):
+        try:
+            if _has_credentials(bus, profile):
+                print(f"{profile.name}: cached credentials found")
+                continue
+        except GLib.Error as exc:
+            print(f"ERROR: VPN SSO service unavailable: {exc.message}", file=sys.stderr)
+            return 1
+        missing.append(profile)
+
+    if not missing:
+        return 0
+
+    # Profiles sharing an sso-group are signed in by one helper run
+    groups: dict[str, list[Profile]] = {}
+    for profile in missing:
+        groups.setdefault(profile.group or profile.uuid, []).append(profile)
+
+    jobs = max(1, args.jobs)
+    slots: queue.Queue = queue.Queue()
+    for slot in range(jobs):
+        slots.put(slot)
+
+    with ThreadPoolExecutor(max_workers=jobs) as pool:
+        stored = sum(pool.map(lambda members: _authenticate(bus, members, slots, args.debug), groups.values()))
+
+    print(f"Pre-authenticated {stored} of {len(missing)} profile(s)")
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -10,6 +10,7 @@ pkgs.mkShell {
     pkgs.gtk4
     pkgs.libadwaita
     pkgs.webkitgtk_6_0
+    pkgs.libsoup_3
     pkgs.libsecret
     pkgs.openconnect
     pkgs.vpnc-scripts
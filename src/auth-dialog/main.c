@@ -41,6 +41,11 @@ on_window_close_request (GtkWindow *window, gpointer user_data)
     cookie = nm_vpn_sso_auth_dialog_get_cookie (dialog);
 
     if (cookie != NULL) {
+        const char *usergroup = nm_vpn_sso_auth_dialog_get_usergroup (dialog);
+        if (usergroup != NULL) {
+            g_print ("USERGROUP=%s\n", usergroup);
+        }
+
         g_print ("COOKIE=%s\n", cookie);
 
         const char *username = nm_vpn_sso_auth_dialog_get_username (dialog);
@@ -11,6 +11,7 @@
 
 #include "config.h"
 #include "nm-vpn-sso-auth-dialog.h"
+#include "sso-web-flow.h"
 
 #include <gtk/gtk.h>
 #include <adwaita.h>
@@ -24,8 +25,12 @@ struct _NmVpnSsoAuthDialog {
     char *gateway;
     char *protocol;
     char *cookie;
+    char *usergroup;
     char *username;
 
+    /* Login flow, shared with vpn-sso-webkit */
+    VpnSsoWebFlow *flow;
+
     /* UI Components */
     GtkWidget *header_bar;
     GtkWidget *status_page;
@@ -56,19 +61,28 @@ static void setup_webview (NmVpnSsoAuthDialog *self);
 static void on_load_changed (WebKitWebView           *web_view,
                               WebKitLoadEvent          load_event,
                               NmVpnSsoAuthDialog      *self);
-static void on_cookie_changed (WebKitCookieManager *cookie_manager,
-                                NmVpnSsoAuthDialog  *self);
 static void on_load_progress (WebKitWebView       *web_view,
                                GParamSpec          *pspec,
                                NmVpnSsoAuthDialog  *self);
-static gboolean on_load_failed (WebKitWebView       *web_view,
-                                 WebKitLoadEvent      load_event,
-                                 const char          *failing_uri,
-                                 GError              *error,
-                                 NmVpnSsoAuthDialog  *self);
+static void on_flow_done (VpnSsoWebCredentials *credentials,
+                          GError               *error,
+                          gpointer              user_data);
 
 /* Implementation */
 
+static void
+nm_vpn_sso_auth_dialog_dispose (GObject *object)
+{
+    NmVpnSsoAuthDialog *self = NM_VPN_SSO_AUTH_DIALOG (object);
+
+    if (self->flow) {
+        g_signal_handlers_disconnect_by_data (self->web_view, self);
+        g_clear_pointer (&self->flow, vpn_sso_web_flow_free);
+    }
+
+    G_OBJECT_CLASS (nm_vpn_sso_auth_dialog_parent_class)->dispose (object);
+}
+
 static void
 nm_vpn_sso_auth_dialog_finalize (GObject *object)
 {
@@ -77,6 +91,7 @@ nm_vpn_sso_auth_dialog_finalize (GObject *object)
     g_clear_pointer (&self->gateway, g_free);
     g_clear_pointer (&self->protocol, g_free);
     g_clear_pointer (&self->cookie, g_free);
+    g_clear_pointer (&self->usergroup, g_free);
     g_clear_pointer (&self->username, g_free);
 
     if (self->main_loop) {
@@ -209,6 +224,7 @@ nm_vpn_sso_auth_dialog_class_init (NmVpnSsoAuthDialogClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+    object_class->dispose = nm_vpn_sso_auth_dialog_dispose;
     object_class->finalize = nm_vpn_sso_auth_dialog_finalize;
     object_class->get_property = nm_vpn_sso_auth_dialog_get_property;
     object_class->set_property = nm_vpn_sso_auth_dialog_set_property;
@@ -231,115 +247,6 @@ nm_vpn_sso_auth_dialog_class_init (NmVpnSsoAuthDialogClass *klass)
     g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
-static void
-extract_globalprotect_cookie (NmVpnSsoAuthDialog *self, const char *cookie_value)
-{
-    /* GlobalProtect uses a prelogin.esp cookie or portal-userauthcookie */
-    if (g_str_has_prefix (cookie_value, "authcookie=") ||
-        g_str_has_prefix (cookie_value, "portal-userauthcookie=")) {
-        const char *start = strchr (cookie_value, '=');
-        if (start) {
-            start++; /* Skip the '=' */
-            char *cookie = g_strdup (start);
-            /* Remove any trailing attributes */
-            char *semicolon = strchr (cookie, ';');
-            if (semicolon)
-                *semicolon = '\0';
-
-            g_free (self->cookie);
-            self->cookie = cookie;
-            g_debug ("Captured GlobalProtect cookie: %s", self->cookie);
-        }
-    }
-}
-
-static void
-extract_anyconnect_cookie (NmVpnSsoAuthDialog *self, const char *cookie_value)
-{
-    /* AnyConnect uses webvpn or webvpnlogin cookies */
-    if (g_str_has_prefix (cookie_value, "webvpn=") ||
-        g_str_has_prefix (cookie_value, "webvpnlogin=")) {
-        const char *start = strchr (cookie_value, '=');
-        if (start) {
-            start++; /* Skip the '=' */
-            char *cookie = g_strdup (start);
-            /* Remove any trailing attributes */
-            char *semicolon = strchr (cookie, ';');
-            if (semicolon)
-                *semicolon = '\0';
-
-            g_free (self->cookie);
-            self->cookie = cookie;
-            g_debug ("Captured AnyConnect cookie: %s", self->cookie);
-        }
-    }
-}
-
-static void
-on_cookies_ready (GObject *source_object, GAsyncResult *result, gpointer user_data)
-{
-    NmVpnSsoAuthDialog *self = NM_VPN_SSO_AUTH_DIALOG (user_data);
-    WebKitCookieManager *cookie_manager = WEBKIT_COOKIE_MANAGER (source_object);
-    GList *cookies, *l;
-
-    cookies = webkit_cookie_manager_get_cookies_finish (cookie_manager, result, NULL);
-
-    for (l = cookies; l != NULL; l = l->next) {
-        SoupCookie *cookie = l->data;
-        const char *name = soup_cookie_get_name (cookie);
-        const char *value = soup_cookie_get_value (cookie);
-
-        g_debug ("Cookie found: %s=%s", name, value);
-
-        /* Check for authentication cookies based on protocol */
-        if (g_strcmp0 (self->protocol, "globalprotect") == 0) {
-            if (g_strcmp0 (name, "authcookie") == 0 ||
-                g_strcmp0 (name, "portal-userauthcookie") == 0) {
-                g_free (self->cookie);
-                self->cookie = g_strdup (value);
-                g_debug ("Captured GlobalProtect cookie: %s", self->cookie);
-                self->auth_completed = TRUE;
-            }
-        } else if (g_strcmp0 (self->protocol, "anyconnect") == 0) {
-            if (g_strcmp0 (name, "webvpn") == 0 ||
-                g_strcmp0 (name, "webvpnlogin") == 0) {
-                g_free (self->cookie);
-                self->cookie = g_strdup (value);
-                g_debug ("Captured AnyConnect cookie: %s", self->cookie);
-                self->auth_completed = TRUE;
-            }
-        }
-
-        soup_cookie_free (cookie);
-    }
-
-    g_list_free (cookies);
-
-    /* If authentication completed, close the dialog */
-    if (self->auth_completed) {
-        g_debug ("Authentication completed successfully");
-        if (self->main_loop && g_main_loop_is_running (self->main_loop))
-            g_main_loop_quit (self->main_loop);
-        gtk_window_close (GTK_WINDOW (self));
-    }
-}
-
-static void
-check_authentication_cookies (NmVpnSsoAuthDialog *self)
-{
-    WebKitNetworkSession *session;
-    WebKitCookieManager *cookie_manager;
-
-    session = webkit_web_view_get_network_session (WEBKIT_WEB_VIEW (self->web_view));
-    cookie_manager = webkit_network_session_get_cookie_manager (session);
-
-    webkit_cookie_manager_get_cookies (cookie_manager,
-                                        self->gateway,
-                                        NULL,
-                                        on_cookies_ready,
-                                        self);
-}
-
 static void
 on_load_changed (WebKitWebView      *web_view,
                   WebKitLoadEvent     load_event,
@@ -367,51 +274,54 @@ on_load_changed (WebKitWebView      *web_view,
             gtk_widget_set_visible (self->status_page, FALSE);
             gtk_widget_set_visible (self->web_view, TRUE);
         }
-
-        /* Check for authentication completion based on URL patterns */
-        if (g_strcmp0 (self->protocol, "globalprotect") == 0) {
-            if (strstr (uri, "/global-protect/") || strstr (uri, "/ssl-vpn/")) {
-                check_authentication_cookies (self);
-            }
-        } else if (g_strcmp0 (self->protocol, "anyconnect") == 0) {
-            if (strstr (uri, "/+CSCOE+/") || strstr (uri, "/+webvpn+/")) {
-                check_authentication_cookies (self);
-            }
-        }
         break;
 
     case WEBKIT_LOAD_FINISHED:
         g_debug ("Page load finished");
         gtk_widget_set_visible (self->progress_bar, FALSE);
         gtk_spinner_stop (GTK_SPINNER (self->spinner));
-
-        /* Final cookie check */
-        check_authentication_cookies (self);
         break;
     }
 }
 
-static gboolean
-on_load_failed (WebKitWebView      *web_view,
-                WebKitLoadEvent     load_event,
-                const char         *failing_uri,
-                GError             *error,
-                NmVpnSsoAuthDialog *self)
+/* The cookie is taken from the gateway's SAML callback by the flow */
+static void
+on_flow_done (VpnSsoWebCredentials *credentials,
+              GError               *error,
+              gpointer              user_data)
 {
-    g_warning ("Failed to load page: %s", error->message);
+    NmVpnSsoAuthDialog *self = NM_VPN_SSO_AUTH_DIALOG (user_data);
 
-    adw_status_page_set_icon_name (ADW_STATUS_PAGE (self->status_page), "dialog-error-symbolic");
-    adw_status_page_set_title (ADW_STATUS_PAGE (self->status_page), _("Authentication Failed"));
-    adw_status_page_set_description (ADW_STATUS_PAGE (self->status_page), error->message);
+    if (error) {
+        g_warning ("Authentication failed: %s", error->message);
 
-    gtk_widget_set_visible (self->web_view, FALSE);
-    gtk_widget_set_visible (self->status_page, TRUE);
-    gtk_spinner_stop (GTK_SPINNER (self->spinner));
-    gtk_widget_set_visible (self->progress_bar, FALSE);
+        adw_status_page_set_icon_name (ADW_STATUS_PAGE (self->status_page), "dialog-error-symbolic");
+        adw_status_page_set_title (ADW_STATUS_PAGE (self->status_page), _("Authentication Failed"));
+        adw_status_page_set_description (ADW_STATUS_PAGE (self->status_page), error->message);
 
-    self->auth_failed = TRUE;
+        gtk_widget_set_visible (self->web_view, FALSE);
+        gtk_widget_set_visible (self->status_page, TRUE);
+        gtk_spinner_stop (GTK_SPINNER (self->spinner));
+        gtk_widget_set_visible (self->progress_bar, FALSE);
+
+        self->auth_failed = TRUE;
+        g_error_free (error);
+        return;
+    }
 
-    return TRUE; /* Error handled */
+    g_free (self->cookie);
+    self->cookie = g_steal_pointer (&credentials->cookie);
+    g_free (self->usergroup);
+    self->usergroup = g_steal_pointer (&credentials->usergroup);
+    g_free (self->username);
+    self->username = g_steal_pointer (&credentials->username);
+    vpn_sso_web_credentials_free (credentials);
+
+    g_debug ("Authentication completed successfully");
+    self->auth_completed = TRUE;
+    if (self->main_loop && g_main_loop_is_running (self->main_loop))
+        g_main_loop_quit (self->main_loop);
+    gtk_window_close (GTK_WINDOW (self));
 }
 
 static void
@@ -426,57 +336,30 @@ on_load_progress (WebKitWebView      *web_view,
 static void
 setup_webview (NmVpnSsoAuthDialog *self)
 {
-    WebKitNetworkSession *network_session;
-    WebKitCookieManager *cookie_manager;
-    WebKitSettings *settings;
-    char *url;
-
-    /* Create network session - use ephemeral for privacy */
-    network_session = webkit_network_session_new_ephemeral ();
-
-    /* Configure cookie manager */
-    cookie_manager = webkit_network_session_get_cookie_manager (network_session);
-    webkit_cookie_manager_set_accept_policy (cookie_manager,
-                                              WEBKIT_COOKIE_POLICY_ACCEPT_ALWAYS);
-
-    /* Create web view with network session */
-    self->web_view = g_object_new (WEBKIT_TYPE_WEB_VIEW,
-                                    "network-session", network_session,
-                                    NULL);
+    GtkWidget *toolbar_view;
+    GtkWidget *main_box;
+
+    /* The flow brings the web view, with an ephemeral session, and loads
+     * the GlobalProtect prelogin or AnyConnect SAML login page */
+    self->flow = vpn_sso_web_flow_new (self->protocol, self->gateway,
+                                       NULL, on_flow_done, self);
+    self->web_view = GTK_WIDGET (vpn_sso_web_flow_get_web_view (self->flow));
     gtk_widget_set_visible (self->web_view, FALSE);
     gtk_widget_set_vexpand (self->web_view, TRUE);
 
-    /* Configure WebKit settings */
-    settings = webkit_web_view_get_settings (WEBKIT_WEB_VIEW (self->web_view));
-    webkit_settings_set_enable_javascript (settings, TRUE);
-    webkit_settings_set_enable_webgl (settings, FALSE);
-    /* plugins are no longer supported in WebKitGTK 6.0 */
-    webkit_settings_set_user_agent (settings, "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36");
-
     /* Connect signals */
     g_signal_connect (self->web_view, "load-changed",
                       G_CALLBACK (on_load_changed), self);
-    g_signal_connect (self->web_view, "load-failed",
-                      G_CALLBACK (on_load_failed), self);
     g_signal_connect (self->web_view, "notify::estimated-load-progress",
                       G_CALLBACK (on_load_progress), self);
 
     /* Add web view to UI - find the main box and append */
-    GtkWidget *toolbar_view = gtk_window_get_child (GTK_WINDOW (self));
-    GtkWidget *main_box = adw_toolbar_view_get_content (ADW_TOOLBAR_VIEW (toolbar_view));
+    toolbar_view = gtk_window_get_child (GTK_WINDOW (self));
+    main_box = adw_toolbar_view_get_content (ADW_TOOLBAR_VIEW (toolbar_view));
     gtk_box_append (GTK_BOX (main_box), self->web_view);
 
-    /* Build URL based on protocol */
-    if (g_strcmp0 (self->protocol, "globalprotect") == 0) {
-        url = g_strdup_printf ("https://%s/global-protect/prelogin.esp", self->gateway);
-    } else {
-        url = g_strdup_printf ("https://%s/", self->gateway);
-    }
-
-    g_debug ("Loading authentication URL: %s", url);
-    webkit_web_view_load_uri (WEBKIT_WEB_VIEW (self->web_view), url);
-
-    g_free (url);
+    g_debug ("Starting authentication with %s", self->gateway);
+    vpn_sso_web_flow_start (self->flow);
 }
 
 /* Public API */
@@ -507,3 +390,10 @@ nm_vpn_sso_auth_dialog_get_username (NmVpnSsoAuthDialog *self)
     g_return_val_if_fail (NM_IS_VPN_SSO_AUTH_DIALOG (self), NULL);
     return self->username;
 }
+
+const char *
+nm_vpn_sso_auth_dialog_get_usergroup (NmVpnSsoAuthDialog *self)
+{
+    g_return_val_if_fail (NM_IS_VPN_SSO_AUTH_DIALOG (self), NULL);
+    return self->usergroup;
+}
@@ -49,6 +49,16 @@ NmVpnSsoAuthDialog *nm_vpn_sso_auth_dialog_new (const char *gateway,
  */
 const char *nm_vpn_sso_auth_dialog_get_cookie (NmVpnSsoAuthDialog *dialog);
 
+/**
+ * nm_vpn_sso_auth_dialog_get_usergroup:
+ * @dialog: A #NmVpnSsoAuthDialog
+ *
+ * Gets the openconnect --usergroup the cookie is for (GlobalProtect).
+ *
+ * Returns: (transfer none) (nullable): The user group, or NULL if not needed
+ */
+const char *nm_vpn_sso_auth_dialog_get_usergroup (NmVpnSsoAuthDialog *dialog);
+
 /**
  * nm_vpn_sso_auth_dialog_get_username:
  * @dialog: A #NmVpnSsoAuthDialog
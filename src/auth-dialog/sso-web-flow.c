@@ -0,0 +1,682 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "sso-web-flow.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#define PRELOGIN_TIMEOUT_S 10
+
+struct _VpnSsoWebFlow {
+    /* Configuration */
+    gboolean gp;
+    gchar *gateway;
+    gchar *host;
+    gchar *base_uri;
+    VpnSsoWebFlowPhaseFunc phase_func;
+    VpnSsoWebFlowDoneFunc done_func;
+    gpointer user_data;
+
+    /* Browser */
+    WebKitWebView *web_view;
+    WebKitNetworkSession *network_session;
+    SoupSession *soup;
+    SoupMessage *prelogin_message;
+    GCancellable *cancellable;
+
+    /* Run state */
+    gboolean started;
+    gboolean done;
+    gchar *start_uri;            /* Start page known but not loaded yet */
+    gchar *start_html;
+    GError *start_error;
+
+    /* Captured from the gateway */
+    gchar *prelogin_cookie;
+    gchar *portal_userauthcookie;
+    gchar *saml_username;
+    gchar *fingerprint;
+};
+
+G_DEFINE_QUARK (vpn-sso-web-flow-error-quark, vpn_sso_web_flow_error)
+
+const gchar *
+vpn_sso_web_flow_error_class (const GError *error)
+{
+    if (!error || error->domain != VPN_SSO_WEB_FLOW_ERROR)
+        return "internal";
+
+    switch ((VpnSsoWebFlowError) error->code) {
+    case VPN_SSO_WEB_FLOW_ERROR_NETWORK:
+        return "network";
+    case VPN_SSO_WEB_FLOW_ERROR_TIMEOUT:
+        return "timeout";
+    case VPN_SSO_WEB_FLOW_ERROR_LOGIN:
+        return "login";
+    case VPN_SSO_WEB_FLOW_ERROR_BROWSER:
+        return "browser";
+    }
+
+    return "internal";
+}
+
+static void
+clear_secret (gchar **secret)
+{
+    if (*secret)
+        memset (*secret, 0, strlen (*secret));
+    g_clear_pointer (secret, g_free);
+}
+
+void
+vpn_sso_web_credentials_free (VpnSsoWebCredentials *credentials)
+{
+    if (!credentials)
+        return;
+
+    clear_secret (&credentials->cookie);
+    g_free (credentials->usergroup);
+    g_free (credentials->username);
+    g_free (credentials->fingerprint);
+    g_free (credentials);
+}
+
+static void
+report_phase (VpnSsoWebFlow *flow,
+              const gchar   *phase,
+              gboolean       done)
+{
+    if (flow->phase_func)
+        flow->phase_func (phase, done, flow->user_data);
+}
+
+static void
+finish (VpnSsoWebFlow        *flow,
+        VpnSsoWebCredentials *credentials,
+        GError               *error)
+{
+    if (flow->done) {
+        vpn_sso_web_credentials_free (credentials);
+        g_clear_error (&error);
+        return;
+    }
+
+    flow->done = TRUE;
+    flow->done_func (credentials, error, flow->user_data);
+}
+
+static GError *
+flow_error_new (VpnSsoWebFlowError  code,
+                const gchar        *format,
+                ...) G_GNUC_PRINTF (2, 3);
+
+static GError *
+flow_error_new (VpnSsoWebFlowError  code,
+                const gchar        *format,
+                ...)
+{
+    GError *error;
+    va_list args;
+
+    va_start (args, format);
+    error = g_error_new_valist (VPN_SSO_WEB_FLOW_ERROR, code, format, args);
+    va_end (args);
+
+    return error;
+}
+
+gboolean
+vpn_sso_web_flow_uri_on_gateway (VpnSsoWebFlow *flow,
+                                 const gchar   *uri)
+{
+    g_autoptr(GUri) parsed = NULL;
+
+    g_return_val_if_fail (flow != NULL, FALSE);
+
+    if (!uri || !flow->host)
+        return FALSE;
+
+    parsed = g_uri_parse (uri, G_URI_FLAGS_NONE, NULL);
+    return parsed && g_uri_get_host (parsed) &&
+           g_ascii_strcasecmp (g_uri_get_host (parsed), flow->host) == 0;
+}
+
+/* Text of the first <tag>...</tag> in @body, as GlobalProtect embeds its
+ * results in XML and in comments of the SAML callback page */
+static gchar *
+find_tag (const gchar *body,
+          gsize        length,
+          const gchar *tag)
+{
+    g_autofree gchar *open = g_strdup_printf ("<%s>", tag);
+    g_autofree gchar *close = g_strdup_printf ("</%s>", tag);
+    const gchar *start, *end;
+    gchar *value;
+
+    start = g_strstr_len (body, length, open);
+    if (!start)
+        return NULL;
+    start += strlen (open);
+
+    end = g_strstr_len (start, length - (start - body), close);
+    if (!end)
+        return NULL;
+
+    value = g_strstrip (g_strndup (start, end - start));
+    if (!*value || g_strcmp0 (value, "empty") == 0) {
+        g_free (value);
+        return NULL;
+    }
+    return value;
+}
+
+/* GlobalProtect: the portal hands out its cookie in the SAML callback */
+
+static void
+gp_try_finish (VpnSsoWebFlow *flow)
+{
+    VpnSsoWebCredentials *credentials;
+
+    if (flow->done || !(flow->portal_userauthcookie || flow->prelogin_cookie))
+        return;
+
+    credentials = g_new0 (VpnSsoWebCredentials, 1);
+    if (flow->portal_userauthcookie) {
+        credentials->cookie = g_strdup (flow->portal_userauthcookie);
+        credentials->usergroup = g_strdup ("portal:portal-userauthcookie");
+    } else {
+        credentials->cookie = g_strdup (flow->prelogin_cookie);
+        credentials->usergroup = g_strdup ("portal:prelogin-cookie");
+    }
+    credentials->username = g_strdup (flow->saml_username);
+
+    finish (flow, credentials, NULL);
+}
+
+static void
+gp_capture (VpnSsoWebFlow *flow,
+            const gchar   *key,
+            gchar         *value)
+{
+    gchar **slot;
+
+    if (!value || !*value || g_strcmp0 (value, "empty") == 0) {
+        g_free (value);
+        return;
+    }
+
+    if (g_strcmp0 (key, "prelogin-cookie") == 0)
+        slot = &flow->prelogin_cookie;
+    else if (g_strcmp0 (key, "portal-userauthcookie") == 0)
+        slot = &flow->portal_userauthcookie;
+    else
+        slot = &flow->saml_username;
+
+    clear_secret (slot);
+    *slot = value;
+}
+
+static void
+gp_callback_body_cb (GObject      *source,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree guchar *data = NULL;
+    VpnSsoWebFlow *flow;
+    gsize length = 0;
+
+    data = webkit_web_resource_get_data_finish (WEBKIT_WEB_RESOURCE (source), result,
+                                                &length, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    flow = user_data;
+    if (data) {
+        const gchar *body = (const gchar *) data;
+
+        gp_capture (flow, "prelogin-cookie", find_tag (body, length, "prelogin-cookie"));
+        gp_capture (flow, "portal-userauthcookie", find_tag (body, length, "portal-userauthcookie"));
+        gp_capture (flow, "saml-username", find_tag (body, length, "saml-username"));
+        memset (data, 0, length);
+    }
+
+    gp_try_finish (flow);
+}
+
+/* AnyConnect: the gateway sets its session cookie in the SAML callback */
+
+static void
+ac_cookies_cb (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+    g_autoptr(GError) error = NULL;
+    VpnSsoWebCredentials *credentials;
+    VpnSsoWebFlow *flow;
+    GString *combined;
+    gboolean have_session = FALSE;
+    GList *cookies;
+
+    cookies = webkit_cookie_manager_get_cookies_finish (WEBKIT_COOKIE_MANAGER (source),
+                                                        result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    flow = user_data;
+    combined = g_string_new (NULL);
+    for (GList *l = cookies; l; l = l->next) {
+        SoupCookie *cookie = l->data;
+        const gchar *name = soup_cookie_get_name (cookie);
+        const gchar *value = soup_cookie_get_value (cookie);
+
+        if (value && *value) {
+            if (g_strcmp0 (name, "webvpn") == 0 || g_strcmp0 (name, "SVPNCOOKIE") == 0)
+                have_session = TRUE;
+            g_string_append_printf (combined, "%s%s=%s", combined->len ? "; " : "", name, value);
+        }
+    }
+    g_list_free_full (cookies, (GDestroyNotify) soup_cookie_free);
+
+    if (!have_session || flow->done) {
+        memset (combined->str, 0, combined->len);
+        g_string_free (combined, TRUE);
+        return;
+    }
+
+    credentials = g_new0 (VpnSsoWebCredentials, 1);
+    credentials->cookie = g_string_free (combined, FALSE);
+    credentials->fingerprint = g_strdup (flow->fingerprint);
+    finish (flow, credentials, NULL);
+}
+
+static void
+ac_check_cookies (VpnSsoWebFlow *flow)
+{
+    WebKitCookieManager *cookie_manager;
+
+    cookie_manager = webkit_network_session_get_cookie_manager (flow->network_session);
+    webkit_cookie_manager_get_cookies (cookie_manager, flow->base_uri,
+                                       flow->cancellable, ac_cookies_cb, flow);
+}
+
+/* The certificate the gateway page was loaded with, for openconnect
+ * --servercert; only taken if WebKit validated it */
+static void
+ac_capture_fingerprint (VpnSsoWebFlow *flow)
+{
+    GTlsCertificate *certificate = NULL;
+    GTlsCertificateFlags errors = 0;
+    g_autoptr(GByteArray) der = NULL;
+    g_autofree gchar *digest = NULL;
+
+    if (flow->fingerprint ||
+        !webkit_web_view_get_tls_info (flow->web_view, &certificate, &errors) ||
+        !certificate || errors != 0)
+        return;
+
+    g_object_get (certificate, "certificate", &der, NULL);
+    if (!der)
+        return;
+
+    digest = g_compute_checksum_for_data (G_CHECKSUM_SHA256, der->data, der->len);
+    flow->fingerprint = g_strconcat ("sha256:", digest, NULL);
+}
+
+/* Web view signals */
+
+static gboolean
+on_decide_policy (WebKitWebView            *web_view,
+                  WebKitPolicyDecision     *decision,
+                  WebKitPolicyDecisionType  type,
+                  VpnSsoWebFlow            *flow)
+{
+    WebKitURIResponse *response;
+    SoupMessageHeaders *headers;
+
+    if (!flow->gp || type != WEBKIT_POLICY_DECISION_TYPE_RESPONSE)
+        return FALSE;
+
+    /* GlobalProtect answers the SAML POST with the cookie in headers */
+    response = webkit_response_policy_decision_get_response (WEBKIT_RESPONSE_POLICY_DECISION (decision));
+    if (!vpn_sso_web_flow_uri_on_gateway (flow, webkit_uri_response_get_uri (response)))
+        return FALSE;
+
+    headers = webkit_uri_response_get_http_headers (response);
+    if (headers) {
+        gp_capture (flow, "prelogin-cookie",
+                    g_strdup (soup_message_headers_get_one (headers, "prelogin-cookie")));
+        gp_capture (flow, "portal-userauthcookie",
+                    g_strdup (soup_message_headers_get_one (headers, "portal-userauthcookie")));
+        gp_capture (flow, "saml-username",
+                    g_strdup (soup_message_headers_get_one (headers, "saml-username")));
+    }
+
+    return FALSE;
+}
+
+static void
+on_load_changed (WebKitWebView   *web_view,
+                 WebKitLoadEvent  load_event,
+                 VpnSsoWebFlow   *flow)
+{
+    WebKitWebResource *resource;
+
+    if (flow->done || !vpn_sso_web_flow_uri_on_gateway (flow, webkit_web_view_get_uri (web_view)))
+        return;
+
+    switch (load_event) {
+    case WEBKIT_LOAD_COMMITTED:
+        if (flow->gp) {
+            gp_try_finish (flow);
+        } else {
+            ac_capture_fingerprint (flow);
+            ac_check_cookies (flow);
+        }
+        break;
+
+    case WEBKIT_LOAD_FINISHED:
+        if (!flow->gp) {
+            ac_check_cookies (flow);
+            break;
+        }
+
+        resource = webkit_web_view_get_main_resource (web_view);
+        if (resource)
+            webkit_web_resource_get_data (resource, flow->cancellable,
+                                          gp_callback_body_cb, flow);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static gboolean
+on_load_failed (WebKitWebView   *web_view,
+                WebKitLoadEvent  load_event,
+                const gchar     *failing_uri,
+                GError          *error,
+                VpnSsoWebFlow   *flow)
+{
+    if (flow->done)
+        return FALSE;
+
+    /* WebKit may refuse to display the GlobalProtect callback; its
+     * headers have been read by then */
+    if (flow->gp && vpn_sso_web_flow_uri_on_gateway (flow, failing_uri)) {
+        gp_try_finish (flow);
+        if (flow->done)
+            return FALSE;
+    }
+
+    /* Navigations replaced by the next one are not failures */
+    if (g_error_matches (error, WEBKIT_NETWORK_ERROR, WEBKIT_NETWORK_ERROR_CANCELLED) ||
+        g_error_matches (error, WEBKIT_POLICY_ERROR,
+                         WEBKIT_POLICY_ERROR_FRAME_LOAD_INTERRUPTED_BY_POLICY_CHANGE))
+        return FALSE;
+
+    finish (flow, NULL, flow_error_new (VPN_SSO_WEB_FLOW_ERROR_NETWORK,
+                                        "Failed to load %s: %s", failing_uri, error->message));
+    return FALSE;
+}
+
+static gboolean
+on_load_failed_with_tls_errors (WebKitWebView        *web_view,
+                                const gchar          *failing_uri,
+                                GTlsCertificate      *certificate,
+                                GTlsCertificateFlags  errors,
+                                VpnSsoWebFlow        *flow)
+{
+    finish (flow, NULL, flow_error_new (VPN_SSO_WEB_FLOW_ERROR_NETWORK,
+                                        "Certificate of %s is not trusted", failing_uri));
+    return TRUE;
+}
+
+/* Start page */
+
+static void
+load_start_page (VpnSsoWebFlow *flow)
+{
+    if (flow->start_error) {
+        finish (flow, NULL, g_steal_pointer (&flow->start_error));
+        return;
+    }
+
+    /* The GlobalProtect prelogin is still running */
+    if (!flow->start_uri && !flow->start_html)
+        return;
+
+    report_phase (flow, "portal", FALSE);
+    if (flow->start_html)
+        webkit_web_view_load_html (flow->web_view, flow->start_html, flow->base_uri);
+    else
+        webkit_web_view_load_uri (flow->web_view, flow->start_uri);
+
+    g_clear_pointer (&flow->start_uri, g_free);
+    g_clear_pointer (&flow->start_html, g_free);
+}
+
+static void
+gp_prelogin_cb (GObject      *source,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GBytes) bytes = NULL;
+    g_autofree gchar *saml_request = NULL;
+    g_autofree guchar *decoded = NULL;
+    VpnSsoWebFlow *flow;
+    gsize length = 0;
+    const gchar *body;
+    guint status;
+
+    bytes = soup_session_send_and_read_finish (SOUP_SESSION (source), result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    flow = user_data;
+    report_phase (flow, "prelogin", TRUE);
+    status = soup_message_get_status (flow->prelogin_message);
+    g_clear_object (&flow->prelogin_message);
+
+    if (!bytes) {
+        flow->start_error = flow_error_new (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)
+                                            ? VPN_SSO_WEB_FLOW_ERROR_TIMEOUT
+                                            : VPN_SSO_WEB_FLOW_ERROR_NETWORK,
+                                            "GlobalProtect prelogin failed: %s", error->message);
+    } else if (status != SOUP_STATUS_OK) {
+        flow->start_error = flow_error_new (VPN_SSO_WEB_FLOW_ERROR_NETWORK,
+                                            "GlobalProtect prelogin returned HTTP %u", status);
+    } else {
+        body = g_bytes_get_data (bytes, &length);
+        saml_request = find_tag (body, length, "saml-request");
+        if (saml_request)
+            decoded = g_base64_decode (saml_request, &length);
+
+        if (!decoded || length == 0) {
+            flow->start_error = flow_error_new (VPN_SSO_WEB_FLOW_ERROR_LOGIN,
+                                                "%s does not offer SAML authentication",
+                                                flow->gateway);
+        } else if (g_str_has_prefix ((const gchar *) decoded, "http")) {
+            /* Redirect binding gives a URL, POST binding a self-submitting form */
+            flow->start_uri = g_strndup ((const gchar *) decoded, length);
+        } else {
+            flow->start_html = g_strndup ((const gchar *) decoded, length);
+        }
+    }
+
+    if (flow->started)
+        load_start_page (flow);
+}
+
+static void
+gp_fetch_prelogin (VpnSsoWebFlow *flow)
+{
+    g_autofree gchar *uri = NULL;
+
+    uri = g_strconcat (flow->base_uri,
+                       "global-protect/prelogin.esp?tmp=tmp&clientVer=4100&clientos=Linux",
+                       NULL);
+    flow->prelogin_message = soup_message_new ("GET", uri);
+    if (!flow->prelogin_message) {
+        flow->start_error = flow_error_new (VPN_SSO_WEB_FLOW_ERROR_LOGIN,
+                                            "Invalid gateway %s", flow->gateway);
+        return;
+    }
+
+    flow->soup = soup_session_new_with_options ("user-agent", "PAN GlobalProtect",
+                                                "timeout", PRELOGIN_TIMEOUT_S,
+                                                NULL);
+
+    report_phase (flow, "prelogin", FALSE);
+    soup_session_send_and_read_async (flow->soup, flow->prelogin_message, G_PRIORITY_DEFAULT,
+                                      flow->cancellable, gp_prelogin_cb, flow);
+}
+
+static void
+setup_web_view (VpnSsoWebFlow *flow)
+{
+    WebKitCookieManager *cookie_manager;
+    WebKitSettings *settings;
+
+    /* Nothing of the IdP session outlives the login */
+    flow->network_session = webkit_network_session_new_ephemeral ();
+    cookie_manager = webkit_network_session_get_cookie_manager (flow->network_session);
+    webkit_cookie_manager_set_accept_policy (cookie_manager, WEBKIT_COOKIE_POLICY_ACCEPT_ALWAYS);
+
+    flow->web_view = g_object_ref_sink (g_object_new (WEBKIT_TYPE_WEB_VIEW,
+                                                      "network-session", flow->network_session,
+                                                      NULL));
+    settings = webkit_web_view_get_settings (flow->web_view);
+    webkit_settings_set_enable_javascript (settings, TRUE);
+    webkit_settings_set_enable_webgl (settings, FALSE);
+    webkit_settings_set_user_agent_with_application_details (settings, "gnome-vpn-sso", PACKAGE_VERSION);
+
+    g_signal_connect (flow->web_view, "decide-policy",
+                      G_CALLBACK (on_decide_policy), flow);
+    g_signal_connect (flow->web_view, "load-changed",
+                      G_CALLBACK (on_load_changed), flow);
+    g_signal_connect (flow->web_view, "load-failed",
+                      G_CALLBACK (on_load_failed), flow);
+    g_signal_connect (flow->web_view, "load-failed-with-tls-errors",
+                      G_CALLBACK (on_load_failed_with_tls_errors), flow);
+}
+
+/* Public API */
+
+VpnSsoWebFlow *
+vpn_sso_web_flow_new (const gchar            *protocol,
+                      const gchar            *gateway,
+                      VpnSsoWebFlowPhaseFunc  phase_func,
+                      VpnSsoWebFlowDoneFunc   done_func,
+                      gpointer                user_data)
+{
+    g_autoptr(GUri) uri = NULL;
+    g_autofree gchar *with_scheme = NULL;
+    VpnSsoWebFlow *flow;
+    const gchar *host;
+
+    g_return_val_if_fail (protocol != NULL, NULL);
+    g_return_val_if_fail (gateway != NULL, NULL);
+    g_return_val_if_fail (done_func != NULL, NULL);
+
+    flow = g_new0 (VpnSsoWebFlow, 1);
+    flow->gp = g_strcmp0 (protocol, "gp") == 0 || g_strcmp0 (protocol, "globalprotect") == 0;
+    flow->gateway = g_strdup (gateway);
+    flow->phase_func = phase_func;
+    flow->done_func = done_func;
+    flow->user_data = user_data;
+    flow->cancellable = g_cancellable_new ();
+
+    with_scheme = strstr (gateway, "://") ? g_strdup (gateway) : g_strconcat ("https://", gateway, NULL);
+    uri = g_uri_parse (with_scheme, G_URI_FLAGS_NONE, NULL);
+    host = uri ? g_uri_get_host (uri) : NULL;
+    if (host && *host) {
+        gboolean ipv6 = strchr (host, ':') != NULL;
+
+        flow->host = g_strdup (host);
+        if (g_uri_get_port (uri) > 0)
+            flow->base_uri = g_strdup_printf (ipv6 ? "https://[%s]:%d/" : "https://%s:%d/",
+                                              host, g_uri_get_port (uri));
+        else
+            flow->base_uri = g_strdup_printf (ipv6 ? "https://[%s]/" : "https://%s/", host);
+    }
+
+    /* The prelogin request runs while WebKit starts */
+    if (flow->base_uri && flow->gp)
+        gp_fetch_prelogin (flow);
+    else if (flow->base_uri)
+        flow->start_uri = g_strconcat (flow->base_uri,
+                                       "+CSCOE+/saml/sp/login?tgname=DefaultWEBVPNGroup",
+                                       NULL);
+
+    setup_web_view (flow);
+
+    return flow;
+}
+
+WebKitWebView *
+vpn_sso_web_flow_get_web_view (VpnSsoWebFlow *flow)
+{
+    g_return_val_if_fail (flow != NULL, NULL);
+
+    return flow->web_view;
+}
+
+void
+vpn_sso_web_flow_start (VpnSsoWebFlow *flow)
+{
+    g_return_if_fail (flow != NULL);
+    g_return_if_fail (!flow->started);
+
+    flow->started = TRUE;
+    if (!flow->host) {
+        finish (flow, NULL, flow_error_new (VPN_SSO_WEB_FLOW_ERROR_LOGIN,
+                                            "Invalid gateway %s", flow->gateway));
+        return;
+    }
+
+    load_start_page (flow);
+}
+
+void
+vpn_sso_web_flow_free (VpnSsoWebFlow *flow)
+{
+    if (!flow)
+        return;
+
+    g_cancellable_cancel (flow->cancellable);
+    if (flow->web_view) {
+        g_signal_handlers_disconnect_by_data (flow->web_view, flow);
+        webkit_web_view_stop_loading (flow->web_view);
+        g_object_unref (flow->web_view);
+    }
+    g_clear_object (&flow->network_session);
+    g_clear_object (&flow->prelogin_message);
+    g_clear_object (&flow->soup);
+    g_clear_object (&flow->cancellable);
+    g_clear_error (&flow->start_error);
+
+    g_free (flow->gateway);
+    g_free (flow->host);
+    g_free (flow->base_uri);
+    g_free (flow->start_uri);
+    g_free (flow->start_html);
+    clear_secret (&flow->prelogin_cookie);
+    clear_secret (&flow->portal_userauthcookie);
+    g_free (flow->saml_username);
+    g_free (flow->fingerprint);
+    g_free (flow);
+}
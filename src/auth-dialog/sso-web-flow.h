@@ -0,0 +1,164 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SSO_WEB_FLOW_H__
+#define __SSO_WEB_FLOW_H__
+
+#include <webkit/webkit.h>
+
+G_BEGIN_DECLS
+
+#define VPN_SSO_WEB_FLOW_ERROR (vpn_sso_web_flow_error_quark ())
+
+/**
+ * VpnSsoWebFlowError:
+ * @VPN_SSO_WEB_FLOW_ERROR_NETWORK: The gateway or IdP could not be reached
+ * @VPN_SSO_WEB_FLOW_ERROR_TIMEOUT: The login did not finish in time
+ * @VPN_SSO_WEB_FLOW_ERROR_LOGIN: The login ended without VPN credentials
+ * @VPN_SSO_WEB_FLOW_ERROR_BROWSER: WebKit could not be started
+ *
+ * One code per error class of the progress protocol.
+ */
+typedef enum {
+    VPN_SSO_WEB_FLOW_ERROR_NETWORK,
+    VPN_SSO_WEB_FLOW_ERROR_TIMEOUT,
+    VPN_SSO_WEB_FLOW_ERROR_LOGIN,
+    VPN_SSO_WEB_FLOW_ERROR_BROWSER,
+} VpnSsoWebFlowError;
+
+GQuark vpn_sso_web_flow_error_quark (void);
+
+/**
+ * vpn_sso_web_flow_error_class:
+ * @error: (nullable): An error passed to a #VpnSsoWebFlowDoneFunc
+ *
+ * Returns: The progress protocol error class for @error
+ */
+const gchar *vpn_sso_web_flow_error_class (const GError *error);
+
+/**
+ * VpnSsoWebCredentials:
+ * @cookie: Value for openconnect --cookie
+ * @usergroup: (nullable): Value for openconnect --usergroup (GlobalProtect)
+ * @username: (nullable): User name the gateway reported
+ * @fingerprint: (nullable): Gateway certificate as "sha256:<hex>" (AnyConnect)
+ *
+ * What the gateway hands out at the end of a SAML login.
+ */
+typedef struct {
+    gchar *cookie;
+    gchar *usergroup;
+    gchar *username;
+    gchar *fingerprint;
+} VpnSsoWebCredentials;
+
+void vpn_sso_web_credentials_free (VpnSsoWebCredentials *credentials);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoWebCredentials, vpn_sso_web_credentials_free)
+
+/**
+ * VpnSsoWebFlow:
+ *
+ * The WebKit side of a SAML login to one GlobalProtect portal or
+ * AnyConnect gateway, shared by the auth dialog and vpn-sso-webkit: a web
+ * view with an ephemeral session, the start page (the GlobalProtect
+ * prelogin or the AnyConnect SAML login URL), and the capture of the VPN
+ * credentials from the gateway's SAML callback. The caller places the web
+ * view and drives the IdP pages, or leaves them to the user.
+ */
+typedef struct _VpnSsoWebFlow VpnSsoWebFlow;
+
+/**
+ * VpnSsoWebFlowPhaseFunc:
+ * @phase: "prelogin" or "portal"
+ * @done: Whether the phase finished or started
+ * @user_data: Data given to vpn_sso_web_flow_new()
+ *
+ * Reports the steps of the start, for step timing.
+ */
+typedef void (*VpnSsoWebFlowPhaseFunc) (const gchar *phase,
+                                        gboolean     done,
+                                        gpointer     user_data);
+
+/**
+ * VpnSsoWebFlowDoneFunc:
+ * @credentials: (transfer full) (nullable): The credentials, or %NULL on error
+ * @error: (transfer full) (nullable): A %VPN_SSO_WEB_FLOW_ERROR, or %NULL
+ * @user_data: Data given to vpn_sso_web_flow_new()
+ *
+ * Called once, when the gateway has handed out its credentials or the
+ * login failed. The flow must not be freed from here.
+ */
+typedef void (*VpnSsoWebFlowDoneFunc) (VpnSsoWebCredentials *credentials,
+                                       GError               *error,
+                                       gpointer              user_data);
+
+/**
+ * vpn_sso_web_flow_new:
+ * @protocol: "gp", "globalprotect" or "anyconnect"
+ * @gateway: Gateway host name, optionally with a scheme and port
+ * @phase_func: (nullable): Called as start steps begin and end
+ * @done_func: Called with the outcome
+ * @user_data: Data for @phase_func and @done_func
+ *
+ * Creates the web view. For GlobalProtect, the prelogin request goes out
+ * first, so that it overlaps with WebKit starting. GTK must have been
+ * initialized.
+ *
+ * Returns: (transfer full): A new flow, not started yet
+ */
+VpnSsoWebFlow *vpn_sso_web_flow_new (const gchar            *protocol,
+                                     const gchar            *gateway,
+                                     VpnSsoWebFlowPhaseFunc  phase_func,
+                                     VpnSsoWebFlowDoneFunc   done_func,
+                                     gpointer                user_data);
+
+/**
+ * vpn_sso_web_flow_get_web_view:
+ * @flow: A #VpnSsoWebFlow
+ *
+ * Returns: (transfer none): The web view, for the caller to place
+ */
+WebKitWebView *vpn_sso_web_flow_get_web_view (VpnSsoWebFlow *flow);
+
+/**
+ * vpn_sso_web_flow_uri_on_gateway:
+ * @flow: A #VpnSsoWebFlow
+ * @uri: (nullable): A URI
+ *
+ * Returns: Whether @uri is on the gateway rather than the IdP
+ */
+gboolean vpn_sso_web_flow_uri_on_gateway (VpnSsoWebFlow *flow,
+                                          const gchar   *uri);
+
+/**
+ * vpn_sso_web_flow_start:
+ * @flow: A #VpnSsoWebFlow
+ *
+ * Loads the start page once it is known. The done function may run
+ * before this returns, for an invalid gateway.
+ */
+void vpn_sso_web_flow_start (VpnSsoWebFlow *flow);
+
+/**
+ * vpn_sso_web_flow_free:
+ * @flow: (nullable): A #VpnSsoWebFlow
+ *
+ * Cancels what is pending without calling the done function, and drops
+ * the flow's reference on the web view.
+ */
+void vpn_sso_web_flow_free (VpnSsoWebFlow *flow);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoWebFlow, vpn_sso_web_flow_free)
+
+G_END_DECLS
+
+#endif /* __SSO_WEB_FLOW_H__ */
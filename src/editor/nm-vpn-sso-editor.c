@@ -142,7 +142,7 @@ init_editor_ui (NmVpnSsoEditor *self)
     row++;
 
     /* Cache duration */
-    label = gtk_label_new ("Cache Duration:");
+    label = gtk_label_new ("Max Cache Duration:");
     gtk_widget_set_halign (label, GTK_ALIGN_END);
     gtk_grid_attach (GTK_GRID (grid), label, 0, row, 1, 1);
 
@@ -150,7 +150,8 @@ init_editor_ui (NmVpnSsoEditor *self)
     self->cache_hours_spin = gtk_spin_button_new_with_range (0, 168, 1);  /* 0-168 hours (1 week) */
     gtk_spin_button_set_value (GTK_SPIN_BUTTON (self->cache_hours_spin), 8);  /* Default 8 hours */
     gtk_widget_set_tooltip_text (self->cache_hours_spin,
-        "How long to cache SSO credentials (0 = always require fresh SSO)");
+        "Upper bound for caching SSO credentials. Entries expire earlier if the "
+        "gateway announces a shorter session lifetime (0 = use the gateway's lifetime)");
     gtk_box_append (GTK_BOX (cache_box), self->cache_hours_spin);
 
     GtkWidget *hours_label = gtk_label_new ("hours");
@@ -0,0 +1,151 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "cert-pin-store.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+/*
+ * Server certificate pin store.
+ *
+ * Pins live apart from the credential cache, under VPN_SSO_STATEDIR, so
+ * that dropping a stale cookie (or clearing the whole cache) does not
+ * lose the gateway's certificate. One key file, a group per gateway:
+ *
+ *   [vpn.example.com]
+ *   pins=pin-sha256:AbC...=;pin-sha256:XyZ...=;
+ *   updated-at=1718000000
+ */
+
+#define CERT_PIN_FILE   VPN_SSO_STATEDIR "/server-pins.conf"
+
+static GKeyFile *
+pin_store_load (void)
+{
+    GKeyFile *keyfile = g_key_file_new ();
+    g_autoptr(GError) error = NULL;
+
+    if (!g_key_file_load_from_file (keyfile, CERT_PIN_FILE,
+                                    G_KEY_FILE_NONE, &error) &&
+        !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_message ("CERT PINS: Ignoring unreadable %s: %s",
+                   CERT_PIN_FILE, error->message);
+    }
+
+    return keyfile;
+}
+
+static void
+pin_store_save (GKeyFile *keyfile)
+{
+    g_autoptr(GError) error = NULL;
+
+    if (g_mkdir_with_parents (VPN_SSO_STATEDIR, 0700) < 0) {
+        g_message ("CERT PINS: Cannot create %s", VPN_SSO_STATEDIR);
+        return;
+    }
+
+    if (!g_key_file_save_to_file (keyfile, CERT_PIN_FILE, &error))
+        g_message ("CERT PINS: Failed to write %s: %s",
+                   CERT_PIN_FILE, error->message);
+}
+
+static void
+pin_store_set (GKeyFile     *keyfile,
+               const gchar  *gateway,
+               GPtrArray    *pins)
+{
+    if (pins->len == 0) {
+        g_key_file_remove_group (keyfile, gateway, NULL);
+        return;
+    }
+
+    g_key_file_set_string_list (keyfile, gateway, "pins",
+                                (const gchar * const *) pins->pdata, pins->len);
+    g_key_file_set_int64 (keyfile, gateway, "updated-at",
+                          g_get_real_time () / G_USEC_PER_SEC);
+}
+
+gchar **
+vpn_sso_cert_pins_get (const gchar *gateway)
+{
+    g_autoptr(GKeyFile) keyfile = NULL;
+    gchar **pins;
+
+    g_return_val_if_fail (gateway != NULL, NULL);
+
+    keyfile = pin_store_load ();
+    pins = g_key_file_get_string_list (keyfile, gateway, "pins", NULL, NULL);
+    if (pins && !pins[0])
+        g_clear_pointer (&pins, g_strfreev);
+
+    return pins;
+}
+
+void
+vpn_sso_cert_pins_add (const gchar *gateway,
+                       const gchar *pin)
+{
+    g_autoptr(GKeyFile) keyfile = NULL;
+    g_auto(GStrv) old = NULL;
+    g_autoptr(GPtrArray) pins = NULL;
+
+    g_return_if_fail (gateway != NULL);
+
+    if (!pin || !*pin || strchr (pin, ';') || strchr (pin, '\n'))
+        return;
+
+    keyfile = pin_store_load ();
+    old = g_key_file_get_string_list (keyfile, gateway, "pins", NULL, NULL);
+
+    if (old && g_strcmp0 (old[0], pin) == 0)
+        return;
+
+    pins = g_ptr_array_new ();
+    g_ptr_array_add (pins, (gpointer) pin);
+    for (gchar **p = old; p && *p && pins->len < VPN_SSO_CERT_PINS_MAX; p++) {
+        if (g_strcmp0 (*p, pin) != 0)
+            g_ptr_array_add (pins, *p);
+    }
+
+    pin_store_set (keyfile, gateway, pins);
+    pin_store_save (keyfile);
+    g_message ("CERT PINS: %s now pinned to %s (%u known)", gateway, pin, pins->len);
+}
+
+void
+vpn_sso_cert_pins_remove (const gchar *gateway,
+                          const gchar *pin)
+{
+    g_autoptr(GKeyFile) keyfile = NULL;
+    g_auto(GStrv) old = NULL;
+    g_autoptr(GPtrArray) pins = NULL;
+
+    g_return_if_fail (gateway != NULL);
+    g_return_if_fail (pin != NULL);
+
+    keyfile = pin_store_load ();
+    old = g_key_file_get_string_list (keyfile, gateway, "pins", NULL, NULL);
+    if (!old || !g_strv_contains ((const gchar * const *) old, pin))
+        return;
+
+    pins = g_ptr_array_new ();
+    for (gchar **p = old; *p; p++) {
+        if (g_strcmp0 (*p, pin) != 0)
+            g_ptr_array_add (pins, *p);
+    }
+
+    pin_store_set (keyfile, gateway, pins);
+    pin_store_save (keyfile);
+    g_message ("CERT PINS: Removed %s for %s", pin, gateway);
+}
@@ -0,0 +1,55 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __CERT_PIN_STORE_H__
+#define __CERT_PIN_STORE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Pins kept per gateway, newest first; older ones cover certificate
+ * rotation and load-balanced gateways presenting different certificates */
+#define VPN_SSO_CERT_PINS_MAX 3
+
+/**
+ * vpn_sso_cert_pins_get:
+ * @gateway: Gateway address as configured in the connection
+ *
+ * Returns: (transfer full) (nullable): The pinned server certificate
+ *   fingerprints for @gateway in openconnect --servercert syntax, newest
+ *   first, or %NULL if none are known
+ */
+gchar **vpn_sso_cert_pins_get (const gchar *gateway);
+
+/**
+ * vpn_sso_cert_pins_add:
+ * @gateway: Gateway address as configured in the connection
+ * @pin: Fingerprint ("pin-sha256:...", "sha256:..." or SHA-1 hex)
+ *
+ * Makes @pin the preferred pin for @gateway, keeping up to
+ * %VPN_SSO_CERT_PINS_MAX previous ones. Only pins obtained over a
+ * validated connection may be added.
+ */
+void vpn_sso_cert_pins_add (const gchar *gateway,
+                            const gchar *pin);
+
+/**
+ * vpn_sso_cert_pins_remove:
+ * @gateway: Gateway address as configured in the connection
+ * @pin: Fingerprint to forget
+ */
+void vpn_sso_cert_pins_remove (const gchar *gateway,
+                               const gchar *pin);
+
+G_END_DECLS
+
+#endif /* __CERT_PIN_STORE_H__ */
@@ -0,0 +1,241 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "child-process.h"
+#include "process-scope.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <glib-unix.h>
+
+/*
+ * Child process supervision through pidfds (Linux >= 5.3).
+ *
+ * The pidfd becomes readable when the child exits; a GLib unix fd source
+ * on it replaces g_child_watch_add(), waitid (P_PIDFD) reaps the child and
+ * pidfd_send_signal() replaces kill(). Once the child is reaped the pidfd
+ * keeps referring to the dead process, so a late signal fails with ESRCH
+ * instead of hitting whatever process got the PID next.
+ *
+ * waitid (P_PIDFD) only arrived in Linux 5.4; on 5.3 it fails with EINVAL
+ * and the child is reaped with waitpid(), which is just as safe there: the
+ * exited child keeps its PID until it is reaped.
+ */
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+struct _VpnSsoChild {
+    GPid pid;
+    gint pidfd;                  /* -1 without kernel support */
+    guint watch;
+    gboolean exited;
+    gchar *name;
+    VpnSsoScope *scope;
+    GChildWatchFunc exit_func;
+    gpointer user_data;
+};
+
+static gint
+pidfd_open_compat (GPid pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall (SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static gint
+pidfd_send_signal_compat (gint pidfd, gint signum)
+{
+#ifdef SYS_pidfd_send_signal
+    return syscall (SYS_pidfd_send_signal, pidfd, signum, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void
+child_free (VpnSsoChild *child)
+{
+    if (child->watch)
+        g_source_remove (child->watch);
+    if (child->pidfd >= 0)
+        close (child->pidfd);
+    vpn_sso_scope_free (child->scope);
+    g_free (child->name);
+    g_free (child);
+}
+
+static void
+child_exited (VpnSsoChild *child, gint status)
+{
+    child->exited = TRUE;
+    child->watch = 0;
+
+    /* Nothing the child started may outlive it, e.g. browser processes
+     * of an SSO helper */
+    vpn_sso_scope_kill (child->scope);
+    g_clear_pointer (&child->scope, vpn_sso_scope_free);
+
+    if (child->exit_func) {
+        /* May release the child */
+        child->exit_func (child->pid, status, child->user_data);
+    } else {
+        g_message ("%s (PID %d) exited with status %d", child->name, child->pid, status);
+        child_free (child);
+    }
+}
+
+static gboolean
+pidfd_ready_cb (gint fd, GIOCondition condition G_GNUC_UNUSED, gpointer user_data)
+{
+    VpnSsoChild *child = user_data;
+    siginfo_t info = { 0 };
+    gint status = 0;
+
+    if (waitid (P_PIDFD, fd, &info, WEXITED) < 0) {
+        const gchar *call = "waitid";
+
+        /* Linux 5.3: pidfds, but no waitid (P_PIDFD) yet */
+        if (errno == EINVAL) {
+            pid_t reaped;
+
+            call = "waitpid";
+            do
+                reaped = waitpid (child->pid, &status, 0);
+            while (reaped < 0 && errno == EINTR);
+
+            if (reaped == child->pid) {
+                child_exited (child, status);
+                return G_SOURCE_REMOVE;
+            }
+        }
+
+        g_message ("%s (PID %d): %s failed: %s",
+                   child->name, child->pid, call, g_strerror (errno));
+        status = W_EXITCODE (255, 0);
+    } else if (info.si_code == CLD_EXITED) {
+        status = W_EXITCODE (info.si_status, 0);
+    } else {
+        /* Killed or dumped core; keep the wait(2) status encoding the
+         * callers decode with WIFEXITED() and friends */
+        status = info.si_status | (info.si_code == CLD_DUMPED ? WCOREFLAG : 0);
+    }
+
+    child_exited (child, status);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+child_watch_cb (GPid pid G_GNUC_UNUSED, gint status, gpointer user_data)
+{
+    child_exited (user_data, status);
+}
+
+VpnSsoChild *
+vpn_sso_child_new (GPid             pid,
+                   const gchar     *name,
+                   const gchar     *connection,
+                   GChildWatchFunc  exit_func,
+                   gpointer         user_data)
+{
+    VpnSsoChild *child;
+
+    g_return_val_if_fail (pid > 0, NULL);
+
+    child = g_new0 (VpnSsoChild, 1);
+    child->pid = pid;
+    child->name = g_strdup (name);
+    child->exit_func = exit_func;
+    child->user_data = user_data;
+    child->pidfd = pidfd_open_compat (pid);
+    child->scope = vpn_sso_scope_new (pid, connection, name);
+
+    if (child->pidfd >= 0) {
+        child->watch = g_unix_fd_add (child->pidfd, G_IO_IN, pidfd_ready_cb, child);
+    } else {
+        g_debug ("%s (PID %d): no pidfd (%s), using a child watch",
+                 name, pid, g_strerror (errno));
+        child->watch = g_child_watch_add (pid, child_watch_cb, child);
+    }
+
+    return child;
+}
+
+GPid
+vpn_sso_child_get_pid (VpnSsoChild *child)
+{
+    g_return_val_if_fail (child != NULL, 0);
+
+    return child->pid;
+}
+
+gboolean
+vpn_sso_child_signal (VpnSsoChild *child,
+                      gint         signum)
+{
+    g_return_val_if_fail (child != NULL, FALSE);
+
+    if (child->exited)
+        return FALSE;
+
+    if (child->pidfd >= 0) {
+        if (pidfd_send_signal_compat (child->pidfd, signum) == 0)
+            return TRUE;
+        if (errno == ESRCH)
+            return FALSE;
+        g_message ("%s (PID %d): pidfd_send_signal failed: %s",
+                   child->name, child->pid, g_strerror (errno));
+        return FALSE;
+    }
+
+    /* Without a pidfd the unreaped child still holds its PID */
+    return kill (child->pid, signum) == 0;
+}
+
+void
+vpn_sso_child_kill_tree (VpnSsoChild *child)
+{
+    g_return_if_fail (child != NULL);
+
+    if (child->exited)
+        return;
+
+    if (child->scope && vpn_sso_scope_kill (child->scope))
+        return;
+
+    vpn_sso_child_signal (child, SIGTERM);
+}
+
+void
+vpn_sso_child_release (VpnSsoChild *child)
+{
+    if (!child)
+        return;
+
+    if (child->exited) {
+        child_free (child);
+        return;
+    }
+
+    /* Keep the watch so the child is reaped, but only log its exit */
+    child->exit_func = NULL;
+    child->user_data = NULL;
+}
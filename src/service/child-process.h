@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __CHILD_PROCESS_H__
+#define __CHILD_PROCESS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * VpnSsoChild:
+ *
+ * A spawned child process supervised through a pidfd. Signals go to
+ * exactly this process, and it is never confused with an unrelated
+ * process that later reuses its PID. The child and everything it forks
+ * run in a #VpnSsoScope; whatever is left of the tree when the child
+ * exits is killed.
+ */
+typedef struct _VpnSsoChild VpnSsoChild;
+
+/**
+ * vpn_sso_child_new:
+ * @pid: A child spawned with %G_SPAWN_DO_NOT_REAP_CHILD and not yet reaped
+ * @name: Short name for log messages and its scope, e.g. "OpenConnect"
+ * @connection: (nullable): Connection the child works for, for reporting
+ * @exit_func: Called once the child has exited and been reaped
+ * @user_data: Data for @exit_func
+ *
+ * Takes over supervision of @pid. Since the child has not been reaped,
+ * its PID cannot have been reused, so the pidfd refers to it reliably.
+ * Falls back to a GLib child watch on kernels without pidfd support.
+ *
+ * Returns: (transfer full): The supervised child
+ */
+VpnSsoChild *vpn_sso_child_new (GPid             pid,
+                                const gchar     *name,
+                                const gchar     *connection,
+                                GChildWatchFunc  exit_func,
+                                gpointer         user_data);
+
+GPid vpn_sso_child_get_pid (VpnSsoChild *child);
+
+/**
+ * vpn_sso_child_signal:
+ * @child: A #VpnSsoChild
+ * @signum: Signal to send
+ *
+ * Returns: %FALSE if the child has already exited
+ */
+gboolean vpn_sso_child_signal (VpnSsoChild *child,
+                               gint         signum);
+
+/**
+ * vpn_sso_child_kill_tree:
+ * @child: A #VpnSsoChild
+ *
+ * SIGKILLs the child and all its descendants at once. Until its scope
+ * exists (or without systemd), only the child itself gets SIGTERM.
+ */
+void vpn_sso_child_kill_tree (VpnSsoChild *child);
+
+/**
+ * vpn_sso_child_release:
+ * @child: (transfer full): A #VpnSsoChild
+ *
+ * Drops the caller's interest in @child. A child that is still running
+ * is reaped in the background when it exits; its exit function is not
+ * called any more.
+ */
+void vpn_sso_child_release (VpnSsoChild *child);
+
+G_END_DECLS
+
+#endif /* __CHILD_PROCESS_H__ */
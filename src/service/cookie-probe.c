@@ -0,0 +1,366 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * SECTION:cookie-probe
+ * @short_description: One-request validity check for cached cookies
+ *
+ * Before openconnect is started with a cached cookie, a single HTTPS
+ * request asks the gateway whether the cookie is still accepted:
+ *
+ * - GlobalProtect: POST /global-protect/getconfig.esp with the portal
+ *   cookie, which is the first thing openconnect would do anyway. A valid
+ *   cookie returns the portal <policy>; a stale one returns HTTP 512.
+ *   Only portal-userauthcookie is probed: a prelogin-cookie is single-use,
+ *   so checking it would spend it, and a gateway login creates a session.
+ * - AnyConnect: GET /+webvpn+/index.html with the webvpn session cookie.
+ *   A live session gets the portal page, a dead one a redirect to logon.
+ *
+ * Anything that is not a clear answer (timeouts, certificate problems,
+ * unexpected responses) yields %VPN_SSO_COOKIE_PROBE_UNKNOWN so the caller
+ * keeps the old behaviour. The deadline is a timeout source on the
+ * caller's main context that cancels the request, so it holds to the
+ * millisecond for the connect, handshake and response alike.
+ */
+
+#include "config.h"
+#include "cookie-probe.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PROBE_MAX_RESPONSE  (16 * 1024)
+#define PROBE_USER_AGENT_GP "PAN GlobalProtect"
+#define PROBE_USER_AGENT_AC "Open AnyConnect VPN Agent"
+
+typedef struct {
+    gchar *host;
+    gchar *protocol;
+    gchar *username;
+    gchar *usergroup;
+    gchar *cookie;
+    guint timeout_ms;
+    GCancellable *deadline;     /* Cancelled by @timer or the caller */
+    GCancellable *cancellable;  /* The caller's, forwarded to @deadline */
+    gulong cancelled_id;
+    GSource *timer;
+} ProbeData;
+
+static void
+probe_data_free (ProbeData *data)
+{
+    if (data) {
+        if (data->timer) {
+            g_source_destroy (data->timer);
+            g_source_unref (data->timer);
+        }
+        if (data->cancellable) {
+            g_cancellable_disconnect (data->cancellable, data->cancelled_id);
+            g_object_unref (data->cancellable);
+        }
+        g_clear_object (&data->deadline);
+        g_free (data->host);
+        g_free (data->protocol);
+        g_free (data->username);
+        g_free (data->usergroup);
+        if (data->cookie) {
+            memset (data->cookie, 0, strlen (data->cookie));
+            g_free (data->cookie);
+        }
+        g_free (data);
+    }
+}
+
+/*
+ * Reduce a gateway setting ("https://host:port/path") to "host[:port]".
+ */
+static gchar *
+gateway_host (const gchar *gateway)
+{
+    const gchar *start = gateway;
+    const gchar *end;
+
+    if (g_str_has_prefix (start, "https://"))
+        start += strlen ("https://");
+
+    end = strchr (start, '/');
+    return end ? g_strndup (start, end - start) : g_strdup (start);
+}
+
+static gchar *
+build_gp_request (ProbeData *data)
+{
+    const gchar *usergroup = data->usergroup ? data->usergroup : "portal:prelogin-cookie";
+    const gchar *cookie_name;
+
+    /* Only portal cookies can be checked without creating a session */
+    if (!g_str_has_prefix (usergroup, "portal:") || !data->username)
+        return NULL;
+
+    cookie_name = usergroup + strlen ("portal:");
+
+    /* The portal accepts a prelogin-cookie once */
+    if (g_strcmp0 (cookie_name, "prelogin-cookie") == 0)
+        return NULL;
+
+    g_autofree gchar *user = g_uri_escape_string (data->username, NULL, FALSE);
+    g_autofree gchar *cookie = g_uri_escape_string (data->cookie, NULL, FALSE);
+    g_autofree gchar *server = g_uri_escape_string (data->host, NULL, FALSE);
+    g_autofree gchar *body = g_strdup_printf ("user=%s&%s=%s&clientos=Linux&os-version=linux-64"
+                                              "&ok=Login&prot=https%%3A&server=%s"
+                                              "&jnlpReady=jnlpReady&direct=yes",
+                                              user, cookie_name, cookie, server);
+    gchar *request;
+
+    request = g_strdup_printf ("POST /global-protect/getconfig.esp HTTP/1.1\r\n"
+                               "Host: %s\r\n"
+                               "User-Agent: " PROBE_USER_AGENT_GP "\r\n"
+                               "Content-Type: application/x-www-form-urlencoded\r\n"
+                               "Content-Length: %zu\r\n"
+                               "Connection: close\r\n"
+                               "\r\n"
+                               "%s",
+                               data->host, strlen (body), body);
+
+    memset (body, 0, strlen (body));
+    memset (cookie, 0, strlen (cookie));
+    return request;
+}
+
+static gchar *
+build_ac_request (ProbeData *data)
+{
+    const gchar *cookie = data->cookie;
+
+    if (g_str_has_prefix (cookie, "webvpn="))
+        cookie += strlen ("webvpn=");
+
+    return g_strdup_printf ("GET /+webvpn+/index.html HTTP/1.1\r\n"
+                            "Host: %s\r\n"
+                            "User-Agent: " PROBE_USER_AGENT_AC "\r\n"
+                            "Cookie: webvpn=%s\r\n"
+                            "Connection: close\r\n"
+                            "\r\n",
+                            data->host, cookie);
+}
+
+static VpnSsoCookieProbeResult
+classify_gp_response (guint status, const gchar *headers G_GNUC_UNUSED, const gchar *body)
+{
+    if (status == 200 && body && strstr (body, "<policy"))
+        return VPN_SSO_COOKIE_PROBE_VALID;
+
+    /* GlobalProtect answers failed cookie auth with HTTP 512 */
+    if (status == 512 || status == 401 || status == 403)
+        return VPN_SSO_COOKIE_PROBE_REJECTED;
+
+    return VPN_SSO_COOKIE_PROBE_UNKNOWN;
+}
+
+static VpnSsoCookieProbeResult
+classify_ac_response (guint status, const gchar *headers, const gchar *body G_GNUC_UNUSED)
+{
+    if (status == 200)
+        return VPN_SSO_COOKIE_PROBE_VALID;
+
+    if (status >= 300 && status < 400) {
+        g_autofree gchar *lower = g_ascii_strdown (headers, -1);
+        const gchar *location = strstr (lower, "\nlocation:");
+
+        if (location && strstr (location, "logon"))
+            return VPN_SSO_COOKIE_PROBE_REJECTED;
+    }
+
+    if (status == 401 || status == 403)
+        return VPN_SSO_COOKIE_PROBE_REJECTED;
+
+    return VPN_SSO_COOKIE_PROBE_UNKNOWN;
+}
+
+/*
+ * Send @request and read the (truncated) response.
+ */
+static GString *
+probe_exchange (ProbeData    *data,
+                const gchar  *request,
+                GError      **error)
+{
+    GCancellable *cancellable = data->deadline;
+    g_autoptr(GSocketClient) client = g_socket_client_new ();
+    g_autoptr(GSocketConnection) conn = NULL;
+    GOutputStream *out;
+    GInputStream *in;
+    GString *response;
+    gchar buf[4096];
+    gssize n = 0;
+
+    g_socket_client_set_tls (client, TRUE);
+
+    conn = g_socket_client_connect_to_host (client, data->host, 443, cancellable, error);
+    if (!conn)
+        return NULL;
+
+    out = g_io_stream_get_output_stream (G_IO_STREAM (conn));
+    if (!g_output_stream_write_all (out, request, strlen (request), NULL, cancellable, error))
+        return NULL;
+
+    in = g_io_stream_get_input_stream (G_IO_STREAM (conn));
+    response = g_string_new (NULL);
+
+    while (response->len < PROBE_MAX_RESPONSE &&
+           (n = g_input_stream_read (in, buf, sizeof (buf), cancellable, error)) > 0)
+        g_string_append_len (response, buf, n);
+
+    if (n < 0 && response->len == 0) {
+        g_string_free (response, TRUE);
+        return NULL;
+    }
+    g_clear_error (error);
+
+    g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
+    return response;
+}
+
+static void
+probe_thread_func (GTask        *task,
+                   gpointer      source_object G_GNUC_UNUSED,
+                   gpointer      task_data,
+                   GCancellable *cancellable G_GNUC_UNUSED)
+{
+    ProbeData *data = task_data;
+    VpnSsoCookieProbeResult result = VPN_SSO_COOKIE_PROBE_UNKNOWN;
+    gboolean is_gp = g_strcmp0 (data->protocol, "globalprotect") == 0;
+    g_autofree gchar *request = NULL;
+    g_autoptr(GError) error = NULL;
+    GString *response;
+    gint64 start = g_get_monotonic_time ();
+    guint status = 0;
+
+    request = is_gp ? build_gp_request (data) : build_ac_request (data);
+    if (!request) {
+        g_message ("COOKIE PROBE: Cookie type not probeable - skipping");
+        g_task_return_int (task, VPN_SSO_COOKIE_PROBE_UNKNOWN);
+        return;
+    }
+
+    response = probe_exchange (data, request, &error);
+    memset (request, 0, strlen (request));
+
+    if (g_task_return_error_if_cancelled (task)) {
+        if (response)
+            g_string_free (response, TRUE);
+        return;
+    }
+
+    if (!response) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_message ("COOKIE PROBE: %s did not answer within %u ms", data->host,
+                       data->timeout_ms);
+        else
+            g_message ("COOKIE PROBE: %s unreachable: %s", data->host,
+                       error ? error->message : "no response");
+        g_task_return_int (task, VPN_SSO_COOKIE_PROBE_UNKNOWN);
+        return;
+    }
+
+    if (sscanf (response->str, "HTTP/%*d.%*d %u", &status) == 1) {
+        gchar *body = strstr (response->str, "\r\n\r\n");
+
+        if (body) {
+            *body = '\0';
+            body += 4;
+        }
+
+        result = is_gp ? classify_gp_response (status, response->str, body)
+                       : classify_ac_response (status, response->str, body);
+    }
+
+    g_message ("COOKIE PROBE: %s answered HTTP %u in %" G_GINT64_FORMAT " ms -> %s",
+               data->host, status, (g_get_monotonic_time () - start) / 1000,
+               result == VPN_SSO_COOKIE_PROBE_VALID ? "valid" :
+               result == VPN_SSO_COOKIE_PROBE_REJECTED ? "rejected" : "unknown");
+
+    g_string_free (response, TRUE);
+    g_task_return_int (task, result);
+}
+
+static void
+forward_cancel_cb (GCancellable *cancellable G_GNUC_UNUSED,
+                   gpointer      user_data)
+{
+    g_cancellable_cancel (G_CANCELLABLE (user_data));
+}
+
+static gboolean
+deadline_cb (gpointer user_data)
+{
+    g_cancellable_cancel (G_CANCELLABLE (user_data));
+    return G_SOURCE_REMOVE;
+}
+
+void
+vpn_sso_cookie_probe_async (const gchar         *gateway,
+                            const gchar         *protocol,
+                            const gchar         *username,
+                            const gchar         *usergroup,
+                            const gchar         *cookie,
+                            guint                timeout_ms,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+    GTask *task;
+    ProbeData *data;
+
+    g_return_if_fail (gateway != NULL);
+    g_return_if_fail (protocol != NULL);
+    g_return_if_fail (cookie != NULL);
+
+    task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_source_tag (task, vpn_sso_cookie_probe_async);
+
+    data = g_new0 (ProbeData, 1);
+    data->host = gateway_host (gateway);
+    data->protocol = g_strdup (protocol);
+    data->username = g_strdup (username);
+    data->usergroup = g_strdup (usergroup);
+    data->cookie = g_strdup (cookie);
+    data->timeout_ms = timeout_ms > 0 ? timeout_ms : VPN_SSO_COOKIE_PROBE_TIMEOUT_MS;
+    data->deadline = g_cancellable_new ();
+    if (cancellable) {
+        data->cancellable = g_object_ref (cancellable);
+        data->cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (forward_cancel_cb),
+                                                    g_object_ref (data->deadline),
+                                                    g_object_unref);
+    }
+    data->timer = g_timeout_source_new (data->timeout_ms);
+    g_source_set_callback (data->timer, deadline_cb, g_object_ref (data->deadline),
+                           g_object_unref);
+    g_source_attach (data->timer, g_task_get_context (task));
+    g_task_set_task_data (task, data, (GDestroyNotify) probe_data_free);
+
+    g_message ("COOKIE PROBE: Checking cached %s cookie against %s", protocol, data->host);
+
+    /* Run in thread */
+    g_task_run_in_thread (task, probe_thread_func);
+    g_object_unref (task);
+}
+
+VpnSsoCookieProbeResult
+vpn_sso_cookie_probe_finish (GAsyncResult  *result,
+                             GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), VPN_SSO_COOKIE_PROBE_UNKNOWN);
+
+    gssize ret = g_task_propagate_int (G_TASK (result), error);
+
+    return ret < 0 ? VPN_SSO_COOKIE_PROBE_UNKNOWN : (VpnSsoCookieProbeResult) ret;
+}
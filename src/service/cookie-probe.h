@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __COOKIE_PROBE_H__
+#define __COOKIE_PROBE_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Default probe deadline */
+#define VPN_SSO_COOKIE_PROBE_TIMEOUT_MS 3000
+
+/**
+ * VpnSsoCookieProbeResult:
+ * @VPN_SSO_COOKIE_PROBE_UNKNOWN: The probe could not decide (network error,
+ *   untrusted certificate, unsupported cookie type, unexpected response)
+ * @VPN_SSO_COOKIE_PROBE_VALID: The gateway accepted the cookie
+ * @VPN_SSO_COOKIE_PROBE_REJECTED: The gateway rejected the cookie
+ *
+ * Outcome of a cookie validity probe. Only %VPN_SSO_COOKIE_PROBE_REJECTED
+ * should change behaviour; anything else means "try openconnect as usual".
+ */
+typedef enum {
+    VPN_SSO_COOKIE_PROBE_UNKNOWN,
+    VPN_SSO_COOKIE_PROBE_VALID,
+    VPN_SSO_COOKIE_PROBE_REJECTED,
+} VpnSsoCookieProbeResult;
+
+/**
+ * vpn_sso_cookie_probe_async:
+ * @gateway: VPN gateway address ("host" or "host:port")
+ * @protocol: VPN protocol (globalprotect/anyconnect)
+ * @username: (nullable): Username, required for GlobalProtect
+ * @usergroup: (nullable): GlobalProtect usergroup naming the cookie type
+ * @cookie: Cached cookie to check
+ * @timeout_ms: Deadline for the whole probe
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: Callback function
+ * @user_data: User data for callback
+ *
+ * Checks a cached cookie against the gateway with a single HTTPS request,
+ * so a stale cookie can go straight to SSO instead of waiting for
+ * openconnect to fail. The cookie is only sent over a connection whose
+ * certificate passes system validation.
+ */
+void vpn_sso_cookie_probe_async (const gchar         *gateway,
+                                 const gchar         *protocol,
+                                 const gchar         *username,
+                                 const gchar         *usergroup,
+                                 const gchar         *cookie,
+                                 guint                timeout_ms,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data);
+
+/**
+ * vpn_sso_cookie_probe_finish:
+ * @result: A #GAsyncResult
+ * @error: Return location for error, set only on cancellation
+ *
+ * Completes the probe.
+ *
+ * Returns: The probe result
+ */
+VpnSsoCookieProbeResult vpn_sso_cookie_probe_finish (GAsyncResult  *result,
+                                                     GError       **error);
+
+G_END_DECLS
+
+#endif /* __COOKIE_PROBE_H__ */
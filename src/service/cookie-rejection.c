@@ -0,0 +1,66 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "cookie-rejection.h"
+
+#include <string.h>
+
+/*
+ * The openconnect messages that mean the gateway refused the cookie. A line
+ * matches when it starts with @prefix and, if @detail is set, the rest of
+ * the line contains @detail (case-insensitively, for server-supplied text).
+ */
+typedef struct {
+    const gchar *prefix;
+    const gchar *detail;
+    const gchar *description;
+} RejectionSignature;
+
+static const RejectionSignature rejection_signatures[] = {
+    /* main loop exit, both protocols */
+    { "Cookie was rejected by server", NULL, "cookie rejected" },
+    { "Cookie is no longer valid", NULL, "cookie no longer valid" },
+    /* AnyConnect CSTP CONNECT with a dead webvpn cookie */
+    { "Got inappropriate HTTP CONNECT response: ", " 401 ", "CONNECT 401" },
+    { "Got inappropriate HTTP CONNECT response: ", " 403 ", "CONNECT 403" },
+    /* AnyConnect 503 with an X-Reason about the session */
+    { "VPN service unavailable; reason: ", "session has expired", "session expired" },
+    { "VPN service unavailable; reason: ", "session expired", "session expired" },
+    /* GlobalProtect tunnel GET and getconfig.esp (with -v) */
+    { "Got unexpected HTTP response: ", "auth-failed", "auth-failed" },
+    { "Got HTTP response: ", " 512 ", "512 Custom error" },
+};
+
+const gchar *
+vpn_sso_cookie_rejection_match (const gchar *line)
+{
+    g_return_val_if_fail (line != NULL, NULL);
+
+    while (g_ascii_isspace (*line))
+        line++;
+
+    for (guint i = 0; i < G_N_ELEMENTS (rejection_signatures); i++) {
+        const RejectionSignature *sig = &rejection_signatures[i];
+        g_autofree gchar *rest = NULL;
+
+        if (!g_str_has_prefix (line, sig->prefix))
+            continue;
+        if (!sig->detail)
+            return sig->description;
+
+        rest = g_ascii_strdown (line + strlen (sig->prefix), -1);
+        if (strstr (rest, sig->detail))
+            return sig->description;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __COOKIE_REJECTION_H__
+#define __COOKIE_REJECTION_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * vpn_sso_cookie_rejection_match:
+ * @line: One line of openconnect output, without the newline
+ *
+ * Checks whether @line is one of the messages openconnect prints when the
+ * gateway refuses the session cookie. Only whole openconnect messages
+ * count: a status code such as 401 or 403 is matched on the tunnel's
+ * CONNECT response line, never on its own, so proxy and other HTTP
+ * failures do not look like a rejected cookie.
+ *
+ * Returns: (nullable): A short description of the matched message for
+ *   logging, or %NULL if @line is not a cookie rejection
+ */
+const gchar *vpn_sso_cookie_rejection_match (const gchar *line);
+
+G_END_DECLS
+
+#endif /* __COOKIE_REJECTION_H__ */
@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __CREDENTIAL_CACHE_BACKEND_H__
+#define __CREDENTIAL_CACHE_BACKEND_H__
+
+#include "credential-cache.h"
+
+G_BEGIN_DECLS
+
+/**
+ * VpnSsoCacheBackend:
+ * @name: Backend name as used in the "cache-backend" setting
+ * @is_available: Returns whether the backend can be used on this system
+ * @store: Persists @record for @gateway/@protocol until @expires_at
+ * @lookup: Returns the stored record, or %NULL without error if absent
+ * @list: Returns every stored record as a #GPtrArray of strings
+ * @clear: Removes the record for @gateway/@protocol
+ * @clear_all: Removes every record owned by this plugin
+ *
+ * Storage operations used by the credential cache. Records are opaque,
+ * already serialized strings. All operations are synchronous and are
+ * called from #GTask worker threads, never from the main loop.
+ */
+typedef struct {
+    const gchar *name;
+    gboolean   (*is_available) (void);
+    gboolean   (*store)        (const gchar  *gateway,
+                                const gchar  *protocol,
+                                const gchar  *record,
+                                gint64        expires_at,
+                                GError      **error);
+    gchar     *(*lookup)       (const gchar  *gateway,
+                                const gchar  *protocol,
+                                GError      **error);
+    GPtrArray *(*list)         (GError      **error);
+    gboolean   (*clear)        (const gchar  *gateway,
+                                const gchar  *protocol,
+                                GError      **error);
+    gboolean   (*clear_all)    (GError      **error);
+} VpnSsoCacheBackend;
+
+extern const VpnSsoCacheBackend vpn_sso_cache_backend_secret_tool;
+extern const VpnSsoCacheBackend vpn_sso_cache_backend_kernel;
+extern const VpnSsoCacheBackend vpn_sso_cache_backend_file;
+
+G_END_DECLS
+
+#endif /* __CREDENTIAL_CACHE_BACKEND_H__ */
@@ -0,0 +1,194 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * SECTION:credential-cache-dbus
+ * @short_description: Admin D-Bus interface for the credential cache
+ *
+ * Lets administrators inspect and manage cached credentials on a running
+ * service, e.g.:
+ *
+ *   busctl call org.freedesktop.NetworkManager.vpn-sso \
+ *       /org/freedesktop/NetworkManager/VpnSso/CredentialCache \
+ *       org.freedesktop.NetworkManager.VpnSso.CredentialCache GetMetrics
+ *
+ * NetworkManager runs a service process per connection, which exits
+ * after the disconnect. GetMetrics therefore reports totals since the
+ * "since" timestamp: what earlier processes saved to
+ * VPN_SSO_STATEDIR/cache-metrics.conf when they exited, plus the counts of
+ * the process answering. Delete that file to start over.
+ *
+ * Access is restricted to root by the D-Bus policy. ListEntries,
+ * Invalidate and ClearAll take the backend to act on, as named in a
+ * profile's "cache-backend" ("keyring", "kernel-keyring" or "file"), or
+ * "" for the auto-detected one, e.g.:
+ *
+ *   busctl call ... ListEntries s file
+ */
+
+#include "config.h"
+#include "credential-cache-dbus.h"
+#include "credential-cache.h"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" VPN_SSO_CACHE_DBUS_INTERFACE "'>"
+    "    <method name='GetMetrics'>"
+    "      <arg type='a{sv}' name='metrics' direction='out'/>"
+    "    </method>"
+    "    <method name='ListEntries'>"
+    "      <arg type='s' name='backend' direction='in'/>"
+    "      <arg type='aa{sv}' name='entries' direction='out'/>"
+    "    </method>"
+    "    <method name='Invalidate'>"
+    "      <arg type='s' name='backend' direction='in'/>"
+    "      <arg type='s' name='gateway' direction='in'/>"
+    "      <arg type='s' name='protocol' direction='in'/>"
+    "    </method>"
+    "    <method name='ClearAll'>"
+    "      <arg type='s' name='backend' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+/*
+ * Parse the backend argument: "" or "auto" for auto-detection, or a
+ * backend name. Unknown names are rejected rather than falling back to
+ * auto-detection, which could act on another backend's entries.
+ */
+static gboolean
+parse_backend (const gchar             *name,
+               VpnSsoCacheBackendType  *out_backend,
+               GDBusMethodInvocation   *invocation)
+{
+    *out_backend = vpn_sso_cache_backend_type_from_string (name);
+    if (*out_backend != VPN_SSO_CACHE_BACKEND_AUTO || !*name || g_strcmp0 (name, "auto") == 0)
+        return TRUE;
+
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                           G_DBUS_ERROR_INVALID_ARGS,
+                                           "Unknown cache backend '%s'", name);
+    return FALSE;
+}
+
+static void
+list_done_cb (GObject *source G_GNUC_UNUSED, GAsyncResult *result, gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    GError *error = NULL;
+    GVariant *entries;
+
+    entries = vpn_sso_credential_cache_list_finish (result, &error);
+    if (!entries) {
+        g_dbus_method_invocation_take_error (invocation, error);
+        return;
+    }
+
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(@aa{sv})", entries));
+    g_variant_unref (entries);
+}
+
+static void
+clear_done_cb (GObject *source G_GNUC_UNUSED, GAsyncResult *result, gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    GError *error = NULL;
+    gboolean ok;
+
+    if (g_task_get_source_tag (G_TASK (result)) == vpn_sso_credential_cache_clear_all_async)
+        ok = vpn_sso_credential_cache_clear_all_finish (result, &error);
+    else
+        ok = vpn_sso_credential_cache_clear_finish (result, &error);
+
+    if (!ok) {
+        g_dbus_method_invocation_take_error (invocation, error);
+        return;
+    }
+
+    g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static void
+handle_method_call (GDBusConnection       *connection G_GNUC_UNUSED,
+                    const gchar           *sender,
+                    const gchar           *object_path G_GNUC_UNUSED,
+                    const gchar           *interface_name G_GNUC_UNUSED,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data G_GNUC_UNUSED)
+{
+    VpnSsoCacheBackendType backend;
+    const gchar *backend_name;
+
+    g_message ("CACHE ADMIN: %s from %s", method_name, sender);
+
+    if (g_strcmp0 (method_name, "GetMetrics") == 0) {
+        g_dbus_method_invocation_return_value (invocation,
+            g_variant_new ("(@a{sv})", vpn_sso_credential_cache_get_metrics ()));
+    } else if (g_strcmp0 (method_name, "ListEntries") == 0) {
+        g_variant_get (parameters, "(&s)", &backend_name);
+        if (!parse_backend (backend_name, &backend, invocation))
+            return;
+
+        vpn_sso_credential_cache_list_async (backend, NULL, list_done_cb, invocation);
+    } else if (g_strcmp0 (method_name, "Invalidate") == 0) {
+        const gchar *gateway;
+        const gchar *protocol;
+
+        g_variant_get (parameters, "(&s&s&s)", &backend_name, &gateway, &protocol);
+        if (!parse_backend (backend_name, &backend, invocation))
+            return;
+        if (!*gateway || !*protocol) {
+            g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR,
+                                                           G_DBUS_ERROR_INVALID_ARGS,
+                                                           "Gateway and protocol are required");
+            return;
+        }
+
+        vpn_sso_credential_cache_clear_async (backend, gateway, protocol,
+                                              NULL, clear_done_cb, invocation);
+    } else if (g_strcmp0 (method_name, "ClearAll") == 0) {
+        g_variant_get (parameters, "(&s)", &backend_name);
+        if (!parse_backend (backend_name, &backend, invocation))
+            return;
+
+        vpn_sso_credential_cache_clear_all_async (backend, NULL, clear_done_cb, invocation);
+    } else {
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                               G_DBUS_ERROR_UNKNOWN_METHOD,
+                                               "Unknown method %s", method_name);
+    }
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    .method_call = handle_method_call,
+};
+
+guint
+vpn_sso_credential_cache_dbus_register (GDBusConnection  *connection,
+                                        GError          **error)
+{
+    g_autoptr(GDBusNodeInfo) node_info = NULL;
+
+    g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), 0);
+
+    node_info = g_dbus_node_info_new_for_xml (introspection_xml, error);
+    if (!node_info)
+        return 0;
+
+    return g_dbus_connection_register_object (connection,
+                                              VPN_SSO_CACHE_DBUS_PATH,
+                                              node_info->interfaces[0],
+                                              &interface_vtable,
+                                              NULL, NULL,
+                                              error);
+}
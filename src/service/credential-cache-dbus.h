@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __CREDENTIAL_CACHE_DBUS_H__
+#define __CREDENTIAL_CACHE_DBUS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define VPN_SSO_CACHE_DBUS_PATH      "/org/freedesktop/NetworkManager/VpnSso/CredentialCache"
+#define VPN_SSO_CACHE_DBUS_INTERFACE "org.freedesktop.NetworkManager.VpnSso.CredentialCache"
+
+/**
+ * vpn_sso_credential_cache_dbus_register:
+ * @connection: The system bus connection
+ * @error: Return location for error
+ *
+ * Exports the credential cache admin interface (GetMetrics, ListEntries,
+ * Invalidate, ClearAll) at %VPN_SSO_CACHE_DBUS_PATH.
+ *
+ * Returns: The registration id, or 0 on error
+ */
+guint vpn_sso_credential_cache_dbus_register (GDBusConnection  *connection,
+                                              GError          **error);
+
+G_END_DECLS
+
+#endif /* __CREDENTIAL_CACHE_DBUS_H__ */
@@ -0,0 +1,432 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "credential-cache-backend.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#ifdef HAVE_GNUTLS
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#endif
+
+/*
+ * Encrypted file backend.
+ *
+ * Each record is written to its own file under VPN_SSO_CACHEDIR, sealed
+ * with AES-256-GCM. The "<protocol>:<gateway>" key is bound to the file as
+ * associated data, so a file renamed to another gateway fails to decrypt.
+ * The 256-bit key is generated on first use and kept root-only under
+ * VPN_SSO_STATEDIR, outside the cache directory, so copying or backing up
+ * /var/cache alone does not expose cookies.
+ *
+ * File layout: "VSC1" | id length (1 byte) | id | nonce (12 bytes) |
+ *              ciphertext | tag (16 bytes)
+ *
+ * The id is the "<protocol>:<gateway>" associated data, kept in clear so
+ * entries can be listed without knowing gateway names in advance.
+ */
+
+#define FILE_CACHE_DIR      VPN_SSO_CACHEDIR "/credentials"
+#define FILE_CACHE_KEY      VPN_SSO_STATEDIR "/credential-cache.key"
+#define FILE_CACHE_SUFFIX   ".cred"
+#define FILE_CACHE_MAGIC    "VSC1"
+#define FILE_CACHE_MAGIC_LEN 4
+#define FILE_CACHE_ID_MAX    255
+#define FILE_CACHE_KEY_LEN   32
+#define FILE_CACHE_NONCE_LEN 12
+#define FILE_CACHE_TAG_LEN   16
+
+static gchar *
+file_cache_id (const gchar *gateway, const gchar *protocol)
+{
+    return g_strdup_printf ("%s:%s", protocol, gateway);
+}
+
+static gchar *
+file_cache_path (const gchar *gateway, const gchar *protocol)
+{
+    g_autofree gchar *id = file_cache_id (gateway, protocol);
+    g_autofree gchar *digest = g_compute_checksum_for_string (G_CHECKSUM_SHA256, id, -1);
+
+    return g_strdup_printf (FILE_CACHE_DIR "/%s" FILE_CACHE_SUFFIX, digest);
+}
+
+#ifdef HAVE_GNUTLS
+
+static GMutex key_lock;
+
+/*
+ * Load the cache key, creating it on first use.
+ */
+static gboolean
+file_cache_load_key (guint8 key[FILE_CACHE_KEY_LEN], GError **error)
+{
+    g_autofree gchar *contents = NULL;
+    gsize length = 0;
+    g_autoptr(GError) read_error = NULL;
+    g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&key_lock);
+
+    if (g_file_get_contents (FILE_CACHE_KEY, &contents, &length, &read_error)) {
+        if (length != FILE_CACHE_KEY_LEN) {
+            memset (contents, 0, length);
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Credential cache key %s has invalid length %" G_GSIZE_FORMAT,
+                         FILE_CACHE_KEY, length);
+            return FALSE;
+        }
+        memcpy (key, contents, FILE_CACHE_KEY_LEN);
+        memset (contents, 0, length);
+        return TRUE;
+    }
+
+    if (!g_error_matches (read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_propagate_error (error, g_steal_pointer (&read_error));
+        return FALSE;
+    }
+
+    if (g_mkdir_with_parents (VPN_SSO_STATEDIR, 0700) < 0) {
+        int saved_errno = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                     "Failed to create %s: %s", VPN_SSO_STATEDIR, g_strerror (saved_errno));
+        return FALSE;
+    }
+
+    if (gnutls_rnd (GNUTLS_RND_KEY, key, FILE_CACHE_KEY_LEN) < 0) {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Failed to generate credential cache key");
+        return FALSE;
+    }
+
+    if (!g_file_set_contents_full (FILE_CACHE_KEY, (const gchar *) key, FILE_CACHE_KEY_LEN,
+                                   G_FILE_SET_CONTENTS_CONSISTENT, 0600, error)) {
+        memset (key, 0, FILE_CACHE_KEY_LEN);
+        return FALSE;
+    }
+
+    g_message ("FILE CACHE: Generated new credential cache key at %s", FILE_CACHE_KEY);
+    return TRUE;
+}
+
+static gnutls_aead_cipher_hd_t
+file_cache_cipher_new (GError **error)
+{
+    guint8 key_data[FILE_CACHE_KEY_LEN];
+    gnutls_datum_t key = { key_data, FILE_CACHE_KEY_LEN };
+    gnutls_aead_cipher_hd_t handle = NULL;
+    int ret;
+
+    if (!file_cache_load_key (key_data, error))
+        return NULL;
+
+    ret = gnutls_aead_cipher_init (&handle, GNUTLS_CIPHER_AES_256_GCM, &key);
+    memset (key_data, 0, sizeof (key_data));
+
+    if (ret < 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "Failed to initialize cipher: %s", gnutls_strerror (ret));
+        return NULL;
+    }
+
+    return handle;
+}
+
+static gboolean
+file_is_available (void)
+{
+    /* Writing the key and cache files requires root */
+    return getuid () == 0;
+}
+
+static gboolean
+file_store (const gchar  *gateway,
+            const gchar  *protocol,
+            const gchar  *record,
+            gint64        expires_at G_GNUC_UNUSED,
+            GError      **error)
+{
+    g_autofree gchar *path = file_cache_path (gateway, protocol);
+    g_autofree gchar *aad = file_cache_id (gateway, protocol);
+    g_autofree guint8 *out = NULL;
+    gnutls_aead_cipher_hd_t cipher;
+    gsize aad_len = strlen (aad);
+    gsize record_len = strlen (record);
+    size_t ctext_len = record_len + FILE_CACHE_TAG_LEN;
+    gsize header_len = FILE_CACHE_MAGIC_LEN + 1 + aad_len;
+    guint8 *nonce;
+    int ret;
+
+    if (aad_len > FILE_CACHE_ID_MAX) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "Gateway name too long for file cache: %s", gateway);
+        return FALSE;
+    }
+
+    if (g_mkdir_with_parents (FILE_CACHE_DIR, 0700) < 0) {
+        int saved_errno = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                     "Failed to create %s: %s", FILE_CACHE_DIR, g_strerror (saved_errno));
+        return FALSE;
+    }
+
+    cipher = file_cache_cipher_new (error);
+    if (!cipher)
+        return FALSE;
+
+    out = g_malloc (header_len + FILE_CACHE_NONCE_LEN + ctext_len);
+    memcpy (out, FILE_CACHE_MAGIC, FILE_CACHE_MAGIC_LEN);
+    out[FILE_CACHE_MAGIC_LEN] = (guint8) aad_len;
+    memcpy (out + FILE_CACHE_MAGIC_LEN + 1, aad, aad_len);
+    nonce = out + header_len;
+
+    ret = gnutls_rnd (GNUTLS_RND_NONCE, nonce, FILE_CACHE_NONCE_LEN);
+    if (ret >= 0)
+        ret = gnutls_aead_cipher_encrypt (cipher,
+                                          nonce, FILE_CACHE_NONCE_LEN,
+                                          aad, aad_len,
+                                          FILE_CACHE_TAG_LEN,
+                                          record, record_len,
+                                          nonce + FILE_CACHE_NONCE_LEN, &ctext_len);
+    gnutls_aead_cipher_deinit (cipher);
+
+    if (ret < 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "Failed to encrypt credential record: %s", gnutls_strerror (ret));
+        return FALSE;
+    }
+
+    return g_file_set_contents_full (path, (const gchar *) out,
+                                     header_len + FILE_CACHE_NONCE_LEN + ctext_len,
+                                     G_FILE_SET_CONTENTS_CONSISTENT, 0600, error);
+}
+
+/*
+ * Decrypt a cache file. If @expected_id is not %NULL, the id stored in
+ * the header must match it.
+ */
+static gchar *
+file_cache_decrypt (const gchar  *path,
+                    const gchar  *expected_id,
+                    GError      **error)
+{
+    g_autofree gchar *contents = NULL;
+    g_autofree gchar *aad = NULL;
+    g_autoptr(GError) read_error = NULL;
+    gnutls_aead_cipher_hd_t cipher;
+    const guint8 *data;
+    const guint8 *nonce;
+    gsize length = 0;
+    gsize header_len;
+    size_t ptext_len;
+    gchar *record;
+    int ret;
+
+    if (!g_file_get_contents (path, &contents, &length, &read_error)) {
+        if (!g_error_matches (read_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_propagate_error (error, g_steal_pointer (&read_error));
+        return NULL;
+    }
+
+    data = (const guint8 *) contents;
+    header_len = 0;
+
+    if (length > FILE_CACHE_MAGIC_LEN &&
+        memcmp (data, FILE_CACHE_MAGIC, FILE_CACHE_MAGIC_LEN) == 0) {
+        gsize id_len = data[FILE_CACHE_MAGIC_LEN];
+
+        header_len = FILE_CACHE_MAGIC_LEN + 1 + id_len;
+        if (length >= header_len)
+            aad = g_strndup ((const gchar *) data + FILE_CACHE_MAGIC_LEN + 1, id_len);
+    }
+
+    if (!aad || length < header_len + FILE_CACHE_NONCE_LEN + FILE_CACHE_TAG_LEN) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Credential cache file %s is corrupt", path);
+        return NULL;
+    }
+
+    if (expected_id && g_strcmp0 (aad, expected_id) != 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Credential cache file %s belongs to another gateway", path);
+        return NULL;
+    }
+
+    cipher = file_cache_cipher_new (error);
+    if (!cipher)
+        return NULL;
+
+    nonce = data + header_len;
+    ptext_len = length - header_len - FILE_CACHE_NONCE_LEN;
+    record = g_malloc0 (ptext_len + 1);
+
+    ret = gnutls_aead_cipher_decrypt (cipher,
+                                      nonce, FILE_CACHE_NONCE_LEN,
+                                      aad, strlen (aad),
+                                      FILE_CACHE_TAG_LEN,
+                                      nonce + FILE_CACHE_NONCE_LEN,
+                                      length - header_len - FILE_CACHE_NONCE_LEN,
+                                      record, &ptext_len);
+    gnutls_aead_cipher_deinit (cipher);
+
+    if (ret < 0) {
+        g_free (record);
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "Failed to decrypt credential cache file %s: %s",
+                     path, gnutls_strerror (ret));
+        return NULL;
+    }
+
+    record[ptext_len] = '\0';
+    return record;
+}
+
+static gchar *
+file_lookup (const gchar  *gateway,
+             const gchar  *protocol,
+             GError      **error)
+{
+    g_autofree gchar *path = file_cache_path (gateway, protocol);
+    g_autofree gchar *id = file_cache_id (gateway, protocol);
+
+    return file_cache_decrypt (path, id, error);
+}
+
+static GPtrArray *
+file_list (GError **error)
+{
+    g_autoptr(GError) dir_error = NULL;
+    g_autoptr(GDir) dir = g_dir_open (FILE_CACHE_DIR, 0, &dir_error);
+    GPtrArray *records;
+    const gchar *name;
+
+    if (!dir) {
+        if (!g_error_matches (dir_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_propagate_error (error, g_steal_pointer (&dir_error));
+            return NULL;
+        }
+        return g_ptr_array_new_with_free_func (g_free);
+    }
+
+    records = g_ptr_array_new_with_free_func (g_free);
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *path = NULL;
+        g_autoptr(GError) local_error = NULL;
+        gchar *record;
+
+        if (!g_str_has_suffix (name, FILE_CACHE_SUFFIX))
+            continue;
+
+        path = g_build_filename (FILE_CACHE_DIR, name, NULL);
+        record = file_cache_decrypt (path, NULL, &local_error);
+        if (record)
+            g_ptr_array_add (records, record);
+        else if (local_error)
+            g_message ("FILE CACHE: Skipping %s: %s", name, local_error->message);
+    }
+
+    return records;
+}
+
+#else /* !HAVE_GNUTLS */
+
+static gboolean
+file_is_available (void)
+{
+    return FALSE;
+}
+
+static gboolean
+file_store (const gchar  *gateway G_GNUC_UNUSED,
+            const gchar  *protocol G_GNUC_UNUSED,
+            const gchar  *record G_GNUC_UNUSED,
+            gint64        expires_at G_GNUC_UNUSED,
+            GError      **error)
+{
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "Encrypted file cache requires GnuTLS support");
+    return FALSE;
+}
+
+static gchar *
+file_lookup (const gchar  *gateway G_GNUC_UNUSED,
+             const gchar  *protocol G_GNUC_UNUSED,
+             GError      **error)
+{
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "Encrypted file cache requires GnuTLS support");
+    return NULL;
+}
+
+static GPtrArray *
+file_list (GError **error)
+{
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "Encrypted file cache requires GnuTLS support");
+    return NULL;
+}
+
+#endif /* HAVE_GNUTLS */
+
+static gboolean
+file_clear (const gchar  *gateway,
+            const gchar  *protocol,
+            GError      **error)
+{
+    g_autofree gchar *path = file_cache_path (gateway, protocol);
+
+    if (g_unlink (path) < 0 && errno != ENOENT) {
+        int saved_errno = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                     "Failed to remove %s: %s", path, g_strerror (saved_errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+file_clear_all (GError **error)
+{
+    g_autoptr(GError) dir_error = NULL;
+    g_autoptr(GDir) dir = g_dir_open (FILE_CACHE_DIR, 0, &dir_error);
+    const gchar *name;
+
+    if (!dir) {
+        if (!g_error_matches (dir_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_propagate_error (error, g_steal_pointer (&dir_error));
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        if (g_str_has_suffix (name, FILE_CACHE_SUFFIX)) {
+            g_autofree gchar *path = g_build_filename (FILE_CACHE_DIR, name, NULL);
+            g_unlink (path);
+        }
+    }
+
+    return TRUE;
+}
+
+const VpnSsoCacheBackend vpn_sso_cache_backend_file = {
+    .name         = "file",
+    .is_available = file_is_available,
+    .store        = file_store,
+    .lookup       = file_lookup,
+    .list         = file_list,
+    .clear        = file_clear,
+    .clear_all    = file_clear_all,
+};
@@ -0,0 +1,357 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "credential-cache-backend.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/keyctl.h>
+
+/*
+ * Linux kernel keyring backend.
+ *
+ * Records are kept as "user" keys in the user keyring of the service's
+ * UID, so they outlive a single service instance but not a reboot. The
+ * kernel expires each key on its own via KEYCTL_SET_TIMEOUT. This works
+ * on machines without a graphical session or GNOME Keyring.
+ *
+ * Under NetworkManager and systemd the service runs with a session
+ * keyring of its own that @u is not linked into. Keys are then not
+ * "possessed", and the default permissions of a "user" key grant its
+ * owner only VIEW: searches find the key but reading, setting a timeout
+ * or invalidating it fail with EACCES. Changing the permissions needs
+ * SETATTR, which the owner lacks as well, so @u is linked into the
+ * session keyring before first use instead.
+ *
+ * The syscalls are used directly to avoid a libkeyutils dependency.
+ */
+
+#define KERNEL_KEY_TYPE    "user"
+#define KERNEL_KEY_PREFIX  "vpn-sso:"
+#define KERNEL_KEYRING     KEY_SPEC_USER_KEYRING
+#define KERNEL_PROBE_KEY   "vpn-sso-probe"
+
+typedef int32_t key_serial_t;
+
+static key_serial_t
+sys_add_key (const gchar  *type,
+             const gchar  *description,
+             const void   *payload,
+             gsize         plen,
+             key_serial_t  keyring)
+{
+    return (key_serial_t) syscall (__NR_add_key, type, description, payload, plen, keyring);
+}
+
+static long
+sys_keyctl (int           cmd,
+            unsigned long arg2,
+            unsigned long arg3,
+            unsigned long arg4,
+            unsigned long arg5)
+{
+    return syscall (__NR_keyctl, cmd, arg2, arg3, arg4, arg5);
+}
+
+static gchar *
+kernel_key_description (const gchar *gateway, const gchar *protocol)
+{
+    return g_strdup_printf (KERNEL_KEY_PREFIX "%s:%s", protocol, gateway);
+}
+
+static void
+set_errno_error (GError **error, const gchar *what)
+{
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "%s: %s", what, g_strerror (saved_errno));
+}
+
+static key_serial_t
+kernel_search (const gchar *description)
+{
+    return (key_serial_t) sys_keyctl (KEYCTL_SEARCH, KERNEL_KEYRING,
+                                      (unsigned long) KERNEL_KEY_TYPE,
+                                      (unsigned long) description, 0);
+}
+
+static gchar *
+kernel_read_key (key_serial_t key, GError **error)
+{
+    long size;
+    gchar *buf;
+
+    size = sys_keyctl (KEYCTL_READ, key, 0, 0, 0);
+    if (size < 0) {
+        set_errno_error (error, "Failed to read key size");
+        return NULL;
+    }
+
+    buf = g_malloc0 (size + 1);
+    if (sys_keyctl (KEYCTL_READ, key, (unsigned long) buf, size, 0) < 0) {
+        set_errno_error (error, "Failed to read key");
+        g_free (buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+/*
+ * A round trip through a probe key: the keyring may exist and still be
+ * unusable, with keyctl filtered by seccomp (ENOSYS/EPERM, as in many
+ * container runtimes) or with keys the service cannot read.
+ */
+static gboolean
+kernel_probe (void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *description = NULL;
+    g_autofree gchar *read_back = NULL;
+    const gchar *payload = "probe";
+    key_serial_t key;
+    key_serial_t found;
+
+    if (sys_keyctl (KEYCTL_LINK, KERNEL_KEYRING, KEY_SPEC_SESSION_KEYRING, 0, 0) < 0) {
+        set_errno_error (&error, "Failed to link the user keyring");
+        g_message ("KERNEL KEYRING: Not available: %s", error->message);
+        return FALSE;
+    }
+
+    /* Per process, so that concurrent services do not replace each other's */
+    description = g_strdup_printf (KERNEL_PROBE_KEY ":%d", getpid ());
+    key = sys_add_key (KERNEL_KEY_TYPE, description, payload, strlen (payload), KERNEL_KEYRING);
+    if (key < 0) {
+        set_errno_error (&error, "add_key failed");
+        g_message ("KERNEL KEYRING: Not available: %s", error->message);
+        return FALSE;
+    }
+
+    found = kernel_search (description);
+    if (found < 0)
+        set_errno_error (&error, "Key search failed");
+    else
+        read_back = kernel_read_key (found, &error);
+
+    if (sys_keyctl (KEYCTL_INVALIDATE, key, 0, 0, 0) < 0 && !error)
+        set_errno_error (&error, "Failed to invalidate key");
+
+    if (error || g_strcmp0 (read_back, payload) != 0) {
+        g_message ("KERNEL KEYRING: Not available: %s",
+                   error ? error->message : "probe key read back wrong");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Links @u into the session keyring and checks that keys can be used,
+ * once per process. Every operation goes through here, since a profile
+ * may name this backend without auto-detection.
+ */
+static gboolean
+kernel_is_available (void)
+{
+    static gsize available = 0;
+
+    if (g_once_init_enter (&available))
+        g_once_init_leave (&available, kernel_probe () ? 1 : 2);
+
+    return available == 1;
+}
+
+static gboolean
+kernel_check_available (GError **error)
+{
+    if (kernel_is_available ())
+        return TRUE;
+
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "Kernel keyring is not usable by the service");
+    return FALSE;
+}
+
+static gboolean
+kernel_store (const gchar  *gateway,
+              const gchar  *protocol,
+              const gchar  *record,
+              gint64        expires_at,
+              GError      **error)
+{
+    g_autofree gchar *description = kernel_key_description (gateway, protocol);
+    gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+    key_serial_t key;
+
+    if (!kernel_check_available (error))
+        return FALSE;
+
+    /* add_key() atomically replaces an existing key with the same description */
+    key = sys_add_key (KERNEL_KEY_TYPE, description, record, strlen (record), KERNEL_KEYRING);
+    if (key < 0) {
+        set_errno_error (error, "add_key failed");
+        return FALSE;
+    }
+
+    if (expires_at > now &&
+        sys_keyctl (KEYCTL_SET_TIMEOUT, key, (unsigned long) (expires_at - now), 0, 0) < 0) {
+        set_errno_error (error, "Failed to set key timeout");
+        sys_keyctl (KEYCTL_INVALIDATE, key, 0, 0, 0);
+        return FALSE;
+    }
+
+    g_message ("KERNEL KEYRING: Stored key %d (%s)", key, description);
+    return TRUE;
+}
+
+/*
+ * Returns the serials of all keys owned by this plugin in the keyring.
+ */
+static GArray *
+kernel_list_keys (GError **error)
+{
+    g_autofree key_serial_t *keys = NULL;
+    GArray *owned;
+    long size;
+    guint n_keys;
+
+    if (!kernel_check_available (error))
+        return NULL;
+
+    /* Reading a keyring returns the serials of the keys linked into it */
+    size = sys_keyctl (KEYCTL_READ, KERNEL_KEYRING, 0, 0, 0);
+    if (size < 0) {
+        set_errno_error (error, "Failed to read keyring");
+        return NULL;
+    }
+
+    keys = g_malloc0 (size + sizeof (key_serial_t));
+    size = sys_keyctl (KEYCTL_READ, KERNEL_KEYRING, (unsigned long) keys, size, 0);
+    if (size < 0) {
+        set_errno_error (error, "Failed to read keyring");
+        return NULL;
+    }
+
+    owned = g_array_new (FALSE, FALSE, sizeof (key_serial_t));
+    n_keys = size / sizeof (key_serial_t);
+    for (guint i = 0; i < n_keys; i++) {
+        gchar desc[512];
+        const gchar *name;
+
+        /* Description format: "type;uid;gid;perm;description" */
+        if (sys_keyctl (KEYCTL_DESCRIBE, keys[i], (unsigned long) desc, sizeof (desc) - 1, 0) < 0)
+            continue;
+        desc[sizeof (desc) - 1] = '\0';
+
+        if (!g_str_has_prefix (desc, KERNEL_KEY_TYPE ";"))
+            continue;
+
+        name = strrchr (desc, ';');
+        if (name && g_str_has_prefix (name + 1, KERNEL_KEY_PREFIX))
+            g_array_append_val (owned, keys[i]);
+    }
+
+    return owned;
+}
+
+static gchar *
+kernel_lookup (const gchar  *gateway,
+               const gchar  *protocol,
+               GError      **error)
+{
+    g_autofree gchar *description = kernel_key_description (gateway, protocol);
+    key_serial_t key;
+
+    if (!kernel_check_available (error))
+        return NULL;
+
+    key = kernel_search (description);
+    if (key < 0) {
+        /* ENOKEY: not found, EKEYEXPIRED/EKEYREVOKED: gone */
+        if (errno != ENOKEY && errno != EKEYEXPIRED && errno != EKEYREVOKED)
+            set_errno_error (error, "Key search failed");
+        return NULL;
+    }
+
+    return kernel_read_key (key, error);
+}
+
+static GPtrArray *
+kernel_list (GError **error)
+{
+    g_autoptr(GArray) keys = kernel_list_keys (error);
+    GPtrArray *records;
+
+    if (!keys)
+        return NULL;
+
+    records = g_ptr_array_new_with_free_func (g_free);
+    for (guint i = 0; i < keys->len; i++) {
+        /* Keys may expire between listing and reading; skip those */
+        gchar *record = kernel_read_key (g_array_index (keys, key_serial_t, i), NULL);
+        if (record)
+            g_ptr_array_add (records, record);
+    }
+
+    return records;
+}
+
+static gboolean
+kernel_clear (const gchar  *gateway,
+              const gchar  *protocol,
+              GError      **error)
+{
+    g_autofree gchar *description = kernel_key_description (gateway, protocol);
+    key_serial_t key;
+
+    if (!kernel_check_available (error))
+        return FALSE;
+
+    key = kernel_search (description);
+    if (key < 0)
+        return TRUE;
+
+    if (sys_keyctl (KEYCTL_INVALIDATE, key, 0, 0, 0) < 0) {
+        set_errno_error (error, "Failed to invalidate key");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+kernel_clear_all (GError **error)
+{
+    g_autoptr(GArray) keys = kernel_list_keys (error);
+
+    if (!keys)
+        return FALSE;
+
+    for (guint i = 0; i < keys->len; i++)
+        sys_keyctl (KEYCTL_INVALIDATE, g_array_index (keys, key_serial_t, i), 0, 0, 0);
+
+    return TRUE;
+}
+
+const VpnSsoCacheBackend vpn_sso_cache_backend_kernel = {
+    .name         = "kernel-keyring",
+    .is_available = kernel_is_available,
+    .store        = kernel_store,
+    .lookup       = kernel_lookup,
+    .list         = kernel_list,
+    .clear        = kernel_clear,
+    .clear_all    = kernel_clear_all,
+};
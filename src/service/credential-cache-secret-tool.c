@@ -0,0 +1,304 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "credential-cache-backend.h"
+#include "utils.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <sys/types.h>
+
+/*
+ * GNOME Keyring backend.
+ *
+ * Credentials are stored with the secret-tool command. When running as
+ * root, we spawn secret-tool as the target user using runuser, since
+ * D-Bus session buses reject connections from different UIDs.
+ */
+
+#define SECRET_TOOL_PATH   "/usr/bin/secret-tool"
+#define SECRET_TOOL_SCHEMA "org.freedesktop.NetworkManager.vpn-sso"
+
+/* Cache the target username for keyring operations */
+static gchar *cached_target_username = NULL;
+
+/*
+ * Get the username for keyring operations.
+ * When running as root, we need to find the logged-in user's username.
+ */
+static const gchar *
+get_target_username (void)
+{
+    if (cached_target_username)
+        return cached_target_username;
+
+    /* If not running as root, use current user */
+    if (getuid () != 0) {
+        struct passwd *pw = getpwuid (getuid ());
+        if (pw) {
+            cached_target_username = g_strdup (pw->pw_name);
+            g_message ("KEYRING: Using current user: %s", cached_target_username);
+            return cached_target_username;
+        }
+    }
+
+    /* Running as root - find graphical session user */
+    VpnSsoSessionEnv *session_env = vpn_sso_get_graphical_session_env ();
+    if (session_env && session_env->uid > 0) {
+        struct passwd *pw = getpwuid (session_env->uid);
+        if (pw) {
+            cached_target_username = g_strdup (pw->pw_name);
+            g_message ("KEYRING: Using graphical session user: %s (UID %d)",
+                       cached_target_username, session_env->uid);
+        }
+        vpn_sso_session_env_free (session_env);
+    }
+
+    if (!cached_target_username) {
+        g_warning ("KEYRING: Could not determine target username for keyring access");
+    }
+
+    return cached_target_username;
+}
+
+/*
+ * Run secret-tool as target user.
+ * Returns stdout content on success, NULL on failure.
+ */
+static gchar *
+run_secret_tool (const gchar * const *argv,
+                 const gchar         *stdin_data,
+                 GError             **error)
+{
+    const gchar *username = get_target_username ();
+    if (!username) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "Could not determine target user for keyring access");
+        return NULL;
+    }
+
+    /* Build command: runuser -u <username> -- secret-tool <args...> */
+    g_autoptr(GPtrArray) cmd = g_ptr_array_new ();
+
+    /* If running as root, use runuser to switch to target user */
+    if (getuid () == 0) {
+        g_ptr_array_add (cmd, (gchar *) "/usr/sbin/runuser");
+        g_ptr_array_add (cmd, (gchar *) "-u");
+        g_ptr_array_add (cmd, (gchar *) username);
+        g_ptr_array_add (cmd, (gchar *) "--");
+    }
+
+    /* Add secret-tool command and arguments */
+    for (int i = 0; argv[i] != NULL; i++) {
+        g_ptr_array_add (cmd, (gchar *) argv[i]);
+    }
+    g_ptr_array_add (cmd, NULL);
+
+    g_autofree gchar *cmdline = g_strjoinv (" ", (gchar **) cmd->pdata);
+    g_message ("KEYRING: Running command: %s", cmdline);
+
+    GSubprocessFlags flags = G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_PIPE;
+    if (stdin_data)
+        flags |= G_SUBPROCESS_FLAGS_STDIN_PIPE;
+
+    g_autoptr(GSubprocess) proc = g_subprocess_newv ((const gchar * const *) cmd->pdata,
+                                                      flags, error);
+    if (!proc) {
+        g_prefix_error (error, "Failed to spawn secret-tool: ");
+        return NULL;
+    }
+
+    g_autofree gchar *stdout_data = NULL;
+    g_autofree gchar *stderr_data = NULL;
+    GBytes *stdin_bytes = stdin_data ? g_bytes_new_static (stdin_data, strlen (stdin_data)) : NULL;
+
+    gboolean success = g_subprocess_communicate_utf8 (proc,
+                                                       stdin_data,
+                                                       NULL, /* cancellable */
+                                                       &stdout_data,
+                                                       &stderr_data,
+                                                       error);
+
+    if (stdin_bytes)
+        g_bytes_unref (stdin_bytes);
+
+    if (!success) {
+        g_prefix_error (error, "secret-tool communication failed: ");
+        return NULL;
+    }
+
+    gint exit_status = g_subprocess_get_exit_status (proc);
+    if (exit_status != 0) {
+        /* Exit status 1 from secret-tool lookup/search means "not found" - not an error */
+        if (exit_status == 1 &&
+            (g_strstr_len (cmdline, -1, "lookup") || g_strstr_len (cmdline, -1, "search"))) {
+            g_message ("KEYRING: secret-tool lookup returned no results");
+            return NULL;
+        }
+
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "secret-tool exited with status %d: %s",
+                     exit_status, stderr_data ? stderr_data : "(no error output)");
+        return NULL;
+    }
+
+    return g_steal_pointer (&stdout_data);
+}
+
+static gboolean
+secret_tool_is_available (void)
+{
+    if (!g_file_test (SECRET_TOOL_PATH, G_FILE_TEST_IS_EXECUTABLE))
+        return FALSE;
+
+    /* secret-tool needs a session bus to reach the keyring daemon */
+    if (!g_getenv ("DBUS_SESSION_BUS_ADDRESS"))
+        return FALSE;
+
+    return get_target_username () != NULL;
+}
+
+static gboolean
+secret_tool_store (const gchar  *gateway,
+                   const gchar  *protocol,
+                   const gchar  *record,
+                   gint64        expires_at G_GNUC_UNUSED,
+                   GError      **error)
+{
+    g_autofree gchar *label = g_strdup_printf ("VPN SSO: %s (%s)", gateway, protocol);
+    const gchar *argv[] = {
+        SECRET_TOOL_PATH, "store",
+        "--label", label,
+        "xdg:schema", SECRET_TOOL_SCHEMA,
+        "gateway", gateway,
+        "protocol", protocol,
+        NULL
+    };
+
+    GError *local_error = NULL;
+
+    /* secret-tool reads the secret from stdin */
+    g_autofree gchar *result = run_secret_tool (argv, record, &local_error);
+
+    if (local_error) {
+        g_propagate_error (error, local_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gchar *
+secret_tool_lookup (const gchar  *gateway,
+                    const gchar  *protocol,
+                    GError      **error)
+{
+    const gchar *argv[] = {
+        SECRET_TOOL_PATH, "lookup",
+        "xdg:schema", SECRET_TOOL_SCHEMA,
+        "gateway", gateway,
+        "protocol", protocol,
+        NULL
+    };
+
+    return run_secret_tool (argv, NULL, error);
+}
+
+static GPtrArray *
+secret_tool_list (GError **error)
+{
+    const gchar *argv[] = {
+        SECRET_TOOL_PATH, "search", "--all",
+        "xdg:schema", SECRET_TOOL_SCHEMA,
+        NULL
+    };
+
+    GError *local_error = NULL;
+    g_autofree gchar *output = run_secret_tool (argv, NULL, &local_error);
+    GPtrArray *records;
+
+    if (local_error) {
+        g_propagate_error (error, local_error);
+        return NULL;
+    }
+
+    records = g_ptr_array_new_with_free_func (g_free);
+    if (!output)
+        return records;
+
+    /* One "secret = <record>" line per matching item */
+    g_auto(GStrv) lines = g_strsplit (output, "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+        if (g_str_has_prefix (lines[i], "secret = "))
+            g_ptr_array_add (records, g_strdup (lines[i] + strlen ("secret = ")));
+        memset (lines[i], 0, strlen (lines[i]));
+    }
+    memset (output, 0, strlen (output));
+
+    return records;
+}
+
+static gboolean
+secret_tool_clear (const gchar  *gateway,
+                   const gchar  *protocol,
+                   GError      **error)
+{
+    const gchar *argv[] = {
+        SECRET_TOOL_PATH, "clear",
+        "xdg:schema", SECRET_TOOL_SCHEMA,
+        "gateway", gateway,
+        "protocol", protocol,
+        NULL
+    };
+
+    GError *local_error = NULL;
+    g_autofree gchar *result = run_secret_tool (argv, NULL, &local_error);
+
+    if (local_error) {
+        g_propagate_error (error, local_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+secret_tool_clear_all (GError **error)
+{
+    /* Clear all items with our schema */
+    const gchar *argv[] = {
+        SECRET_TOOL_PATH, "clear",
+        "xdg:schema", SECRET_TOOL_SCHEMA,
+        NULL
+    };
+
+    GError *local_error = NULL;
+    g_autofree gchar *result = run_secret_tool (argv, NULL, &local_error);
+
+    if (local_error) {
+        g_propagate_error (error, local_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+const VpnSsoCacheBackend vpn_sso_cache_backend_secret_tool = {
+    .name         = "keyring",
+    .is_available = secret_tool_is_available,
+    .store        = secret_tool_store,
+    .lookup       = secret_tool_lookup,
+    .list         = secret_tool_list,
+    .clear        = secret_tool_clear,
+    .clear_all    = secret_tool_clear_all,
+};
@@ -11,299 +11,361 @@
 
 #include "config.h"
 #include "credential-cache.h"
-#include "utils.h"
+#include "credential-cache-backend.h"
+#include "credential-record.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
-#include <pwd.h>
-#include <sys/types.h>
+#include <unistd.h>
+#include <sys/file.h>
 
 /**
  * SECTION:credential-cache
  * @title: Credential Cache
- * @short_description: GNOME Keyring storage for VPN SSO credentials
+ * @short_description: Secure storage for VPN SSO credentials
  *
- * This module provides secure storage for VPN SSO credentials using
- * the secret-tool command to access GNOME Keyring.
+ * This module serializes VPN SSO credentials and hands them to one of
+ * several storage backends (see credential-cache-backend.h):
  *
- * When running as root, we spawn secret-tool as the target user using
- * runuser, since D-Bus session buses reject connections from different UIDs.
+ * - "keyring": GNOME Keyring via secret-tool, for desktop sessions
+ * - "kernel-keyring": the Linux kernel user keyring, for headless machines
+ * - "file": AES-GCM encrypted files under /var/cache
+ *
+ * The backend is chosen per profile with the "cache-backend" setting, or
+ * detected automatically in that order. Callers pass it with every
+ * operation, so connections using different backends can share the
+ * service process.
  */
 
-/* Cache the target username for keyring operations */
-static gchar *cached_target_username = NULL;
+/* Auto-detection order: desktop keyring first, then the kernel keyring for
+ * headless machines, then the encrypted file store (e.g. in containers
+ * where keyctl is filtered) */
+static const VpnSsoCacheBackend * const auto_backends[] = {
+    &vpn_sso_cache_backend_secret_tool,
+    &vpn_sso_cache_backend_kernel,
+    &vpn_sso_cache_backend_file,
+};
+
+const gchar *
+vpn_sso_cache_backend_type_to_string (VpnSsoCacheBackendType type)
+{
+    switch (type) {
+    case VPN_SSO_CACHE_BACKEND_KEYRING:
+        return vpn_sso_cache_backend_secret_tool.name;
+    case VPN_SSO_CACHE_BACKEND_KERNEL_KEYRING:
+        return vpn_sso_cache_backend_kernel.name;
+    case VPN_SSO_CACHE_BACKEND_FILE:
+        return vpn_sso_cache_backend_file.name;
+    case VPN_SSO_CACHE_BACKEND_AUTO:
+    default:
+        return "auto";
+    }
+}
+
+VpnSsoCacheBackendType
+vpn_sso_cache_backend_type_from_string (const gchar *str)
+{
+    if (g_strcmp0 (str, vpn_sso_cache_backend_secret_tool.name) == 0)
+        return VPN_SSO_CACHE_BACKEND_KEYRING;
+    if (g_strcmp0 (str, vpn_sso_cache_backend_kernel.name) == 0)
+        return VPN_SSO_CACHE_BACKEND_KERNEL_KEYRING;
+    if (g_strcmp0 (str, vpn_sso_cache_backend_file.name) == 0)
+        return VPN_SSO_CACHE_BACKEND_FILE;
+
+    if (str && *str && g_strcmp0 (str, "auto") != 0)
+        g_warning ("CACHE: Unknown cache backend '%s', using auto-detection", str);
+
+    return VPN_SSO_CACHE_BACKEND_AUTO;
+}
 
 /*
- * Get the username for keyring operations.
- * When running as root, we need to find the logged-in user's username.
+ * Resolve a backend type to an implementation. Runs in worker threads,
+ * since availability checks may spawn processes.
  */
-static const gchar *
-get_target_username (void)
-{
-    if (cached_target_username)
-        return cached_target_username;
-
-    /* If not running as root, use current user */
-    if (getuid () != 0) {
-        struct passwd *pw = getpwuid (getuid ());
-        if (pw) {
-            cached_target_username = g_strdup (pw->pw_name);
-            g_message ("KEYRING: Using current user: %s", cached_target_username);
-            return cached_target_username;
-        }
-    }
-
-    /* Running as root - find graphical session user */
-    VpnSsoSessionEnv *session_env = vpn_sso_get_graphical_session_env ();
-    if (session_env && session_env->uid > 0) {
-        struct passwd *pw = getpwuid (session_env->uid);
-        if (pw) {
-            cached_target_username = g_strdup (pw->pw_name);
-            g_message ("KEYRING: Using graphical session user: %s (UID %d)",
-                       cached_target_username, session_env->uid);
-        }
-        vpn_sso_session_env_free (session_env);
+static const VpnSsoCacheBackend *
+resolve_backend (VpnSsoCacheBackendType type)
+{
+    switch (type) {
+    case VPN_SSO_CACHE_BACKEND_KEYRING:
+        return &vpn_sso_cache_backend_secret_tool;
+    case VPN_SSO_CACHE_BACKEND_KERNEL_KEYRING:
+        return &vpn_sso_cache_backend_kernel;
+    case VPN_SSO_CACHE_BACKEND_FILE:
+        return &vpn_sso_cache_backend_file;
+    case VPN_SSO_CACHE_BACKEND_AUTO:
+    default:
+        break;
     }
 
-    if (!cached_target_username) {
-        g_warning ("KEYRING: Could not determine target username for keyring access");
+    for (guint i = 0; i < G_N_ELEMENTS (auto_backends); i++) {
+        if (auto_backends[i]->is_available ())
+            return auto_backends[i];
     }
 
-    return cached_target_username;
+    return NULL;
 }
 
-void
-vpn_sso_cached_credential_free (VpnSsoCachedCredential *credential)
+static const VpnSsoCacheBackend *
+resolve_backend_for_task (GTask *task, VpnSsoCacheBackendType type)
 {
-    if (!credential)
-        return;
+    const VpnSsoCacheBackend *backend = resolve_backend (type);
 
-    g_free (credential->gateway);
-    g_free (credential->protocol);
-    g_free (credential->username);
-
-    /* Securely clear the cookie before freeing */
-    if (credential->cookie) {
-        memset (credential->cookie, 0, strlen (credential->cookie));
-        g_free (credential->cookie);
+    if (!backend) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                 "No credential cache backend available");
     }
 
-    g_free (credential->fingerprint);
-    g_free (credential->usergroup);
-    g_free (credential);
+    return backend;
 }
 
 /*
- * Serialize credential data to JSON for storage in keyring
+ * Cache metrics.
+ *
+ * Counters are updated from worker threads with atomic operations and
+ * read from the main loop by the admin D-Bus interface. Backend latency
+ * is recorded per operation as a histogram with fixed millisecond bucket
+ * bounds; the last bucket counts everything slower than the largest bound.
+ *
+ * NetworkManager starts the service for a connection and it exits after
+ * the disconnect, so a process only ever sees one connection's worth. The
+ * counts are therefore added to a key file under VPN_SSO_STATEDIR when the
+ * process exits, and GetMetrics reports the total of earlier runs plus
+ * this one:
+ *
+ *   [counters]
+ *   since=1718000000
+ *   hits=12
+ *   ...
+ *   [latency-ms]
+ *   lookup=3;9;0;0;0;0;0;0;0;
  */
-static gchar *
-serialize_credential (const gchar *gateway,
-                      const gchar *protocol,
-                      const gchar *username,
-                      const gchar *cookie,
-                      const gchar *fingerprint,
-                      const gchar *usergroup,
-                      gint64       created_at,
-                      gint64       expires_at)
-{
-    g_autoptr(GString) json = g_string_new ("{\n");
-
-    g_string_append_printf (json, "  \"gateway\": \"%s\",\n", gateway);
-    g_string_append_printf (json, "  \"protocol\": \"%s\",\n", protocol);
-    g_string_append_printf (json, "  \"created_at\": %" G_GINT64_FORMAT ",\n", created_at);
-    g_string_append_printf (json, "  \"expires_at\": %" G_GINT64_FORMAT, expires_at);
-
-    if (username) {
-        g_autofree gchar *escaped = g_strescape (username, NULL);
-        g_string_append_printf (json, ",\n  \"username\": \"%s\"", escaped);
-    }
 
-    if (cookie) {
-        g_autofree gchar *escaped = g_strescape (cookie, NULL);
-        g_string_append_printf (json, ",\n  \"cookie\": \"%s\"", escaped);
-    }
+#define CACHE_METRICS_FILE  VPN_SSO_STATEDIR "/cache-metrics.conf"
+#define CACHE_METRICS_LOCK  VPN_SSO_STATEDIR "/cache-metrics.lock"
 
-    if (fingerprint) {
-        g_autofree gchar *escaped = g_strescape (fingerprint, NULL);
-        g_string_append_printf (json, ",\n  \"fingerprint\": \"%s\"", escaped);
-    }
+typedef enum {
+    CACHE_OP_STORE,
+    CACHE_OP_LOOKUP,
+    CACHE_OP_CLEAR,
+    CACHE_OP_CLEAR_ALL,
+    CACHE_OP_LIST,
+    CACHE_OP_LAST
+} CacheOp;
 
-    if (usergroup) {
-        g_autofree gchar *escaped = g_strescape (usergroup, NULL);
-        g_string_append_printf (json, ",\n  \"usergroup\": \"%s\"", escaped);
-    }
+static const gchar * const cache_op_names[CACHE_OP_LAST] = {
+    "store", "lookup", "clear", "clear-all", "list",
+};
 
-    g_string_append (json, "\n}");
+static const guint32 latency_bounds_ms[] = { 1, 5, 10, 50, 100, 500, 1000, 5000 };
 
-    return g_string_free (g_steal_pointer (&json), FALSE);
+#define N_LATENCY_BUCKETS (G_N_ELEMENTS (latency_bounds_ms) + 1)
+
+typedef struct {
+    gint hits;
+    gint misses;
+    gint expired;
+    gint parse_failures;
+    gint fallbacks;
+    gint stores;
+    gint store_failures;
+    gint coalesced;
+    gint backend_errors;
+    gint latency[CACHE_OP_LAST][N_LATENCY_BUCKETS];
+} CacheMetrics;
+
+static const struct {
+    const gchar *name;
+    gsize offset;
+} metric_counters[] = {
+    { "hits", G_STRUCT_OFFSET (CacheMetrics, hits) },
+    { "misses", G_STRUCT_OFFSET (CacheMetrics, misses) },
+    { "expired", G_STRUCT_OFFSET (CacheMetrics, expired) },
+    { "parse-failures", G_STRUCT_OFFSET (CacheMetrics, parse_failures) },
+    { "fallbacks", G_STRUCT_OFFSET (CacheMetrics, fallbacks) },
+    { "stores", G_STRUCT_OFFSET (CacheMetrics, stores) },
+    { "store-failures", G_STRUCT_OFFSET (CacheMetrics, store_failures) },
+    { "coalesced-writes", G_STRUCT_OFFSET (CacheMetrics, coalesced) },
+    { "backend-errors", G_STRUCT_OFFSET (CacheMetrics, backend_errors) },
+};
+
+#define METRIC_COUNTER(m, i) G_STRUCT_MEMBER (gint, (m), metric_counters[i].offset)
+
+/* This process, and what earlier ones saved */
+static CacheMetrics metrics;
+static CacheMetrics saved_metrics;
+static gint64 metrics_since;
+
+static void
+metrics_observe_latency (CacheOp op, gint64 start_us)
+{
+    gint64 elapsed_ms = (g_get_monotonic_time () - start_us) / 1000;
+    guint bucket = 0;
+
+    while (bucket < G_N_ELEMENTS (latency_bounds_ms) && elapsed_ms > latency_bounds_ms[bucket])
+        bucket++;
+
+    g_atomic_int_inc (&metrics.latency[op][bucket]);
 }
 
-/*
- * Parse a JSON string field
- */
-static gchar *
-parse_json_string (const gchar *json, const gchar *key)
+void
+vpn_sso_credential_cache_record_fallback (void)
 {
-    g_autofree gchar *pattern = g_strdup_printf ("\"%s\"\\s*:\\s*\"", key);
-    g_autoptr(GRegex) regex = g_regex_new (pattern, 0, 0, NULL);
-    g_autoptr(GMatchInfo) match_info = NULL;
+    g_atomic_int_inc (&metrics.fallbacks);
+}
 
-    if (!g_regex_match (regex, json, 0, &match_info))
-        return NULL;
+static GKeyFile *
+metrics_file_read (CacheMetrics *into, gint64 *since)
+{
+    GKeyFile *keyfile = g_key_file_new ();
+    g_autoptr(GError) error = NULL;
 
-    gint end;
-    g_match_info_fetch_pos (match_info, 0, NULL, &end);
+    memset (into, 0, sizeof (*into));
+    *since = 0;
 
-    /* Find the closing quote */
-    const gchar *value_start = json + end;
-    const gchar *p = value_start;
-    while (*p && *p != '"') {
-        if (*p == '\\' && *(p + 1))
-            p++;
-        p++;
+    if (!g_key_file_load_from_file (keyfile, CACHE_METRICS_FILE, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_message ("CACHE: Ignoring unreadable %s: %s", CACHE_METRICS_FILE, error->message);
+        return keyfile;
     }
 
-    if (*p != '"')
-        return NULL;
+    *since = g_key_file_get_int64 (keyfile, "counters", "since", NULL);
+    for (guint i = 0; i < G_N_ELEMENTS (metric_counters); i++)
+        METRIC_COUNTER (into, i) = g_key_file_get_integer (keyfile, "counters",
+                                                           metric_counters[i].name, NULL);
 
-    gchar *escaped = g_strndup (value_start, p - value_start);
-    gchar *result = g_strcompress (escaped);
-    g_free (escaped);
+    for (guint op = 0; op < CACHE_OP_LAST; op++) {
+        g_autofree gint *counts = NULL;
+        gsize n = 0;
 
-    return result;
+        counts = g_key_file_get_integer_list (keyfile, "latency-ms", cache_op_names[op], &n, NULL);
+        for (gsize b = 0; b < MIN (n, N_LATENCY_BUCKETS); b++)
+            into->latency[op][b] = counts[b];
+    }
+
+    return keyfile;
 }
 
-/*
- * Parse a JSON integer field
- */
-static gint64
-parse_json_int64 (const gchar *json, const gchar *key)
+void
+vpn_sso_credential_cache_load_metrics (void)
 {
-    g_autofree gchar *pattern = g_strdup_printf ("\"%s\"\\s*:\\s*([0-9]+)", key);
-    g_autoptr(GRegex) regex = g_regex_new (pattern, 0, 0, NULL);
-    g_autoptr(GMatchInfo) match_info = NULL;
-
-    if (!g_regex_match (regex, json, 0, &match_info))
-        return 0;
+    g_key_file_unref (metrics_file_read (&saved_metrics, &metrics_since));
 
-    g_autofree gchar *value = g_match_info_fetch (match_info, 1);
-    return g_ascii_strtoll (value, NULL, 10);
+    if (metrics_since == 0)
+        metrics_since = g_get_real_time () / G_USEC_PER_SEC;
 }
 
-/*
- * Deserialize credential data from JSON
- */
-static VpnSsoCachedCredential *
-deserialize_credential (const gchar *json)
+void
+vpn_sso_credential_cache_save_metrics (void)
 {
-    if (!json || !*json)
-        return NULL;
-
-    VpnSsoCachedCredential *cred = g_new0 (VpnSsoCachedCredential, 1);
-
-    cred->gateway = parse_json_string (json, "gateway");
-    cred->protocol = parse_json_string (json, "protocol");
-    cred->username = parse_json_string (json, "username");
-    cred->cookie = parse_json_string (json, "cookie");
-    cred->fingerprint = parse_json_string (json, "fingerprint");
-    cred->usergroup = parse_json_string (json, "usergroup");
-    cred->created_at = parse_json_int64 (json, "created_at");
-    cred->expires_at = parse_json_int64 (json, "expires_at");
+    g_autoptr(GKeyFile) keyfile = NULL;
+    g_autoptr(GError) error = NULL;
+    CacheMetrics total;
+    gint64 since;
+    gboolean counted = FALSE;
+    gint lock_fd;
+
+    for (guint i = 0; i < G_N_ELEMENTS (metric_counters) && !counted; i++)
+        counted = g_atomic_int_get (&METRIC_COUNTER (&metrics, i)) != 0;
+    for (guint op = 0; op < CACHE_OP_LAST && !counted; op++)
+        for (guint b = 0; b < N_LATENCY_BUCKETS && !counted; b++)
+            counted = g_atomic_int_get (&metrics.latency[op][b]) != 0;
+    if (!counted)
+        return;
 
-    return cred;
-}
+    if (g_mkdir_with_parents (VPN_SSO_STATEDIR, 0700) < 0) {
+        g_message ("CACHE: Cannot create %s", VPN_SSO_STATEDIR);
+        return;
+    }
 
-/*
- * Run secret-tool as target user.
- * Returns stdout content on success, NULL on failure.
- */
-static gchar *
-run_secret_tool (const gchar * const *argv,
-                 const gchar         *stdin_data,
-                 GError             **error)
-{
-    const gchar *username = get_target_username ();
-    if (!username) {
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "Could not determine target user for keyring access");
-        return NULL;
+    /* Services for other connections may be exiting at the same time;
+     * each adds its own counts to what is on disk at that moment */
+    lock_fd = open (CACHE_METRICS_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0 || flock (lock_fd, LOCK_EX) < 0) {
+        g_message ("CACHE: Cannot lock %s: %s", CACHE_METRICS_LOCK, g_strerror (errno));
+        if (lock_fd >= 0)
+            close (lock_fd);
+        return;
     }
 
-    /* Build command: runuser -u <username> -- secret-tool <args...> */
-    g_autoptr(GPtrArray) cmd = g_ptr_array_new ();
+    keyfile = metrics_file_read (&total, &since);
+    if (since == 0)
+        since = metrics_since ? metrics_since : g_get_real_time () / G_USEC_PER_SEC;
 
-    /* If running as root, use runuser to switch to target user */
-    if (getuid () == 0) {
-        g_ptr_array_add (cmd, (gchar *) "/usr/sbin/runuser");
-        g_ptr_array_add (cmd, (gchar *) "-u");
-        g_ptr_array_add (cmd, (gchar *) username);
-        g_ptr_array_add (cmd, (gchar *) "--");
-    }
+    g_key_file_set_int64 (keyfile, "counters", "since", since);
+    for (guint i = 0; i < G_N_ELEMENTS (metric_counters); i++)
+        g_key_file_set_integer (keyfile, "counters", metric_counters[i].name,
+                                METRIC_COUNTER (&total, i) +
+                                g_atomic_int_get (&METRIC_COUNTER (&metrics, i)));
+
+    for (guint op = 0; op < CACHE_OP_LAST; op++) {
+        gint counts[N_LATENCY_BUCKETS];
 
-    /* Add secret-tool command and arguments */
-    for (int i = 0; argv[i] != NULL; i++) {
-        g_ptr_array_add (cmd, (gchar *) argv[i]);
+        for (guint b = 0; b < N_LATENCY_BUCKETS; b++)
+            counts[b] = total.latency[op][b] + g_atomic_int_get (&metrics.latency[op][b]);
+        g_key_file_set_integer_list (keyfile, "latency-ms", cache_op_names[op],
+                                     counts, N_LATENCY_BUCKETS);
     }
-    g_ptr_array_add (cmd, NULL);
 
-    g_autofree gchar *cmdline = g_strjoinv (" ", (gchar **) cmd->pdata);
-    g_message ("KEYRING: Running command: %s", cmdline);
+    if (!g_key_file_save_to_file (keyfile, CACHE_METRICS_FILE, &error))
+        g_message ("CACHE: Failed to write %s: %s", CACHE_METRICS_FILE, error->message);
 
-    GSubprocessFlags flags = G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_PIPE;
-    if (stdin_data)
-        flags |= G_SUBPROCESS_FLAGS_STDIN_PIPE;
+    close (lock_fd);
+}
 
-    g_autoptr(GSubprocess) proc = g_subprocess_newv ((const gchar * const *) cmd->pdata,
-                                                      flags, error);
-    if (!proc) {
-        g_prefix_error (error, "Failed to spawn secret-tool: ");
-        return NULL;
-    }
+GVariant *
+vpn_sso_credential_cache_get_metrics (void)
+{
+    GVariantBuilder builder;
+    GVariantBuilder latency;
 
-    g_autofree gchar *stdout_data = NULL;
-    g_autofree gchar *stderr_data = NULL;
-    GBytes *stdin_bytes = stdin_data ? g_bytes_new_static (stdin_data, strlen (stdin_data)) : NULL;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
 
-    gboolean success = g_subprocess_communicate_utf8 (proc,
-                                                       stdin_data,
-                                                       NULL, /* cancellable */
-                                                       &stdout_data,
-                                                       &stderr_data,
-                                                       error);
+    g_variant_builder_add (&builder, "{sv}", "since",
+                           g_variant_new_int64 (metrics_since));
 
-    if (stdin_bytes)
-        g_bytes_unref (stdin_bytes);
+    for (guint i = 0; i < G_N_ELEMENTS (metric_counters); i++) {
+        guint32 value = (guint32) (METRIC_COUNTER (&saved_metrics, i) +
+                                   g_atomic_int_get (&METRIC_COUNTER (&metrics, i)));
 
-    if (!success) {
-        g_prefix_error (error, "secret-tool communication failed: ");
-        return NULL;
+        g_variant_builder_add (&builder, "{sv}", metric_counters[i].name,
+                               g_variant_new_uint32 (value));
     }
 
-    gint exit_status = g_subprocess_get_exit_status (proc);
-    if (exit_status != 0) {
-        /* Exit status 1 from secret-tool lookup means "not found" - not an error */
-        if (exit_status == 1 && g_strstr_len (cmdline, -1, "lookup")) {
-            g_message ("KEYRING: secret-tool lookup returned no results");
-            return NULL;
-        }
+    g_variant_builder_add (&builder, "{sv}", "latency-bounds-ms",
+                           g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                      latency_bounds_ms,
+                                                      G_N_ELEMENTS (latency_bounds_ms),
+                                                      sizeof (guint32)));
 
-        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                     "secret-tool exited with status %d: %s",
-                     exit_status, stderr_data ? stderr_data : "(no error output)");
-        return NULL;
+    g_variant_builder_init (&latency, G_VARIANT_TYPE ("a{sau}"));
+    for (guint op = 0; op < CACHE_OP_LAST; op++) {
+        guint32 counts[N_LATENCY_BUCKETS];
+
+        for (guint b = 0; b < N_LATENCY_BUCKETS; b++)
+            counts[b] = (guint32) (saved_metrics.latency[op][b] +
+                                   g_atomic_int_get (&metrics.latency[op][b]));
+
+        g_variant_builder_add (&latency, "{s@au}", cache_op_names[op],
+                               g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                          counts, N_LATENCY_BUCKETS,
+                                                          sizeof (guint32)));
     }
+    g_variant_builder_add (&builder, "{sv}", "latency-ms",
+                           g_variant_builder_end (&latency));
 
-    return g_steal_pointer (&stdout_data);
+    return g_variant_builder_end (&builder);
 }
 
 /*
  * Data structure for async store operation
  */
 typedef struct {
+    VpnSsoCacheBackendType backend;
     gchar *gateway;
     gchar *protocol;
-    gchar *username;
-    gchar *json;
-    gchar *label;
+    gchar *record;
+    gint64 expires_at;
 } StoreData;
 
 static void
@@ -312,71 +374,261 @@ store_data_free (StoreData *data)
     if (data) {
         g_free (data->gateway);
         g_free (data->protocol);
-        g_free (data->username);
-        g_free (data->label);
-        if (data->json) {
-            memset (data->json, 0, strlen (data->json));
-            g_free (data->json);
+        if (data->record) {
+            memset (data->record, 0, strlen (data->record));
+            g_free (data->record);
         }
         g_free (data);
     }
 }
 
 /*
- * Thread function for storing credentials using secret-tool.
+ * Thread function for writing (storing or, with a %NULL record, clearing)
+ * credentials.
  */
 static void
-store_thread_func (GTask        *task,
+write_thread_func (GTask        *task,
                    gpointer      source_object G_GNUC_UNUSED,
                    gpointer      task_data,
                    GCancellable *cancellable G_GNUC_UNUSED)
 {
     StoreData *data = task_data;
+    const VpnSsoCacheBackend *backend;
     GError *error = NULL;
 
-    g_message ("KEYRING STORE THREAD: Storing credentials for %s:%s",
-               data->gateway, data->protocol);
+    backend = resolve_backend_for_task (task, data->backend);
+    if (!backend)
+        return;
 
-    /* Build secret-tool store command */
-    const gchar *argv[] = {
-        "/usr/bin/secret-tool", "store",
-        "--label", data->label,
-        "xdg:schema", "org.freedesktop.NetworkManager.vpn-sso",
-        "gateway", data->gateway,
-        "protocol", data->protocol,
-        NULL
-    };
+    if (!data->record) {
+        g_message ("CACHE CLEAR THREAD [%s]: Clearing credentials for %s:%s",
+                   backend->name, data->gateway, data->protocol);
+
+        gint64 start = g_get_monotonic_time ();
+        gboolean cleared = backend->clear (data->gateway, data->protocol, &error);
+        metrics_observe_latency (CACHE_OP_CLEAR, start);
+
+        if (!cleared) {
+            g_atomic_int_inc (&metrics.backend_errors);
+            g_warning ("CACHE CLEAR THREAD [%s]: Error clearing credentials: %s",
+                       backend->name, error->message);
+            g_error_free (error);
+            /* Don't fail the task - clearing is best effort */
+        } else {
+            g_message ("CACHE CLEAR THREAD [%s]: SUCCESS - credentials cleared for %s:%s",
+                       backend->name, data->gateway, data->protocol);
+        }
 
-    /* secret-tool reads the secret from stdin */
-    gchar *result = run_secret_tool (argv, data->json, &error);
+        g_task_return_boolean (task, TRUE);
+        return;
+    }
 
-    if (error) {
-        g_warning ("KEYRING STORE THREAD: FAILED to store credentials: %s", error->message);
+    g_message ("CACHE STORE THREAD [%s]: Storing credentials for %s:%s",
+               backend->name, data->gateway, data->protocol);
+
+    gint64 start = g_get_monotonic_time ();
+    gboolean stored = backend->store (data->gateway, data->protocol, data->record,
+                                      data->expires_at, &error);
+    metrics_observe_latency (CACHE_OP_STORE, start);
+
+    if (!stored) {
+        g_atomic_int_inc (&metrics.store_failures);
+        g_warning ("CACHE STORE THREAD [%s]: FAILED to store credentials: %s",
+                   backend->name, error->message);
         g_task_return_error (task, error);
-    } else {
-        g_message ("KEYRING STORE THREAD: SUCCESS - credentials stored for %s:%s",
+        return;
+    }
+
+    g_atomic_int_inc (&metrics.stores);
+    g_message ("CACHE STORE THREAD [%s]: SUCCESS - credentials stored for %s:%s",
+               backend->name, data->gateway, data->protocol);
+    g_task_return_boolean (task, TRUE);
+}
+
+/*
+ * Per-entry write-behind queue.
+ *
+ * A single connect can write the same entry several times in quick
+ * succession (SSO cookie, then portal-userauthcookie, then the server
+ * lifetime), and a clear can follow a store. Writes for one
+ * gateway/protocol are therefore queued on the main context: updates
+ * arriving within CACHE_WRITE_COALESCE_MS collapse into the latest one,
+ * and at most one backend write per entry is in flight, so writes land
+ * in the order they were issued. Every caller's task completes with the
+ * result of the write that superseded it.
+ */
+#define CACHE_WRITE_COALESCE_MS 250
+
+typedef struct {
+    gchar *key;
+    StoreData *pending;         /* Latest unwritten update; record NULL = clear */
+    GPtrArray *waiters;         /* Caller tasks covered by @pending */
+    StoreData *writing;         /* Update being written, owned by its task */
+    GPtrArray *in_flight;       /* Caller tasks covered by the running write */
+    guint timer;
+} WriteQueue;
+
+static GHashTable *write_queues;
+
+static void
+write_queue_free (WriteQueue *queue)
+{
+    g_clear_handle_id (&queue->timer, g_source_remove);
+    store_data_free (queue->pending);
+    g_ptr_array_unref (queue->waiters);
+    g_clear_pointer (&queue->in_flight, g_ptr_array_unref);
+    g_free (queue->key);
+    g_free (queue);
+}
+
+static void write_queue_flush (WriteQueue *queue);
+
+static void
+write_done_cb (GObject      *source G_GNUC_UNUSED,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+    WriteQueue *queue = user_data;
+    g_autoptr(GPtrArray) waiters = g_steal_pointer (&queue->in_flight);
+    GError *error = NULL;
+
+    queue->writing = NULL;
+    g_task_propagate_boolean (G_TASK (result), &error);
+
+    for (guint i = 0; i < waiters->len; i++) {
+        GTask *task = g_ptr_array_index (waiters, i);
+
+        if (error)
+            g_task_return_error (task, g_error_copy (error));
+        else
+            g_task_return_boolean (task, TRUE);
+    }
+    g_clear_error (&error);
+
+    /* Updates queued while writing go out right away, in order */
+    if (queue->pending)
+        write_queue_flush (queue);
+    else
+        g_hash_table_remove (write_queues, queue->key);
+}
+
+static void
+write_queue_flush (WriteQueue *queue)
+{
+    GTask *task;
+
+    g_return_if_fail (queue->in_flight == NULL);
+
+    queue->in_flight = g_steal_pointer (&queue->waiters);
+    queue->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+
+    task = g_task_new (NULL, NULL, write_done_cb, queue);
+    queue->writing = queue->pending;
+    g_task_set_task_data (task, g_steal_pointer (&queue->pending),
+                          (GDestroyNotify) store_data_free);
+    g_task_run_in_thread (task, write_thread_func);
+    g_object_unref (task);
+}
+
+static gboolean
+write_queue_timeout_cb (gpointer user_data)
+{
+    WriteQueue *queue = user_data;
+
+    queue->timer = 0;
+    write_queue_flush (queue);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Hash key of the write queue for one entry of one backend */
+static gchar *
+write_queue_key (VpnSsoCacheBackendType backend,
+                 const gchar           *gateway,
+                 const gchar           *protocol)
+{
+    return g_strdup_printf ("%d\x1f%s\x1f%s", backend, protocol, gateway);
+}
+
+/*
+ * The latest update for an entry that has not reached the backend yet,
+ * queued or being written, or %NULL if there is none.
+ */
+static const StoreData *
+write_queue_peek (VpnSsoCacheBackendType backend,
+                  const gchar           *gateway,
+                  const gchar           *protocol)
+{
+    g_autofree gchar *key = NULL;
+    WriteQueue *queue;
+
+    if (!write_queues)
+        return NULL;
+
+    key = write_queue_key (backend, gateway, protocol);
+    queue = g_hash_table_lookup (write_queues, key);
+    if (!queue)
+        return NULL;
+
+    return queue->pending ? queue->pending : queue->writing;
+}
+
+/*
+ * Queue @data (store or clear) for its entry and take ownership of it.
+ * @task is completed once @data, or a later update replacing it, has
+ * been written.
+ */
+static void
+write_queue_push (StoreData *data, GTask *task)
+{
+    g_autofree gchar *key = write_queue_key (data->backend, data->gateway, data->protocol);
+    WriteQueue *queue;
+
+    if (!write_queues)
+        write_queues = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify) write_queue_free);
+
+    queue = g_hash_table_lookup (write_queues, key);
+    if (!queue) {
+        queue = g_new0 (WriteQueue, 1);
+        queue->key = g_steal_pointer (&key);
+        queue->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+        g_hash_table_insert (write_queues, queue->key, queue);
+    }
+
+    if (queue->pending) {
+        g_atomic_int_inc (&metrics.coalesced);
+        g_message ("CACHE: Coalescing pending %s for %s:%s",
+                   queue->pending->record ? "store" : "clear",
                    data->gateway, data->protocol);
-        g_free (result);
-        g_task_return_boolean (task, TRUE);
+        store_data_free (queue->pending);
     }
+
+    queue->pending = data;
+    g_ptr_array_add (queue->waiters, g_object_ref (task));
+
+    if (!queue->in_flight && !queue->timer)
+        queue->timer = g_timeout_add (CACHE_WRITE_COALESCE_MS, write_queue_timeout_cb, queue);
 }
 
 /**
  * vpn_sso_credential_cache_store_async:
  *
- * Stores VPN SSO credentials in GNOME Keyring.
+ * Stores VPN SSO credentials in @backend.
  */
 void
-vpn_sso_credential_cache_store_async (const gchar         *gateway,
-                                       const gchar         *protocol,
-                                       const gchar         *username,
-                                       const gchar         *cookie,
-                                       const gchar         *fingerprint,
-                                       const gchar         *usergroup,
-                                       gint                 cache_hours,
-                                       GCancellable        *cancellable,
-                                       GAsyncReadyCallback  callback,
-                                       gpointer             user_data)
+vpn_sso_credential_cache_store_async (VpnSsoCacheBackendType  backend,
+                                      const gchar            *gateway,
+                                      const gchar            *protocol,
+                                      const gchar            *username,
+                                      const gchar            *cookie,
+                                      const gchar            *fingerprint,
+                                      const gchar            *usergroup,
+                                      gint                    cache_hours,
+                                      gint64                  server_expires_at,
+                                      GCancellable           *cancellable,
+                                      GAsyncReadyCallback     callback,
+                                      gpointer                user_data)
 {
     GTask *task;
     StoreData *data;
@@ -387,33 +639,40 @@ vpn_sso_credential_cache_store_async (const gchar         *gateway,
     task = g_task_new (NULL, cancellable, callback, user_data);
     g_task_set_source_tag (task, vpn_sso_credential_cache_store_async);
 
-    if (cache_hours <= 0)
-        cache_hours = VPN_SSO_DEFAULT_CACHE_DURATION_HOURS;
-
     /* Calculate timestamps */
     gint64 now = g_get_real_time () / G_USEC_PER_SEC;
-    gint64 expires_at = now + (cache_hours * 3600);
+    gint64 expires_at;
+
+    /*
+     * The gateway-announced lifetime wins when known; cache_hours only
+     * caps it. Without a server lifetime fall back to the fixed default.
+     */
+    if (server_expires_at > now) {
+        expires_at = server_expires_at;
+        if (cache_hours > 0)
+            expires_at = MIN (expires_at, now + (gint64) cache_hours * 3600);
+    } else {
+        if (cache_hours <= 0)
+            cache_hours = VPN_SSO_DEFAULT_CACHE_DURATION_HOURS;
+        expires_at = now + (gint64) cache_hours * 3600;
+    }
 
-    g_message ("KEYRING STORE: gateway=%s protocol=%s username=%s cookie=%s (expires in %d hours)",
+    g_message ("CACHE STORE: gateway=%s protocol=%s username=%s cookie=%s (expires in %" G_GINT64_FORMAT " minutes, %s)",
                gateway, protocol, username ? username : "(null)",
-               cookie ? "(present)" : "(null)", cache_hours);
-
-    /* Serialize to JSON */
-    gchar *json = serialize_credential (gateway, protocol, username,
-                                        cookie, fingerprint, usergroup,
-                                        now, expires_at);
+               cookie ? "(present)" : "(null)", (expires_at - now) / 60,
+               server_expires_at > now ? "server lifetime" : "fixed lifetime");
 
     /* Store data for thread */
     data = g_new0 (StoreData, 1);
+    data->backend = backend;
     data->gateway = g_strdup (gateway);
     data->protocol = g_strdup (protocol);
-    data->username = g_strdup (username);
-    data->json = json;
-    data->label = g_strdup_printf ("VPN SSO: %s (%s)", gateway, protocol);
-    g_task_set_task_data (task, data, (GDestroyNotify) store_data_free);
+    data->record = vpn_sso_credential_record_serialize (gateway, protocol, username,
+                                                        cookie, fingerprint, usergroup,
+                                                        now, expires_at);
+    data->expires_at = expires_at;
 
-    /* Run in thread */
-    g_task_run_in_thread (task, store_thread_func);
+    write_queue_push (data, task);
     g_object_unref (task);
 }
 
@@ -431,16 +690,42 @@ vpn_sso_credential_cache_store_finish (GAsyncResult  *result,
     return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+void
+vpn_sso_credential_cache_flush (void)
+{
+    GHashTableIter iter;
+    WriteQueue *queue;
+
+    if (!write_queues || g_hash_table_size (write_queues) == 0)
+        return;
+
+    g_message ("CACHE: Flushing %u pending credential writes", g_hash_table_size (write_queues));
+
+    /* Start every write still waiting out its coalescing delay */
+    g_hash_table_iter_init (&iter, write_queues);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &queue)) {
+        if (queue->timer) {
+            g_clear_handle_id (&queue->timer, g_source_remove);
+            write_queue_flush (queue);
+        }
+    }
+
+    /* Completions run on this context; each drops its queue when done */
+    while (g_hash_table_size (write_queues) > 0)
+        g_main_context_iteration (NULL, TRUE);
+}
+
 /*
- * Data structure for async lookup operation
+ * Data structure for async lookup operations
  */
 typedef struct {
+    VpnSsoCacheBackendType backend;
     gchar *gateway;
     gchar *protocol;
-} LookupData;
+} EntryData;
 
 static void
-lookup_data_free (LookupData *data)
+entry_data_free (EntryData *data)
 {
     if (data) {
         g_free (data->gateway);
@@ -449,8 +734,20 @@ lookup_data_free (LookupData *data)
     }
 }
 
+static EntryData *
+entry_data_new (VpnSsoCacheBackendType backend, const gchar *gateway, const gchar *protocol)
+{
+    EntryData *data = g_new0 (EntryData, 1);
+
+    data->backend = backend;
+    data->gateway = g_strdup (gateway);
+    data->protocol = g_strdup (protocol);
+
+    return data;
+}
+
 /*
- * Thread function for looking up credentials using secret-tool.
+ * Thread function for looking up credentials.
  */
 static void
 lookup_thread_func (GTask        *task,
@@ -458,49 +755,51 @@ lookup_thread_func (GTask        *task,
                     gpointer      task_data,
                     GCancellable *cancellable G_GNUC_UNUSED)
 {
-    LookupData *data = task_data;
+    EntryData *data = task_data;
+    const VpnSsoCacheBackend *backend;
     GError *error = NULL;
 
-    g_message ("KEYRING LOOKUP THREAD: Looking up credentials for %s:%s",
-               data->gateway, data->protocol);
+    backend = resolve_backend_for_task (task, data->backend);
+    if (!backend)
+        return;
 
-    /* Build secret-tool lookup command */
-    const gchar *argv[] = {
-        "/usr/bin/secret-tool", "lookup",
-        "xdg:schema", "org.freedesktop.NetworkManager.vpn-sso",
-        "gateway", data->gateway,
-        "protocol", data->protocol,
-        NULL
-    };
+    g_message ("CACHE LOOKUP THREAD [%s]: Looking up credentials for %s:%s",
+               backend->name, data->gateway, data->protocol);
 
-    gchar *secret = run_secret_tool (argv, NULL, &error);
+    gint64 start = g_get_monotonic_time ();
+    gchar *secret = backend->lookup (data->gateway, data->protocol, &error);
+    metrics_observe_latency (CACHE_OP_LOOKUP, start);
 
     if (error) {
-        g_warning ("KEYRING LOOKUP THREAD: Error looking up credentials: %s", error->message);
+        g_atomic_int_inc (&metrics.backend_errors);
+        g_warning ("CACHE LOOKUP THREAD [%s]: Error looking up credentials: %s",
+                   backend->name, error->message);
         g_task_return_error (task, error);
         return;
     }
 
     if (!secret || !*secret) {
-        g_message ("KEYRING LOOKUP THREAD: No cached credentials found for %s:%s",
-                   data->gateway, data->protocol);
+        g_message ("CACHE LOOKUP THREAD [%s]: No cached credentials found for %s:%s",
+                   backend->name, data->gateway, data->protocol);
         g_free (secret);
+        g_atomic_int_inc (&metrics.misses);
         g_task_return_pointer (task, NULL, NULL);
         return;
     }
 
-    g_message ("KEYRING LOOKUP THREAD: FOUND credentials for %s:%s (secret length=%zu)",
-               data->gateway, data->protocol, strlen (secret));
+    g_message ("CACHE LOOKUP THREAD [%s]: FOUND credentials for %s:%s (secret length=%zu)",
+               backend->name, data->gateway, data->protocol, strlen (secret));
 
-    /* Parse JSON */
-    VpnSsoCachedCredential *cred = deserialize_credential (secret);
+    /* Decode record (new or legacy format) */
+    VpnSsoCachedCredential *cred = vpn_sso_credential_record_parse (secret);
 
     /* Securely clear and free the secret string */
     memset (secret, 0, strlen (secret));
     g_free (secret);
 
     if (!cred) {
-        g_warning ("KEYRING LOOKUP THREAD: Failed to parse cached credentials");
+        g_atomic_int_inc (&metrics.parse_failures);
+        g_warning ("CACHE LOOKUP THREAD: Failed to parse cached credentials");
         g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
                                  "Failed to parse cached credentials");
         return;
@@ -509,32 +808,68 @@ lookup_thread_func (GTask        *task,
     /* Check expiration */
     gint64 now = g_get_real_time () / G_USEC_PER_SEC;
     if (cred->expires_at > 0 && now >= cred->expires_at) {
-        g_message ("KEYRING LOOKUP THREAD: Cached credentials expired - will be cleared");
+        g_message ("CACHE LOOKUP THREAD: Cached credentials expired - will be cleared");
         vpn_sso_cached_credential_free (cred);
+        g_atomic_int_inc (&metrics.expired);
         g_task_return_pointer (task, NULL, NULL);
         return;
     }
 
     gint64 remaining = cred->expires_at - now;
-    g_message ("KEYRING LOOKUP THREAD: Valid credentials (expires in %" G_GINT64_FORMAT " seconds)", remaining);
+    g_message ("CACHE LOOKUP THREAD: Valid credentials (expires in %" G_GINT64_FORMAT " seconds)", remaining);
 
+    g_atomic_int_inc (&metrics.hits);
+    g_task_return_pointer (task, cred, (GDestroyNotify) vpn_sso_cached_credential_free);
+}
+
+/*
+ * Answer a lookup from an update that has not been written yet: the
+ * backend would still return the entry it replaces.
+ */
+static void
+lookup_return_queued (GTask *task, const StoreData *queued)
+{
+    VpnSsoCachedCredential *cred;
+    gint64 now;
+
+    if (!queued->record) {
+        g_message ("CACHE LOOKUP: Credentials for %s:%s are being cleared",
+                   queued->gateway, queued->protocol);
+        g_atomic_int_inc (&metrics.misses);
+        g_task_return_pointer (task, NULL, NULL);
+        return;
+    }
+
+    cred = vpn_sso_credential_record_parse (queued->record);
+    now = g_get_real_time () / G_USEC_PER_SEC;
+    if (!cred || (cred->expires_at > 0 && now >= cred->expires_at)) {
+        vpn_sso_cached_credential_free (cred);
+        g_atomic_int_inc (&metrics.expired);
+        g_task_return_pointer (task, NULL, NULL);
+        return;
+    }
+
+    g_message ("CACHE LOOKUP: Using credentials for %s:%s not yet written to the backend",
+               queued->gateway, queued->protocol);
+    g_atomic_int_inc (&metrics.hits);
     g_task_return_pointer (task, cred, (GDestroyNotify) vpn_sso_cached_credential_free);
 }
 
 /**
  * vpn_sso_credential_cache_lookup_async:
  *
- * Looks up cached credentials from GNOME Keyring.
+ * Looks up cached credentials from @backend.
  */
 void
-vpn_sso_credential_cache_lookup_async (const gchar         *gateway,
-                                        const gchar         *protocol,
-                                        GCancellable        *cancellable,
-                                        GAsyncReadyCallback  callback,
-                                        gpointer             user_data)
+vpn_sso_credential_cache_lookup_async (VpnSsoCacheBackendType  backend,
+                                       const gchar            *gateway,
+                                       const gchar            *protocol,
+                                       GCancellable           *cancellable,
+                                       GAsyncReadyCallback     callback,
+                                       gpointer                user_data)
 {
+    const StoreData *queued;
     GTask *task;
-    LookupData *data;
 
     g_return_if_fail (gateway != NULL);
     g_return_if_fail (protocol != NULL);
@@ -542,13 +877,17 @@ vpn_sso_credential_cache_lookup_async (const gchar         *gateway,
     task = g_task_new (NULL, cancellable, callback, user_data);
     g_task_set_source_tag (task, vpn_sso_credential_cache_lookup_async);
 
-    g_message ("KEYRING LOOKUP: gateway=%s protocol=%s", gateway, protocol);
+    g_message ("CACHE LOOKUP: gateway=%s protocol=%s", gateway, protocol);
 
-    /* Store data for thread */
-    data = g_new0 (LookupData, 1);
-    data->gateway = g_strdup (gateway);
-    data->protocol = g_strdup (protocol);
-    g_task_set_task_data (task, data, (GDestroyNotify) lookup_data_free);
+    queued = write_queue_peek (backend, gateway, protocol);
+    if (queued) {
+        lookup_return_queued (task, queued);
+        g_object_unref (task);
+        return;
+    }
+
+    g_task_set_task_data (task, entry_data_new (backend, gateway, protocol),
+                          (GDestroyNotify) entry_data_free);
 
     /* Run in thread */
     g_task_run_in_thread (task, lookup_thread_func);
@@ -569,77 +908,20 @@ vpn_sso_credential_cache_lookup_finish (GAsyncResult  *result,
     return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-/*
- * Data structure for clear operation
- */
-typedef struct {
-    gchar *gateway;
-    gchar *protocol;
-} ClearData;
-
-static void
-clear_data_free (ClearData *data)
-{
-    if (data) {
-        g_free (data->gateway);
-        g_free (data->protocol);
-        g_free (data);
-    }
-}
-
-/*
- * Thread function for clearing credentials using secret-tool.
- */
-static void
-clear_thread_func (GTask        *task,
-                   gpointer      source_object G_GNUC_UNUSED,
-                   gpointer      task_data,
-                   GCancellable *cancellable G_GNUC_UNUSED)
-{
-    ClearData *data = task_data;
-    GError *error = NULL;
-
-    g_message ("KEYRING CLEAR THREAD: Clearing credentials for %s:%s",
-               data->gateway, data->protocol);
-
-    /* Build secret-tool clear command */
-    const gchar *argv[] = {
-        "/usr/bin/secret-tool", "clear",
-        "xdg:schema", "org.freedesktop.NetworkManager.vpn-sso",
-        "gateway", data->gateway,
-        "protocol", data->protocol,
-        NULL
-    };
-
-    gchar *result = run_secret_tool (argv, NULL, &error);
-    g_free (result);
-
-    if (error) {
-        g_warning ("KEYRING CLEAR THREAD: Error clearing credentials: %s", error->message);
-        g_error_free (error);
-        /* Don't fail the task - clearing is best effort */
-    } else {
-        g_message ("KEYRING CLEAR THREAD: SUCCESS - credentials cleared for %s:%s",
-                   data->gateway, data->protocol);
-    }
-
-    g_task_return_boolean (task, TRUE);
-}
-
 /**
  * vpn_sso_credential_cache_clear_async:
  *
- * Clears cached credentials for a gateway from GNOME Keyring.
+ * Clears cached credentials for a gateway from @backend.
  */
 void
-vpn_sso_credential_cache_clear_async (const gchar         *gateway,
-                                       const gchar         *protocol,
-                                       GCancellable        *cancellable,
-                                       GAsyncReadyCallback  callback,
-                                       gpointer             user_data)
+vpn_sso_credential_cache_clear_async (VpnSsoCacheBackendType  backend,
+                                      const gchar            *gateway,
+                                      const gchar            *protocol,
+                                      GCancellable           *cancellable,
+                                      GAsyncReadyCallback     callback,
+                                      gpointer                user_data)
 {
     GTask *task;
-    ClearData *data;
 
     g_return_if_fail (gateway != NULL);
     g_return_if_fail (protocol != NULL);
@@ -647,16 +929,14 @@ vpn_sso_credential_cache_clear_async (const gchar         *gateway,
     task = g_task_new (NULL, cancellable, callback, user_data);
     g_task_set_source_tag (task, vpn_sso_credential_cache_clear_async);
 
-    g_message ("KEYRING CLEAR: Clearing credentials for %s:%s", gateway, protocol);
+    g_message ("CACHE CLEAR: Clearing credentials for %s:%s", gateway, protocol);
 
-    /* Store data for thread */
-    data = g_new0 (ClearData, 1);
+    StoreData *data = g_new0 (StoreData, 1);
+    data->backend = backend;
     data->gateway = g_strdup (gateway);
     data->protocol = g_strdup (protocol);
-    g_task_set_task_data (task, data, (GDestroyNotify) clear_data_free);
 
-    /* Run in thread */
-    g_task_run_in_thread (task, clear_thread_func);
+    write_queue_push (data, task);
     g_object_unref (task);
 }
 
@@ -675,33 +955,36 @@ vpn_sso_credential_cache_clear_finish (GAsyncResult  *result,
 }
 
 /*
- * Thread function for clearing all credentials using secret-tool.
+ * Thread function for clearing all credentials.
  */
 static void
 clear_all_thread_func (GTask        *task,
                        gpointer      source_object G_GNUC_UNUSED,
-                       gpointer      task_data G_GNUC_UNUSED,
+                       gpointer      task_data,
                        GCancellable *cancellable G_GNUC_UNUSED)
 {
+    VpnSsoCacheBackendType type = GPOINTER_TO_INT (task_data);
+    const VpnSsoCacheBackend *backend;
     GError *error = NULL;
 
-    g_message ("KEYRING CLEAR ALL THREAD: Clearing all VPN SSO credentials");
+    backend = resolve_backend_for_task (task, type);
+    if (!backend)
+        return;
 
-    /* Build secret-tool clear command - clear all items with our schema */
-    const gchar *argv[] = {
-        "/usr/bin/secret-tool", "clear",
-        "xdg:schema", "org.freedesktop.NetworkManager.vpn-sso",
-        NULL
-    };
+    g_message ("CACHE CLEAR ALL THREAD [%s]: Clearing all VPN SSO credentials", backend->name);
 
-    gchar *result = run_secret_tool (argv, NULL, &error);
-    g_free (result);
+    gint64 start = g_get_monotonic_time ();
+    gboolean cleared = backend->clear_all (&error);
+    metrics_observe_latency (CACHE_OP_CLEAR_ALL, start);
 
-    if (error) {
-        g_warning ("KEYRING CLEAR ALL THREAD: Error clearing credentials: %s", error->message);
+    if (!cleared) {
+        g_atomic_int_inc (&metrics.backend_errors);
+        g_warning ("CACHE CLEAR ALL THREAD [%s]: Error clearing credentials: %s",
+                   backend->name, error->message);
         g_error_free (error);
     } else {
-        g_message ("KEYRING CLEAR ALL THREAD: SUCCESS - all credentials cleared");
+        g_message ("CACHE CLEAR ALL THREAD [%s]: SUCCESS - all credentials cleared",
+                   backend->name);
     }
 
     g_task_return_boolean (task, TRUE);
@@ -710,19 +993,21 @@ clear_all_thread_func (GTask        *task,
 /**
  * vpn_sso_credential_cache_clear_all_async:
  *
- * Clears all cached VPN SSO credentials from GNOME Keyring.
+ * Clears all cached VPN SSO credentials from @backend.
  */
 void
-vpn_sso_credential_cache_clear_all_async (GCancellable        *cancellable,
-                                           GAsyncReadyCallback  callback,
-                                           gpointer             user_data)
+vpn_sso_credential_cache_clear_all_async (VpnSsoCacheBackendType  backend,
+                                          GCancellable           *cancellable,
+                                          GAsyncReadyCallback     callback,
+                                          gpointer                user_data)
 {
     GTask *task;
 
     task = g_task_new (NULL, cancellable, callback, user_data);
     g_task_set_source_tag (task, vpn_sso_credential_cache_clear_all_async);
+    g_task_set_task_data (task, GINT_TO_POINTER (backend), NULL);
 
-    g_message ("KEYRING CLEAR ALL: Clearing all VPN SSO credentials");
+    g_message ("CACHE CLEAR ALL: Clearing all VPN SSO credentials");
 
     /* Run in thread */
     g_task_run_in_thread (task, clear_all_thread_func);
@@ -742,3 +1027,105 @@ vpn_sso_credential_cache_clear_all_finish (GAsyncResult  *result,
 
     return g_task_propagate_boolean (G_TASK (result), error);
 }
+
+/*
+ * Thread function for listing credential metadata.
+ */
+static void
+list_thread_func (GTask        *task,
+                  gpointer      source_object G_GNUC_UNUSED,
+                  gpointer      task_data,
+                  GCancellable *cancellable G_GNUC_UNUSED)
+{
+    VpnSsoCacheBackendType type = GPOINTER_TO_INT (task_data);
+    const VpnSsoCacheBackend *backend;
+    g_autoptr(GPtrArray) records = NULL;
+    GVariantBuilder builder;
+    GError *error = NULL;
+
+    backend = resolve_backend_for_task (task, type);
+    if (!backend)
+        return;
+
+    gint64 start = g_get_monotonic_time ();
+    records = backend->list (&error);
+    metrics_observe_latency (CACHE_OP_LIST, start);
+
+    if (!records) {
+        g_atomic_int_inc (&metrics.backend_errors);
+        g_warning ("CACHE LIST THREAD [%s]: Error listing credentials: %s",
+                   backend->name, error->message);
+        g_task_return_error (task, error);
+        return;
+    }
+
+    gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+    for (guint i = 0; i < records->len; i++) {
+        gchar *record = g_ptr_array_index (records, i);
+        g_autoptr(VpnSsoCachedCredential) cred = vpn_sso_credential_record_parse (record);
+
+        memset (record, 0, strlen (record));
+        if (!cred || !cred->gateway || !cred->protocol)
+            continue;
+
+        /* Metadata only: the cookie never leaves the service */
+        g_variant_builder_open (&builder, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&builder, "{sv}", "gateway", g_variant_new_string (cred->gateway));
+        g_variant_builder_add (&builder, "{sv}", "protocol", g_variant_new_string (cred->protocol));
+        if (cred->username)
+            g_variant_builder_add (&builder, "{sv}", "username", g_variant_new_string (cred->username));
+        if (cred->usergroup)
+            g_variant_builder_add (&builder, "{sv}", "usergroup", g_variant_new_string (cred->usergroup));
+        g_variant_builder_add (&builder, "{sv}", "has-fingerprint",
+                               g_variant_new_boolean (cred->fingerprint != NULL));
+        g_variant_builder_add (&builder, "{sv}", "created-at", g_variant_new_int64 (cred->created_at));
+        g_variant_builder_add (&builder, "{sv}", "expires-at", g_variant_new_int64 (cred->expires_at));
+        g_variant_builder_add (&builder, "{sv}", "expired",
+                               g_variant_new_boolean (cred->expires_at > 0 && now >= cred->expires_at));
+        g_variant_builder_add (&builder, "{sv}", "backend", g_variant_new_string (backend->name));
+        g_variant_builder_close (&builder);
+    }
+
+    g_message ("CACHE LIST THREAD [%s]: Listed %u entries", backend->name, records->len);
+
+    g_task_return_pointer (task, g_variant_ref_sink (g_variant_builder_end (&builder)),
+                           (GDestroyNotify) g_variant_unref);
+}
+
+/**
+ * vpn_sso_credential_cache_list_async:
+ *
+ * Lists metadata of all cached credentials in @backend.
+ */
+void
+vpn_sso_credential_cache_list_async (VpnSsoCacheBackendType  backend,
+                                     GCancellable           *cancellable,
+                                     GAsyncReadyCallback     callback,
+                                     gpointer                user_data)
+{
+    GTask *task;
+
+    task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_source_tag (task, vpn_sso_credential_cache_list_async);
+    g_task_set_task_data (task, GINT_TO_POINTER (backend), NULL);
+
+    /* Run in thread */
+    g_task_run_in_thread (task, list_thread_func);
+    g_object_unref (task);
+}
+
+/**
+ * vpn_sso_credential_cache_list_finish:
+ *
+ * Completes credential listing.
+ */
+GVariant *
+vpn_sso_credential_cache_list_finish (GAsyncResult  *result,
+                                       GError       **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
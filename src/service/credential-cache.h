@@ -17,9 +17,43 @@
 
 G_BEGIN_DECLS
 
-/* Default cache duration: 8 hours */
+/* Default cache duration when the gateway announces no lifetime: 8 hours */
 #define VPN_SSO_DEFAULT_CACHE_DURATION_HOURS 8
 
+/**
+ * VpnSsoCacheBackendType:
+ * @VPN_SSO_CACHE_BACKEND_AUTO: Pick the first available backend
+ * @VPN_SSO_CACHE_BACKEND_KEYRING: GNOME Keyring via secret-tool
+ * @VPN_SSO_CACHE_BACKEND_KERNEL_KEYRING: Linux kernel user keyring
+ * @VPN_SSO_CACHE_BACKEND_FILE: AES-GCM encrypted files in the cache directory
+ *
+ * Storage backend used for cached credentials.
+ */
+typedef enum {
+    VPN_SSO_CACHE_BACKEND_AUTO = 0,
+    VPN_SSO_CACHE_BACKEND_KEYRING,
+    VPN_SSO_CACHE_BACKEND_KERNEL_KEYRING,
+    VPN_SSO_CACHE_BACKEND_FILE,
+} VpnSsoCacheBackendType;
+
+/**
+ * vpn_sso_cache_backend_type_from_string:
+ * @str: (nullable): Backend name ("auto", "keyring", "kernel-keyring", "file")
+ *
+ * Parses a backend name from the connection settings.
+ *
+ * Returns: The backend type, %VPN_SSO_CACHE_BACKEND_AUTO if unknown
+ */
+VpnSsoCacheBackendType vpn_sso_cache_backend_type_from_string (const gchar *str);
+
+/**
+ * vpn_sso_cache_backend_type_to_string:
+ * @type: A #VpnSsoCacheBackendType
+ *
+ * Returns: The backend name
+ */
+const gchar *vpn_sso_cache_backend_type_to_string (VpnSsoCacheBackendType type);
+
 /**
  * VpnSsoCachedCredential:
  * @gateway: VPN gateway address
@@ -56,29 +90,40 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoCachedCredential, vpn_sso_cached_credential
 
 /**
  * vpn_sso_credential_cache_store_async:
+ * @backend: Backend of the profile, from its "cache-backend" setting
  * @gateway: VPN gateway address
  * @protocol: VPN protocol
  * @username: (nullable): Username
  * @cookie: SSO cookie to store
  * @fingerprint: (nullable): Server fingerprint
  * @usergroup: (nullable): User group
- * @cache_hours: Number of hours to cache (0 = use default)
+ * @cache_hours: Upper bound in hours (0 = no bound if @server_expires_at is
+ *   known, otherwise %VPN_SSO_DEFAULT_CACHE_DURATION_HOURS)
+ * @server_expires_at: Session expiry announced by the gateway as a Unix
+ *   timestamp, or 0 if unknown
  * @cancellable: (nullable): A #GCancellable
  * @callback: Callback function
  * @user_data: User data for callback
  *
- * Stores SSO credentials in the secure keyring.
+ * Stores SSO credentials in @backend. The entry expires at
+ * @server_expires_at, capped by @cache_hours.
+ *
+ * Writes are queued per backend/gateway/protocol on the main context:
+ * stores and clears issued close together are coalesced into the latest
+ * one and written in order. Must be called from the main context.
  */
-void vpn_sso_credential_cache_store_async (const gchar         *gateway,
-                                            const gchar         *protocol,
-                                            const gchar         *username,
-                                            const gchar         *cookie,
-                                            const gchar         *fingerprint,
-                                            const gchar         *usergroup,
-                                            gint                 cache_hours,
-                                            GCancellable        *cancellable,
-                                            GAsyncReadyCallback  callback,
-                                            gpointer             user_data);
+void vpn_sso_credential_cache_store_async (VpnSsoCacheBackendType  backend,
+                                           const gchar            *gateway,
+                                           const gchar            *protocol,
+                                           const gchar            *username,
+                                           const gchar            *cookie,
+                                           const gchar            *fingerprint,
+                                           const gchar            *usergroup,
+                                           gint                    cache_hours,
+                                           gint64                  server_expires_at,
+                                           GCancellable           *cancellable,
+                                           GAsyncReadyCallback     callback,
+                                           gpointer                user_data);
 
 /**
  * vpn_sso_credential_cache_store_finish:
@@ -92,21 +137,33 @@ void vpn_sso_credential_cache_store_async (const gchar         *gateway,
 gboolean vpn_sso_credential_cache_store_finish (GAsyncResult  *result,
                                                  GError       **error);
 
+/**
+ * vpn_sso_credential_cache_flush:
+ *
+ * Writes every store and clear still queued, and waits for them by
+ * iterating the default main context. Call before the process exits.
+ */
+void vpn_sso_credential_cache_flush (void);
+
 /**
  * vpn_sso_credential_cache_lookup_async:
+ * @backend: Backend of the profile
  * @gateway: VPN gateway address
  * @protocol: VPN protocol
  * @cancellable: (nullable): A #GCancellable
  * @callback: Callback function
  * @user_data: User data for callback
  *
- * Looks up cached SSO credentials for the given gateway.
+ * Looks up cached SSO credentials for the given gateway in @backend.
+ * A store or clear for the entry that is still queued answers the lookup
+ * instead of the backend.
  */
-void vpn_sso_credential_cache_lookup_async (const gchar         *gateway,
-                                             const gchar         *protocol,
-                                             GCancellable        *cancellable,
-                                             GAsyncReadyCallback  callback,
-                                             gpointer             user_data);
+void vpn_sso_credential_cache_lookup_async (VpnSsoCacheBackendType  backend,
+                                            const gchar            *gateway,
+                                            const gchar            *protocol,
+                                            GCancellable           *cancellable,
+                                            GAsyncReadyCallback     callback,
+                                            gpointer                user_data);
 
 /**
  * vpn_sso_credential_cache_lookup_finish:
@@ -122,19 +179,22 @@ VpnSsoCachedCredential *vpn_sso_credential_cache_lookup_finish (GAsyncResult  *r
 
 /**
  * vpn_sso_credential_cache_clear_async:
+ * @backend: Backend of the profile
  * @gateway: VPN gateway address
  * @protocol: VPN protocol
  * @cancellable: (nullable): A #GCancellable
  * @callback: Callback function
  * @user_data: User data for callback
  *
- * Removes cached credentials for the given gateway.
+ * Removes cached credentials for the given gateway from @backend.
+ * Ordered with, and coalesced into, pending stores for the same entry.
  */
-void vpn_sso_credential_cache_clear_async (const gchar         *gateway,
-                                            const gchar         *protocol,
-                                            GCancellable        *cancellable,
-                                            GAsyncReadyCallback  callback,
-                                            gpointer             user_data);
+void vpn_sso_credential_cache_clear_async (VpnSsoCacheBackendType  backend,
+                                           const gchar            *gateway,
+                                           const gchar            *protocol,
+                                           GCancellable           *cancellable,
+                                           GAsyncReadyCallback     callback,
+                                           gpointer                user_data);
 
 /**
  * vpn_sso_credential_cache_clear_finish:
@@ -150,15 +210,17 @@ gboolean vpn_sso_credential_cache_clear_finish (GAsyncResult  *result,
 
 /**
  * vpn_sso_credential_cache_clear_all_async:
+ * @backend: Backend to clear
  * @cancellable: (nullable): A #GCancellable
  * @callback: Callback function
  * @user_data: User data for callback
  *
- * Removes all cached VPN SSO credentials.
+ * Removes all cached VPN SSO credentials from @backend.
  */
-void vpn_sso_credential_cache_clear_all_async (GCancellable        *cancellable,
-                                                GAsyncReadyCallback  callback,
-                                                gpointer             user_data);
+void vpn_sso_credential_cache_clear_all_async (VpnSsoCacheBackendType  backend,
+                                               GCancellable           *cancellable,
+                                               GAsyncReadyCallback     callback,
+                                               gpointer                user_data);
 
 /**
  * vpn_sso_credential_cache_clear_all_finish:
@@ -172,6 +234,72 @@ void vpn_sso_credential_cache_clear_all_async (GCancellable        *cancellable,
 gboolean vpn_sso_credential_cache_clear_all_finish (GAsyncResult  *result,
                                                      GError       **error);
 
+/**
+ * vpn_sso_credential_cache_list_async:
+ * @backend: Backend to list
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: Callback function
+ * @user_data: User data for callback
+ *
+ * Lists all cached VPN SSO credentials in @backend. Only metadata is
+ * returned, never the cookie itself.
+ */
+void vpn_sso_credential_cache_list_async (VpnSsoCacheBackendType  backend,
+                                          GCancellable           *cancellable,
+                                          GAsyncReadyCallback     callback,
+                                          gpointer                user_data);
+
+/**
+ * vpn_sso_credential_cache_list_finish:
+ * @result: A #GAsyncResult
+ * @error: Return location for error
+ *
+ * Completes the list operation.
+ *
+ * Returns: (transfer full): An `aa{sv}` #GVariant, one dictionary per entry
+ */
+GVariant *vpn_sso_credential_cache_list_finish (GAsyncResult  *result,
+                                                 GError       **error);
+
+/**
+ * vpn_sso_credential_cache_record_fallback:
+ *
+ * Records that cached credentials were rejected by the server and a
+ * full SSO login had to be run instead.
+ */
+void vpn_sso_credential_cache_record_fallback (void);
+
+/**
+ * vpn_sso_credential_cache_load_metrics:
+ *
+ * Reads the counts earlier service processes saved, so that
+ * vpn_sso_credential_cache_get_metrics() reports totals. Call once at
+ * startup.
+ */
+void vpn_sso_credential_cache_load_metrics (void);
+
+/**
+ * vpn_sso_credential_cache_save_metrics:
+ *
+ * Adds this process's counts to the saved totals. Call once before the
+ * process exits, after vpn_sso_credential_cache_flush().
+ */
+void vpn_sso_credential_cache_save_metrics (void);
+
+/**
+ * vpn_sso_credential_cache_get_metrics:
+ *
+ * Returns a snapshot of the cache counters (hits, misses, expired,
+ * parse-failures, fallbacks, stores, ...) and per-operation backend
+ * latency histograms, totalled over the service runs since "since"
+ * (Unix time): the saved counts plus this process's. Services running
+ * for other connections at the same time are not included until they
+ * exit.
+ *
+ * Returns: (transfer floating): An `a{sv}` #GVariant
+ */
+GVariant *vpn_sso_credential_cache_get_metrics (void);
+
 G_END_DECLS
 
 #endif /* __CREDENTIAL_CACHE_H__ */
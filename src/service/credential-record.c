@@ -0,0 +1,282 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "credential-record.h"
+
+#include <string.h>
+
+/**
+ * SECTION:credential-record
+ * @short_description: Serialized form of cached credentials
+ *
+ * Entries are stored as a versioned GVariant tuple, base64-encoded so that
+ * secret-tool can pass it through stdin/stdout as text:
+ *
+ *   "vpnsso:1:" base64 ((gateway, protocol, username?, cookie?,
+ *                        fingerprint?, usergroup?, created_at, expires_at))
+ *
+ * Entries written by older versions are plain JSON objects; those are still
+ * read by parse_legacy_json() and rewritten in the new format on next store.
+ */
+#define CREDENTIAL_RECORD_PREFIX   "vpnsso:"
+#define CREDENTIAL_RECORD_VERSION  1
+#define CREDENTIAL_RECORD_TYPE_V1  "(ssmsmsmsmsxx)"
+
+void
+vpn_sso_cached_credential_free (VpnSsoCachedCredential *credential)
+{
+    if (!credential)
+        return;
+
+    g_free (credential->gateway);
+    g_free (credential->protocol);
+    g_free (credential->username);
+
+    /* Securely clear the cookie before freeing */
+    if (credential->cookie) {
+        memset (credential->cookie, 0, strlen (credential->cookie));
+        g_free (credential->cookie);
+    }
+
+    g_free (credential->fingerprint);
+    g_free (credential->usergroup);
+    g_free (credential);
+}
+
+gchar *
+vpn_sso_credential_record_serialize (const gchar *gateway,
+                                     const gchar *protocol,
+                                     const gchar *username,
+                                     const gchar *cookie,
+                                     const gchar *fingerprint,
+                                     const gchar *usergroup,
+                                     gint64       created_at,
+                                     gint64       expires_at)
+{
+    g_autoptr(GVariant) record = NULL;
+    gchar *encoded;
+    gchar *result;
+    gsize size;
+    guchar *data;
+
+    record = g_variant_ref_sink (g_variant_new (CREDENTIAL_RECORD_TYPE_V1,
+                                                gateway,
+                                                protocol,
+                                                username,
+                                                cookie,
+                                                fingerprint,
+                                                usergroup,
+                                                created_at,
+                                                expires_at));
+
+    size = g_variant_get_size (record);
+    data = g_malloc (size);
+    g_variant_store (record, data);
+
+    encoded = g_base64_encode (data, size);
+    memset (data, 0, size);
+    g_free (data);
+
+    result = g_strdup_printf (CREDENTIAL_RECORD_PREFIX "%d:%s",
+                              CREDENTIAL_RECORD_VERSION, encoded);
+    memset (encoded, 0, strlen (encoded));
+    g_free (encoded);
+
+    return result;
+}
+
+/*
+ * Decode a versioned GVariant record produced by
+ * vpn_sso_credential_record_serialize()
+ */
+static VpnSsoCachedCredential *
+parse_credential_record (const gchar *record)
+{
+    const gchar *p = record + strlen (CREDENTIAL_RECORD_PREFIX);
+    gchar *end = NULL;
+    guint64 version;
+    guchar *data;
+    gsize size = 0;
+    GVariant *value;
+    VpnSsoCachedCredential *cred;
+
+    version = g_ascii_strtoull (p, &end, 10);
+    if (end == p || *end != ':') {
+        g_warning ("CACHE: Malformed credential record header");
+        return NULL;
+    }
+
+    if (version != CREDENTIAL_RECORD_VERSION) {
+        g_warning ("CACHE: Unsupported credential record version %" G_GUINT64_FORMAT,
+                   version);
+        return NULL;
+    }
+
+    data = g_base64_decode (end + 1, &size);
+    if (!data || size == 0) {
+        g_free (data);
+        return NULL;
+    }
+
+    value = g_variant_ref_sink (g_variant_new_from_data (G_VARIANT_TYPE (CREDENTIAL_RECORD_TYPE_V1),
+                                                         data, size, FALSE, NULL, NULL));
+
+    cred = g_new0 (VpnSsoCachedCredential, 1);
+    g_variant_get (value, CREDENTIAL_RECORD_TYPE_V1,
+                   &cred->gateway,
+                   &cred->protocol,
+                   &cred->username,
+                   &cred->cookie,
+                   &cred->fingerprint,
+                   &cred->usergroup,
+                   &cred->created_at,
+                   &cred->expires_at);
+
+    g_variant_unref (value);
+    memset (data, 0, size);
+    g_free (data);
+
+    return cred;
+}
+
+/*
+ * Assign a field read from a legacy JSON entry
+ */
+static void
+set_legacy_field (VpnSsoCachedCredential *cred,
+                  const gchar *key,
+                  gsize                   key_len,
+                  gchar                  *str_value,
+                  gint64                  int_value)
+{
+    gchar **target = NULL;
+
+#define KEY_IS(name) (key_len == sizeof (name) - 1 && strncmp (key, name, key_len) == 0)
+    if (KEY_IS ("gateway"))
+        target = &cred->gateway;
+    else if (KEY_IS ("protocol"))
+        target = &cred->protocol;
+    else if (KEY_IS ("username"))
+        target = &cred->username;
+    else if (KEY_IS ("cookie"))
+        target = &cred->cookie;
+    else if (KEY_IS ("fingerprint"))
+        target = &cred->fingerprint;
+    else if (KEY_IS ("usergroup"))
+        target = &cred->usergroup;
+    else if (KEY_IS ("created_at"))
+        cred->created_at = int_value;
+    else if (KEY_IS ("expires_at"))
+        cred->expires_at = int_value;
+#undef KEY_IS
+
+    if (target && str_value) {
+        g_free (*target);
+        *target = str_value;
+        return;
+    }
+
+    if (str_value) {
+        memset (str_value, 0, strlen (str_value));
+        g_free (str_value);
+    }
+}
+
+/*
+ * Parse a legacy JSON entry in a single pass.
+ *
+ * Only the flat object written by earlier versions is understood: string
+ * values escaped with g_strescape() and unsigned integer values.
+ */
+static VpnSsoCachedCredential *
+parse_legacy_json (const gchar *json)
+{
+    VpnSsoCachedCredential *cred = g_new0 (VpnSsoCachedCredential, 1);
+    const gchar *p = json;
+
+    while (g_ascii_isspace (*p))
+        p++;
+    if (*p++ != '{')
+        goto fail;
+
+    for (;;) {
+        const gchar *key;
+        gsize key_len;
+
+        while (g_ascii_isspace (*p) || *p == ',')
+            p++;
+        if (*p == '}')
+            break;
+        if (*p++ != '"')
+            goto fail;
+
+        key = p;
+        while (*p && *p != '"')
+            p++;
+        if (*p != '"')
+            goto fail;
+        key_len = p - key;
+        p++;
+
+        while (g_ascii_isspace (*p))
+            p++;
+        if (*p++ != ':')
+            goto fail;
+        while (g_ascii_isspace (*p))
+            p++;
+
+        if (*p == '"') {
+            const gchar *value_start = ++p;
+            g_autofree gchar *escaped = NULL;
+
+            while (*p && *p != '"') {
+                if (*p == '\\' && *(p + 1))
+                    p++;
+                p++;
+            }
+            if (*p != '"')
+                goto fail;
+
+            escaped = g_strndup (value_start, p - value_start);
+            set_legacy_field (cred, key, key_len, g_strcompress (escaped), 0);
+            memset (escaped, 0, strlen (escaped));
+            p++;
+        } else if (g_ascii_isdigit (*p)) {
+            gchar *end = NULL;
+            gint64 value = g_ascii_strtoll (p, &end, 10);
+
+            set_legacy_field (cred, key, key_len, NULL, value);
+            p = end;
+        } else {
+            goto fail;
+        }
+    }
+
+    return cred;
+
+fail:
+    g_warning ("CACHE: Malformed legacy credential entry");
+    vpn_sso_cached_credential_free (cred);
+    return NULL;
+}
+
+VpnSsoCachedCredential *
+vpn_sso_credential_record_parse (const gchar *secret)
+{
+    if (!secret || !*secret)
+        return NULL;
+
+    if (g_str_has_prefix (secret, CREDENTIAL_RECORD_PREFIX))
+        return parse_credential_record (secret);
+
+    return parse_legacy_json (secret);
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __CREDENTIAL_RECORD_H__
+#define __CREDENTIAL_RECORD_H__
+
+#include "credential-cache.h"
+
+G_BEGIN_DECLS
+
+/**
+ * vpn_sso_credential_record_serialize:
+ * @gateway: VPN gateway address
+ * @protocol: VPN protocol
+ * @username: (nullable): Username
+ * @cookie: (nullable): SSO cookie
+ * @fingerprint: (nullable): Server fingerprint
+ * @usergroup: (nullable): User group
+ * @created_at: Unix timestamp of the login
+ * @expires_at: Unix timestamp the entry expires at
+ *
+ * Returns: (transfer full): The record to hand to a cache backend; clear
+ *   it before freeing, it holds the cookie
+ */
+gchar *vpn_sso_credential_record_serialize (const gchar *gateway,
+                                            const gchar *protocol,
+                                            const gchar *username,
+                                            const gchar *cookie,
+                                            const gchar *fingerprint,
+                                            const gchar *usergroup,
+                                            gint64       created_at,
+                                            gint64       expires_at);
+
+/**
+ * vpn_sso_credential_record_parse:
+ * @secret: (nullable): A record from a cache backend, in the current or
+ *   the legacy JSON format
+ *
+ * Returns: (transfer full) (nullable): The credential, or %NULL if
+ *   @secret is empty or malformed
+ */
+VpnSsoCachedCredential *vpn_sso_credential_record_parse (const gchar *secret);
+
+G_END_DECLS
+
+#endif /* __CREDENTIAL_RECORD_H__ */
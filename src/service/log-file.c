@@ -0,0 +1,214 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE             /* splice() */
+
+#include "config.h"
+#include "log-file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+/*
+ * splice(2) refuses files opened with O_APPEND, so the log is written at
+ * an explicit offset, shared by all writers under the lock.
+ */
+
+struct _VpnSsoLogFile {
+    gatomicrefcount ref_count;
+    GMutex lock;
+    gchar *path;
+    gint fd;                     /* -1 after a failed rotation */
+    loff_t offset;
+};
+
+static gint
+open_log (const gchar *path, loff_t *offset)
+{
+    gint fd = g_open (path, O_WRONLY | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+
+    if (fd < 0) {
+        g_message ("LOG: Cannot open %s: %s", path, g_strerror (errno));
+        return -1;
+    }
+
+    *offset = lseek (fd, 0, SEEK_END);
+    if (*offset < 0)
+        *offset = 0;
+
+    return fd;
+}
+
+/* Shifts name.log.N to name.log.N+1 and starts a new name.log */
+static void
+rotate_locked (VpnSsoLogFile *log)
+{
+    for (gint i = VPN_SSO_LOG_FILE_KEEP - 1; i >= 0; i--) {
+        g_autofree gchar *from = i ? g_strdup_printf ("%s.%d", log->path, i)
+                                   : g_strdup (log->path);
+        g_autofree gchar *to = g_strdup_printf ("%s.%d", log->path, i + 1);
+
+        if (g_rename (from, to) < 0 && errno != ENOENT)
+            g_message ("LOG: Cannot rotate %s: %s", from, g_strerror (errno));
+    }
+
+    if (log->fd >= 0)
+        close (log->fd);
+    log->fd = open_log (log->path, &log->offset);
+}
+
+static void
+write_locked (VpnSsoLogFile *log, const gchar *buf, gsize len)
+{
+    while (len > 0 && log->fd >= 0) {
+        gssize n = pwrite (log->fd, buf, len, log->offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        log->offset += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+VpnSsoLogFile *
+vpn_sso_log_file_open (const gchar *name)
+{
+    VpnSsoLogFile *log;
+    g_autoptr(GDateTime) now = NULL;
+    g_autofree gchar *now_str = NULL;
+    g_autofree gchar *marker = NULL;
+
+    g_return_val_if_fail (name && *name && !strchr (name, '/'), NULL);
+
+    if (g_mkdir_with_parents (VPN_SSO_LOGDIR, 0700) < 0) {
+        g_message ("LOG: Cannot create %s: %s", VPN_SSO_LOGDIR, g_strerror (errno));
+        return NULL;
+    }
+
+    log = g_new0 (VpnSsoLogFile, 1);
+    g_atomic_ref_count_init (&log->ref_count);
+    g_mutex_init (&log->lock);
+    log->path = g_strdup_printf ("%s/%s.log", VPN_SSO_LOGDIR, name);
+    log->fd = open_log (log->path, &log->offset);
+    if (log->fd < 0) {
+        vpn_sso_log_file_unref (log);
+        return NULL;
+    }
+
+    if (log->offset >= VPN_SSO_LOG_FILE_MAX_SIZE)
+        rotate_locked (log);
+
+    now = g_date_time_new_now_local ();
+    now_str = g_date_time_format_iso8601 (now);
+    marker = g_strdup_printf ("--- %s ---\n", now_str);
+    write_locked (log, marker, strlen (marker));
+
+    g_message ("LOG: Writing OpenConnect output to %s", log->path);
+    return log;
+}
+
+VpnSsoLogFile *
+vpn_sso_log_file_ref (VpnSsoLogFile *log)
+{
+    g_return_val_if_fail (log != NULL, NULL);
+
+    g_atomic_ref_count_inc (&log->ref_count);
+    return log;
+}
+
+void
+vpn_sso_log_file_unref (VpnSsoLogFile *log)
+{
+    if (!log || !g_atomic_ref_count_dec (&log->ref_count))
+        return;
+
+    if (log->fd >= 0)
+        close (log->fd);
+    g_mutex_clear (&log->lock);
+    g_free (log->path);
+    g_free (log);
+}
+
+gssize
+vpn_sso_log_file_splice (VpnSsoLogFile *log,
+                         gint           pipe_fd,
+                         gsize          len)
+{
+    gssize total = 0;
+    gint saved_errno = 0;
+
+    g_return_val_if_fail (log != NULL, -1);
+
+    g_mutex_lock (&log->lock);
+
+    if (log->fd < 0) {
+        g_mutex_unlock (&log->lock);
+        errno = EBADF;
+        return -1;
+    }
+
+    while ((gsize) total < len) {
+        gssize n = splice (pipe_fd, NULL, log->fd, &log->offset, len - total,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN) {
+            /* Pipe empty: not the end of file, the caller polls again */
+            if (total == 0) {
+                saved_errno = EAGAIN;
+                total = -1;
+            }
+            break;
+        }
+        if (n < 0 && total == 0) {
+            saved_errno = errno;
+            total = -1;
+            break;
+        }
+        if (n <= 0)
+            break;
+
+        total += n;
+    }
+
+    if (log->offset >= VPN_SSO_LOG_FILE_MAX_SIZE)
+        rotate_locked (log);
+
+    g_mutex_unlock (&log->lock);
+
+    if (total < 0)
+        errno = saved_errno;
+    return total;
+}
+
+void
+vpn_sso_log_file_write (VpnSsoLogFile *log,
+                        const gchar   *buf,
+                        gsize          len)
+{
+    g_return_if_fail (log != NULL);
+
+    g_mutex_lock (&log->lock);
+
+    write_locked (log, buf, len);
+    if (log->offset >= VPN_SSO_LOG_FILE_MAX_SIZE)
+        rotate_locked (log);
+
+    g_mutex_unlock (&log->lock);
+}
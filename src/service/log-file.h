@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __LOG_FILE_H__
+#define __LOG_FILE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Size at which a log is rotated, and rotated logs kept (name.log.1 ...) */
+#define VPN_SSO_LOG_FILE_MAX_SIZE (4 * 1024 * 1024)
+#define VPN_SSO_LOG_FILE_KEEP     3
+
+/**
+ * VpnSsoLogFile:
+ *
+ * A per-connection log under %VPN_SSO_LOGDIR that pipe output is spliced
+ * into without passing through user space. Thread-safe, so the stdout and
+ * stderr readers of one process can share it.
+ */
+typedef struct _VpnSsoLogFile VpnSsoLogFile;
+
+/**
+ * vpn_sso_log_file_open:
+ * @name: Log name, e.g. the connection UUID; the file is @name.log
+ *
+ * Opens the log for appending, rotating it first if it has grown too
+ * large, and marks the start of a new run in it.
+ *
+ * Returns: (transfer full) (nullable): The log, or %NULL if it cannot be
+ *   opened (the reason is logged)
+ */
+VpnSsoLogFile *vpn_sso_log_file_open (const gchar *name);
+
+VpnSsoLogFile *vpn_sso_log_file_ref (VpnSsoLogFile *log);
+void vpn_sso_log_file_unref (VpnSsoLogFile *log);
+
+/**
+ * vpn_sso_log_file_splice:
+ * @log: A #VpnSsoLogFile
+ * @pipe_fd: Read end of a pipe
+ * @len: Most bytes to move
+ *
+ * Moves up to @len bytes that are already in the pipe into the log with
+ * splice(2), without waiting for more.
+ *
+ * Returns: Bytes moved, 0 at end of file, -1 with errno %EAGAIN if the
+ *   pipe is empty, or -1 with another errno if splice(2) cannot be used
+ */
+gssize vpn_sso_log_file_splice (VpnSsoLogFile *log,
+                                gint           pipe_fd,
+                                gsize          len);
+
+/**
+ * vpn_sso_log_file_write:
+ * @log: A #VpnSsoLogFile
+ * @buf: Data
+ * @len: Length of @buf
+ *
+ * Copies @buf into the log, for data that has been read already.
+ */
+void vpn_sso_log_file_write (VpnSsoLogFile *log,
+                             const gchar   *buf,
+                             gsize          len);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoLogFile, vpn_sso_log_file_unref)
+
+G_END_DECLS
+
+#endif /* __LOG_FILE_H__ */
@@ -11,6 +11,10 @@
 
 #include "config.h"
 #include "nm-vpn-sso-service.h"
+#include "credential-cache.h"
+#include "credential-cache-dbus.h"
+#include "preauth-dbus.h"
+#include "process-scope-dbus.h"
 #include "utils.h"
 
 #include <stdio.h>
@@ -195,6 +199,41 @@ main (int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    /* Cache metrics are totals over service runs */
+    vpn_sso_credential_cache_load_metrics ();
+
+    /* Export the credential cache admin interface */
+    GDBusConnection *system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+    guint cache_admin_id = 0;
+    guint preauth_id = 0;
+    guint processes_id = 0;
+
+    if (system_bus)
+        cache_admin_id = vpn_sso_credential_cache_dbus_register (system_bus, &error);
+    if (!cache_admin_id) {
+        g_warning ("Failed to export credential cache admin interface: %s",
+                   error ? error->message : "unknown error");
+        g_clear_error (&error);
+    }
+
+    /* Export the interface of the login-time pre-authentication agent */
+    if (system_bus)
+        preauth_id = vpn_sso_preauth_dbus_register (system_bus, &error);
+    if (!preauth_id) {
+        g_warning ("Failed to export pre-authentication interface: %s",
+                   error ? error->message : "unknown error");
+        g_clear_error (&error);
+    }
+
+    /* Export the child process resource usage interface */
+    if (system_bus)
+        processes_id = vpn_sso_process_scope_dbus_register (system_bus, &error);
+    if (!processes_id) {
+        g_warning ("Failed to export process interface: %s",
+                   error ? error->message : "unknown error");
+        g_clear_error (&error);
+    }
+
     /* Create main loop */
     main_loop = g_main_loop_new (NULL, FALSE);
 
@@ -216,7 +255,21 @@ main (int argc, char **argv)
 
     g_message ("Main loop exited, cleaning up");
 
+    /* Cookies stored just before the quit must not be lost */
+    vpn_sso_credential_cache_flush ();
+    vpn_sso_credential_cache_save_metrics ();
+
     /* Cleanup */
+    if (system_bus) {
+        if (cache_admin_id)
+            g_dbus_connection_unregister_object (system_bus, cache_admin_id);
+        if (preauth_id)
+            g_dbus_connection_unregister_object (system_bus, preauth_id);
+        if (processes_id)
+            g_dbus_connection_unregister_object (system_bus, processes_id);
+        g_object_unref (system_bus);
+    }
+
     if (vpn_service) {
         g_object_unref (vpn_service);
         vpn_service = NULL;
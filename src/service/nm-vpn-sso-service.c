@@ -12,12 +12,23 @@
 #include "config.h"
 #include "nm-vpn-sso-service.h"
 #include "credential-cache.h"
+#include "cookie-probe.h"
+#include "cookie-rejection.h"
+#include "portal-cache.h"
+#include "cert-pin-store.h"
+#include "child-process.h"
+#include "pipe-drain.h"
+#include "log-file.h"
+#include "sso-progress.h"
+#include "flat-json.h"
 #include "utils.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <pwd.h>
@@ -37,6 +48,16 @@
 #define NM_VPN_SSO_KEY_EXTRA_ARGS   "extra-args"
 #define NM_VPN_SSO_KEY_CACHE_HOURS  "cache-hours"
 #define NM_VPN_SSO_KEY_HEADLESS     "headless"
+#define NM_VPN_SSO_KEY_CACHE_BACKEND "cache-backend"
+#define NM_VPN_SSO_KEY_COOKIE_PROBE "cookie-probe"
+#define NM_VPN_SSO_KEY_HEDGE_DELAY  "hedge-delay"
+#define NM_VPN_SSO_KEY_GP_DIRECT    "gp-direct-gateway"
+#define NM_VPN_SSO_KEY_SSO_GROUP    "sso-group"
+#define NM_VPN_SSO_KEY_LOG_FILE     "log-file"
+#define NM_VPN_SSO_KEY_SSO_HELPER   "sso-helper"
+
+/* Seconds to wait for a cached cookie before starting SSO in parallel */
+#define NM_VPN_SSO_DEFAULT_HEDGE_DELAY 10
 #define NM_VPN_SSO_SECRET_PASSWORD  "password"
 #define NM_VPN_SSO_SECRET_TOTP      "totp-secret"
 
@@ -44,12 +65,25 @@
 #define NM_VPN_SSO_PROTOCOL_GP      "globalprotect"
 #define NM_VPN_SSO_PROTOCOL_AC      "anyconnect"
 
+/* Credential cache protocol key for GlobalProtect gateway cookies; portal
+ * cookies are stored under NM_VPN_SSO_PROTOCOL_GP */
+#define NM_VPN_SSO_CACHE_GP_GATEWAY "globalprotect-gateway"
+
 /* Bundled Python SSO helper */
 #define BUNDLED_PY_SSO              VPN_SSO_LIBEXECDIR "/gnome-vpn-sso/vpn-sso-auth"
 
+/* Native WebKitGTK SSO helper, chosen with sso-helper=webkit */
+#define BUNDLED_WEBKIT_SSO          VPN_SSO_LIBEXECDIR "/gnome-vpn-sso/vpn-sso-webkit"
+
 /* Process watch interval (ms) */
 #define PROCESS_WATCH_INTERVAL 1000
 
+/* Longest the SSO helper waits for the gateway address lookup (ms) */
+#define SSO_RESOLVE_TIMEOUT_MS 1000
+
+/* Browsers installed by install.sh, unless the service is told otherwise */
+#define DEFAULT_BROWSERS_PATH  "/var/cache/ms-playwright"
+
 typedef enum {
     VPN_STATE_IDLE,
     VPN_STATE_AUTHENTICATING,
@@ -59,6 +93,24 @@ typedef enum {
     VPN_STATE_FAILED
 } VpnConnectionState;
 
+/* Another profile in the same sso-group, signed in by our SSO run */
+typedef struct {
+    gchar *gateway;
+    gchar *protocol;
+    gchar *username;
+    gint cache_hours;
+    VpnSsoCacheBackendType cache_backend;
+} SsoPeer;
+
+static void
+sso_peer_free (SsoPeer *peer)
+{
+    g_free (peer->gateway);
+    g_free (peer->protocol);
+    g_free (peer->username);
+    g_free (peer);
+}
+
 struct _NmVpnSsoServicePrivate {
     /* Connection state */
     VpnConnectionState state;
@@ -70,8 +122,19 @@ struct _NmVpnSsoServicePrivate {
     char *usergroup;
     char *extra_args;
     gint cache_hours;
+    VpnSsoCacheBackendType cache_backend;
     gboolean headless;
     gboolean headless_set;
+    gboolean webkit_helper;      /* sso-helper=webkit */
+
+    /* Profiles sharing an IdP session, signed in together */
+    char *sso_group;
+    char *connection_uuid;
+    char *service_type;
+    GPtrArray *sso_peers;        /* SsoPeer, NULL until listed */
+    GCancellable *peers_cancellable;     /* Listing the connections, from connect */
+    gboolean spawn_after_peers;          /* The helper waits for the list */
+    gchar *peers_gateway_ip;             /* For the helper started then */
 
     /* SSO authentication */
     char *sso_cookie;
@@ -81,18 +144,23 @@ struct _NmVpnSsoServicePrivate {
     GIOChannel *sso_stderr;
     guint sso_stdout_watch;
     guint sso_stderr_watch;
-    guint sso_child_watch;
+    VpnSsoChild *sso_child;
     GString *sso_output;
+    VpnSsoPipeDrain *sso_progress;       /* Helper progress events */
+    gboolean sso_cookie_event;           /* OpenConnect started on the cookie event */
+    gchar *sso_error_class;              /* From the helper's error event */
+    GCancellable *resolve_cancellable;   /* Gateway lookup before the helper starts */
+    guint resolve_timer;
 
     /* OpenConnect process */
     GPid openconnect_pid;
-    GIOChannel *openconnect_stdout;
-    GIOChannel *openconnect_stderr;
+    VpnSsoPipeDrain *openconnect_stdout;
+    VpnSsoPipeDrain *openconnect_stderr;
     GIOChannel *openconnect_stdin;
-    guint openconnect_stdout_watch;
-    guint openconnect_stderr_watch;
-    guint openconnect_child_watch;
+    VpnSsoChild *openconnect_child;
     guint openconnect_watch_timer;
+    gboolean log_file;           /* Capture output in VPN_SSO_LOGDIR */
+    VpnSsoLogFile *openconnect_log;
 
     /* IP4 configuration */
     char *tundev;          /* Tunnel device name (e.g., "tun0") */
@@ -108,6 +176,39 @@ struct _NmVpnSsoServicePrivate {
 
     /* Cached credential tracking for fallback to SSO */
     gboolean using_cached_credentials;
+    gboolean cookie_probe;
+    GCancellable *probe_cancellable;
+
+    /* Hedged authentication: speculative SSO while a cached cookie is tried */
+    gint hedge_delay;            /* Seconds, 0 = disabled */
+    guint hedge_timer;
+    gboolean hedging;
+
+    /* GlobalProtect portal configuration, for logging in to the gateway
+     * directly on reconnect */
+    gboolean gp_direct;
+    char *direct_gateway;        /* Gateway to log in to, NULL = via portal */
+    GPtrArray *portal_gateways;  /* Gateway hosts listed by the portal */
+    char *login_gateway;         /* Gateway openconnect logged in to */
+
+    /* GlobalProtect gateway authcookie, used to bring the tunnel up
+     * without the portal and gateway logins */
+    char *gateway_cookie;
+    char *gateway_fingerprint;
+    char *tunnel_gateway;        /* Gateway the cookie belongs to */
+    gboolean gateway_cookie_cached;
+    GString *gp_auth_output;     /* Non-NULL while openconnect --authenticate runs */
+
+    /* AnyConnect server certificate pins, kept apart from the cookie */
+    gchar **cert_pins;           /* From the pin store, newest first */
+    guint cert_pin_index;        /* Candidate currently tried */
+    gchar *servercert;           /* Pin passed to this run, NULL = CA validation */
+    gchar *observed_pin;         /* Pin openconnect reported on a mismatch */
+    gboolean cert_mismatch;
+
+    /* Session limits announced by the gateway (0 = unknown) */
+    gint64 session_expires_at;   /* Unix timestamp */
+    gint idle_timeout;           /* Seconds */
 
     /* Optional secrets for headless SSO */
     char *password;
@@ -121,8 +222,11 @@ typedef struct _SsoChildSetupData SsoChildSetupData;
 static gboolean connect_to_vpn (NmVpnSsoService *self, GError **error);
 static void cleanup_connection (NmVpnSsoService *self);
 static void start_sso_authentication (NmVpnSsoService *self);
+static void spawn_sso_helper (NmVpnSsoService *self, const gchar *gateway_ip);
 static void start_openconnect (NmVpnSsoService *self);
-static gchar **build_subprocess_environment (SsoChildSetupData **out_setup_data);
+static void discard_cached_credentials (NmVpnSsoService *self);
+static gchar **build_subprocess_environment (SsoChildSetupData  **out_setup_data,
+                                             VpnSsoSessionEnv   **out_session_env);
 
 /*
  * Credential cache callbacks
@@ -151,22 +255,180 @@ store_credentials_in_cache (NmVpnSsoService *self)
         return;
     }
 
-    g_message ("Storing SSO credentials in cache for %s (%s) - expires in %d hours",
-               priv->gateway, priv->protocol,
-               priv->cache_hours > 0 ? priv->cache_hours : VPN_SSO_DEFAULT_CACHE_DURATION_HOURS);
+    /* The GlobalProtect session lifetime belongs to the gateway cookie;
+     * the portal cookie is only bounded by cache-hours */
+    gint64 server_expires_at = g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_GP) == 0 ?
+                               0 : priv->session_expires_at;
 
-    vpn_sso_credential_cache_store_async (priv->gateway,
+    g_message ("Storing SSO credentials in cache for %s (%s) - cache-hours bound %d, server expiry %" G_GINT64_FORMAT,
+               priv->gateway, priv->protocol, priv->cache_hours, server_expires_at);
+
+    vpn_sso_credential_cache_store_async (priv->cache_backend,
+                                          priv->gateway,
                                           priv->protocol,
                                           priv->username,
                                           priv->sso_cookie,
                                           priv->sso_fingerprint,
                                           priv->usergroup,
                                           priv->cache_hours,
+                                          server_expires_at,
+                                          NULL, /* cancellable */
+                                          credential_store_cb,
+                                          self);
+}
+
+static void
+store_gateway_credentials_in_cache (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (!priv->gateway_cookie || !priv->tunnel_gateway)
+        return;
+
+    g_message ("Storing GlobalProtect gateway cookie in cache for %s - server expiry %" G_GINT64_FORMAT,
+               priv->tunnel_gateway, priv->session_expires_at);
+
+    vpn_sso_credential_cache_store_async (priv->cache_backend,
+                                          priv->tunnel_gateway,
+                                          NM_VPN_SSO_CACHE_GP_GATEWAY,
+                                          priv->username,
+                                          priv->gateway_cookie,
+                                          priv->gateway_fingerprint,
+                                          NULL,
+                                          priv->cache_hours,
+                                          priv->session_expires_at,
                                           NULL, /* cancellable */
                                           credential_store_cb,
                                           self);
 }
 
+/*
+ * Refresh whichever cache entry the gateway's session lifetime applies to.
+ */
+static void
+store_session_credentials_in_cache (NmVpnSsoService *self)
+{
+    if (g_strcmp0 (self->priv->protocol, NM_VPN_SSO_PROTOCOL_GP) == 0)
+        store_gateway_credentials_in_cache (self);
+    else
+        store_credentials_in_cache (self);
+}
+
+static void
+cookie_probe_cb (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+    g_autoptr(GError) error = NULL;
+    VpnSsoCookieProbeResult probe;
+
+    probe = vpn_sso_cookie_probe_finish (result, &error);
+
+    /* Cancelled by disconnect; self may already be gone */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    g_clear_object (&priv->probe_cancellable);
+
+    if (probe == VPN_SSO_COOKIE_PROBE_REJECTED) {
+        g_message ("Gateway rejected cached cookie - clearing cache and starting SSO");
+        discard_cached_credentials (self);
+        start_sso_authentication (self);
+        return;
+    }
+
+    start_openconnect (self);
+}
+
+/*
+ * Continue with the portal (or AnyConnect) cookie found in the cache, or
+ * start SSO if there is none.
+ */
+static void
+use_cached_credentials (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (!priv->using_cached_credentials) {
+        g_message ("No valid cached credentials found for %s (%s) - starting SSO",
+                   priv->gateway, priv->protocol);
+        g_clear_pointer (&priv->direct_gateway, g_free);
+        start_sso_authentication (self);
+        return;
+    }
+
+    /* Only a portal cookie can be presented to the gateway directly */
+    if (priv->direct_gateway &&
+        g_strcmp0 (priv->usergroup, "portal:portal-userauthcookie") != 0)
+        g_clear_pointer (&priv->direct_gateway, g_free);
+
+    if (priv->direct_gateway)
+        g_message ("Using cached portal configuration - logging in to gateway %s directly",
+                   priv->direct_gateway);
+
+    /* Skip SSO and go directly to OpenConnect */
+    priv->state = VPN_STATE_CONNECTING;
+
+    /* The probe asks the portal, which a direct login skips anyway */
+    if (priv->cookie_probe && !priv->direct_gateway) {
+        /* Check the cookie first so a stale one goes straight to SSO */
+        g_clear_object (&priv->probe_cancellable);
+        priv->probe_cancellable = g_cancellable_new ();
+        vpn_sso_cookie_probe_async (priv->gateway, priv->protocol,
+                                    priv->username, priv->usergroup,
+                                    priv->sso_cookie,
+                                    VPN_SSO_COOKIE_PROBE_TIMEOUT_MS,
+                                    priv->probe_cancellable,
+                                    cookie_probe_cb,
+                                    self);
+        return;
+    }
+
+    start_openconnect (self);
+}
+
+static void
+gateway_credential_lookup_cb (GObject      *source,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+    NmVpnSsoServicePrivate *priv = self->priv;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(VpnSsoCachedCredential) cached = NULL;
+
+    cached = vpn_sso_credential_cache_lookup_finish (result, &error);
+
+    if (error)
+        g_message ("Gateway cookie lookup failed: %s", error->message);
+
+    if (cached && cached->cookie && *cached->cookie) {
+        g_message ("Found cached gateway cookie for %s - skipping portal and gateway login",
+                   priv->direct_gateway);
+
+        g_free (priv->gateway_cookie);
+        priv->gateway_cookie = g_strdup (cached->cookie);
+        g_free (priv->gateway_fingerprint);
+        priv->gateway_fingerprint = g_strdup (cached->fingerprint);
+        g_free (priv->tunnel_gateway);
+        priv->tunnel_gateway = g_strdup (priv->direct_gateway);
+        priv->gateway_cookie_cached = TRUE;
+
+        if (cached->username && !priv->username)
+            priv->username = g_strdup (cached->username);
+
+        priv->using_cached_credentials = TRUE;
+        priv->state = VPN_STATE_CONNECTING;
+        start_openconnect (self);
+        return;
+    }
+
+    use_cached_credentials (self);
+}
+
 static void
 credential_lookup_cb (GObject      *source,
                       GAsyncResult *result,
@@ -200,6 +462,14 @@ credential_lookup_cb (GObject      *source,
         if (cached->fingerprint) {
             g_free (priv->sso_fingerprint);
             priv->sso_fingerprint = g_strdup (cached->fingerprint);
+
+            /* Records written before the pin store existed */
+            if (g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_AC) == 0) {
+                g_auto(GStrv) pins = vpn_sso_cert_pins_get (priv->gateway);
+
+                if (!pins)
+                    vpn_sso_cert_pins_add (priv->gateway, cached->fingerprint);
+            }
         }
 
         if (cached->username && !priv->username) {
@@ -217,15 +487,155 @@ credential_lookup_cb (GObject      *source,
 
         /* Mark that we're using cached credentials for fallback handling */
         priv->using_cached_credentials = TRUE;
+    } else {
+        priv->using_cached_credentials = FALSE;
+    }
+
+    /* A known gateway lets OpenConnect skip the portal */
+    g_clear_pointer (&priv->direct_gateway, g_free);
+    if (priv->gp_direct && g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_GP) == 0) {
+        g_autoptr(VpnSsoPortalConfig) portal =
+            vpn_sso_portal_cache_lookup (priv->gateway,
+                                         VPN_SSO_PORTAL_CACHE_TTL_SECONDS);
+
+        if (portal)
+            priv->direct_gateway = g_strdup (portal->selected_gateway);
+    }
+
+    /* A gateway cookie skips the gateway login as well */
+    if (priv->direct_gateway) {
+        vpn_sso_credential_cache_lookup_async (priv->cache_backend,
+                                               priv->direct_gateway,
+                                               NM_VPN_SSO_CACHE_GP_GATEWAY,
+                                               NULL, /* cancellable */
+                                               gateway_credential_lookup_cb,
+                                               self);
+        return;
+    }
+
+    use_cached_credentials (self);
+}
+
+/*
+ * Forget credentials that came from the cache after the gateway refused
+ * them, so the next attempt runs a fresh SSO login.
+ */
+static void
+discard_cached_credentials (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    vpn_sso_credential_cache_record_fallback ();
+    vpn_sso_credential_cache_clear_async (priv->cache_backend,
+                                          priv->gateway, priv->protocol,
+                                          NULL, NULL, NULL);
+
+    g_clear_pointer (&priv->sso_cookie, g_free);
+    g_clear_pointer (&priv->sso_fingerprint, g_free);
+    priv->using_cached_credentials = FALSE;
+    g_clear_pointer (&priv->direct_gateway, g_free);
+
+    if (priv->gateway_cookie_cached)
+        vpn_sso_credential_cache_clear_async (priv->cache_backend,
+                                              priv->tunnel_gateway,
+                                              NM_VPN_SSO_CACHE_GP_GATEWAY,
+                                              NULL, NULL, NULL);
+    g_clear_pointer (&priv->gateway_cookie, g_free);
+    g_clear_pointer (&priv->gateway_fingerprint, g_free);
+    g_clear_pointer (&priv->tunnel_gateway, g_free);
+    priv->gateway_cookie_cached = FALSE;
+}
+
+/*
+ * A GlobalProtect login with cached credentials failed before the tunnel
+ * came up. Step down one level before giving up on the cache:
+ *
+ *   cached gateway cookie -> gateway login with the portal cookie
+ *   direct gateway login  -> login through the portal
+ *
+ * Returns: TRUE if OpenConnect was restarted
+ */
+static gboolean
+step_down_cached_login (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (priv->state == VPN_STATE_CONNECTED)
+        return FALSE;
+
+    if (priv->gateway_cookie_cached) {
+        g_message ("Cached gateway cookie for %s failed - logging in again",
+                   priv->tunnel_gateway);
+
+        vpn_sso_credential_cache_clear_async (priv->cache_backend,
+                                              priv->tunnel_gateway,
+                                              NM_VPN_SSO_CACHE_GP_GATEWAY,
+                                              NULL, NULL, NULL);
+        g_clear_pointer (&priv->gateway_cookie, g_free);
+        g_clear_pointer (&priv->gateway_fingerprint, g_free);
+        g_clear_pointer (&priv->tunnel_gateway, g_free);
+        priv->gateway_cookie_cached = FALSE;
+
+        if (!priv->sso_cookie)
+            return FALSE;
+
+        if (g_strcmp0 (priv->usergroup, "portal:portal-userauthcookie") != 0)
+            g_clear_pointer (&priv->direct_gateway, g_free);
 
-        /* Skip SSO and go directly to OpenConnect */
         priv->state = VPN_STATE_CONNECTING;
         start_openconnect (self);
-    } else {
-        g_message ("No valid cached credentials found for %s (%s) - starting SSO",
-                   priv->gateway, priv->protocol);
-        priv->using_cached_credentials = FALSE;
-        start_sso_authentication (self);
+        return TRUE;
+    }
+
+    if (!priv->direct_gateway || !priv->sso_cookie)
+        return FALSE;
+
+    g_message ("Direct login to gateway %s failed - retrying through portal %s",
+               priv->direct_gateway, priv->gateway);
+
+    vpn_sso_portal_cache_clear (priv->gateway);
+    g_clear_pointer (&priv->direct_gateway, g_free);
+
+    priv->state = VPN_STATE_CONNECTING;
+    start_openconnect (self);
+    return TRUE;
+}
+
+/*
+ * Drop an OpenConnect attempt that lost the race against a hedged SSO
+ * login. The process is terminated and reaped in the background so a new
+ * OpenConnect can take over the per-connection state.
+ */
+static void
+abandon_openconnect (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (!priv->openconnect_pid)
+        return;
+
+    g_message ("Abandoning OpenConnect (PID %d) started with cached cookie",
+               priv->openconnect_pid);
+
+    g_clear_pointer (&priv->openconnect_stdout, vpn_sso_pipe_drain_free);
+    g_clear_pointer (&priv->openconnect_stderr, vpn_sso_pipe_drain_free);
+    if (priv->openconnect_stdin) {
+        g_io_channel_unref (priv->openconnect_stdin);
+        priv->openconnect_stdin = NULL;
+    }
+
+    /* Reaped in the background */
+    vpn_sso_child_signal (priv->openconnect_child, SIGTERM);
+    g_clear_pointer (&priv->openconnect_child, vpn_sso_child_release);
+    priv->openconnect_pid = 0;
+
+    g_clear_pointer (&priv->tundev, g_free);
+    g_clear_pointer (&priv->ip4_address, g_free);
+    g_clear_pointer (&priv->ip4_gateway, g_free);
+
+    if (priv->gp_auth_output) {
+        g_string_free (priv->gp_auth_output, TRUE);
+        priv->gp_auth_output = NULL;
     }
 }
 
@@ -311,6 +721,13 @@ parse_sso_cookie (NmVpnSsoService *self, const char *output)
 {
     NmVpnSsoServicePrivate *priv = self->priv;
     const char *cookie_start, *cookie_end;
+    g_autofree gchar *own_output = NULL;
+
+    /* Credentials for sso-group peers follow our own; see
+     * store_sso_peer_credentials() */
+    cookie_end = strstr (output, "\nTARGET=");
+    if (cookie_end)
+        output = own_output = g_strndup (output, cookie_end - output);
 
     /* First, try generic KEY=VALUE output (vpn-sso-auth). */
     {
@@ -421,6 +838,223 @@ parse_sso_cookie (NmVpnSsoService *self, const char *output)
     }
 }
 
+static SsoPeer *
+find_sso_peer (NmVpnSsoService *self,
+               const gchar     *protocol,
+               const gchar     *gateway)
+{
+    GPtrArray *peers = self->priv->sso_peers;
+
+    for (guint i = 0; peers && i < peers->len; i++) {
+        SsoPeer *peer = g_ptr_array_index (peers, i);
+
+        if (g_strcmp0 (peer->protocol, protocol) == 0 &&
+            g_strcmp0 (peer->gateway, gateway) == 0)
+            return peer;
+    }
+
+    return NULL;
+}
+
+/*
+ * Cache the credentials the helper collected for other profiles in our
+ * sso-group, so that bringing those up does not need another login.
+ * Each peer follows the primary output as its own section:
+ *
+ *   TARGET=anyconnect:vpn2.example.com
+ *   FINGERPRINT=sha256:...
+ *   COOKIE=...
+ */
+static void
+store_sso_peer_credentials (NmVpnSsoService *self, const gchar *output)
+{
+    const gchar *section = strstr (output, "\nTARGET=");
+
+    while (section) {
+        g_autofree gchar *block = NULL;
+        g_auto(GStrv) lines = NULL;
+        g_autofree gchar *protocol = NULL;
+        const gchar *gateway = NULL;
+        const gchar *cookie = NULL;
+        const gchar *fingerprint = NULL;
+        const gchar *usergroup = NULL;
+        const gchar *username = NULL;
+        const gchar *next;
+        SsoPeer *peer;
+
+        section += strlen ("\nTARGET=");
+        next = strstr (section, "\nTARGET=");
+        block = next ? g_strndup (section, next - section) : g_strdup (section);
+        section = next;
+
+        lines = g_strsplit (block, "\n", -1);
+        for (gint i = 0; lines[i]; i++) {
+            gchar *line = g_strstrip (lines[i]);
+
+            if (i == 0) {
+                gchar *colon = strchr (line, ':');
+                if (colon) {
+                    protocol = g_strndup (line, colon - line);
+                    gateway = colon + 1;
+                }
+            } else if (g_str_has_prefix (line, "COOKIE=")) {
+                cookie = line + 7;
+            } else if (g_str_has_prefix (line, "FINGERPRINT=")) {
+                fingerprint = line + 12;
+            } else if (g_str_has_prefix (line, "USERGROUP=")) {
+                usergroup = line + 10;
+            } else if (g_str_has_prefix (line, "USERNAME=")) {
+                username = line + 9;
+            }
+        }
+
+        peer = find_sso_peer (self, protocol, gateway);
+        if (!peer) {
+            g_message ("SSO GROUP: Ignoring credentials for unknown gateway %s", gateway);
+            continue;
+        }
+        if (!cookie || !*cookie) {
+            g_message ("SSO GROUP: No cookie collected for %s", peer->gateway);
+            continue;
+        }
+
+        if (fingerprint && g_strcmp0 (peer->protocol, NM_VPN_SSO_PROTOCOL_AC) == 0)
+            vpn_sso_cert_pins_add (peer->gateway, fingerprint);
+
+        g_message ("SSO GROUP: Storing credentials for %s (%s)",
+                   peer->gateway, peer->protocol);
+        vpn_sso_credential_cache_store_async (peer->cache_backend,
+                                              peer->gateway,
+                                              peer->protocol,
+                                              peer->username ? peer->username : username,
+                                              cookie,
+                                              fingerprint,
+                                              usergroup,
+                                              peer->cache_hours,
+                                              0, /* server expiry unknown */
+                                              NULL, /* cancellable */
+                                              credential_store_cb,
+                                              self);
+    }
+}
+
+/*
+ * Fresh credentials from the helper: keep them and bring the tunnel up.
+ */
+static void
+start_with_sso_credentials (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    /* The helper read the certificate over a validated connection */
+    if (g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_AC) == 0 && priv->sso_fingerprint) {
+        vpn_sso_cert_pins_add (priv->gateway, priv->sso_fingerprint);
+        g_clear_pointer (&priv->cert_pins, g_strfreev);
+        priv->cert_pin_index = 0;
+    }
+
+    /* Store credentials in cache for future connections */
+    store_credentials_in_cache (self);
+    /* Fresh credentials from SSO - don't retry SSO if these fail */
+    priv->using_cached_credentials = FALSE;
+    priv->state = VPN_STATE_CONNECTING;
+    start_openconnect (self);
+}
+
+/*
+ * The helper reports its cookie as soon as the login is done, while it
+ * still signs in sso-group peers and shuts Chromium down. Start
+ * OpenConnect right away instead of waiting for it to exit.
+ */
+static void
+handle_sso_cookie_event (NmVpnSsoService     *self,
+                         VpnSsoProgressEvent *event)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (priv->sso_cookie_event || !event->cookie || !*event->cookie)
+        return;
+
+    if (priv->hedging) {
+        /* Cached cookie won the race; the exit handler ignores this run */
+        if (priv->state == VPN_STATE_CONNECTED)
+            return;
+
+        g_message ("Speculative SSO finished first - replacing cached cookie attempt");
+        priv->hedging = FALSE;
+        abandon_openconnect (self);
+        discard_cached_credentials (self);
+    }
+
+    g_free (priv->sso_cookie);
+    priv->sso_cookie = g_strdup (event->cookie);
+    g_free (priv->sso_fingerprint);
+    priv->sso_fingerprint = g_strdup (event->fingerprint);
+    if (event->usergroup) {
+        g_free (priv->usergroup);
+        priv->usergroup = g_strdup (event->usergroup);
+    }
+    if (event->username && (!priv->username || !*priv->username)) {
+        g_free (priv->username);
+        priv->username = g_strdup (event->username);
+    }
+
+    g_message ("SSO PROGRESS: Cookie received - starting OpenConnect while the helper finishes");
+    priv->sso_cookie_event = TRUE;
+    start_with_sso_credentials (self);
+}
+
+static gboolean
+sso_progress_line_cb (const gchar *line, gpointer user_data)
+{
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+    NmVpnSsoServicePrivate *priv = self->priv;
+    g_autoptr(VpnSsoProgressEvent) event = NULL;
+    g_autoptr(GError) error = NULL;
+
+    event = vpn_sso_progress_event_parse (line, &error);
+    if (!event) {
+        g_message ("SSO PROGRESS: Ignoring malformed event: %s", error->message);
+        return TRUE;
+    }
+
+    switch (event->type) {
+    case VPN_SSO_PROGRESS_PHASE_STARTED:
+        g_message ("SSO PROGRESS: %s started", event->phase ? event->phase : "(unnamed)");
+        break;
+    case VPN_SSO_PROGRESS_PHASE_DONE:
+        g_message ("SSO PROGRESS: %s done in %" G_GINT64_FORMAT " ms",
+                   event->phase ? event->phase : "(unnamed)", event->duration_ms);
+        break;
+    case VPN_SSO_PROGRESS_COOKIE:
+        handle_sso_cookie_event (self, event);
+        break;
+    case VPN_SSO_PROGRESS_ERROR:
+        g_message ("SSO PROGRESS: Login failed (%s): %s",
+                   event->error_class ? event->error_class : "unknown",
+                   event->message ? event->message : "");
+        g_free (priv->sso_error_class);
+        priv->sso_error_class = g_strdup (event->error_class);
+        break;
+    case VPN_SSO_PROGRESS_UNKNOWN:
+        break;
+    }
+
+    return TRUE;
+}
+
+/* Network trouble is not the user's doing; anything else fails the login */
+static NMVpnPluginFailure
+sso_failure_reason (NmVpnSsoService *self)
+{
+    const gchar *error_class = self->priv->sso_error_class;
+
+    if (g_strcmp0 (error_class, "network") == 0 || g_strcmp0 (error_class, "timeout") == 0)
+        return NM_VPN_PLUGIN_FAILURE_CONNECT_FAILED;
+
+    return NM_VPN_PLUGIN_FAILURE_LOGIN_FAILED;
+}
+
 static void
 sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
 {
@@ -429,6 +1063,10 @@ sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
 
     g_message ("SSO process exited with status %d", status);
 
+    /* The last events, the cookie among them, may still be in the pipe */
+    if (priv->sso_progress)
+        vpn_sso_pipe_drain_finish (g_steal_pointer (&priv->sso_progress));
+
     /* Clean up SSO process resources */
     if (priv->sso_stdout_watch) {
         g_source_remove (priv->sso_stdout_watch);
@@ -447,9 +1085,51 @@ sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
         priv->sso_stderr = NULL;
     }
 
-    g_spawn_close_pid (pid);
+    g_clear_pointer (&priv->sso_child, vpn_sso_child_release);
     priv->sso_pid = 0;
-    priv->sso_child_watch = 0;
+
+    /* OpenConnect already runs on the cookie event's credentials; only
+     * those the helper collected for sso-group peers are left */
+    if (priv->sso_cookie_event) {
+        priv->sso_cookie_event = FALSE;
+        if (WIFEXITED (status) && WEXITSTATUS (status) == 0 && priv->sso_output)
+            store_sso_peer_credentials (self, priv->sso_output->str);
+        else
+            g_message ("SSO helper failed after delivering the cookie - ignoring");
+        if (priv->sso_output) {
+            g_string_free (priv->sso_output, TRUE);
+            priv->sso_output = NULL;
+        }
+        return;
+    }
+
+    if (priv->hedging) {
+        priv->hedging = FALSE;
+
+        if (priv->state == VPN_STATE_CONNECTED) {
+            /* Cached cookie won the race; this SSO run was cancelled */
+            g_message ("Speculative SSO finished after tunnel came up - ignoring");
+            if (priv->sso_output) {
+                g_string_free (priv->sso_output, TRUE);
+                priv->sso_output = NULL;
+            }
+            return;
+        }
+
+        if (!(WIFEXITED (status) && WEXITSTATUS (status) == 0) && priv->openconnect_pid) {
+            g_message ("Speculative SSO failed - still waiting for cached cookie");
+            if (priv->sso_output) {
+                g_string_free (priv->sso_output, TRUE);
+                priv->sso_output = NULL;
+            }
+            return;
+        }
+
+        /* SSO won: drop the cached-cookie attempt and use the fresh cookie */
+        g_message ("Speculative SSO finished first - replacing cached cookie attempt");
+        abandon_openconnect (self);
+        discard_cached_credentials (self);
+    }
 
     /*
      * Both protocols now use the same flow:
@@ -468,12 +1148,8 @@ sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
 
             if (priv->sso_cookie) {
                 g_message ("AnyConnect SSO successful, starting OpenConnect with cookie");
-                /* Store credentials in cache for future connections */
-                store_credentials_in_cache (self);
-                /* Fresh credentials from SSO - don't retry SSO if these fail */
-                priv->using_cached_credentials = FALSE;
-                priv->state = VPN_STATE_CONNECTING;
-                start_openconnect (self);
+                store_sso_peer_credentials (self, priv->sso_output->str);
+                start_with_sso_credentials (self);
             } else {
                 g_warning ("AnyConnect SSO completed but no cookie found");
                 nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
@@ -485,7 +1161,7 @@ sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
             g_warning ("AnyConnect SSO authentication failed (exit status %d)",
                        WIFEXITED (status) ? WEXITSTATUS (status) : -1);
             nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
-                                          NM_VPN_PLUGIN_FAILURE_LOGIN_FAILED);
+                                          sso_failure_reason (self));
             cleanup_connection (self);
         }
     } else {
@@ -496,12 +1172,8 @@ sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
 
             if (priv->sso_cookie) {
                 g_message ("SSO authentication successful, starting OpenConnect");
-                /* Store credentials in cache for future connections */
-                store_credentials_in_cache (self);
-                /* Fresh credentials from SSO - don't retry SSO if these fail */
-                priv->using_cached_credentials = FALSE;
-                priv->state = VPN_STATE_CONNECTING;
-                start_openconnect (self);
+                store_sso_peer_credentials (self, priv->sso_output->str);
+                start_with_sso_credentials (self);
             } else {
                 g_warning ("SSO authentication completed but no cookie found");
                 nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
@@ -511,7 +1183,7 @@ sso_child_watch_cb (GPid pid, gint status, gpointer user_data)
         } else {
             g_warning ("SSO authentication failed");
             nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
-                                          NM_VPN_PLUGIN_FAILURE_LOGIN_FAILED);
+                                          sso_failure_reason (self));
             cleanup_connection (self);
         }
     }
@@ -543,12 +1215,27 @@ sso_child_setup_data_free (SsoChildSetupData *data)
     }
 }
 
+/*
+ * Report a child setup failure on the child's stderr, which the service
+ * logs through sso_stderr_cb(). Only write(2) is allowed between fork()
+ * and exec(); GLib logging may deadlock on a lock held at fork time.
+ */
+static void
+sso_child_setup_report (const char *message)
+{
+    ssize_t G_GNUC_UNUSED ret;
+
+    ret = write (STDERR_FILENO, message, strlen (message));
+}
+
 /**
  * sso_child_setup:
  *
  * Child setup function called after fork() but before exec().
  * Drops privileges from root to the target user so that the
  * Qt WebEngine browser can run (Chromium refuses to run as root).
+ *
+ * Must stay async-signal-safe.
  */
 static void
 sso_child_setup (gpointer user_data)
@@ -564,27 +1251,33 @@ sso_child_setup (gpointer user_data)
 
     /* Clear supplementary groups */
     if (setgroups (0, NULL) < 0) {
-        g_warning ("Failed to clear supplementary groups: %s", g_strerror (errno));
+        sso_child_setup_report ("vpn-sso: failed to clear supplementary groups\n");
         /* Continue anyway */
     }
 
     /* Set the group ID first (must be done before setuid) */
     if (setgid (data->gid) < 0) {
-        g_warning ("Failed to setgid(%d): %s", data->gid, g_strerror (errno));
+        sso_child_setup_report ("vpn-sso: failed to set group ID\n");
         _exit (1);
     }
 
     /* Set the user ID */
     if (setuid (data->uid) < 0) {
-        g_warning ("Failed to setuid(%d): %s", data->uid, g_strerror (errno));
+        sso_child_setup_report ("vpn-sso: failed to set user ID\n");
         _exit (1);
     }
 
-    /* Change to user's home directory */
-    if (data->home && chdir (data->home) < 0) {
-        /* Non-fatal - just log it */
-        g_debug ("Failed to chdir to %s: %s", data->home, g_strerror (errno));
-    }
+    /* Change to user's home directory (non-fatal) */
+    if (data->home && chdir (data->home) < 0)
+        sso_child_setup_report ("vpn-sso: failed to change to home directory\n");
+}
+
+static const gchar *
+sso_browsers_path (void)
+{
+    const gchar *path = g_getenv ("PLAYWRIGHT_BROWSERS_PATH");
+
+    return path && *path ? path : DEFAULT_BROWSERS_PATH;
 }
 
 /**
@@ -597,12 +1290,15 @@ sso_child_setup (gpointer user_data)
  * @out_setup_data: (out) (optional): If non-NULL, returns a
  *                  SsoChildSetupData struct that should be passed
  *                  to sso_child_setup. Caller should free with g_free().
+ * @out_session_env: (out) (optional): If non-NULL, returns the session
+ *                  the environment was built for.
  *
  * Returns: (transfer full): A null-terminated array of environment
  *          strings, or NULL on failure. Free with g_strfreev().
  */
 static gchar **
-build_subprocess_environment (SsoChildSetupData **out_setup_data)
+build_subprocess_environment (SsoChildSetupData  **out_setup_data,
+                              VpnSsoSessionEnv   **out_session_env)
 {
     g_autoptr(VpnSsoSessionEnv) session_env = NULL;
     GPtrArray *env_array;
@@ -612,6 +1308,8 @@ build_subprocess_environment (SsoChildSetupData **out_setup_data)
 
     if (out_setup_data)
         *out_setup_data = NULL;
+    if (out_session_env)
+        *out_session_env = NULL;
 
     session_env = vpn_sso_get_graphical_session_env ();
     if (!session_env) {
@@ -674,8 +1372,7 @@ build_subprocess_environment (SsoChildSetupData **out_setup_data)
     /* Add some standard environment variables that Python/Qt might need */
     g_ptr_array_add (env_array, g_strdup ("QT_QPA_PLATFORM=xcb"));
     g_ptr_array_add (env_array, g_strdup ("GDK_BACKEND=x11"));
-    if (!g_getenv ("PLAYWRIGHT_BROWSERS_PATH"))
-        g_ptr_array_add (env_array, g_strdup ("PLAYWRIGHT_BROWSERS_PATH=/var/cache/ms-playwright"));
+    g_ptr_array_add (env_array, g_strdup_printf ("PLAYWRIGHT_BROWSERS_PATH=%s", sso_browsers_path ()));
 
     /* Null-terminate the array */
     g_ptr_array_add (env_array, NULL);
@@ -686,30 +1383,244 @@ build_subprocess_environment (SsoChildSetupData **out_setup_data)
                session_env->xdg_runtime_dir ? session_env->xdg_runtime_dir : "(null)",
                session_env->home ? session_env->home : "(null)");
 
+    if (out_session_env)
+        *out_session_env = g_steal_pointer (&session_env);
+
     return (gchar **) g_ptr_array_free (env_array, FALSE);
 }
 
+/*
+ * Collect the other VPN SSO profiles with our sso-group. They share an
+ * IdP session with this one, so the helper can sign in to all of them
+ * with a single login.
+ */
 static void
-start_sso_authentication (NmVpnSsoService *self)
+collect_sso_peers (NmVpnSsoService *self,
+                   NMClient        *client)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    const GPtrArray *connections;
+
+    connections = nm_client_get_connections (client);
+    for (guint i = 0; i < connections->len; i++) {
+        NMConnection *connection = NM_CONNECTION (g_ptr_array_index (connections, i));
+        NMSettingVpn *s_vpn = nm_connection_get_setting_vpn (connection);
+        const char *gateway, *protocol, *value;
+        SsoPeer *peer;
+
+        if (!s_vpn ||
+            g_strcmp0 (nm_connection_get_uuid (connection), priv->connection_uuid) == 0 ||
+            g_strcmp0 (nm_setting_vpn_get_service_type (s_vpn), priv->service_type) != 0 ||
+            g_strcmp0 (nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_SSO_GROUP),
+                       priv->sso_group) != 0)
+            continue;
+
+        gateway = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_GATEWAY);
+        protocol = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_PROTOCOL);
+        if (!gateway || !*gateway ||
+            (g_strcmp0 (protocol, NM_VPN_SSO_PROTOCOL_GP) != 0 &&
+             g_strcmp0 (protocol, NM_VPN_SSO_PROTOCOL_AC) != 0) ||
+            find_sso_peer (self, protocol, gateway) ||
+            (g_strcmp0 (protocol, priv->protocol) == 0 &&
+             g_strcmp0 (gateway, priv->gateway) == 0))
+            continue;
+
+        peer = g_new0 (SsoPeer, 1);
+        peer->gateway = g_strdup (gateway);
+        peer->protocol = g_strdup (protocol);
+        value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_USERNAME);
+        peer->username = value && *value ? g_strdup (value) : NULL;
+        value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_CACHE_HOURS);
+        peer->cache_hours = value ? atoi (value) : 0;
+        value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_CACHE_BACKEND);
+        peer->cache_backend = vpn_sso_cache_backend_type_from_string (value);
+        g_ptr_array_add (priv->sso_peers, peer);
+
+        g_message ("SSO GROUP: Also signing in to %s (%s, profile '%s')",
+                   gateway, protocol, nm_connection_get_id (connection));
+    }
+}
+
+static void
+sso_peers_client_cb (GObject      *source G_GNUC_UNUSED,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+    g_autoptr(NMClient) client = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *gateway_ip = NULL;
+
+    client = nm_client_new_finish (result, &error);
+
+    /* Cancelled by disconnect or the next connect */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    g_clear_object (&priv->peers_cancellable);
+
+    if (client)
+        collect_sso_peers (self, client);
+    else
+        g_message ("SSO GROUP: Cannot list connections: %s", error->message);
+
+    if (priv->spawn_after_peers) {
+        priv->spawn_after_peers = FALSE;
+        gateway_ip = g_steal_pointer (&priv->peers_gateway_ip);
+        spawn_sso_helper (self, gateway_ip);
+    }
+}
+
+/*
+ * Ask NetworkManager for the connections while the cache lookup runs, so
+ * the main loop does not block on it; a helper that needs the list before
+ * it arrives waits for it.
+ */
+static void
+list_sso_peers (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    g_clear_pointer (&priv->sso_peers, g_ptr_array_unref);
+    priv->sso_peers = g_ptr_array_new_with_free_func ((GDestroyNotify) sso_peer_free);
+
+    if (priv->peers_cancellable) {
+        g_cancellable_cancel (priv->peers_cancellable);
+        g_clear_object (&priv->peers_cancellable);
+    }
+
+    /* Only the Playwright helper can sign in to several gateways */
+    if (!priv->sso_group || !*priv->sso_group || priv->webkit_helper)
+        return;
+
+    priv->peers_cancellable = g_cancellable_new ();
+    nm_client_new_async (priv->peers_cancellable, sso_peers_client_cb, self);
+}
+
+/*
+ * Build the one-line JSON context the helper reads from stdin: who it runs
+ * as, where its browsers and caches are, the gateway address and the
+ * secrets. With it the helper skips its own session discovery, and the
+ * secrets stay out of the environment (readable in /proc by the user).
+ */
+static GString *
+build_sso_context (NmVpnSsoService    *self,
+                   VpnSsoSessionEnv   *session_env,
+                   SsoChildSetupData  *setup_data,
+                   const gchar        *gateway_ip)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    g_autofree gchar *cache_dir = NULL;
+    GString *json;
+
+    /* Sized up front so no copy of the secrets is left behind by a realloc */
+    json = g_string_sized_new (4096);
+    g_string_append_c (json, '{');
+
+    if (setup_data && session_env) {
+        vpn_sso_json_add_string (json, "user", session_env->username);
+        vpn_sso_json_add_string (json, "home", setup_data->home);
+        if (setup_data->home)
+            cache_dir = g_build_filename (setup_data->home, ".cache", "gnome-vpn-sso", NULL);
+    } else {
+        vpn_sso_json_add_string (json, "user", g_get_user_name ());
+        vpn_sso_json_add_string (json, "home", g_get_home_dir ());
+        if (getuid () == 0)
+            cache_dir = g_strdup (VPN_SSO_CACHEDIR);
+        else
+            cache_dir = g_build_filename (g_get_user_cache_dir (), "gnome-vpn-sso", NULL);
+    }
+
+    vpn_sso_json_add_string (json, "browsers_path", sso_browsers_path ());
+    vpn_sso_json_add_string (json, "cache_dir", cache_dir);
+    vpn_sso_json_add_string (json, "gateway_ip", gateway_ip);
+    vpn_sso_json_add_string (json, "password", priv->password);
+    vpn_sso_json_add_string (json, "totp_secret", priv->totp_secret);
+    g_string_append (json, "}\n");
+
+    return json;
+}
+
+static void
+write_sso_context (GIOChannel *channel,
+                   GString    *context)
+{
+    g_autoptr(GError) error = NULL;
+    gsize bytes_written;
+
+    /* Far below the pipe buffer, so this does not block */
+    if (g_io_channel_write_chars (channel, context->str, context->len,
+                                  &bytes_written, &error) != G_IO_STATUS_NORMAL)
+        g_warning ("Failed to pass context to SSO helper: %s",
+                   error ? error->message : "short write");
+
+    g_io_channel_shutdown (channel, TRUE, NULL);
+}
+
+/* Both ends of the progress pipe, when the helper did not get the write end */
+static void
+close_progress_pipe (gint fds[2])
+{
+    for (guint i = 0; i < 2; i++) {
+        if (fds[i] >= 0)
+            close (fds[i]);
+        fds[i] = -1;
+    }
+}
+
+static void
+spawn_sso_helper (NmVpnSsoService *self,
+                  const gchar     *gateway_ip)
 {
     NmVpnSsoServicePrivate *priv = self->priv;
     GError *error = NULL;
     GPtrArray *argv;
+    g_autoptr(GPtrArray) also_args = NULL;
+    g_autoptr(VpnSsoSessionEnv) session_env = NULL;
+    GString *context;
+    GIOChannel *sso_stdin;
     gchar **envp;
-    gint sso_stdout_fd, sso_stderr_fd;
+    gint sso_stdin_fd, sso_stdout_fd, sso_stderr_fd;
+    gint progress_fds[2] = { -1, -1 };
+    const gint progress_target_fd = VPN_SSO_PROGRESS_FD;
+
+    /* The sso-group peers are still being listed */
+    if (priv->peers_cancellable) {
+        g_message ("SSO GROUP: Waiting for the connection list");
+        priv->spawn_after_peers = TRUE;
+        g_free (priv->peers_gateway_ip);
+        priv->peers_gateway_ip = g_strdup (gateway_ip);
+        return;
+    }
 
     g_message ("Starting SSO authentication for protocol: %s", priv->protocol);
 
-    priv->sso_output = g_string_new ("");
+    priv->sso_cookie_event = FALSE;
+    g_clear_pointer (&priv->sso_error_class, g_free);
     argv = g_ptr_array_new ();
 
+    /* Without the progress pipe, the credentials are read from stdout
+     * once the helper has exited */
+    if (!g_unix_open_pipe (progress_fds, FD_CLOEXEC, &error)) {
+        g_message ("SSO PROGRESS: Cannot create pipe: %s", error->message);
+        g_clear_error (&error);
+        progress_fds[0] = progress_fds[1] = -1;
+    }
+
     if (g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_GP) == 0 ||
         g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_AC) == 0) {
-        g_ptr_array_add (argv, (gpointer) BUNDLED_PY_SSO);
+        g_ptr_array_add (argv, (gpointer) (priv->webkit_helper ? BUNDLED_WEBKIT_SSO : BUNDLED_PY_SSO));
         g_ptr_array_add (argv, (gpointer) "--protocol");
         g_ptr_array_add (argv, (gpointer) priv->protocol);
         g_ptr_array_add (argv, (gpointer) "--gateway");
         g_ptr_array_add (argv, (gpointer) priv->gateway);
+        g_ptr_array_add (argv, (gpointer) "--context-stdin");
+        if (progress_fds[1] >= 0) {
+            g_ptr_array_add (argv, (gpointer) "--progress-fd");
+            g_ptr_array_add (argv, (gpointer) G_STRINGIFY (VPN_SSO_PROGRESS_FD));
+        }
         if (priv->username && *priv->username) {
             g_ptr_array_add (argv, (gpointer) "--username");
             g_ptr_array_add (argv, (gpointer) priv->username);
@@ -722,11 +1633,22 @@ start_sso_authentication (NmVpnSsoService *self)
         if (g_getenv ("VPN_SSO_DEBUG")) {
             g_ptr_array_add (argv, (gpointer) "--debug");
         }
+
+        also_args = g_ptr_array_new_with_free_func (g_free);
+        for (guint i = 0; priv->sso_peers && i < priv->sso_peers->len; i++) {
+            SsoPeer *peer = g_ptr_array_index (priv->sso_peers, i);
+            gchar *target = g_strdup_printf ("%s:%s", peer->protocol, peer->gateway);
+
+            g_ptr_array_add (also_args, target);
+            g_ptr_array_add (argv, (gpointer) "--also");
+            g_ptr_array_add (argv, target);
+        }
     } else {
         g_warning ("Unknown protocol: %s", priv->protocol);
         nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
                                       NM_VPN_PLUGIN_FAILURE_CONNECT_FAILED);
         g_ptr_array_free (argv, TRUE);
+        close_progress_pipe (progress_fds);
         return;
     }
 
@@ -735,15 +1657,11 @@ start_sso_authentication (NmVpnSsoService *self)
     /* Build environment with display variables for GUI and get user credentials
      * for dropping privileges (Qt WebEngine refuses to run as root) */
     SsoChildSetupData *setup_data = NULL;
-    envp = build_subprocess_environment (&setup_data);
+    envp = build_subprocess_environment (&setup_data, &session_env);
     if (envp) {
         GPtrArray *env_array = g_ptr_array_new_with_free_func (g_free);
         for (gint i = 0; envp[i]; i++)
             g_ptr_array_add (env_array, g_strdup (envp[i]));
-        if (priv->password && *priv->password)
-            g_ptr_array_add (env_array, g_strdup_printf ("VPN_SSO_PASSWORD=%s", priv->password));
-        if (priv->totp_secret && *priv->totp_secret)
-            g_ptr_array_add (env_array, g_strdup_printf ("VPN_SSO_TOTP_SECRET=%s", priv->totp_secret));
         g_ptr_array_add (env_array, g_strdup ("PYTHONUNBUFFERED=1"));
         g_ptr_array_add (env_array, NULL);
         g_strfreev (envp);
@@ -754,18 +1672,24 @@ start_sso_authentication (NmVpnSsoService *self)
         /* Continue anyway, some systems might work without explicit env */
     }
 
-    if (!g_spawn_async_with_pipes (NULL, /* working_directory */
-                                   (gchar **) argv->pdata,
-                                   envp,
-                                   G_SPAWN_DO_NOT_REAP_CHILD, /* No SEARCH_PATH - using absolute paths */
-                                   sso_child_setup, /* Drop privileges to user */
-                                   setup_data, /* user_data for child_setup */
-                                   &priv->sso_pid,
-                                   NULL, /* stdin */
-                                   &sso_stdout_fd,
-                                   &sso_stderr_fd,
-                                   &error)) {
+    /* The write end of the progress pipe becomes the helper's fd 3 */
+    if (!g_spawn_async_with_pipes_and_fds (NULL, /* working_directory */
+                                           (const gchar * const *) argv->pdata,
+                                           (const gchar * const *) envp,
+                                           G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_CLOEXEC_PIPES, /* No SEARCH_PATH - using absolute paths */
+                                           sso_child_setup, /* Drop privileges to user */
+                                           setup_data, /* user_data for child_setup */
+                                           -1, -1, -1, /* stdin, stdout, stderr: pipes */
+                                           &progress_fds[1],
+                                           &progress_target_fd,
+                                           progress_fds[1] >= 0 ? 1 : 0,
+                                           &priv->sso_pid,
+                                           &sso_stdin_fd,
+                                           &sso_stdout_fd,
+                                           &sso_stderr_fd,
+                                           &error)) {
         g_warning ("Failed to spawn SSO process: %s", error->message);
+        close_progress_pipe (progress_fds);
         nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
                                       NM_VPN_PLUGIN_FAILURE_CONNECT_FAILED);
         g_error_free (error);
@@ -775,40 +1699,321 @@ start_sso_authentication (NmVpnSsoService *self)
         return;
     }
 
-    g_strfreev (envp);
-    sso_child_setup_data_free (setup_data);
+    g_message ("SSO process started with PID %d", priv->sso_pid);
+
+    /* Only now, so the failure paths above have nothing to release */
+    priv->sso_output = g_string_new ("");
+
+    if (progress_fds[0] >= 0) {
+        close (progress_fds[1]);
+        priv->sso_progress = vpn_sso_pipe_drain_new (progress_fds[0], "SSO progress", NULL,
+                                                     sso_progress_line_cb, self);
+    }
+
+    context = build_sso_context (self, session_env, setup_data, gateway_ip);
+    sso_stdin = g_io_channel_unix_new (sso_stdin_fd);
+    g_io_channel_set_encoding (sso_stdin, NULL, NULL);
+    g_io_channel_set_buffered (sso_stdin, FALSE);
+    write_sso_context (sso_stdin, context);
+    g_io_channel_unref (sso_stdin);
+    memset (context->str, 0, context->allocated_len);
+    g_string_free (context, TRUE);
+
+    g_strfreev (envp);
+    sso_child_setup_data_free (setup_data);
+
+    /* Set up I/O channels */
+    priv->sso_stdout = g_io_channel_unix_new (sso_stdout_fd);
+    priv->sso_stderr = g_io_channel_unix_new (sso_stderr_fd);
+    g_io_channel_set_encoding (priv->sso_stdout, NULL, NULL);
+    g_io_channel_set_encoding (priv->sso_stderr, NULL, NULL);
+    g_io_channel_set_buffered (priv->sso_stdout, FALSE);
+    g_io_channel_set_buffered (priv->sso_stderr, FALSE);
+
+    priv->sso_stdout_watch = g_io_add_watch (priv->sso_stdout,
+                                            G_IO_IN | G_IO_HUP,
+                                            sso_stdout_cb,
+                                            self);
+    priv->sso_stderr_watch = g_io_add_watch (priv->sso_stderr,
+                                            G_IO_IN | G_IO_HUP,
+                                            sso_stderr_cb,
+                                            self);
+
+    priv->sso_child = vpn_sso_child_new (priv->sso_pid, "SSO helper", priv->gateway,
+                                         sso_child_watch_cb, self);
+
+    priv->state = VPN_STATE_AUTHENTICATING;
+
+    g_ptr_array_free (argv, TRUE);
+}
+
+static void
+stop_gateway_resolve (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (priv->resolve_timer) {
+        g_source_remove (priv->resolve_timer);
+        priv->resolve_timer = 0;
+    }
+    if (priv->resolve_cancellable) {
+        g_cancellable_cancel (priv->resolve_cancellable);
+        g_clear_object (&priv->resolve_cancellable);
+    }
+
+    /* A start waiting for the sso-group peers; the list itself stays */
+    priv->spawn_after_peers = FALSE;
+    g_clear_pointer (&priv->peers_gateway_ip, g_free);
+}
+
+/* Whether the SSO helper runs or is about to start */
+static gboolean
+sso_helper_pending (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    return priv->sso_pid || priv->resolve_cancellable || priv->spawn_after_peers;
+}
+
+static gboolean
+gateway_resolve_timeout_cb (gpointer user_data)
+{
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+
+    self->priv->resolve_timer = 0;
+    g_message ("Gateway lookup is slow - starting SSO without its address");
+    stop_gateway_resolve (self);
+    spawn_sso_helper (self, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+gateway_resolve_cb (GObject      *source,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *address = NULL;
+    GList *addresses;
+
+    addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (source), result, &error);
+
+    /* Cancelled by disconnect or the timeout, which went on without us */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+
+    stop_gateway_resolve (self);
+
+    if (addresses) {
+        address = g_inet_address_to_string (G_INET_ADDRESS (addresses->data));
+        g_resolver_free_addresses (addresses);
+    } else {
+        g_message ("Cannot resolve gateway: %s", error->message);
+    }
+
+    spawn_sso_helper (self, address);
+}
+
+/*
+ * Start the SSO helper once the gateway address is known, so it can tell
+ * the VPN server's callback by address as well as by name. The lookup
+ * mostly hits the resolver cache; a slow one is not waited for.
+ */
+static void
+start_sso_authentication (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    g_autoptr(GSocketConnectable) connectable = NULL;
+    g_autoptr(GResolver) resolver = NULL;
+    const gchar *host = NULL;
+
+    /* Already on its way */
+    if (priv->resolve_cancellable || priv->spawn_after_peers)
+        return;
+
+    if (priv->gateway) {
+        if (strstr (priv->gateway, "://"))
+            connectable = g_network_address_parse_uri (priv->gateway, 443, NULL);
+        else
+            connectable = g_network_address_parse (priv->gateway, 443, NULL);
+    }
+    if (connectable)
+        host = g_network_address_get_hostname (G_NETWORK_ADDRESS (connectable));
+
+    if (!host || g_hostname_is_ip_address (host)) {
+        spawn_sso_helper (self, host);
+        return;
+    }
+
+    priv->resolve_cancellable = g_cancellable_new ();
+    priv->resolve_timer = g_timeout_add (SSO_RESOLVE_TIMEOUT_MS,
+                                         gateway_resolve_timeout_cb, self);
+    resolver = g_resolver_get_default ();
+    g_resolver_lookup_by_name_async (resolver, host, priv->resolve_cancellable,
+                                     gateway_resolve_cb, self);
+}
+
+/*
+ * OpenConnect Process Handlers
+ */
+
+/*
+ * Parse the ctime()-style date OpenConnect prints for the AnyConnect
+ * session expiry, e.g. "Wed Jun 30 21:49:08 2024", in local time.
+ */
+static gint64
+parse_ctime_timestamp (const gchar *str)
+{
+    static const gchar *months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+    };
+    gchar month_name[4] = { 0 };
+    gint day, hour, minute, second, year;
+    gint month = 0;
+
+    if (sscanf (str, "%*3s %3s %d %d:%d:%d %d",
+                month_name, &day, &hour, &minute, &second, &year) != 6)
+        return 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS (months); i++) {
+        if (g_strcmp0 (month_name, months[i]) == 0) {
+            month = i + 1;
+            break;
+        }
+    }
+    if (month == 0)
+        return 0;
+
+    g_autoptr(GDateTime) dt = g_date_time_new_local (year, month, day, hour, minute, second);
+
+    return dt ? g_date_time_to_unix (dt) : 0;
+}
+
+/*
+ * Pick up the session lifetime and idle timeout the gateway announces, so
+ * cached cookies expire when the server says rather than after a fixed
+ * number of hours. OpenConnect reports:
+ *   AnyConnect:    "Session authentication will expire at <ctime>"
+ *   GlobalProtect: "Session will expire after N minutes."
+ *   Both:          "Idle timeout is N minutes."
+ */
+static void
+parse_session_lifetime (NmVpnSsoService *self, const gchar *buf)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    gint64 expires_at = 0;
+    const gchar *p;
+    gint minutes;
+
+    p = strstr (buf, "Session authentication will expire at ");
+    if (p)
+        expires_at = parse_ctime_timestamp (p + strlen ("Session authentication will expire at "));
+
+    p = strstr (buf, "Session will expire after ");
+    if (p && sscanf (p, "Session will expire after %d minutes", &minutes) == 1 && minutes > 0)
+        expires_at = g_get_real_time () / G_USEC_PER_SEC + (gint64) minutes * 60;
+
+    p = strstr (buf, "Idle timeout is ");
+    if (p && sscanf (p, "Idle timeout is %d minutes", &minutes) == 1 && minutes > 0) {
+        priv->idle_timeout = minutes * 60;
+        g_message ("Gateway idle timeout: %d minutes", minutes);
+    }
+
+    if (expires_at > 0 && expires_at != priv->session_expires_at) {
+        priv->session_expires_at = expires_at;
+        g_message ("Gateway session lifetime: expires in %" G_GINT64_FORMAT " minutes",
+                   (expires_at - g_get_real_time () / G_USEC_PER_SEC) / 60);
 
-    g_message ("SSO process started with PID %d", priv->sso_pid);
+        /* Refresh the cache entry with the server-derived expiry */
+        store_session_credentials_in_cache (self);
+    }
+}
 
-    /* Set up I/O channels */
-    priv->sso_stdout = g_io_channel_unix_new (sso_stdout_fd);
-    priv->sso_stderr = g_io_channel_unix_new (sso_stderr_fd);
-    g_io_channel_set_encoding (priv->sso_stdout, NULL, NULL);
-    g_io_channel_set_encoding (priv->sso_stderr, NULL, NULL);
-    g_io_channel_set_buffered (priv->sso_stdout, FALSE);
-    g_io_channel_set_buffered (priv->sso_stderr, FALSE);
+/*
+ * Pick up the GlobalProtect portal configuration from OpenConnect's log:
+ *
+ *   2 gateway servers available:
+ *     Europe (gw-eu.example.com)
+ *     US (gw-us.example.com)
+ *   ...
+ *   POST https://gw-eu.example.com/ssl-vpn/login.esp
+ *
+ * The login.esp request names the gateway that was actually chosen.
+ */
+static void
+parse_portal_config (NmVpnSsoService *self, const gchar *buf)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    const gchar *p;
 
-    priv->sso_stdout_watch = g_io_add_watch (priv->sso_stdout,
-                                            G_IO_IN | G_IO_HUP,
-                                            sso_stdout_cb,
-                                            self);
-    priv->sso_stderr_watch = g_io_add_watch (priv->sso_stderr,
-                                            G_IO_IN | G_IO_HUP,
-                                            sso_stderr_cb,
-                                            self);
+    p = strstr (buf, "gateway servers available:");
+    if (p) {
+        g_auto(GStrv) lines = NULL;
 
-    priv->sso_child_watch = g_child_watch_add (priv->sso_pid,
-                                              sso_child_watch_cb,
-                                              self);
+        g_clear_pointer (&priv->portal_gateways, g_ptr_array_unref);
+        priv->portal_gateways = g_ptr_array_new_with_free_func (g_free);
 
-    priv->state = VPN_STATE_AUTHENTICATING;
+        p = strchr (p, '\n');
+        lines = g_strsplit (p ? p + 1 : "", "\n", -1);
+        for (gchar **line = lines; *line; line++) {
+            const gchar *open, *close;
 
-    g_ptr_array_free (argv, TRUE);
+            if (!g_str_has_prefix (*line, "  "))
+                break;
+            open = strrchr (*line, '(');
+            close = open ? strchr (open, ')') : NULL;
+            if (!close || close == open + 1)
+                continue;
+            g_ptr_array_add (priv->portal_gateways, g_strndup (open + 1, close - open - 1));
+        }
+        g_message ("Portal lists %u gateway(s)", priv->portal_gateways->len);
+    }
+
+    p = strstr (buf, "POST https://");
+    if (p) {
+        const gchar *host = p + 13;
+        const gchar *end = strchr (host, '/');
+
+        if (end && g_str_has_prefix (end, "/ssl-vpn/login.esp")) {
+            g_free (priv->login_gateway);
+            priv->login_gateway = g_strndup (host, end - host);
+            g_message ("Logging in to gateway %s", priv->login_gateway);
+        }
+    }
 }
 
 /*
- * OpenConnect Process Handlers
+ * OpenConnect reports a --servercert mismatch as
+ *   "Server SSL certificate didn't match: pin-sha256:..."
+ * naming the fingerprint the server actually presented.
  */
+static void
+parse_cert_mismatch (NmVpnSsoService *self, const gchar *buf)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    const gchar *p;
+
+    p = strstr (buf, "certificate didn't match");
+    if (!p)
+        return;
+
+    priv->cert_mismatch = TRUE;
+
+    p = strchr (p, ':');
+    if (p) {
+        p++;
+        while (*p == ' ')
+            p++;
+        if (*p) {
+            g_free (priv->observed_pin);
+            priv->observed_pin = g_strndup (p, strcspn (p, " \r\n"));
+        }
+    }
+}
 
 static void
 parse_openconnect_output (NmVpnSsoService *self, const gchar *buf)
@@ -939,6 +2144,13 @@ parse_openconnect_output (NmVpnSsoService *self, const gchar *buf)
         }
     }
 
+    if (g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_GP) == 0)
+        parse_portal_config (self, buf);
+    else
+        parse_cert_mismatch (self, buf);
+
+    parse_session_lifetime (self, buf);
+
     /* Parse DNS servers: OpenConnect outputs "Got DNS server address X.X.X.X"
      * We need to collect all DNS servers as there may be multiple
      */
@@ -1125,81 +2337,315 @@ schedule_ip4_config_report (NmVpnSsoService *self)
     priv->ip4_config_retry_source = g_timeout_add (100, report_ip4_config_retry_cb, self);
 }
 
+/*
+ * Output that means the gateway refused the cookie. OpenConnect may keep
+ * retrying for a while before exiting, so lines are matched as they
+ * arrive instead of waiting for the exit status.
+ */
 static gboolean
-openconnect_stdout_cb (GIOChannel *source, GIOCondition condition, gpointer user_data)
+output_shows_cookie_rejection (const gchar *line)
+{
+    const gchar *match = vpn_sso_cookie_rejection_match (line);
+
+    if (match)
+        g_message ("OpenConnect output shows cookie rejection: %s", match);
+
+    return match != NULL;
+}
+
+/*
+ * The gateway rejected the cached cookie: stop OpenConnect right away and
+ * go to SSO, rather than waiting for its retries and exit status.
+ */
+static void
+handle_cookie_rejection (NmVpnSsoService *self)
 {
-    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
     NmVpnSsoServicePrivate *priv = self->priv;
-    gchar buf[1024];
-    gsize bytes_read;
-    GIOStatus status;
 
-    if (condition & G_IO_IN) {
-        status = g_io_channel_read_chars (source, buf, sizeof (buf) - 1, &bytes_read, NULL);
-        if (status == G_IO_STATUS_NORMAL && bytes_read > 0) {
-            buf[bytes_read] = '\0';
-            g_message ("OpenConnect: %s", buf);
+    g_message ("Cached cookie rejected - stopping OpenConnect and falling back to SSO");
 
-            /* Try to parse tunnel device and IP from output */
-            parse_openconnect_output (self, buf);
+    if (priv->hedge_timer) {
+        g_source_remove (priv->hedge_timer);
+        priv->hedge_timer = 0;
+    }
 
-            /* Parse for connection success indicators.
-             * IMPORTANT: "Connected to X.X.X.X" is just the TCP connection - too early!
-             * We need to wait for "Configured as X.X.X.X" which means the tunnel is up.
-             * Even then, the tun device may not exist immediately - schedule with retries.
-             */
-            if (strstr (buf, "Configured as") != NULL) {
-                if (priv->state != VPN_STATE_CONNECTED) {
-                    priv->state = VPN_STATE_CONNECTED;
+    abandon_openconnect (self);
 
-                    /* Schedule IP4 configuration report - waits for tun device */
-                    schedule_ip4_config_report (self);
-                }
-            }
-        }
+    if (!priv->hedging && step_down_cached_login (self))
+        return;
+
+    discard_cached_credentials (self);
+
+    /* A speculative SSO is already running - it becomes the fallback */
+    if (priv->hedging && sso_helper_pending (self)) {
+        priv->hedging = FALSE;
+        return;
     }
 
-    if (condition & G_IO_HUP) {
+    priv->state = VPN_STATE_AUTHENTICATING;
+    start_sso_authentication (self);
+}
+
+static void
+tunnel_configured (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (priv->state == VPN_STATE_CONNECTED)
+        return;
+
+    priv->state = VPN_STATE_CONNECTED;
+
+    if (priv->hedge_timer) {
+        g_source_remove (priv->hedge_timer);
+        priv->hedge_timer = 0;
+    }
+
+    /* Cached cookie won the race - cancel the speculative SSO */
+    if (priv->hedging)
+        stop_gateway_resolve (self);
+    if (priv->hedging && priv->sso_pid) {
+        g_message ("Tunnel up with cached cookie - cancelling speculative SSO (PID %d)",
+                   priv->sso_pid);
+        vpn_sso_child_kill_tree (priv->sso_child);
+    }
+
+    /* Keep the pin that worked at the front; after a CA-validated run,
+     * pin the certificate the server reported */
+    if (g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_AC) == 0) {
+        if (priv->servercert && priv->cert_pin_index > 0)
+            vpn_sso_cert_pins_add (priv->gateway, priv->servercert);
+        else if (!priv->servercert && priv->observed_pin)
+            vpn_sso_cert_pins_add (priv->gateway, priv->observed_pin);
+    }
+
+    /* Nothing on stdout matters to the parser from here on; with a log
+     * file, let it go there without passing through the service */
+    if (priv->openconnect_stdout)
+        vpn_sso_pipe_drain_set_parsing (priv->openconnect_stdout, FALSE);
+
+    /* Schedule IP4 configuration report - waits for tun device */
+    schedule_ip4_config_report (self);
+}
+
+/*
+ * One line of openconnect output, stdout or stderr (openconnect often puts
+ * important information on stderr too).
+ *
+ * Returns: FALSE if OpenConnect was abandoned, freeing the drains
+ */
+static gboolean
+handle_openconnect_line (NmVpnSsoService *self, const gchar *line)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (priv->using_cached_credentials && priv->state != VPN_STATE_CONNECTED &&
+        output_shows_cookie_rejection (line)) {
+        handle_cookie_rejection (self);
         return FALSE;
     }
 
+    /* Try to parse tunnel device and IP from output */
+    parse_openconnect_output (self, line);
+
+    /* Parse for connection success indicators.
+     * IMPORTANT: "Connected to X.X.X.X" is just the TCP connection - too early!
+     * We need to wait for "Configured as X.X.X.X" which means the tunnel is up.
+     * Even then, the tun device may not exist immediately - schedule with retries.
+     */
+    if (strstr (line, "Configured as") != NULL)
+        tunnel_configured (self);
+
     return TRUE;
 }
 
 static gboolean
-openconnect_stderr_cb (GIOChannel *source, GIOCondition condition, gpointer user_data)
+openconnect_stdout_cb (const gchar *line, gpointer user_data)
 {
     NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
     NmVpnSsoServicePrivate *priv = self->priv;
-    gchar buf[1024];
-    gsize bytes_read;
-    GIOStatus status;
 
-    if (condition & G_IO_IN) {
-        status = g_io_channel_read_chars (source, buf, sizeof (buf) - 1, &bytes_read, NULL);
-        if (status == G_IO_STATUS_NORMAL && bytes_read > 0) {
-            buf[bytes_read] = '\0';
-            g_message ("OpenConnect stderr: %s", buf);
+    /* --authenticate prints the gateway cookie; keep it out of the log */
+    if (priv->gp_auth_output) {
+        g_string_append (priv->gp_auth_output, line);
+        g_string_append_c (priv->gp_auth_output, '\n');
+        g_message ("OpenConnect: (%zu bytes of login result)", strlen (line));
+        return TRUE;
+    }
+
+    /* Once the tunnel is up, progress messages (rekeys, DPD, stats) are
+     * only of interest when debugging; errors still arrive on stderr.
+     * openconnect cannot be made quieter at runtime - its SIGUSR1 and
+     * SIGUSR2 print statistics and force a reconnect - so the service
+     * turns down its own logging instead. A log file has it all anyway. */
+    if (priv->state == VPN_STATE_CONNECTED || priv->openconnect_log)
+        g_debug ("OpenConnect: %s", line);
+    else
+        g_message ("OpenConnect: %s", line);
 
-            /* Also parse stderr - openconnect often outputs important info there */
-            parse_openconnect_output (self, buf);
+    return handle_openconnect_line (self, line);
+}
 
-            /* Check for connection success in stderr too.
-             * IMPORTANT: Wait for "Configured as" - the tun device only exists then.
-             */
-            if (strstr (buf, "Configured as") != NULL) {
-                if (priv->state != VPN_STATE_CONNECTED) {
-                    priv->state = VPN_STATE_CONNECTED;
-                    schedule_ip4_config_report (self);
-                }
-            }
-        }
+static gboolean
+openconnect_stderr_cb (const gchar *line, gpointer user_data)
+{
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+
+    g_message ("OpenConnect stderr: %s", line);
+
+    return handle_openconnect_line (self, line);
+}
+
+/*
+ * Choose the --servercert value for an AnyConnect run: the pin store
+ * first, then the fingerprint that came with the cookie. Past the last
+ * candidate, NULL leaves validation to the system CA store.
+ */
+static const gchar *
+select_server_cert_pin (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (!priv->cert_pins)
+        priv->cert_pins = vpn_sso_cert_pins_get (priv->gateway);
+
+    if (priv->cert_pins) {
+        if (priv->cert_pin_index < g_strv_length (priv->cert_pins))
+            return priv->cert_pins[priv->cert_pin_index];
+        return NULL;
     }
 
-    if (condition & G_IO_HUP) {
+    return priv->cert_pin_index == 0 ? priv->sso_fingerprint : NULL;
+}
+
+/*
+ * OpenConnect refused the gateway certificate because it did not match
+ * the pin. The gateway may have rotated its certificate or sit behind a
+ * balancer with several, so try the next known pin and finally plain CA
+ * validation. A certificate that passes CA validation is pinned once the
+ * tunnel is up.
+ *
+ * Returns: TRUE if OpenConnect was restarted
+ */
+static gboolean
+retry_next_cert_pin (NmVpnSsoService *self)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    if (!priv->cert_mismatch || !priv->servercert ||
+        priv->state == VPN_STATE_CONNECTED)
+        return FALSE;
+
+    g_message ("Gateway %s no longer presents pinned certificate %s%s%s",
+               priv->gateway, priv->servercert,
+               priv->observed_pin ? " - server offers " : "",
+               priv->observed_pin ? priv->observed_pin : "");
+
+    priv->cert_pin_index++;
+    priv->state = VPN_STATE_CONNECTING;
+    start_openconnect (self);
+    return TRUE;
+}
+
+/* Strip the shell quoting openconnect --authenticate puts around values */
+static gchar *
+unquote_auth_value (const gchar *value)
+{
+    gsize len = strlen (value);
+
+    if (len >= 2 && value[0] == '\'' && value[len - 1] == '\'')
+        return g_strndup (value + 1, len - 2);
+    return g_strdup (value);
+}
+
+/*
+ * openconnect --authenticate finished logging in to a GlobalProtect
+ * gateway. Its stdout carries the gateway cookie:
+ *
+ *   COOKIE='authcookie=...&portal=...&user=...'
+ *   HOST='192.0.2.10'
+ *   CONNECT_URL='https://gw.example.com'
+ *   FINGERPRINT='pin-sha256:...'
+ *
+ * Cache the cookie on its own and start the tunnel with it.
+ *
+ * Returns: TRUE if the exit was handled, FALSE to treat it as a failed
+ *   OpenConnect run
+ */
+static gboolean
+finish_gp_authentication (NmVpnSsoService *self, gint status)
+{
+    NmVpnSsoServicePrivate *priv = self->priv;
+    g_autoptr(GString) output = g_steal_pointer (&priv->gp_auth_output);
+    g_auto(GStrv) lines = NULL;
+    g_autofree gchar *cookie = NULL;
+    g_autofree gchar *fingerprint = NULL;
+    g_autofree gchar *connect_host = NULL;
+
+    if (!(WIFEXITED (status) && WEXITSTATUS (status) == 0))
         return FALSE;
+
+    lines = g_strsplit (output->str, "\n", -1);
+    for (gchar **line = lines; *line; line++) {
+        g_strstrip (*line);
+        if (g_str_has_prefix (*line, "COOKIE=")) {
+            g_free (cookie);
+            cookie = unquote_auth_value (*line + 7);
+        } else if (g_str_has_prefix (*line, "FINGERPRINT=")) {
+            g_free (fingerprint);
+            fingerprint = unquote_auth_value (*line + 12);
+        } else if (g_str_has_prefix (*line, "CONNECT_URL=")) {
+            g_autofree gchar *url = unquote_auth_value (*line + 12);
+            const gchar *host = strstr (url, "://");
+
+            host = host ? host + 3 : url;
+            g_free (connect_host);
+            connect_host = g_strndup (host, strcspn (host, "/"));
+        }
     }
 
+    if (!cookie || !*cookie) {
+        g_warning ("GlobalProtect login completed but no gateway cookie found");
+        nm_vpn_service_plugin_failure (NM_VPN_SERVICE_PLUGIN (self),
+                                      NM_VPN_PLUGIN_FAILURE_LOGIN_FAILED);
+        cleanup_connection (self);
+        return TRUE;
+    }
+
+    /* Remember which gateway the portal sent us to. A direct login did
+     * not ask the portal, so it must not extend the entry's lifetime. */
+    if (priv->login_gateway && !priv->direct_gateway) {
+        if (priv->portal_gateways)
+            g_ptr_array_add (priv->portal_gateways, NULL);
+        vpn_sso_portal_cache_store (priv->gateway,
+                                    priv->portal_gateways ?
+                                    (const gchar * const *) priv->portal_gateways->pdata : NULL,
+                                    priv->login_gateway);
+        g_clear_pointer (&priv->portal_gateways, g_ptr_array_unref);
+    }
+
+    /* Key the cookie by the name the portal configuration uses */
+    g_free (priv->tunnel_gateway);
+    if (priv->login_gateway)
+        priv->tunnel_gateway = g_strdup (priv->login_gateway);
+    else if (connect_host && *connect_host)
+        priv->tunnel_gateway = g_steal_pointer (&connect_host);
+    else if (priv->direct_gateway)
+        priv->tunnel_gateway = g_strdup (priv->direct_gateway);
+    else
+        priv->tunnel_gateway = g_strdup (priv->gateway);
+
+    g_free (priv->gateway_cookie);
+    priv->gateway_cookie = g_steal_pointer (&cookie);
+    g_free (priv->gateway_fingerprint);
+    priv->gateway_fingerprint = g_steal_pointer (&fingerprint);
+    priv->gateway_cookie_cached = FALSE;
+
+    g_message ("GlobalProtect gateway login to %s succeeded - starting tunnel",
+               priv->tunnel_gateway);
+    store_gateway_credentials_in_cache (self);
+
+    start_openconnect (self);
     return TRUE;
 }
 
@@ -1211,35 +2657,53 @@ openconnect_child_watch_cb (GPid pid, gint status, gpointer user_data)
 
     g_message ("OpenConnect process exited with status %d", status);
 
-    /* Clean up OpenConnect process resources */
-    if (priv->openconnect_stdout_watch) {
-        g_source_remove (priv->openconnect_stdout_watch);
-        priv->openconnect_stdout_watch = 0;
-    }
-    if (priv->openconnect_stderr_watch) {
-        g_source_remove (priv->openconnect_stderr_watch);
-        priv->openconnect_stderr_watch = 0;
+    if (priv->openconnect_stdout && priv->openconnect_stderr) {
+        guint64 dropped = vpn_sso_pipe_drain_get_dropped (priv->openconnect_stdout) +
+                          vpn_sso_pipe_drain_get_dropped (priv->openconnect_stderr);
+
+        if (dropped > 0)
+            g_message ("OpenConnect: %" G_GUINT64_FORMAT " bytes of output dropped in total",
+                       dropped);
     }
+
+    /* The login output may not all have been delivered yet */
+    if (priv->gp_auth_output && priv->openconnect_stdout)
+        vpn_sso_pipe_drain_finish (g_steal_pointer (&priv->openconnect_stdout));
+
+    /* Clean up OpenConnect process resources */
     if (priv->openconnect_watch_timer) {
         g_source_remove (priv->openconnect_watch_timer);
         priv->openconnect_watch_timer = 0;
     }
-    if (priv->openconnect_stdout) {
-        g_io_channel_unref (priv->openconnect_stdout);
-        priv->openconnect_stdout = NULL;
-    }
-    if (priv->openconnect_stderr) {
-        g_io_channel_unref (priv->openconnect_stderr);
-        priv->openconnect_stderr = NULL;
-    }
+    g_clear_pointer (&priv->openconnect_stdout, vpn_sso_pipe_drain_free);
+    g_clear_pointer (&priv->openconnect_stderr, vpn_sso_pipe_drain_free);
     if (priv->openconnect_stdin) {
         g_io_channel_unref (priv->openconnect_stdin);
         priv->openconnect_stdin = NULL;
     }
 
-    g_spawn_close_pid (pid);
+    g_clear_pointer (&priv->openconnect_child, vpn_sso_child_release);
     priv->openconnect_pid = 0;
-    priv->openconnect_child_watch = 0;
+
+    if (priv->hedge_timer) {
+        g_source_remove (priv->hedge_timer);
+        priv->hedge_timer = 0;
+    }
+
+    if (priv->gp_auth_output && finish_gp_authentication (self, status))
+        return;
+
+    if (retry_next_cert_pin (self))
+        return;
+
+    /* The cached-cookie attempt died while a speculative SSO is running:
+     * let that SSO continue as the regular fallback */
+    if (priv->hedging && sso_helper_pending (self)) {
+        g_message ("Cached credentials failed (status %d) - continuing with speculative SSO", status);
+        priv->hedging = FALSE;
+        discard_cached_credentials (self);
+        return;
+    }
 
     /* Handle connection failure */
     if (priv->state == VPN_STATE_CONNECTED || priv->state == VPN_STATE_CONNECTING) {
@@ -1249,16 +2713,11 @@ openconnect_child_watch_cb (GPid pid, gint status, gpointer user_data)
 
             /* OpenConnect failed - check if we should fallback to SSO */
             if (priv->using_cached_credentials) {
-                g_message ("Cached credentials failed (exit code %d) - clearing cache and falling back to SSO", exit_code);
-
-                /* Clear invalid cached credentials */
-                vpn_sso_credential_cache_clear_async (priv->gateway, priv->protocol,
-                                                      NULL, NULL, NULL);
+                if (step_down_cached_login (self))
+                    return;
 
-                /* Clear credential state */
-                g_clear_pointer (&priv->sso_cookie, g_free);
-                g_clear_pointer (&priv->sso_fingerprint, g_free);
-                priv->using_cached_credentials = FALSE;
+                g_message ("Cached credentials failed (exit code %d) - clearing cache and falling back to SSO", exit_code);
+                discard_cached_credentials (self);
 
                 /* Fallback to SSO authentication */
                 priv->state = VPN_STATE_AUTHENTICATING;
@@ -1276,6 +2735,26 @@ openconnect_child_watch_cb (GPid pid, gint status, gpointer user_data)
     cleanup_connection (self);
 }
 
+static gboolean
+hedge_timeout_cb (gpointer user_data)
+{
+    NmVpnSsoService *self = NM_VPN_SSO_SERVICE (user_data);
+    NmVpnSsoServicePrivate *priv = self->priv;
+
+    priv->hedge_timer = 0;
+
+    if (priv->state == VPN_STATE_CONNECTING && priv->using_cached_credentials && !priv->sso_pid) {
+        g_message ("No tunnel %d s after starting with cached cookie - starting speculative SSO",
+                   priv->hedge_delay);
+        priv->hedging = TRUE;
+        start_sso_authentication (self);
+        if (!sso_helper_pending (self))
+            priv->hedging = FALSE;
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
 start_openconnect (NmVpnSsoService *self)
 {
@@ -1284,6 +2763,7 @@ start_openconnect (NmVpnSsoService *self)
     GPtrArray *argv;
     gchar **envp;
     gint stdin_fd, stdout_fd, stderr_fd;
+    const gchar *stdin_cookie = priv->gateway_cookie ? priv->gateway_cookie : priv->sso_cookie;
 
     g_message ("Starting OpenConnect for gateway: %s (protocol: %s)", priv->gateway, priv->protocol);
     g_message ("  cookie: %s (len=%zu)",
@@ -1303,16 +2783,28 @@ start_openconnect (NmVpnSsoService *self)
         g_ptr_array_add (argv, (gpointer) "--useragent=PAN GlobalProtect");
         g_ptr_array_add (argv, (gpointer) "--os=linux-64");
 
-        if (priv->username) {
-            g_ptr_array_add (argv, (gpointer) "--user");
-            g_ptr_array_add (argv, (gpointer) priv->username);
-        }
+        if (priv->gateway_cookie) {
+            /* Gateway authcookie: straight to the tunnel, no HTTP logins */
+            g_message ("Using gateway cookie for %s", priv->tunnel_gateway);
+            if (priv->gateway_fingerprint) {
+                gchar *servercert_arg = g_strdup_printf ("--servercert=%s", priv->gateway_fingerprint);
+                g_ptr_array_add (argv, (gpointer) servercert_arg);
+            }
+            g_ptr_array_add (argv, (gpointer) "--cookie-on-stdin");
+        } else if (priv->sso_cookie) {
+            if (priv->username) {
+                g_ptr_array_add (argv, (gpointer) "--user");
+                g_ptr_array_add (argv, (gpointer) priv->username);
+            }
 
-        if (priv->sso_cookie) {
             /* Use cached usergroup if available (e.g., portal:portal-userauthcookie),
              * otherwise default to portal:prelogin-cookie for initial SSO auth.
              */
-            if (priv->usergroup && *priv->usergroup) {
+            if (priv->direct_gateway) {
+                g_ptr_array_add (argv, (gpointer) "--usergroup=gateway:portal-userauthcookie");
+                g_message ("Using usergroup: gateway:portal-userauthcookie (direct to %s)",
+                           priv->direct_gateway);
+            } else if (priv->usergroup && *priv->usergroup) {
                 gchar *usergroup_arg = g_strdup_printf ("--usergroup=%s", priv->usergroup);
                 g_ptr_array_add (argv, (gpointer) usergroup_arg);
                 g_message ("Using usergroup: %s", priv->usergroup);
@@ -1321,6 +2813,16 @@ start_openconnect (NmVpnSsoService *self)
                 g_message ("Using default usergroup: portal:prelogin-cookie");
             }
             g_ptr_array_add (argv, (gpointer) "--passwd-on-stdin");
+
+            /* Only log in here; the tunnel is started separately with the
+             * resulting gateway cookie so that it can be cached on its own */
+            g_ptr_array_add (argv, (gpointer) "--authenticate");
+            if (priv->gp_auth_output)
+                g_string_free (priv->gp_auth_output, TRUE);
+            priv->gp_auth_output = g_string_new (NULL);
+        } else if (priv->username) {
+            g_ptr_array_add (argv, (gpointer) "--user");
+            g_ptr_array_add (argv, (gpointer) priv->username);
         }
     } else if (g_strcmp0 (priv->protocol, NM_VPN_SSO_PROTOCOL_AC) == 0) {
         /* AnyConnect: use credentials from openconnect-sso --authenticate */
@@ -1331,10 +2833,15 @@ start_openconnect (NmVpnSsoService *self)
             g_ptr_array_add (argv, (gpointer) priv->username);
         }
 
-        /* Server certificate fingerprint - required to prevent MITM warnings */
-        if (priv->sso_fingerprint) {
-            gchar *servercert_arg = g_strdup_printf ("--servercert=%s", priv->sso_fingerprint);
+        /* Server certificate pin - required to prevent MITM warnings */
+        g_free (priv->servercert);
+        priv->servercert = g_strdup (select_server_cert_pin (self));
+        priv->cert_mismatch = FALSE;
+        if (priv->servercert) {
+            gchar *servercert_arg = g_strdup_printf ("--servercert=%s", priv->servercert);
             g_ptr_array_add (argv, (gpointer) servercert_arg);
+        } else {
+            g_message ("No pinned certificate for %s - using CA validation", priv->gateway);
         }
 
         /* Cookie authentication - send cookie via stdin */
@@ -1357,7 +2864,12 @@ start_openconnect (NmVpnSsoService *self)
     g_ptr_array_add (argv, (gpointer) "--non-inter");
 
     /* Gateway (must be last positional argument) */
-    g_ptr_array_add (argv, (gpointer) priv->gateway);
+    if (priv->gateway_cookie)
+        g_ptr_array_add (argv, (gpointer) priv->tunnel_gateway);
+    else if (priv->direct_gateway && priv->sso_cookie)
+        g_ptr_array_add (argv, (gpointer) priv->direct_gateway);
+    else
+        g_ptr_array_add (argv, (gpointer) priv->gateway);
     g_ptr_array_add (argv, NULL);
 
     /* Log the command line for debugging */
@@ -1368,12 +2880,13 @@ start_openconnect (NmVpnSsoService *self)
 
     /* Build environment - openconnect typically runs as root so doesn't
      * strictly need display env, but we build it anyway for consistency */
-    envp = build_subprocess_environment (NULL);
+    envp = build_subprocess_environment (NULL, NULL);
 
     if (!g_spawn_async_with_pipes (NULL, /* working_directory */
                                    (gchar **) argv->pdata,
                                    envp,
-                                   G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                                   G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH |
+                                   G_SPAWN_CLOEXEC_PIPES,
                                    NULL, /* child_setup */
                                    NULL, /* user_data */
                                    &priv->openconnect_pid,
@@ -1395,27 +2908,34 @@ start_openconnect (NmVpnSsoService *self)
 
     /* Set up I/O channels */
     priv->openconnect_stdin = g_io_channel_unix_new (stdin_fd);
-    priv->openconnect_stdout = g_io_channel_unix_new (stdout_fd);
-    priv->openconnect_stderr = g_io_channel_unix_new (stderr_fd);
-
     g_io_channel_set_encoding (priv->openconnect_stdin, NULL, NULL);
-    g_io_channel_set_encoding (priv->openconnect_stdout, NULL, NULL);
-    g_io_channel_set_encoding (priv->openconnect_stderr, NULL, NULL);
     g_io_channel_set_buffered (priv->openconnect_stdin, FALSE);
-    g_io_channel_set_buffered (priv->openconnect_stdout, FALSE);
-    g_io_channel_set_buffered (priv->openconnect_stderr, FALSE);
 
-    /* If we have an SSO cookie, send it to stdin */
-    if (priv->sso_cookie) {
+    if (priv->log_file && !priv->openconnect_log && priv->connection_uuid)
+        priv->openconnect_log = vpn_sso_log_file_open (priv->connection_uuid);
+
+    /* Output is read on threads of its own: openconnect must never block
+     * writing its log while the main loop is busy. The gateway cookie
+     * --authenticate prints on stdout stays out of the log file. */
+    priv->openconnect_stdout = vpn_sso_pipe_drain_new (stdout_fd, "OpenConnect",
+                                                       priv->gp_auth_output ? NULL :
+                                                       priv->openconnect_log,
+                                                       openconnect_stdout_cb, self);
+    priv->openconnect_stderr = vpn_sso_pipe_drain_new (stderr_fd, "OpenConnect stderr",
+                                                       priv->openconnect_log,
+                                                       openconnect_stderr_cb, self);
+
+    /* If we have a cookie, send it to stdin */
+    if (stdin_cookie) {
         gsize bytes_written;
         GError *write_error = NULL;
-        gsize cookie_len = strlen (priv->sso_cookie);
+        gsize cookie_len = strlen (stdin_cookie);
 
         g_message ("Writing cookie to OpenConnect stdin (length=%zu, first 20 chars: %.20s...)",
-                   cookie_len, priv->sso_cookie);
+                   cookie_len, stdin_cookie);
 
         g_io_channel_write_chars (priv->openconnect_stdin,
-                                 priv->sso_cookie,
+                                 stdin_cookie,
                                  -1,
                                  &bytes_written,
                                  &write_error);
@@ -1434,18 +2954,18 @@ start_openconnect (NmVpnSsoService *self)
         }
     }
 
-    priv->openconnect_stdout_watch = g_io_add_watch (priv->openconnect_stdout,
-                                                    G_IO_IN | G_IO_HUP,
-                                                    openconnect_stdout_cb,
-                                                    self);
-    priv->openconnect_stderr_watch = g_io_add_watch (priv->openconnect_stderr,
-                                                    G_IO_IN | G_IO_HUP,
-                                                    openconnect_stderr_cb,
-                                                    self);
+    priv->openconnect_child = vpn_sso_child_new (priv->openconnect_pid, "OpenConnect",
+                                                 priv->gateway,
+                                                 openconnect_child_watch_cb,
+                                                 self);
 
-    priv->openconnect_child_watch = g_child_watch_add (priv->openconnect_pid,
-                                                      openconnect_child_watch_cb,
-                                                      self);
+    /* Cap the stale-cookie path: if the cached cookie has not brought the
+     * tunnel up by the deadline, race a fresh SSO login against it */
+    if (priv->using_cached_credentials && priv->hedge_delay > 0) {
+        if (priv->hedge_timer)
+            g_source_remove (priv->hedge_timer);
+        priv->hedge_timer = g_timeout_add_seconds (priv->hedge_delay, hedge_timeout_cb, self);
+    }
 
     g_ptr_array_free (argv, TRUE);
 }
@@ -1461,9 +2981,29 @@ cleanup_connection (NmVpnSsoService *self)
 
     g_message ("Cleaning up connection resources");
 
-    /* Kill SSO process if running */
-    if (priv->sso_pid) {
-        kill (priv->sso_pid, SIGTERM);
+    if (priv->hedge_timer) {
+        g_source_remove (priv->hedge_timer);
+        priv->hedge_timer = 0;
+    }
+    priv->hedging = FALSE;
+
+    /* Abort a pending cookie probe */
+    if (priv->probe_cancellable) {
+        g_cancellable_cancel (priv->probe_cancellable);
+        g_clear_object (&priv->probe_cancellable);
+    }
+
+    /* And a gateway lookup the SSO helper is waiting for */
+    stop_gateway_resolve (self);
+
+    if (priv->peers_cancellable) {
+        g_cancellable_cancel (priv->peers_cancellable);
+        g_clear_object (&priv->peers_cancellable);
+    }
+
+    /* Kill SSO process, and the browser it started, if running */
+    if (priv->sso_child) {
+        vpn_sso_child_kill_tree (priv->sso_child);
     }
 
     /* Disconnect OpenConnect process if running.
@@ -1476,10 +3016,10 @@ cleanup_connection (NmVpnSsoService *self)
      * This allows the cached credentials to be reused for reconnection within
      * the server's session timeout (typically 8-12 hours for AnyConnect).
      */
-    if (priv->openconnect_pid) {
+    if (priv->openconnect_child) {
         g_message ("Sending SIGHUP to openconnect (PID %d) to preserve session cookie",
                    priv->openconnect_pid);
-        kill (priv->openconnect_pid, SIGHUP);
+        vpn_sso_child_signal (priv->openconnect_child, SIGHUP);
     }
 
     /* Clean up SSO resources */
@@ -1491,10 +3031,9 @@ cleanup_connection (NmVpnSsoService *self)
         g_source_remove (priv->sso_stderr_watch);
         priv->sso_stderr_watch = 0;
     }
-    if (priv->sso_child_watch) {
-        g_source_remove (priv->sso_child_watch);
-        priv->sso_child_watch = 0;
-    }
+    /* Signalled above; reaped in the background from here on */
+    g_clear_pointer (&priv->sso_child, vpn_sso_child_release);
+    priv->sso_pid = 0;
     if (priv->sso_stdout) {
         g_io_channel_unref (priv->sso_stdout);
         priv->sso_stdout = NULL;
@@ -1507,20 +3046,13 @@ cleanup_connection (NmVpnSsoService *self)
         g_string_free (priv->sso_output, TRUE);
         priv->sso_output = NULL;
     }
+    g_clear_pointer (&priv->sso_progress, vpn_sso_pipe_drain_free);
+    priv->sso_cookie_event = FALSE;
+    g_clear_pointer (&priv->sso_error_class, g_free);
 
     /* Clean up OpenConnect resources */
-    if (priv->openconnect_stdout_watch) {
-        g_source_remove (priv->openconnect_stdout_watch);
-        priv->openconnect_stdout_watch = 0;
-    }
-    if (priv->openconnect_stderr_watch) {
-        g_source_remove (priv->openconnect_stderr_watch);
-        priv->openconnect_stderr_watch = 0;
-    }
-    if (priv->openconnect_child_watch) {
-        g_source_remove (priv->openconnect_child_watch);
-        priv->openconnect_child_watch = 0;
-    }
+    g_clear_pointer (&priv->openconnect_child, vpn_sso_child_release);
+    priv->openconnect_pid = 0;
     if (priv->openconnect_watch_timer) {
         g_source_remove (priv->openconnect_watch_timer);
         priv->openconnect_watch_timer = 0;
@@ -1529,14 +3061,9 @@ cleanup_connection (NmVpnSsoService *self)
         g_source_remove (priv->ip4_config_retry_source);
         priv->ip4_config_retry_source = 0;
     }
-    if (priv->openconnect_stdout) {
-        g_io_channel_unref (priv->openconnect_stdout);
-        priv->openconnect_stdout = NULL;
-    }
-    if (priv->openconnect_stderr) {
-        g_io_channel_unref (priv->openconnect_stderr);
-        priv->openconnect_stderr = NULL;
-    }
+    g_clear_pointer (&priv->openconnect_stdout, vpn_sso_pipe_drain_free);
+    g_clear_pointer (&priv->openconnect_stderr, vpn_sso_pipe_drain_free);
+    g_clear_pointer (&priv->openconnect_log, vpn_sso_log_file_unref);
     if (priv->openconnect_stdin) {
         g_io_channel_unref (priv->openconnect_stdin);
         priv->openconnect_stdin = NULL;
@@ -1551,6 +3078,24 @@ cleanup_connection (NmVpnSsoService *self)
     g_clear_pointer (&priv->ip4_address, g_free);
     g_clear_pointer (&priv->ip4_netmask, g_free);
     g_clear_pointer (&priv->ip4_gateway, g_free);
+    g_clear_pointer (&priv->direct_gateway, g_free);
+    g_clear_pointer (&priv->login_gateway, g_free);
+    g_clear_pointer (&priv->portal_gateways, g_ptr_array_unref);
+    g_clear_pointer (&priv->gateway_cookie, g_free);
+    g_clear_pointer (&priv->gateway_fingerprint, g_free);
+    g_clear_pointer (&priv->tunnel_gateway, g_free);
+    priv->gateway_cookie_cached = FALSE;
+    g_clear_pointer (&priv->sso_peers, g_ptr_array_unref);
+    g_clear_pointer (&priv->cert_pins, g_strfreev);
+    g_clear_pointer (&priv->servercert, g_free);
+    g_clear_pointer (&priv->observed_pin, g_free);
+    priv->cert_pin_index = 0;
+    priv->cert_mismatch = FALSE;
+
+    if (priv->gp_auth_output) {
+        g_string_free (priv->gp_auth_output, TRUE);
+        priv->gp_auth_output = NULL;
+    }
 
     if (priv->ip4_dns) {
         g_ptr_array_free (priv->ip4_dns, TRUE);
@@ -1590,7 +3135,8 @@ connect_to_vpn (NmVpnSsoService *self, GError **error)
      * SSO flow and connect directly. The callback will either use cached
      * credentials or fall back to SSO authentication. */
     g_message ("Checking for cached credentials...");
-    vpn_sso_credential_cache_lookup_async (priv->gateway,
+    vpn_sso_credential_cache_lookup_async (priv->cache_backend,
+                                           priv->gateway,
                                            priv->protocol,
                                            NULL, /* cancellable */
                                            credential_lookup_cb,
@@ -1627,6 +3173,18 @@ real_connect (NMVpnServicePlugin *plugin,
     g_clear_pointer (&priv->totp_secret, g_free);
     priv->headless = FALSE;
     priv->headless_set = FALSE;
+    priv->webkit_helper = FALSE;
+    priv->session_expires_at = 0;
+    priv->idle_timeout = 0;
+    priv->cookie_probe = TRUE;
+    priv->hedge_delay = NM_VPN_SSO_DEFAULT_HEDGE_DELAY;
+    priv->gp_direct = TRUE;
+    g_clear_pointer (&priv->sso_group, g_free);
+    g_clear_pointer (&priv->connection_uuid, g_free);
+    g_clear_pointer (&priv->service_type, g_free);
+
+    priv->connection_uuid = g_strdup (nm_connection_get_uuid (connection));
+    priv->service_type = g_strdup (nm_setting_vpn_get_service_type (s_vpn));
 
     /* Extract connection settings */
     value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_GATEWAY);
@@ -1653,6 +3211,40 @@ real_connect (NMVpnServicePlugin *plugin,
     if (value)
         priv->cache_hours = atoi (value);
 
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_COOKIE_PROBE);
+    if (value && (g_ascii_strcasecmp (value, "false") == 0 || g_strcmp0 (value, "0") == 0))
+        priv->cookie_probe = FALSE;
+
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_HEDGE_DELAY);
+    if (value)
+        priv->hedge_delay = MAX (0, atoi (value));
+
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_GP_DIRECT);
+    if (value && (g_ascii_strcasecmp (value, "false") == 0 || g_strcmp0 (value, "0") == 0))
+        priv->gp_direct = FALSE;
+
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_SSO_GROUP);
+    if (value && *value)
+        priv->sso_group = g_strdup (value);
+
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_LOG_FILE);
+    priv->log_file = value && (g_ascii_strcasecmp (value, "true") == 0 || g_strcmp0 (value, "1") == 0);
+
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_SSO_HELPER);
+    if (value && g_ascii_strcasecmp (value, "webkit") == 0) {
+#ifdef HAVE_WEBKIT_HELPER
+        priv->webkit_helper = TRUE;
+#else
+        g_warning ("sso-helper=webkit needs a build with -Dwebkit_helper=true, using playwright");
+#endif
+    } else if (value && g_ascii_strcasecmp (value, "playwright") != 0)
+        g_warning ("Unknown sso-helper '%s', using playwright", value);
+
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_CACHE_BACKEND);
+    priv->cache_backend = vpn_sso_cache_backend_type_from_string (value);
+    g_message ("Using %s credential cache backend",
+               vpn_sso_cache_backend_type_to_string (priv->cache_backend));
+
     /* Optional secrets for headless SSO */
     value = nm_setting_vpn_get_secret (s_vpn, NM_VPN_SSO_SECRET_PASSWORD);
     if (value)
@@ -1673,6 +3265,8 @@ real_connect (NMVpnServicePlugin *plugin,
         priv->headless = TRUE;
     }
 
+    list_sso_peers (self);
+
     return connect_to_vpn (self, error);
 }
 
@@ -1691,9 +3285,24 @@ real_disconnect (NMVpnServicePlugin *plugin,
                 GError **error)
 {
     NmVpnSsoService *self = NM_VPN_SSO_SERVICE (plugin);
+    NmVpnSsoServicePrivate *priv = self->priv;
 
     g_message ("VPN disconnect requested");
 
+    /*
+     * Sessions survive a SIGHUP disconnect only until the gateway's idle
+     * timeout runs out, so shorten the cached AnyConnect cookie or
+     * GlobalProtect gateway cookie.
+     */
+    if (priv->state == VPN_STATE_CONNECTED && priv->idle_timeout > 0) {
+        gint64 idle_expiry = g_get_real_time () / G_USEC_PER_SEC + priv->idle_timeout;
+
+        if (priv->session_expires_at == 0 || idle_expiry < priv->session_expires_at) {
+            priv->session_expires_at = idle_expiry;
+            store_session_credentials_in_cache (self);
+        }
+    }
+
     cleanup_connection (self);
 
     return TRUE;
@@ -0,0 +1,404 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE             /* tee(), pipe2() */
+
+#include "config.h"
+#include "pipe-drain.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <glib-unix.h>
+
+/*
+ * A pipe watched from the main loop is only read while the main loop
+ * runs. Whenever it is busy (a slow D-Bus call, cache I/O, a burst of
+ * output being parsed) the 64 KiB kernel buffer fills up and the child
+ * blocks in write(), which for openconnect means the tunnel stops
+ * moving packets until the service catches up.
+ *
+ * Here a thread does nothing but read the pipe and split it into lines.
+ * The lines are queued for the main loop up to a fixed size; past that
+ * they are dropped and counted, so neither the child nor the service's
+ * memory depend on how fast the main loop is.
+ *
+ * With a log file, the output is tee(2)d into a second pipe and spliced
+ * from there into the file, then read for parsing as before. Once parsing
+ * is switched off, it is spliced straight from the child's pipe into the
+ * file and never enters the service's address space.
+ */
+
+/* Longer lines are delivered in pieces */
+#define MAX_LINE 4096
+
+struct _VpnSsoPipeDrain {
+    gint fd;
+    gint wake_fd;                /* eventfd telling the thread to stop, -1 = none */
+    gint stopping;               /* Atomic, for when there is no eventfd */
+    gchar *name;
+    VpnSsoPipeLineFunc line_func;
+    gpointer user_data;
+    GMainContext *context;
+    GThread *thread;
+    VpnSsoLogFile *log;
+    gint tee_pipe[2];            /* -1 without a log or tee(2) */
+    gint parse;                  /* Atomic */
+
+    /* Shared with the thread */
+    GMutex lock;
+    GQueue lines;
+    gsize queued_bytes;
+    guint64 dropped;
+    guint64 dropped_reported;
+    GSource *dispatch;           /* Pending delivery to the main loop */
+
+    /* Thread only */
+    GString *partial;
+};
+
+static gboolean dispatch_cb (gpointer user_data);
+
+static void
+queue_partial_line (VpnSsoPipeDrain *drain)
+{
+    gsize len = drain->partial->len;
+
+    g_mutex_lock (&drain->lock);
+
+    if (drain->queued_bytes + len + 1 > VPN_SSO_PIPE_DRAIN_MAX_QUEUED) {
+        /* A delivery is already pending, it reports the drop */
+        drain->dropped += len + 1;
+    } else {
+        g_queue_push_tail (&drain->lines, g_strndup (drain->partial->str, len));
+        drain->queued_bytes += len + 1;
+
+        if (!drain->dispatch) {
+            drain->dispatch = g_idle_source_new ();
+            g_source_set_callback (drain->dispatch, dispatch_cb, drain, NULL);
+            g_source_attach (drain->dispatch, drain->context);
+        }
+    }
+
+    g_mutex_unlock (&drain->lock);
+
+    g_string_truncate (drain->partial, 0);
+}
+
+static void
+take_output (VpnSsoPipeDrain *drain, const gchar *buf, gsize len)
+{
+    const gchar *end = buf + len;
+
+    while (buf < end) {
+        const gchar *nl = memchr (buf, '\n', end - buf);
+        gsize chunk = (nl ? nl : end) - buf;
+
+        g_string_append_len (drain->partial, buf, chunk);
+        if (nl || drain->partial->len >= MAX_LINE)
+            queue_partial_line (drain);
+
+        buf += chunk + (nl ? 1 : 0);
+    }
+}
+
+static void
+close_tee_pipe (VpnSsoPipeDrain *drain)
+{
+    for (guint i = 0; i < G_N_ELEMENTS (drain->tee_pipe); i++) {
+        if (drain->tee_pipe[i] >= 0)
+            close (drain->tee_pipe[i]);
+        drain->tee_pipe[i] = -1;
+    }
+}
+
+/*
+ * Takes the next chunk of output off the pipe, into @buf unless it went
+ * straight into the log (*copied = FALSE).
+ *
+ * Returns: Bytes taken, 0 at end of file, -1 with errno set (%EAGAIN if
+ *   the pipe turned out to be empty)
+ */
+static gssize
+drain_read (VpnSsoPipeDrain *drain, gchar *buf, gsize size, gboolean *copied)
+{
+    gssize n;
+
+    *copied = TRUE;
+
+    if (!drain->log)
+        return read (drain->fd, buf, size);
+
+    if (!g_atomic_int_get (&drain->parse)) {
+        n = vpn_sso_log_file_splice (drain->log, drain->fd, size);
+        if (n >= 0 || errno == EAGAIN) {
+            *copied = FALSE;
+            return n;
+        }
+    } else if (drain->tee_pipe[1] >= 0) {
+        n = tee (drain->fd, drain->tee_pipe[1], size, SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            gssize moved = vpn_sso_log_file_splice (drain->log, drain->tee_pipe[0], n);
+
+            /* The bytes are still in the child's pipe */
+            if (moved == n)
+                return read (drain->fd, buf, n);
+
+            g_message ("%s: cannot splice into log (%s), copying instead",
+                       drain->name, moved < 0 ? g_strerror (errno) : "short write");
+            close_tee_pipe (drain);
+
+            n = read (drain->fd, buf, n);
+            moved = MAX (moved, 0);
+            if (n > moved)
+                vpn_sso_log_file_write (drain->log, buf + moved, n - moved);
+            return n;
+        }
+        if (n < 0 && errno != EAGAIN) {
+            g_message ("%s: cannot tee output (%s), copying instead",
+                       drain->name, g_strerror (errno));
+            close_tee_pipe (drain);
+        }
+    }
+
+    n = read (drain->fd, buf, size);
+    if (n > 0)
+        vpn_sso_log_file_write (drain->log, buf, n);
+    return n;
+}
+
+static gpointer
+drain_thread (gpointer data)
+{
+    VpnSsoPipeDrain *drain = data;
+    struct pollfd fds[2] = {
+        { .fd = drain->fd, .events = POLLIN },
+        { .fd = drain->wake_fd, .events = POLLIN },
+    };
+    gboolean stopping = FALSE;
+    gchar buf[16384];
+
+    for (;;) {
+        gboolean copied;
+        gssize n;
+
+        if (!stopping) {
+            /* poll() ignores the eventfd slot if it is -1 */
+            if (poll (fds, G_N_ELEMENTS (fds), drain->wake_fd >= 0 ? -1 : 200) < 0) {
+                if (errno == EINTR)
+                    continue;
+                g_message ("%s: poll failed: %s", drain->name, g_strerror (errno));
+                break;
+            }
+
+            if ((fds[1].revents & POLLIN) || g_atomic_int_get (&drain->stopping)) {
+                /* Pick up what is left without waiting for more */
+                stopping = TRUE;
+                g_unix_set_fd_nonblocking (drain->fd, TRUE, NULL);
+            } else if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+        }
+
+        n = drain_read (drain, buf, sizeof (buf), &copied);
+        if (n < 0 && errno == EINTR)
+            continue;
+        /* Readable but empty after all; only a 0 return is end of file */
+        if (n < 0 && errno == EAGAIN && !stopping)
+            continue;
+        if (n <= 0)
+            break;          /* EOF, or nothing left once stopping */
+
+        if (copied && g_atomic_int_get (&drain->parse))
+            take_output (drain, buf, n);
+    }
+
+    if (drain->partial->len > 0 && g_atomic_int_get (&drain->parse))
+        queue_partial_line (drain);
+
+    return NULL;
+}
+
+/* Takes the queued lines, reporting anything dropped since last time */
+static void
+steal_lines (VpnSsoPipeDrain *drain, GQueue *lines)
+{
+    guint64 dropped;
+
+    g_mutex_lock (&drain->lock);
+    *lines = drain->lines;
+    g_queue_init (&drain->lines);
+    drain->queued_bytes = 0;
+    dropped = drain->dropped - drain->dropped_reported;
+    drain->dropped_reported = drain->dropped;
+    g_mutex_unlock (&drain->lock);
+
+    if (dropped > 0)
+        g_message ("%s: main loop fell behind, dropped %" G_GUINT64_FORMAT " bytes of output",
+                   drain->name, dropped);
+}
+
+static void
+deliver_lines (VpnSsoPipeLineFunc line_func, gpointer user_data, GQueue *lines)
+{
+    gboolean deliver = TRUE;
+    gchar *line;
+
+    /* The drain may be gone once line_func returns FALSE */
+    while ((line = g_queue_pop_head (lines))) {
+        if (deliver)
+            deliver = line_func (line, user_data);
+        g_free (line);
+    }
+}
+
+static gboolean
+dispatch_cb (gpointer user_data)
+{
+    VpnSsoPipeDrain *drain = user_data;
+    GQueue lines;
+
+    g_mutex_lock (&drain->lock);
+    g_clear_pointer (&drain->dispatch, g_source_unref);
+    g_mutex_unlock (&drain->lock);
+
+    steal_lines (drain, &lines);
+    deliver_lines (drain->line_func, drain->user_data, &lines);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+drain_stop (VpnSsoPipeDrain *drain)
+{
+    guint64 one = 1;
+
+    if (!drain->thread)
+        return;
+
+    g_atomic_int_set (&drain->stopping, TRUE);
+    if (drain->wake_fd >= 0 && write (drain->wake_fd, &one, sizeof (one)) < 0)
+        g_message ("%s: cannot wake reader thread: %s", drain->name, g_strerror (errno));
+
+    g_thread_join (drain->thread);
+    drain->thread = NULL;
+
+    /* Only this thread touches the drain from here on */
+    if (drain->dispatch) {
+        g_source_destroy (drain->dispatch);
+        g_clear_pointer (&drain->dispatch, g_source_unref);
+    }
+}
+
+VpnSsoPipeDrain *
+vpn_sso_pipe_drain_new (gint                fd,
+                        const gchar        *name,
+                        VpnSsoLogFile      *log,
+                        VpnSsoPipeLineFunc  line_func,
+                        gpointer            user_data)
+{
+    VpnSsoPipeDrain *drain;
+
+    g_return_val_if_fail (fd >= 0, NULL);
+    g_return_val_if_fail (line_func != NULL, NULL);
+
+    drain = g_new0 (VpnSsoPipeDrain, 1);
+    drain->fd = fd;
+    drain->name = g_strdup (name);
+    drain->line_func = line_func;
+    drain->user_data = user_data;
+    drain->context = g_main_context_ref_thread_default ();
+    drain->partial = g_string_sized_new (256);
+    drain->parse = TRUE;
+    drain->tee_pipe[0] = drain->tee_pipe[1] = -1;
+    g_mutex_init (&drain->lock);
+    g_queue_init (&drain->lines);
+
+    drain->wake_fd = eventfd (0, EFD_CLOEXEC);
+    if (drain->wake_fd < 0)
+        g_debug ("%s: no eventfd (%s), polling for stop requests",
+                 name, g_strerror (errno));
+
+    if (log) {
+        drain->log = vpn_sso_log_file_ref (log);
+        if (pipe2 (drain->tee_pipe, O_CLOEXEC) < 0) {
+            g_message ("%s: no pipe for tee (%s), copying output into the log",
+                       name, g_strerror (errno));
+            drain->tee_pipe[0] = drain->tee_pipe[1] = -1;
+        }
+    }
+
+    drain->thread = g_thread_new ("pipe-drain", drain_thread, drain);
+
+    return drain;
+}
+
+void
+vpn_sso_pipe_drain_set_parsing (VpnSsoPipeDrain *drain,
+                                gboolean         parse)
+{
+    g_return_if_fail (drain != NULL);
+
+    if (drain->log)
+        g_atomic_int_set (&drain->parse, parse);
+}
+
+guint64
+vpn_sso_pipe_drain_get_dropped (VpnSsoPipeDrain *drain)
+{
+    guint64 dropped;
+
+    g_return_val_if_fail (drain != NULL, 0);
+
+    g_mutex_lock (&drain->lock);
+    dropped = drain->dropped;
+    g_mutex_unlock (&drain->lock);
+
+    return dropped;
+}
+
+void
+vpn_sso_pipe_drain_finish (VpnSsoPipeDrain *drain)
+{
+    GQueue lines;
+
+    g_return_if_fail (drain != NULL);
+
+    drain_stop (drain);
+    steal_lines (drain, &lines);
+    deliver_lines (drain->line_func, drain->user_data, &lines);
+
+    vpn_sso_pipe_drain_free (drain);
+}
+
+void
+vpn_sso_pipe_drain_free (VpnSsoPipeDrain *drain)
+{
+    if (!drain)
+        return;
+
+    drain_stop (drain);
+
+    g_queue_clear_full (&drain->lines, g_free);
+    g_mutex_clear (&drain->lock);
+    g_string_free (drain->partial, TRUE);
+    g_main_context_unref (drain->context);
+    g_clear_pointer (&drain->log, vpn_sso_log_file_unref);
+    close_tee_pipe (drain);
+    if (drain->wake_fd >= 0)
+        close (drain->wake_fd);
+    close (drain->fd);
+    g_free (drain->name);
+    g_free (drain);
+}
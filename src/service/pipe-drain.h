@@ -0,0 +1,104 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PIPE_DRAIN_H__
+#define __PIPE_DRAIN_H__
+
+#include <glib.h>
+
+#include "log-file.h"
+
+G_BEGIN_DECLS
+
+/* Output held for the main loop before further output is dropped */
+#define VPN_SSO_PIPE_DRAIN_MAX_QUEUED (256 * 1024)
+
+/**
+ * VpnSsoPipeDrain:
+ *
+ * Reads a child's output pipe on a thread of its own, so the child never
+ * blocks on write() while the main loop is busy. Complete lines are
+ * handed to the main loop; output beyond %VPN_SSO_PIPE_DRAIN_MAX_QUEUED
+ * that the main loop has not picked up yet is dropped and counted.
+ */
+typedef struct _VpnSsoPipeDrain VpnSsoPipeDrain;
+
+/**
+ * VpnSsoPipeLineFunc:
+ * @line: One line of output, without the newline
+ * @user_data: Data passed to vpn_sso_pipe_drain_new()
+ *
+ * Called on the main loop for each line read.
+ *
+ * Returns: %FALSE to stop delivering the lines read so far; the function
+ *   may free the drain before returning %FALSE, but not otherwise
+ */
+typedef gboolean (*VpnSsoPipeLineFunc) (const gchar *line,
+                                        gpointer     user_data);
+
+/**
+ * vpn_sso_pipe_drain_new:
+ * @fd: (transfer full): Read end of the pipe, closed with the drain
+ * @name: Short name for log messages, e.g. "OpenConnect stderr"
+ * @log: (nullable): Log file receiving a copy of all output
+ * @line_func: Called on the thread-default main context for each line
+ * @user_data: Data for @line_func
+ *
+ * Returns: (transfer full): The drain, already reading
+ */
+VpnSsoPipeDrain *vpn_sso_pipe_drain_new (gint                fd,
+                                         const gchar        *name,
+                                         VpnSsoLogFile      *log,
+                                         VpnSsoPipeLineFunc  line_func,
+                                         gpointer            user_data);
+
+/**
+ * vpn_sso_pipe_drain_set_parsing:
+ * @drain: A #VpnSsoPipeDrain
+ * @parse: Whether lines are still wanted
+ *
+ * With @parse %FALSE, output is only written to the drain's log, moved
+ * there with splice(2) without being read. Drains without a log keep
+ * delivering lines.
+ */
+void vpn_sso_pipe_drain_set_parsing (VpnSsoPipeDrain *drain,
+                                     gboolean         parse);
+
+/**
+ * vpn_sso_pipe_drain_get_dropped:
+ * @drain: A #VpnSsoPipeDrain
+ *
+ * Returns: Bytes of output dropped so far because the main loop fell behind
+ */
+guint64 vpn_sso_pipe_drain_get_dropped (VpnSsoPipeDrain *drain);
+
+/**
+ * vpn_sso_pipe_drain_finish:
+ * @drain: (transfer full): A #VpnSsoPipeDrain
+ *
+ * Reads whatever the pipe still holds, delivers all pending lines
+ * (including an unterminated last line) synchronously and frees the
+ * drain. Use once the child has exited, when its last output matters.
+ * @line_func must not free the drain from here.
+ */
+void vpn_sso_pipe_drain_finish (VpnSsoPipeDrain *drain);
+
+/**
+ * vpn_sso_pipe_drain_free:
+ * @drain: (nullable): A #VpnSsoPipeDrain
+ *
+ * Stops reading and discards output not delivered yet.
+ */
+void vpn_sso_pipe_drain_free (VpnSsoPipeDrain *drain);
+
+G_END_DECLS
+
+#endif /* __PIPE_DRAIN_H__ */
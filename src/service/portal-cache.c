@@ -0,0 +1,151 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "portal-cache.h"
+
+#include <glib/gstdio.h>
+
+/*
+ * GlobalProtect portal configuration cache.
+ *
+ * One key file with a group per portal:
+ *
+ *   [vpn.example.com]
+ *   gateways=gw-eu.example.com;gw-us.example.com;
+ *   gateway=gw-eu.example.com
+ *   fetched-at=1718000000
+ *
+ * The file is small and only touched around connection setup, so it is
+ * read and written synchronously.
+ */
+
+#define PORTAL_CACHE_FILE   VPN_SSO_CACHEDIR "/gp-portals.conf"
+
+static GKeyFile *
+portal_cache_load (void)
+{
+    GKeyFile *keyfile = g_key_file_new ();
+    g_autoptr(GError) error = NULL;
+
+    if (!g_key_file_load_from_file (keyfile, PORTAL_CACHE_FILE,
+                                    G_KEY_FILE_NONE, &error) &&
+        !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_message ("PORTAL CACHE: Ignoring unreadable %s: %s",
+                   PORTAL_CACHE_FILE, error->message);
+    }
+
+    return keyfile;
+}
+
+static void
+portal_cache_save (GKeyFile *keyfile)
+{
+    g_autoptr(GError) error = NULL;
+
+    if (g_mkdir_with_parents (VPN_SSO_CACHEDIR, 0700) < 0) {
+        g_message ("PORTAL CACHE: Cannot create %s", VPN_SSO_CACHEDIR);
+        return;
+    }
+
+    if (!g_key_file_save_to_file (keyfile, PORTAL_CACHE_FILE, &error))
+        g_message ("PORTAL CACHE: Failed to write %s: %s",
+                   PORTAL_CACHE_FILE, error->message);
+}
+
+VpnSsoPortalConfig *
+vpn_sso_portal_cache_lookup (const gchar *portal,
+                             gint64       ttl_seconds)
+{
+    g_autoptr(GKeyFile) keyfile = NULL;
+    VpnSsoPortalConfig *config;
+    gchar *selected;
+    gint64 fetched_at;
+    gint64 age;
+
+    g_return_val_if_fail (portal != NULL, NULL);
+
+    keyfile = portal_cache_load ();
+    if (!g_key_file_has_group (keyfile, portal))
+        return NULL;
+
+    selected = g_key_file_get_string (keyfile, portal, "gateway", NULL);
+    fetched_at = g_key_file_get_int64 (keyfile, portal, "fetched-at", NULL);
+    age = g_get_real_time () / G_USEC_PER_SEC - fetched_at;
+
+    if (!selected || !*selected || fetched_at <= 0 ||
+        age < 0 || age > ttl_seconds) {
+        g_message ("PORTAL CACHE: Entry for %s is stale or incomplete", portal);
+        g_free (selected);
+        return NULL;
+    }
+
+    config = g_new0 (VpnSsoPortalConfig, 1);
+    config->gateways = g_key_file_get_string_list (keyfile, portal, "gateways",
+                                                   NULL, NULL);
+    config->selected_gateway = selected;
+    config->fetched_at = fetched_at;
+
+    return config;
+}
+
+void
+vpn_sso_portal_cache_store (const gchar         *portal,
+                            const gchar * const *gateways,
+                            const gchar         *selected_gateway)
+{
+    g_autoptr(GKeyFile) keyfile = NULL;
+
+    g_return_if_fail (portal != NULL);
+    g_return_if_fail (selected_gateway != NULL);
+
+    keyfile = portal_cache_load ();
+
+    if (gateways && gateways[0])
+        g_key_file_set_string_list (keyfile, portal, "gateways",
+                                    gateways, g_strv_length ((gchar **) gateways));
+    else
+        g_key_file_remove_key (keyfile, portal, "gateways", NULL);
+
+    g_key_file_set_string (keyfile, portal, "gateway", selected_gateway);
+    g_key_file_set_int64 (keyfile, portal, "fetched-at",
+                          g_get_real_time () / G_USEC_PER_SEC);
+
+    portal_cache_save (keyfile);
+    g_message ("PORTAL CACHE: Stored configuration for %s (gateway %s)",
+               portal, selected_gateway);
+}
+
+void
+vpn_sso_portal_cache_clear (const gchar *portal)
+{
+    g_autoptr(GKeyFile) keyfile = NULL;
+
+    g_return_if_fail (portal != NULL);
+
+    keyfile = portal_cache_load ();
+    if (!g_key_file_remove_group (keyfile, portal, NULL))
+        return;
+
+    portal_cache_save (keyfile);
+    g_message ("PORTAL CACHE: Cleared configuration for %s", portal);
+}
+
+void
+vpn_sso_portal_config_free (VpnSsoPortalConfig *config)
+{
+    if (!config)
+        return;
+
+    g_strfreev (config->gateways);
+    g_free (config->selected_gateway);
+    g_free (config);
+}
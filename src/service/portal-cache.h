@@ -0,0 +1,76 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PORTAL_CACHE_H__
+#define __PORTAL_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How long a cached portal configuration is trusted */
+#define VPN_SSO_PORTAL_CACHE_TTL_SECONDS (12 * 3600)
+
+/**
+ * VpnSsoPortalConfig:
+ * @gateways: (nullable): Gateway hosts offered by the portal
+ * @selected_gateway: Gateway openconnect logged in to
+ * @fetched_at: Unix timestamp of the portal getconfig this came from
+ *
+ * The parts of a GlobalProtect portal configuration needed to skip the
+ * portal on reconnect. Holds no secrets; the portal auth cookie stays in
+ * the credential cache.
+ */
+typedef struct {
+    gchar **gateways;
+    gchar *selected_gateway;
+    gint64 fetched_at;
+} VpnSsoPortalConfig;
+
+/**
+ * vpn_sso_portal_cache_lookup:
+ * @portal: Portal address as configured in the connection
+ * @ttl_seconds: Maximum age of the entry
+ *
+ * Returns: (transfer full) (nullable): The cached configuration, or %NULL
+ *   if there is none or it is older than @ttl_seconds
+ */
+VpnSsoPortalConfig *vpn_sso_portal_cache_lookup (const gchar *portal,
+                                                 gint64       ttl_seconds);
+
+/**
+ * vpn_sso_portal_cache_store:
+ * @portal: Portal address as configured in the connection
+ * @gateways: (nullable): Gateway hosts offered by the portal
+ * @selected_gateway: Gateway openconnect logged in to
+ *
+ * Records the portal configuration, stamped with the current time.
+ */
+void vpn_sso_portal_cache_store (const gchar         *portal,
+                                 const gchar * const *gateways,
+                                 const gchar         *selected_gateway);
+
+/**
+ * vpn_sso_portal_cache_clear:
+ * @portal: Portal address as configured in the connection
+ *
+ * Forgets the configuration of @portal, e.g. after the gateway refused a
+ * direct login.
+ */
+void vpn_sso_portal_cache_clear (const gchar *portal);
+
+void vpn_sso_portal_config_free (VpnSsoPortalConfig *config);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoPortalConfig, vpn_sso_portal_config_free)
+
+G_END_DECLS
+
+#endif /* __PORTAL_CACHE_H__ */
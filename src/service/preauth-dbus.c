@@ -0,0 +1,359 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * SECTION:preauth-dbus
+ * @short_description: D-Bus interface for login-time pre-authentication
+ *
+ * The vpn-sso-preauth user agent asks here whether an autoconnect profile
+ * already has cached credentials, and hands over the ones it obtained by
+ * running the SSO helper at login. When NetworkManager later activates
+ * the profile, the credential lookup finds them and openconnect starts
+ * without a browser.
+ *
+ * Callers must be root or the user of the active graphical session, i.e.
+ * the user the service itself runs the SSO helper as. Credentials are only
+ * accepted for the gateway and protocol of an existing VPN SSO profile,
+ * and are cached with that profile's cache-hours and cache-backend;
+ * HasCredentials looks in that profile's backend too.
+ *
+ * A "fingerprint" in StoreCredentials is ignored: any process of the
+ * session may call here, and a fingerprint would become the gateway's
+ * certificate pin. The connection then validates the gateway against the
+ * system CA store, as if the helper had reported no fingerprint.
+ */
+
+#include "config.h"
+#include "preauth-dbus.h"
+#include "credential-cache.h"
+#include "utils.h"
+#include "vpn-config.h"
+
+#include <stdlib.h>
+#include <NetworkManager.h>
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" VPN_SSO_PREAUTH_DBUS_INTERFACE "'>"
+    "    <method name='HasCredentials'>"
+    "      <arg type='s' name='gateway' direction='in'/>"
+    "      <arg type='s' name='protocol' direction='in'/>"
+    "      <arg type='b' name='cached' direction='out'/>"
+    "    </method>"
+    "    <method name='StoreCredentials'>"
+    "      <arg type='a{sv}' name='credentials' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+typedef struct {
+    gchar *gateway;
+    gchar *protocol;
+} HasCredentialsData;
+
+static void
+has_credentials_data_free (HasCredentialsData *data)
+{
+    g_free (data->gateway);
+    g_free (data->protocol);
+    g_free (data);
+}
+
+static void
+has_credentials_list_cb (GObject *source G_GNUC_UNUSED, GAsyncResult *result, gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    HasCredentialsData *data = g_object_get_data (G_OBJECT (invocation), "preauth-query");
+    g_autoptr(GVariant) entries = NULL;
+    GVariantIter iter;
+    GVariant *entry;
+    GError *error = NULL;
+    gboolean cached = FALSE;
+
+    entries = vpn_sso_credential_cache_list_finish (result, &error);
+    if (!entries) {
+        g_dbus_method_invocation_take_error (invocation, error);
+        return;
+    }
+
+    /* Listing rather than looking up keeps the hit/miss metrics about
+     * real connection attempts */
+    g_variant_iter_init (&iter, entries);
+    while (!cached && (entry = g_variant_iter_next_value (&iter))) {
+        const gchar *gateway = NULL;
+        const gchar *protocol = NULL;
+        gboolean expired = TRUE;
+
+        g_variant_lookup (entry, "gateway", "&s", &gateway);
+        g_variant_lookup (entry, "protocol", "&s", &protocol);
+        g_variant_lookup (entry, "expired", "b", &expired);
+
+        cached = !expired &&
+                 g_strcmp0 (gateway, data->gateway) == 0 &&
+                 g_strcmp0 (protocol, data->protocol) == 0;
+        g_variant_unref (entry);
+    }
+
+    g_message ("PREAUTH: %s (%s) %s", data->gateway, data->protocol,
+               cached ? "has cached credentials" : "needs authentication");
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(b)", cached));
+}
+
+static void
+store_done_cb (GObject *source G_GNUC_UNUSED, GAsyncResult *result, gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    GError *error = NULL;
+
+    if (!vpn_sso_credential_cache_store_finish (result, &error)) {
+        g_dbus_method_invocation_take_error (invocation, error);
+        return;
+    }
+
+    g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+/*
+ * Find the VPN SSO profile for @gateway and @protocol; the agent may only
+ * warm the cache for gateways an administrator configured.
+ */
+static NMConnection *
+find_profile (NMClient    *client,
+              const gchar *gateway,
+              const gchar *protocol)
+{
+    const GPtrArray *connections = nm_client_get_connections (client);
+
+    for (guint i = 0; i < connections->len; i++) {
+        NMConnection *connection = NM_CONNECTION (g_ptr_array_index (connections, i));
+        NMSettingVpn *s_vpn = nm_connection_get_setting_vpn (connection);
+
+        if (s_vpn &&
+            g_strcmp0 (nm_setting_vpn_get_service_type (s_vpn), NM_DBUS_SERVICE_VPN_SSO) == 0 &&
+            g_strcmp0 (nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_GATEWAY), gateway) == 0 &&
+            g_strcmp0 (nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_PROTOCOL), protocol) == 0)
+            return connection;
+    }
+
+    return NULL;
+}
+
+static VpnSsoCacheBackendType
+profile_cache_backend (NMConnection *profile)
+{
+    NMSettingVpn *s_vpn = nm_connection_get_setting_vpn (profile);
+
+    return vpn_sso_cache_backend_type_from_string (
+        nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_CACHE_BACKEND));
+}
+
+static void
+handle_has_credentials (GDBusMethodInvocation *invocation,
+                        NMClient              *client)
+{
+    GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+    HasCredentialsData *data = g_new0 (HasCredentialsData, 1);
+    NMConnection *profile;
+
+    g_variant_get (parameters, "(ss)", &data->gateway, &data->protocol);
+    g_object_set_data_full (G_OBJECT (invocation), "preauth-query", data,
+                            (GDestroyNotify) has_credentials_data_free);
+
+    /* Credentials for a gateway without a profile would be refused */
+    profile = find_profile (client, data->gateway, data->protocol);
+    if (!profile) {
+        g_message ("PREAUTH: No VPN SSO profile for %s (%s)", data->gateway, data->protocol);
+        g_dbus_method_invocation_return_value (invocation, g_variant_new ("(b)", FALSE));
+        return;
+    }
+
+    vpn_sso_credential_cache_list_async (profile_cache_backend (profile), NULL,
+                                         has_credentials_list_cb, invocation);
+}
+
+static void
+handle_store_credentials (GDBusMethodInvocation *invocation,
+                          NMClient              *client)
+{
+    GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+    g_autoptr(GVariant) credentials = NULL;
+    NMConnection *profile;
+    NMSettingVpn *s_vpn;
+    const gchar *gateway = NULL;
+    const gchar *protocol = NULL;
+    const gchar *cookie = NULL;
+    const gchar *username = NULL;
+    const gchar *usergroup = NULL;
+    const gchar *value;
+    gint cache_hours;
+
+    g_variant_get (parameters, "(@a{sv})", &credentials);
+    g_variant_lookup (credentials, "gateway", "&s", &gateway);
+    g_variant_lookup (credentials, "protocol", "&s", &protocol);
+    g_variant_lookup (credentials, "cookie", "&s", &cookie);
+    g_variant_lookup (credentials, "username", "&s", &username);
+    g_variant_lookup (credentials, "usergroup", "&s", &usergroup);
+
+    if (!gateway || !*gateway || !protocol || !*protocol || !cookie || !*cookie) {
+        g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR,
+                                                       G_DBUS_ERROR_INVALID_ARGS,
+                                                       "Gateway, protocol and cookie are required");
+        return;
+    }
+
+    profile = find_profile (client, gateway, protocol);
+    if (!profile) {
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                               G_DBUS_ERROR_ACCESS_DENIED,
+                                               "No VPN SSO profile for %s (%s)",
+                                               gateway, protocol);
+        return;
+    }
+
+    s_vpn = nm_connection_get_setting_vpn (profile);
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_CACHE_HOURS);
+    cache_hours = value ? atoi (value) : 0;
+    value = nm_setting_vpn_get_data_item (s_vpn, NM_VPN_SSO_KEY_USERNAME);
+    if (value && *value)
+        username = value;
+
+    if (g_variant_lookup (credentials, "fingerprint", "&s", NULL))
+        g_message ("PREAUTH: Ignoring the certificate fingerprint for %s", gateway);
+
+    g_message ("PREAUTH: Storing credentials for %s (%s, profile '%s')",
+               gateway, protocol, nm_connection_get_id (profile));
+
+    vpn_sso_credential_cache_store_async (profile_cache_backend (profile),
+                                          gateway,
+                                          protocol,
+                                          username,
+                                          cookie,
+                                          NULL, /* fingerprint: not trusted from here */
+                                          usergroup && *usergroup ? usergroup : NULL,
+                                          cache_hours,
+                                          0, /* server expiry unknown */
+                                          NULL, /* cancellable */
+                                          store_done_cb,
+                                          invocation);
+}
+
+/*
+ * Both methods need the caller's profile; NetworkManager is asked for the
+ * connections without blocking the service's main loop.
+ */
+static void
+client_ready_cb (GObject *source G_GNUC_UNUSED, GAsyncResult *result, gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    g_autoptr(NMClient) client = NULL;
+    g_autoptr(GError) error = NULL;
+
+    client = nm_client_new_finish (result, &error);
+    if (!client) {
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                                               "Cannot list connections: %s", error->message);
+        return;
+    }
+
+    if (g_strcmp0 (g_dbus_method_invocation_get_method_name (invocation), "HasCredentials") == 0)
+        handle_has_credentials (invocation, client);
+    else
+        handle_store_credentials (invocation, client);
+}
+
+static void
+caller_uid_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    g_autoptr(VpnSsoSessionEnv) session = NULL;
+    g_autoptr(GVariant) reply = NULL;
+    GError *error = NULL;
+    guint32 uid;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+    if (!reply) {
+        g_dbus_method_invocation_take_error (invocation, error);
+        return;
+    }
+    g_variant_get (reply, "(u)", &uid);
+
+    if (uid != 0) {
+        session = vpn_sso_get_graphical_session_env ();
+        if (!session || session->uid != uid) {
+            g_message ("PREAUTH: Refusing caller uid %u (not the graphical session user)", uid);
+            g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR,
+                                                           G_DBUS_ERROR_ACCESS_DENIED,
+                                                           "Only the graphical session user may pre-authenticate");
+            return;
+        }
+    }
+
+    nm_client_new_async (NULL, client_ready_cb, invocation);
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path G_GNUC_UNUSED,
+                    const gchar           *interface_name G_GNUC_UNUSED,
+                    const gchar           *method_name,
+                    GVariant              *parameters G_GNUC_UNUSED,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data G_GNUC_UNUSED)
+{
+    g_message ("PREAUTH: %s from %s", method_name, sender);
+
+    if (g_strcmp0 (method_name, "HasCredentials") != 0 &&
+        g_strcmp0 (method_name, "StoreCredentials") != 0) {
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                               G_DBUS_ERROR_UNKNOWN_METHOD,
+                                               "Unknown method %s", method_name);
+        return;
+    }
+
+    /* Authorize by the caller's uid before doing anything */
+    g_dbus_connection_call (connection,
+                            "org.freedesktop.DBus",
+                            "/org/freedesktop/DBus",
+                            "org.freedesktop.DBus",
+                            "GetConnectionUnixUser",
+                            g_variant_new ("(s)", sender),
+                            G_VARIANT_TYPE ("(u)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            caller_uid_cb,
+                            invocation);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    .method_call = handle_method_call,
+};
+
+guint
+vpn_sso_preauth_dbus_register (GDBusConnection  *connection,
+                               GError          **error)
+{
+    g_autoptr(GDBusNodeInfo) node_info = NULL;
+
+    g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), 0);
+
+    node_info = g_dbus_node_info_new_for_xml (introspection_xml, error);
+    if (!node_info)
+        return 0;
+
+    return g_dbus_connection_register_object (connection,
+                                              VPN_SSO_PREAUTH_DBUS_PATH,
+                                              node_info->interfaces[0],
+                                              &interface_vtable,
+                                              NULL, NULL,
+                                              error);
+}
@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PREAUTH_DBUS_H__
+#define __PREAUTH_DBUS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define VPN_SSO_PREAUTH_DBUS_PATH      "/org/freedesktop/NetworkManager/VpnSso/Preauth"
+#define VPN_SSO_PREAUTH_DBUS_INTERFACE "org.freedesktop.NetworkManager.VpnSso.Preauth"
+
+/**
+ * vpn_sso_preauth_dbus_register:
+ * @connection: The system bus connection
+ * @error: Return location for error
+ *
+ * Exports the interface the login-time pre-authentication agent uses
+ * (HasCredentials, StoreCredentials) at %VPN_SSO_PREAUTH_DBUS_PATH.
+ *
+ * Returns: The registration id, or 0 on error
+ */
+guint vpn_sso_preauth_dbus_register (GDBusConnection  *connection,
+                                     GError          **error);
+
+G_END_DECLS
+
+#endif /* __PREAUTH_DBUS_H__ */
@@ -0,0 +1,85 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * SECTION:process-scope-dbus
+ * @short_description: D-Bus interface reporting child process resource usage
+ *
+ * Lists the SSO helpers and openconnect processes the service is running,
+ * with the CPU time, memory and process count of each one's scope, e.g.:
+ *
+ *   busctl call org.freedesktop.NetworkManager.vpn-sso \
+ *       /org/freedesktop/NetworkManager/VpnSso/Processes \
+ *       org.freedesktop.NetworkManager.VpnSso.Processes ListProcesses
+ *
+ * Access is restricted to root by the D-Bus policy.
+ */
+
+#include "config.h"
+#include "process-scope-dbus.h"
+#include "process-scope.h"
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" VPN_SSO_PROCESSES_DBUS_INTERFACE "'>"
+    "    <method name='ListProcesses'>"
+    "      <arg type='aa{sv}' name='processes' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+static void
+handle_method_call (GDBusConnection       *connection G_GNUC_UNUSED,
+                    const gchar           *sender,
+                    const gchar           *object_path G_GNUC_UNUSED,
+                    const gchar           *interface_name G_GNUC_UNUSED,
+                    const gchar           *method_name,
+                    GVariant              *parameters G_GNUC_UNUSED,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data G_GNUC_UNUSED)
+{
+    g_message ("SCOPE: %s from %s", method_name, sender);
+
+    if (g_strcmp0 (method_name, "ListProcesses") == 0) {
+        g_autoptr(GVariant) processes = vpn_sso_scope_list_usage ();
+
+        g_dbus_method_invocation_return_value (invocation,
+            g_variant_new ("(@aa{sv})", processes));
+    } else {
+        g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                               G_DBUS_ERROR_UNKNOWN_METHOD,
+                                               "Unknown method %s", method_name);
+    }
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    .method_call = handle_method_call,
+};
+
+guint
+vpn_sso_process_scope_dbus_register (GDBusConnection  *connection,
+                                     GError          **error)
+{
+    g_autoptr(GDBusNodeInfo) node_info = NULL;
+
+    g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), 0);
+
+    node_info = g_dbus_node_info_new_for_xml (introspection_xml, error);
+    if (!node_info)
+        return 0;
+
+    return g_dbus_connection_register_object (connection,
+                                              VPN_SSO_PROCESSES_DBUS_PATH,
+                                              node_info->interfaces[0],
+                                              &interface_vtable,
+                                              NULL, NULL,
+                                              error);
+}
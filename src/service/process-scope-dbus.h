@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PROCESS_SCOPE_DBUS_H__
+#define __PROCESS_SCOPE_DBUS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define VPN_SSO_PROCESSES_DBUS_PATH      "/org/freedesktop/NetworkManager/VpnSso/Processes"
+#define VPN_SSO_PROCESSES_DBUS_INTERFACE "org.freedesktop.NetworkManager.VpnSso.Processes"
+
+/**
+ * vpn_sso_process_scope_dbus_register:
+ * @connection: The system bus connection
+ * @error: Return location for error
+ *
+ * Exports the resource usage of the service's child processes
+ * (ListProcesses) at %VPN_SSO_PROCESSES_DBUS_PATH.
+ *
+ * Returns: The registration id, or 0 on error
+ */
+guint vpn_sso_process_scope_dbus_register (GDBusConnection  *connection,
+                                           GError          **error);
+
+G_END_DECLS
+
+#endif /* __PROCESS_SCOPE_DBUS_H__ */
@@ -0,0 +1,316 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "process-scope.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+
+/*
+ * Per-process transient systemd scopes.
+ *
+ * Every spawned SSO helper and openconnect gets a scope of its own in
+ * VPN_SSO_SCOPE_SLICE, created with StartTransientUnit right after spawn
+ * and before the process has had time to fork. The cgroup then tracks
+ * the whole process tree: cgroup.kill (Linux >= 5.14) tears it down
+ * atomically, and cpu.stat, memory.current/peak and pids.current give
+ * its resource usage. Scopes stop on their own once empty.
+ */
+
+#define SYSTEMD_BUS_NAME       "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_PATH    "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_IFACE  "org.freedesktop.systemd1.Manager"
+
+#define SCOPE_CGROUP_ROOT      "/sys/fs/cgroup/system.slice/" VPN_SSO_SCOPE_SLICE
+
+struct _VpnSsoScope {
+    gchar *unit;
+    gchar *cgroup;               /* Set once systemd created the scope */
+    gchar *connection;
+    gchar *role;
+    GPid pid;
+    gint64 started_at;
+    GCancellable *cancellable;
+};
+
+/* Live scopes, for vpn_sso_scope_list_usage() */
+static GList *scopes;
+
+static GDBusConnection *
+system_bus (void)
+{
+    g_autoptr(GError) error = NULL;
+    GDBusConnection *bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+
+    if (!bus)
+        g_message ("SCOPE: No system bus: %s", error->message);
+
+    return bus;
+}
+
+static gchar *
+scope_unit_name (const gchar *role, GPid pid)
+{
+    g_autofree gchar *slug = g_ascii_strdown (role, -1);
+
+    for (gchar *p = slug; *p; p++) {
+        if (!g_ascii_isalnum (*p))
+            *p = '_';
+    }
+
+    return g_strdup_printf ("vpnsso-%s-%d.scope", slug, pid);
+}
+
+static void
+start_transient_unit_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr(GVariant) reply = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *cgroup = NULL;
+    VpnSsoScope *scope;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    scope = user_data;
+    if (!reply) {
+        g_message ("SCOPE: Cannot create %s, %s (PID %d) stays unconfined: %s",
+                   scope->unit, scope->role, scope->pid, error->message);
+        return;
+    }
+
+    cgroup = g_build_filename (SCOPE_CGROUP_ROOT, scope->unit, NULL);
+    if (!g_file_test (cgroup, G_FILE_TEST_IS_DIR)) {
+        g_message ("SCOPE: %s created, but %s is missing (no unified cgroup hierarchy?)",
+                   scope->unit, cgroup);
+        return;
+    }
+
+    scope->cgroup = g_steal_pointer (&cgroup);
+    g_message ("SCOPE: %s (PID %d) runs in %s", scope->role, scope->pid, scope->unit);
+}
+
+VpnSsoScope *
+vpn_sso_scope_new (GPid         pid,
+                   const gchar *connection,
+                   const gchar *role)
+{
+    g_autoptr(GDBusConnection) bus = NULL;
+    g_autofree gchar *description = NULL;
+    GVariantBuilder properties;
+    VpnSsoScope *scope;
+    guint32 pids[] = { pid };
+
+    g_return_val_if_fail (pid > 0, NULL);
+    g_return_val_if_fail (role != NULL, NULL);
+
+    scope = g_new0 (VpnSsoScope, 1);
+    scope->unit = scope_unit_name (role, pid);
+    scope->connection = g_strdup (connection);
+    scope->role = g_strdup (role);
+    scope->pid = pid;
+    scope->started_at = g_get_real_time () / G_USEC_PER_SEC;
+    scope->cancellable = g_cancellable_new ();
+    scopes = g_list_prepend (scopes, scope);
+
+    bus = system_bus ();
+    if (!bus)
+        return scope;
+
+    description = g_strdup_printf ("GNOME VPN SSO %s%s%s", role,
+                                   connection ? " for " : "",
+                                   connection ? connection : "");
+
+    g_variant_builder_init (&properties, G_VARIANT_TYPE ("a(sv)"));
+    g_variant_builder_add (&properties, "(sv)", "Description",
+                           g_variant_new_string (description));
+    g_variant_builder_add (&properties, "(sv)", "Slice",
+                           g_variant_new_string (VPN_SSO_SCOPE_SLICE));
+    g_variant_builder_add (&properties, "(sv)", "PIDs",
+                           g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                      pids, G_N_ELEMENTS (pids),
+                                                      sizeof (guint32)));
+    g_variant_builder_add (&properties, "(sv)", "CollectMode",
+                           g_variant_new_string ("inactive-or-failed"));
+    g_variant_builder_add (&properties, "(sv)", "CPUAccounting", g_variant_new_boolean (TRUE));
+    g_variant_builder_add (&properties, "(sv)", "MemoryAccounting", g_variant_new_boolean (TRUE));
+    g_variant_builder_add (&properties, "(sv)", "TasksAccounting", g_variant_new_boolean (TRUE));
+
+    g_dbus_connection_call (bus,
+                            SYSTEMD_BUS_NAME,
+                            SYSTEMD_OBJECT_PATH,
+                            SYSTEMD_MANAGER_IFACE,
+                            "StartTransientUnit",
+                            g_variant_new ("(ssa(sv)a(sa(sv)))",
+                                           scope->unit, "fail", &properties, NULL),
+                            G_VARIANT_TYPE ("(o)"),
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            scope->cancellable,
+                            start_transient_unit_cb,
+                            scope);
+
+    return scope;
+}
+
+/*
+ * Read a single-value cgroup file, or with @key the value of the
+ * "key value" line of a flat-keyed file such as cpu.stat.
+ */
+static gboolean
+cgroup_read_u64 (const gchar *cgroup,
+                 const gchar *file,
+                 const gchar *key,
+                 guint64     *value)
+{
+    g_autofree gchar *path = g_build_filename (cgroup, file, NULL);
+    g_autofree gchar *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return FALSE;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (gint i = 0; lines[i]; i++) {
+        const gchar *number = lines[i];
+
+        if (key) {
+            gsize key_len = strlen (key);
+
+            if (strncmp (number, key, key_len) != 0 || number[key_len] != ' ')
+                continue;
+            number += key_len + 1;
+        }
+
+        return g_ascii_string_to_unsigned (number, 10, 0, G_MAXUINT64, value, NULL);
+    }
+
+    return FALSE;
+}
+
+static void
+kill_unit_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    g_autofree gchar *unit = user_data;
+    g_autoptr(GVariant) reply = NULL;
+    g_autoptr(GError) error = NULL;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+    if (!reply)
+        g_debug ("SCOPE: KillUnit %s: %s", unit, error->message);
+}
+
+gboolean
+vpn_sso_scope_kill (VpnSsoScope *scope)
+{
+    g_autoptr(GDBusConnection) bus = NULL;
+    g_autofree gchar *kill_path = NULL;
+    guint64 pids = 0;
+    int fd;
+
+    if (!scope || !scope->cgroup)
+        return FALSE;
+
+    if (cgroup_read_u64 (scope->cgroup, "pids.current", NULL, &pids) && pids == 0)
+        return TRUE;
+
+    g_message ("SCOPE: Killing %s (%" G_GUINT64_FORMAT " processes left)",
+               scope->unit, pids);
+
+    kill_path = g_build_filename (scope->cgroup, "cgroup.kill", NULL);
+    fd = open (kill_path, O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        gboolean written = write (fd, "1", 1) == 1;
+
+        close (fd);
+        if (written)
+            return TRUE;
+    }
+
+    /* Kernels before 5.14: let systemd signal every process in the scope */
+    bus = system_bus ();
+    if (!bus)
+        return FALSE;
+
+    g_dbus_connection_call (bus,
+                            SYSTEMD_BUS_NAME,
+                            SYSTEMD_OBJECT_PATH,
+                            SYSTEMD_MANAGER_IFACE,
+                            "KillUnit",
+                            g_variant_new ("(ssi)", scope->unit, "all", SIGKILL),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1,
+                            NULL,
+                            kill_unit_cb,
+                            g_strdup (scope->unit));
+    return TRUE;
+}
+
+void
+vpn_sso_scope_free (VpnSsoScope *scope)
+{
+    if (!scope)
+        return;
+
+    scopes = g_list_remove (scopes, scope);
+
+    g_cancellable_cancel (scope->cancellable);
+    g_object_unref (scope->cancellable);
+    g_free (scope->unit);
+    g_free (scope->cgroup);
+    g_free (scope->connection);
+    g_free (scope->role);
+    g_free (scope);
+}
+
+GVariant *
+vpn_sso_scope_list_usage (void)
+{
+    GVariantBuilder entries;
+
+    g_variant_builder_init (&entries, G_VARIANT_TYPE ("aa{sv}"));
+
+    for (GList *l = scopes; l; l = l->next) {
+        VpnSsoScope *scope = l->data;
+        GVariantBuilder entry;
+        guint64 value;
+
+        g_variant_builder_init (&entry, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&entry, "{sv}", "unit", g_variant_new_string (scope->unit));
+        g_variant_builder_add (&entry, "{sv}", "role", g_variant_new_string (scope->role));
+        if (scope->connection)
+            g_variant_builder_add (&entry, "{sv}", "connection",
+                                   g_variant_new_string (scope->connection));
+        g_variant_builder_add (&entry, "{sv}", "pid", g_variant_new_int32 (scope->pid));
+        g_variant_builder_add (&entry, "{sv}", "started-at", g_variant_new_int64 (scope->started_at));
+
+        if (scope->cgroup) {
+            if (cgroup_read_u64 (scope->cgroup, "cpu.stat", "usage_usec", &value))
+                g_variant_builder_add (&entry, "{sv}", "cpu-usec", g_variant_new_uint64 (value));
+            if (cgroup_read_u64 (scope->cgroup, "memory.current", NULL, &value))
+                g_variant_builder_add (&entry, "{sv}", "memory-bytes", g_variant_new_uint64 (value));
+            if (cgroup_read_u64 (scope->cgroup, "memory.peak", NULL, &value))
+                g_variant_builder_add (&entry, "{sv}", "memory-peak-bytes", g_variant_new_uint64 (value));
+            if (cgroup_read_u64 (scope->cgroup, "pids.current", NULL, &value))
+                g_variant_builder_add (&entry, "{sv}", "pids", g_variant_new_uint64 (value));
+        }
+
+        g_variant_builder_add_value (&entries, g_variant_builder_end (&entry));
+    }
+
+    return g_variant_ref_sink (g_variant_builder_end (&entries));
+}
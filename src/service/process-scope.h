@@ -0,0 +1,70 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PROCESS_SCOPE_H__
+#define __PROCESS_SCOPE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Slice the scopes are created in */
+#define VPN_SSO_SCOPE_SLICE "system-vpnsso.slice"
+
+/**
+ * VpnSsoScope:
+ *
+ * A transient systemd scope holding one spawned process and everything
+ * it forks (e.g. the browser Playwright starts), so the whole tree can be
+ * killed at once and its resource usage read from the cgroup.
+ */
+typedef struct _VpnSsoScope VpnSsoScope;
+
+/**
+ * vpn_sso_scope_new:
+ * @pid: Freshly spawned process to move into the scope
+ * @connection: (nullable): Connection the process belongs to, for reporting
+ * @role: What the process is, e.g. "SSO helper"
+ *
+ * Asks systemd to create the scope. Without systemd the process simply
+ * stays where it is, and vpn_sso_scope_kill() does nothing.
+ *
+ * Returns: (transfer full): The scope
+ */
+VpnSsoScope *vpn_sso_scope_new (GPid         pid,
+                                const gchar *connection,
+                                const gchar *role);
+
+/**
+ * vpn_sso_scope_kill:
+ * @scope: (nullable): A #VpnSsoScope
+ *
+ * SIGKILLs every process left in the scope in one step (cgroup.kill),
+ * or through systemd where cgroup.kill is unavailable.
+ *
+ * Returns: %FALSE if the scope does not exist (yet)
+ */
+gboolean vpn_sso_scope_kill (VpnSsoScope *scope);
+
+void vpn_sso_scope_free (VpnSsoScope *scope);
+
+/**
+ * vpn_sso_scope_list_usage:
+ *
+ * Returns: (transfer full): An aa{sv} with one entry per live scope: unit,
+ *   connection, role, pid, started-at, cpu-usec, memory-bytes,
+ *   memory-peak-bytes and pids (counters missing if not accounted)
+ */
+GVariant *vpn_sso_scope_list_usage (void);
+
+G_END_DECLS
+
+#endif /* __PROCESS_SCOPE_H__ */
@@ -0,0 +1,77 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "sso-progress.h"
+#include "flat-json.h"
+
+#include <string.h>
+#include <gio/gio.h>
+
+VpnSsoProgressEvent *
+vpn_sso_progress_event_parse (const gchar  *line,
+                              GError      **error)
+{
+    g_autoptr(GHashTable) members = NULL;
+    VpnSsoProgressEvent *event;
+    const gchar *type;
+
+    members = vpn_sso_json_parse_object (line);
+    if (!members) {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Not a flat JSON object");
+        return NULL;
+    }
+
+    event = g_new0 (VpnSsoProgressEvent, 1);
+    type = g_hash_table_lookup (members, "event");
+
+    if (g_strcmp0 (type, "phase-started") == 0)
+        event->type = VPN_SSO_PROGRESS_PHASE_STARTED;
+    else if (g_strcmp0 (type, "phase-done") == 0)
+        event->type = VPN_SSO_PROGRESS_PHASE_DONE;
+    else if (g_strcmp0 (type, "cookie") == 0)
+        event->type = VPN_SSO_PROGRESS_COOKIE;
+    else if (g_strcmp0 (type, "error") == 0)
+        event->type = VPN_SSO_PROGRESS_ERROR;
+    else
+        event->type = VPN_SSO_PROGRESS_UNKNOWN;
+
+    event->phase = vpn_sso_json_take_member (members, "phase");
+    if (g_hash_table_lookup (members, "ms"))
+        event->duration_ms = g_ascii_strtoll (g_hash_table_lookup (members, "ms"), NULL, 10);
+    event->cookie = vpn_sso_json_take_member (members, "cookie");
+    event->usergroup = vpn_sso_json_take_member (members, "usergroup");
+    event->username = vpn_sso_json_take_member (members, "username");
+    event->fingerprint = vpn_sso_json_take_member (members, "fingerprint");
+    event->error_class = vpn_sso_json_take_member (members, "class");
+    event->message = vpn_sso_json_take_member (members, "message");
+
+    return event;
+}
+
+void
+vpn_sso_progress_event_free (VpnSsoProgressEvent *event)
+{
+    if (!event)
+        return;
+
+    g_free (event->phase);
+    if (event->cookie)
+        memset (event->cookie, 0, strlen (event->cookie));
+    g_free (event->cookie);
+    g_free (event->usergroup);
+    g_free (event->username);
+    g_free (event->fingerprint);
+    g_free (event->error_class);
+    g_free (event->message);
+    g_free (event);
+}
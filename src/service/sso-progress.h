@@ -0,0 +1,90 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SSO_PROGRESS_H__
+#define __SSO_PROGRESS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Descriptor the SSO helper writes its progress events to */
+#define VPN_SSO_PROGRESS_FD 3
+
+/**
+ * VpnSsoProgressType:
+ * @VPN_SSO_PROGRESS_PHASE_STARTED: A phase of the login began
+ * @VPN_SSO_PROGRESS_PHASE_DONE: A phase ended, after @duration_ms
+ * @VPN_SSO_PROGRESS_COOKIE: Credentials for the primary gateway are ready
+ * @VPN_SSO_PROGRESS_ERROR: The login failed; see @error_class
+ *
+ * The events of the helper's progress protocol, one JSON object per line
+ * on %VPN_SSO_PROGRESS_FD:
+ *
+ *   {"event":"phase-started","phase":"browser"}
+ *   {"event":"phase-done","phase":"browser","ms":812}
+ *   {"event":"cookie","cookie":"...","usergroup":"...","username":"...","fingerprint":"..."}
+ *   {"event":"error","class":"network","message":"..."}
+ *
+ * Error classes are "network", "timeout", "login", "browser" and
+ * "internal". Unknown events and members are ignored, so either side can
+ * grow the protocol.
+ */
+typedef enum {
+    VPN_SSO_PROGRESS_UNKNOWN,
+    VPN_SSO_PROGRESS_PHASE_STARTED,
+    VPN_SSO_PROGRESS_PHASE_DONE,
+    VPN_SSO_PROGRESS_COOKIE,
+    VPN_SSO_PROGRESS_ERROR,
+} VpnSsoProgressType;
+
+typedef struct {
+    VpnSsoProgressType type;
+
+    /* Phase events */
+    gchar *phase;
+    gint64 duration_ms;
+
+    /* Cookie event */
+    gchar *cookie;
+    gchar *usergroup;
+    gchar *username;
+    gchar *fingerprint;
+
+    /* Error event */
+    gchar *error_class;
+    gchar *message;
+} VpnSsoProgressEvent;
+
+/**
+ * vpn_sso_progress_event_parse:
+ * @line: One line of the progress protocol
+ * @error: Return location for a #GError
+ *
+ * Returns: (transfer full) (nullable): The event, or %NULL if @line is
+ *   not a flat JSON object
+ */
+VpnSsoProgressEvent *vpn_sso_progress_event_parse (const gchar  *line,
+                                                   GError      **error);
+
+/**
+ * vpn_sso_progress_event_free:
+ * @event: (nullable): A #VpnSsoProgressEvent
+ *
+ * Frees the event, clearing the cookie from memory first.
+ */
+void vpn_sso_progress_event_free (VpnSsoProgressEvent *event);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoProgressEvent, vpn_sso_progress_event_free)
+
+G_END_DECLS
+
+#endif /* __SSO_PROGRESS_H__ */
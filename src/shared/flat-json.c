@@ -0,0 +1,217 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "flat-json.h"
+
+#include <string.h>
+
+static void
+skip_space (const gchar **p)
+{
+    while (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n')
+        (*p)++;
+}
+
+static gboolean
+read_hex4 (const gchar *p, gunichar *out)
+{
+    gunichar value = 0;
+
+    for (gint i = 0; i < 4; i++) {
+        gint digit = g_ascii_xdigit_value (p[i]);
+
+        if (digit < 0)
+            return FALSE;
+        value = (value << 4) | digit;
+    }
+
+    *out = value;
+    return TRUE;
+}
+
+/* Reads the string starting at the opening quote at *p */
+static gchar *
+read_string (const gchar **p)
+{
+    GString *str = g_string_new (NULL);
+    const gchar *s = *p + 1;
+    gunichar c, low;
+
+    while (*s != '"') {
+        if (*s == '\0' || (guchar) *s < 0x20)
+            goto fail;
+
+        if (*s != '\\') {
+            g_string_append_c (str, *s++);
+            continue;
+        }
+
+        s++;
+        switch (*s++) {
+        case '"':  g_string_append_c (str, '"'); break;
+        case '\\': g_string_append_c (str, '\\'); break;
+        case '/':  g_string_append_c (str, '/'); break;
+        case 'b':  g_string_append_c (str, '\b'); break;
+        case 'f':  g_string_append_c (str, '\f'); break;
+        case 'n':  g_string_append_c (str, '\n'); break;
+        case 'r':  g_string_append_c (str, '\r'); break;
+        case 't':  g_string_append_c (str, '\t'); break;
+        case 'u':
+            if (!read_hex4 (s, &c))
+                goto fail;
+            s += 4;
+            if (c >= 0xd800 && c < 0xdc00) {
+                if (s[0] != '\\' || s[1] != 'u' || !read_hex4 (s + 2, &low) ||
+                    low < 0xdc00 || low >= 0xe000)
+                    goto fail;
+                s += 6;
+                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+            }
+            if (c == 0 || (c >= 0xdc00 && c < 0xe000))
+                goto fail;
+            g_string_append_unichar (str, c);
+            break;
+        default:
+            goto fail;
+        }
+    }
+
+    *p = s + 1;
+    if (!g_utf8_validate (str->str, str->len, NULL))
+        goto fail;
+    return g_string_free (str, FALSE);
+
+fail:
+    memset (str->str, 0, str->allocated_len);
+    g_string_free (str, TRUE);
+    return NULL;
+}
+
+/* Numbers and literals are kept as their text; null becomes NULL */
+static gboolean
+read_scalar (const gchar **p, gchar **out)
+{
+    const gchar *start = *p;
+
+    while (g_ascii_isalnum (**p) || **p == '-' || **p == '+' || **p == '.')
+        (*p)++;
+
+    if (*p == start)
+        return FALSE;
+
+    *out = g_strndup (start, *p - start);
+    if (g_strcmp0 (*out, "null") == 0)
+        g_clear_pointer (out, g_free);
+    return TRUE;
+}
+
+static void
+member_free (gpointer value)
+{
+    if (value)
+        memset (value, 0, strlen (value));
+    g_free (value);
+}
+
+GHashTable *
+vpn_sso_json_parse_object (const gchar *line)
+{
+    g_autoptr(GHashTable) members = NULL;
+    const gchar *p = line;
+
+    members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, member_free);
+
+    skip_space (&p);
+    if (*p++ != '{')
+        return NULL;
+    skip_space (&p);
+
+    if (*p == '}') {
+        p++;
+    } else {
+        for (;;) {
+            gchar *key, *value = NULL;
+
+            if (*p != '"' || !(key = read_string (&p)))
+                return NULL;
+            skip_space (&p);
+            if (*p++ != ':') {
+                g_free (key);
+                return NULL;
+            }
+            skip_space (&p);
+
+            if (*p == '"' ? !(value = read_string (&p)) : !read_scalar (&p, &value)) {
+                g_free (key);
+                return NULL;
+            }
+            g_hash_table_replace (members, key, value);
+
+            skip_space (&p);
+            if (*p == '}') {
+                p++;
+                break;
+            }
+            if (*p++ != ',')
+                return NULL;
+            skip_space (&p);
+        }
+    }
+
+    skip_space (&p);
+    if (*p != '\0')
+        return NULL;
+
+    return g_steal_pointer (&members);
+}
+
+gchar *
+vpn_sso_json_take_member (GHashTable  *members,
+                          const gchar *key)
+{
+    gpointer stolen_key, value;
+
+    if (!g_hash_table_steal_extended (members, key, &stolen_key, &value))
+        return NULL;
+
+    g_free (stolen_key);
+    return value;
+}
+
+void
+vpn_sso_json_add_string (GString     *json,
+                         const gchar *key,
+                         const gchar *value)
+{
+    if (!value || !*value)
+        return;
+
+    g_string_append_printf (json, "%s\"%s\":\"", json->len > 1 ? "," : "", key);
+    for (const guchar *p = (const guchar *) value; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            g_string_append_printf (json, "\\%c", *p);
+        else if (*p < 0x20)
+            g_string_append_printf (json, "\\u%04x", *p);
+        else
+            g_string_append_c (json, *p);
+    }
+    g_string_append_c (json, '"');
+}
+
+void
+vpn_sso_json_add_int (GString     *json,
+                      const gchar *key,
+                      gint64       value)
+{
+    g_string_append_printf (json, "%s\"%s\":%" G_GINT64_FORMAT,
+                            json->len > 1 ? "," : "", key, value);
+}
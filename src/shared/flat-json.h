@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __FLAT_JSON_H__
+#define __FLAT_JSON_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The service and its SSO helpers talk in one-line JSON objects whose
+ * members are all strings or numbers (the stdin context and the progress
+ * events). These read and write just that much JSON, so neither side
+ * needs a JSON library.
+ */
+
+/**
+ * vpn_sso_json_parse_object:
+ * @line: One line holding a flat JSON object
+ *
+ * Numbers and literals are kept as their text, and null members are
+ * %NULL. Values are cleared from memory when the table frees them, as
+ * they may be secrets.
+ *
+ * Returns: (transfer full) (nullable): Member names to values, or %NULL
+ *   if @line is not a flat JSON object
+ */
+GHashTable *vpn_sso_json_parse_object (const gchar *line);
+
+/**
+ * vpn_sso_json_take_member:
+ * @members: A table from vpn_sso_json_parse_object()
+ * @key: Member name
+ *
+ * Returns: (transfer full) (nullable): The value, removed from @members
+ */
+gchar *vpn_sso_json_take_member (GHashTable  *members,
+                                 const gchar *key);
+
+/**
+ * vpn_sso_json_add_string:
+ * @json: An object being built, starting with "{"
+ * @key: Member name (not escaped)
+ * @value: (nullable): Member value; nothing is added if %NULL or empty
+ */
+void vpn_sso_json_add_string (GString     *json,
+                              const gchar *key,
+                              const gchar *value);
+
+/**
+ * vpn_sso_json_add_int:
+ * @json: An object being built, starting with "{"
+ * @key: Member name (not escaped)
+ * @value: Member value
+ */
+void vpn_sso_json_add_int (GString     *json,
+                           const gchar *key,
+                           gint64       value);
+
+G_END_DECLS
+
+#endif /* __FLAT_JSON_H__ */
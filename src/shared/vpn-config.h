@@ -25,6 +25,13 @@ G_BEGIN_DECLS
 #define NM_VPN_SSO_KEY_EXTRA_ARGS   "extra-args"
 #define NM_VPN_SSO_KEY_CACHE_HOURS  "cache-hours"
 #define NM_VPN_SSO_KEY_HEADLESS     "headless"
+#define NM_VPN_SSO_KEY_CACHE_BACKEND "cache-backend"
+#define NM_VPN_SSO_KEY_COOKIE_PROBE "cookie-probe"
+#define NM_VPN_SSO_KEY_HEDGE_DELAY  "hedge-delay"
+#define NM_VPN_SSO_KEY_GP_DIRECT    "gp-direct-gateway"
+#define NM_VPN_SSO_KEY_SSO_GROUP    "sso-group"
+#define NM_VPN_SSO_KEY_LOG_FILE     "log-file"
+#define NM_VPN_SSO_KEY_SSO_HELPER   "sso-helper"
 /* VPN secret keys (stored in connection's vpn secrets) */
 #define NM_VPN_SSO_SECRET_PASSWORD  "password"
 #define NM_VPN_SSO_SECRET_TOTP      "totp-secret"
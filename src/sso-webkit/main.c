@@ -0,0 +1,246 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * vpn-sso-webkit: SAML login helper built on WebKitGTK, for profiles with
+ * sso-helper=webkit. It takes the arguments of python/vpn-sso-auth.py that
+ * the service passes and prints the same USERGROUP=, USERNAME=,
+ * FINGERPRINT= and COOKIE= lines, with the same progress events on
+ * --progress-fd. It signs in to one gateway only: --also is accepted and
+ * ignored.
+ */
+
+#include "config.h"
+#include "sso-web-login.h"
+#include "progress-writer.h"
+#include "flat-json.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gtk/gtk.h>
+
+static gchar *opt_protocol = NULL;
+static gchar *opt_gateway = NULL;
+static gchar *opt_username = NULL;
+static gboolean opt_headless = FALSE;
+static gboolean opt_headful = FALSE;
+static gboolean opt_debug = FALSE;
+static gboolean opt_context_stdin = FALSE;
+static gint opt_progress_fd = -1;
+static gboolean opt_no_auto_totp = FALSE;
+static gchar **opt_also = NULL;
+
+static GOptionEntry option_entries[] = {
+    { "protocol", 0, 0, G_OPTION_ARG_STRING, &opt_protocol,
+      "anyconnect|gp|globalprotect", "PROTOCOL" },
+    { "gateway", 0, 0, G_OPTION_ARG_STRING, &opt_gateway,
+      "VPN gateway hostname", "HOST" },
+    { "username", 0, 0, G_OPTION_ARG_STRING, &opt_username,
+      "Username (optional)", "USER" },
+    { "headless", 0, 0, G_OPTION_ARG_NONE, &opt_headless,
+      "Keep the login window hidden", NULL },
+    { "headful", 0, 0, G_OPTION_ARG_NONE, &opt_headful,
+      "Show the login window", NULL },
+    { "debug", 0, 0, G_OPTION_ARG_NONE, &opt_debug,
+      "Accepted for compatibility; use G_MESSAGES_DEBUG=all", NULL },
+    { "context-stdin", 0, 0, G_OPTION_ARG_NONE, &opt_context_stdin,
+      "Read session paths and secrets as one JSON line from stdin", NULL },
+    { "progress-fd", 0, 0, G_OPTION_ARG_INT, &opt_progress_fd,
+      "Write progress events as JSON lines to this file descriptor", "FD" },
+    { "no-auto-totp", 0, 0, G_OPTION_ARG_NONE, &opt_no_auto_totp,
+      "Disable auto TOTP", NULL },
+    { "also", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_also,
+      "Ignored; only the Playwright helper signs in to further gateways", "PROTOCOL:GATEWAY" },
+    { NULL }
+};
+
+typedef struct {
+    GMainLoop *loop;
+    VpnSsoWebLogin *login;
+    VpnSsoWebCredentials *credentials;
+    GError *error;
+} RunData;
+
+static const gchar *
+normalize_protocol (const gchar *protocol)
+{
+    if (g_ascii_strcasecmp (protocol, "globalprotect") == 0 ||
+        g_ascii_strcasecmp (protocol, "gp") == 0)
+        return "gp";
+    if (g_ascii_strcasecmp (protocol, "anyconnect") == 0 ||
+        g_ascii_strcasecmp (protocol, "ac") == 0)
+        return "anyconnect";
+    return NULL;
+}
+
+/* The one-line JSON context the service writes to our stdin */
+static GHashTable *
+read_context (void)
+{
+    g_autoptr(GIOChannel) channel = g_io_channel_unix_new (STDIN_FILENO);
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *line = NULL;
+    GHashTable *context;
+    gsize length = 0;
+
+    if (g_io_channel_read_line (channel, &line, &length, NULL, &error) != G_IO_STATUS_NORMAL) {
+        if (error)
+            g_printerr ("ERROR: Cannot read context from stdin: %s\n", error->message);
+        return NULL;
+    }
+
+    context = vpn_sso_json_parse_object (line);
+    memset (line, 0, length);
+    if (!context)
+        g_printerr ("ERROR: Invalid context on stdin\n");
+    return context;
+}
+
+static void
+print_credentials (VpnSsoWebCredentials *credentials)
+{
+    if (credentials->usergroup)
+        g_print ("USERGROUP=%s\n", credentials->usergroup);
+    if (credentials->username && *credentials->username)
+        g_print ("USERNAME=%s\n", credentials->username);
+    if (credentials->fingerprint)
+        g_print ("FINGERPRINT=%s\n", credentials->fingerprint);
+    g_print ("COOKIE=%s\n", credentials->cookie);
+}
+
+static void
+login_done_cb (GObject      *source,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+    RunData *data = user_data;
+
+    data->credentials = vpn_sso_web_login_run_finish (data->login, result, &data->error);
+    g_main_loop_quit (data->loop);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_autoptr(GOptionContext) option_context = NULL;
+    g_autoptr(GHashTable) context = NULL;
+    g_autoptr(VpnSsoProgressWriter) progress = NULL;
+    g_autoptr(VpnSsoWebLogin) login = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *password = NULL;
+    g_autofree gchar *totp_secret = NULL;
+    const gchar *protocol;
+    const gchar *username;
+    gboolean headless;
+    RunData data = { NULL, };
+    int status;
+
+    option_context = g_option_context_new ("- WebKitGTK SAML auth helper for GNOME VPN SSO");
+    g_option_context_add_main_entries (option_context, option_entries, NULL);
+    if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+        g_printerr ("ERROR: %s\n", error->message);
+        return 2;
+    }
+
+    progress = vpn_sso_progress_writer_new (opt_progress_fd);
+    /* A service that stops reading must not kill us mid-login */
+    signal (SIGPIPE, SIG_IGN);
+
+    if (!opt_protocol || !opt_gateway) {
+        g_printerr ("ERROR: --protocol and --gateway are required\n");
+        return 2;
+    }
+
+    protocol = normalize_protocol (opt_protocol);
+    if (!protocol) {
+        g_printerr ("ERROR: Unknown protocol '%s'\n", opt_protocol);
+        return 2;
+    }
+
+    for (gint i = 0; opt_also && opt_also[i]; i++)
+        g_print ("  -> Not signing in to %s: only the Playwright helper does that\n", opt_also[i]);
+
+    if (opt_context_stdin)
+        context = read_context ();
+
+    username = opt_username ? opt_username : g_getenv ("VPN_SSO_USERNAME");
+    if (context) {
+        password = vpn_sso_json_take_member (context, "password");
+        totp_secret = vpn_sso_json_take_member (context, "totp_secret");
+    }
+    if (!password)
+        password = g_strdup (g_getenv ("VPN_SSO_PASSWORD"));
+    if (!totp_secret)
+        totp_secret = g_strdup (g_getenv ("VPN_SSO_TOTP_SECRET"));
+    if (opt_no_auto_totp && totp_secret) {
+        memset (totp_secret, 0, strlen (totp_secret));
+        g_clear_pointer (&totp_secret, g_free);
+    }
+
+    if (opt_headful)
+        headless = FALSE;
+    else if (opt_headless)
+        headless = TRUE;
+    else
+        headless = (password && *password) || (totp_secret && *totp_secret);
+
+    /* WebKitGTK needs a display even when nothing is shown; without a
+     * graphical session, run the helper under xvfb-run */
+    if (!gtk_init_check ()) {
+        g_printerr ("ERROR: Cannot open a display for WebKit\n");
+        vpn_sso_progress_writer_error (progress, "browser", "Cannot open a display for WebKit");
+        return 1;
+    }
+
+    login = vpn_sso_web_login_new (protocol, opt_gateway, username,
+                                   password, totp_secret, headless, progress);
+    if (password)
+        memset (password, 0, strlen (password));
+    if (totp_secret)
+        memset (totp_secret, 0, strlen (totp_secret));
+
+    g_print ("  -> Signing in to %s with WebKit (%s)\n", opt_gateway,
+             headless ? "headless" : "window");
+
+    data.loop = g_main_loop_new (NULL, FALSE);
+    data.login = login;
+    vpn_sso_web_login_run_async (login, NULL, login_done_cb, &data);
+    g_main_loop_run (data.loop);
+    g_main_loop_unref (data.loop);
+
+    if (data.credentials) {
+        /* The cookie event first, so the service can start openconnect */
+        vpn_sso_progress_writer_cookie (progress,
+                                        data.credentials->cookie,
+                                        data.credentials->usergroup,
+                                        data.credentials->username,
+                                        data.credentials->fingerprint);
+        print_credentials (data.credentials);
+        vpn_sso_web_credentials_free (data.credentials);
+        status = 0;
+    } else {
+        g_printerr ("ERROR: %s\n", data.error->message);
+        vpn_sso_progress_writer_error (progress,
+                                       vpn_sso_web_flow_error_class (data.error),
+                                       data.error->message);
+        g_error_free (data.error);
+        status = 1;
+    }
+
+    g_free (opt_protocol);
+    g_free (opt_gateway);
+    g_free (opt_username);
+    g_strfreev (opt_also);
+
+    return status;
+}
@@ -0,0 +1,149 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "progress-writer.h"
+#include "flat-json.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+struct _VpnSsoProgressWriter {
+    gint fd;
+};
+
+VpnSsoProgressWriter *
+vpn_sso_progress_writer_new (gint fd)
+{
+    VpnSsoProgressWriter *writer = g_new0 (VpnSsoProgressWriter, 1);
+
+    writer->fd = fd;
+    return writer;
+}
+
+/* Writes the event in @json, then clears it; it may hold a cookie */
+static void
+emit (VpnSsoProgressWriter *writer,
+      GString              *json)
+{
+    const gchar *p;
+    gsize remaining;
+
+    g_string_append (json, "}\n");
+    p = json->str;
+    remaining = json->len;
+
+    while (writer->fd >= 0 && remaining > 0) {
+        gssize written = write (writer->fd, p, remaining);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            /* The service went away or closed its end; carry on silently */
+            close (writer->fd);
+            writer->fd = -1;
+            break;
+        }
+        p += written;
+        remaining -= written;
+    }
+
+    memset (json->str, 0, json->len);
+    g_string_free (json, TRUE);
+}
+
+static GString *
+event_new (const gchar *type)
+{
+    GString *json = g_string_sized_new (4096);
+
+    g_string_append_c (json, '{');
+    vpn_sso_json_add_string (json, "event", type);
+    return json;
+}
+
+void
+vpn_sso_progress_writer_phase_started (VpnSsoProgressWriter *writer,
+                                       const gchar          *phase)
+{
+    GString *json;
+
+    if (writer->fd < 0)
+        return;
+
+    json = event_new ("phase-started");
+    vpn_sso_json_add_string (json, "phase", phase);
+    emit (writer, json);
+}
+
+void
+vpn_sso_progress_writer_phase_done (VpnSsoProgressWriter *writer,
+                                    const gchar          *phase,
+                                    gint64                ms)
+{
+    GString *json;
+
+    if (writer->fd < 0)
+        return;
+
+    json = event_new ("phase-done");
+    vpn_sso_json_add_string (json, "phase", phase);
+    vpn_sso_json_add_int (json, "ms", ms);
+    emit (writer, json);
+}
+
+void
+vpn_sso_progress_writer_cookie (VpnSsoProgressWriter *writer,
+                                const gchar          *cookie,
+                                const gchar          *usergroup,
+                                const gchar          *username,
+                                const gchar          *fingerprint)
+{
+    GString *json;
+
+    if (writer->fd < 0)
+        return;
+
+    json = event_new ("cookie");
+    vpn_sso_json_add_string (json, "cookie", cookie);
+    vpn_sso_json_add_string (json, "usergroup", usergroup);
+    vpn_sso_json_add_string (json, "username", username);
+    vpn_sso_json_add_string (json, "fingerprint", fingerprint);
+    emit (writer, json);
+}
+
+void
+vpn_sso_progress_writer_error (VpnSsoProgressWriter *writer,
+                               const gchar          *error_class,
+                               const gchar          *message)
+{
+    GString *json;
+
+    if (writer->fd < 0)
+        return;
+
+    json = event_new ("error");
+    vpn_sso_json_add_string (json, "class", error_class);
+    vpn_sso_json_add_string (json, "message", message);
+    emit (writer, json);
+}
+
+void
+vpn_sso_progress_writer_free (VpnSsoProgressWriter *writer)
+{
+    if (!writer)
+        return;
+
+    if (writer->fd >= 0)
+        close (writer->fd);
+    g_free (writer);
+}
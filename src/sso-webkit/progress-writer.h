@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __PROGRESS_WRITER_H__
+#define __PROGRESS_WRITER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * VpnSsoProgressWriter:
+ *
+ * Writes the helper side of the progress protocol (see
+ * src/service/sso-progress.h) to the descriptor given with
+ * --progress-fd, as python/core/progress.py does for the Python helper.
+ * Without a descriptor, or once the service has closed its end, every
+ * call does nothing.
+ */
+typedef struct _VpnSsoProgressWriter VpnSsoProgressWriter;
+
+/**
+ * vpn_sso_progress_writer_new:
+ * @fd: (transfer full): Descriptor to write to, or -1 for none
+ *
+ * Returns: (transfer full): A new writer
+ */
+VpnSsoProgressWriter *vpn_sso_progress_writer_new (gint fd);
+
+void vpn_sso_progress_writer_phase_started (VpnSsoProgressWriter *writer,
+                                            const gchar          *phase);
+
+void vpn_sso_progress_writer_phase_done (VpnSsoProgressWriter *writer,
+                                         const gchar          *phase,
+                                         gint64                ms);
+
+void vpn_sso_progress_writer_cookie (VpnSsoProgressWriter *writer,
+                                     const gchar          *cookie,
+                                     const gchar          *usergroup,
+                                     const gchar          *username,
+                                     const gchar          *fingerprint);
+
+void vpn_sso_progress_writer_error (VpnSsoProgressWriter *writer,
+                                    const gchar          *error_class,
+                                    const gchar          *message);
+
+/**
+ * vpn_sso_progress_writer_free:
+ * @writer: (nullable): A #VpnSsoProgressWriter
+ *
+ * Closes the descriptor and frees the writer.
+ */
+void vpn_sso_progress_writer_free (VpnSsoProgressWriter *writer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoProgressWriter, vpn_sso_progress_writer_free)
+
+G_END_DECLS
+
+#endif /* __PROGRESS_WRITER_H__ */
@@ -0,0 +1,510 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "sso-web-login.h"
+#include "totp.h"
+
+#include <string.h>
+#include <gtk/gtk.h>
+
+/* Longest a login may take; headful leaves time to type */
+#define LOGIN_TIMEOUT_S           300
+#define LOGIN_TIMEOUT_HEADLESS_S  120
+
+/* How often the IdP page is checked for a form to fill in (ms) */
+#define AUTOFILL_INTERVAL_MS      250
+
+/* Forms filled before giving up, so a rejected password is not retried
+ * until the account locks */
+#define AUTOFILL_MAX_ROUNDS       6
+
+/* The same selectors as python/core/auth.py */
+static const gchar * const username_selectors[] = {
+    "input[type='email']",
+    "input[name='loginfmt']",
+    "input[name='login']",
+    "input[id='i0116']",
+    "input[autocomplete='username']",
+    NULL
+};
+
+static const gchar * const password_selectors[] = {
+    "input[type='password']",
+    "input[name='passwd']",
+    "input[id='i0118']",
+    "input[autocomplete='current-password']",
+    NULL
+};
+
+static const gchar * const otp_selectors[] = {
+    "input[name='otc']",
+    "input[id='otc']",
+    "input[name='code']",
+    "input[type='tel']",
+    "input[autocomplete='one-time-code']",
+    NULL
+};
+
+static const gchar * const submit_selectors[] = {
+    "input[id='idSIButton9']",
+    "button#idSIButton9",
+    "button[type='submit']",
+    "input[type='submit']",
+    NULL
+};
+
+/*
+ * Fills in every visible, not yet filled field of the username, password
+ * and one-time code fields the arguments have a value for, then submits
+ * once, so a form asking for username and password together is sent
+ * complete. With nothing to fill, answers Entra ID's "Stay signed in?".
+ * Returns what it did as a comma-separated list. Fields are remembered
+ * per page, so a form the IdP shows again after rejecting it is left to
+ * the user. Only the main frame is searched.
+ */
+static const gchar autofill_js[] =
+    "const visible = (el) => {\n"
+    "    const r = el.getBoundingClientRect();\n"
+    "    return r.width > 0 && r.height > 0 && getComputedStyle(el).visibility !== 'hidden';\n"
+    "};\n"
+    "const find = (selectors) => {\n"
+    "    for (const sel of selectors)\n"
+    "        for (const el of document.querySelectorAll(sel))\n"
+    "            if (visible(el) && !el.disabled && !el.readOnly)\n"
+    "                return el;\n"
+    "    return null;\n"
+    "};\n"
+    "const done = window.__vpnSsoFilled || (window.__vpnSsoFilled = new WeakSet());\n"
+    "const setValue = Object.getOwnPropertyDescriptor(HTMLInputElement.prototype, 'value').set;\n"
+    "const filled = [];\n"
+    "let last = null;\n"
+    "for (const [name, selectors, value] of [['username', usernameSelectors, username],\n"
+    "                                        ['password', passwordSelectors, password],\n"
+    "                                        ['otp', otpSelectors, otp]]) {\n"
+    "    const el = value ? find(selectors) : null;\n"
+    "    if (!el || done.has(el))\n"
+    "        continue;\n"
+    "    el.focus();\n"
+    "    setValue.call(el, value);\n"
+    "    el.dispatchEvent(new Event('input', { bubbles: true }));\n"
+    "    el.dispatchEvent(new Event('change', { bubbles: true }));\n"
+    "    done.add(el);\n"
+    "    filled.push(name);\n"
+    "    last = el;\n"
+    "}\n"
+    "if (last) {\n"
+    "    const button = find(submitSelectors);\n"
+    "    if (button)\n"
+    "        button.click();\n"
+    "    else if (last.form)\n"
+    "        last.form.requestSubmit();\n"
+    "    return filled.join(',');\n"
+    "}\n"
+    "const kmsi = document.querySelector(\"input[name='DontShowAgain'], #KmsiCheckboxField\");\n"
+    "const button = kmsi ? find(submitSelectors) : null;\n"
+    "if (button && !done.has(button)) {\n"
+    "    done.add(button);\n"
+    "    button.click();\n"
+    "    return 'prompt';\n"
+    "}\n"
+    "return '';\n";
+
+struct _VpnSsoWebLogin {
+    /* Configuration */
+    gchar *protocol;
+    gchar *gateway;
+    gchar *username;
+    gchar *password;
+    gchar *totp_secret;
+    gboolean headless;
+    VpnSsoProgressWriter *progress;
+
+    /* Browser */
+    VpnSsoWebFlow *flow;
+    GtkWindow *window;
+    WebKitWebView *web_view;     /* Owned by flow */
+    GCancellable *cancellable;
+
+    /* Run state */
+    GTask *task;                 /* NULL once the login has finished */
+    guint timeout_id;
+    guint autofill_id;
+    gboolean autofill_pending;
+    guint autofill_rounds;
+    gboolean portal_loaded;
+    gint64 started_at;
+    gint64 last_mark;
+};
+
+static void
+clear_secret (gchar **secret)
+{
+    if (*secret)
+        memset (*secret, 0, strlen (*secret));
+    g_clear_pointer (secret, g_free);
+}
+
+/* Step timing, printed and reported as python/core/auth.py's _StepTimer does */
+
+static void
+phase_begin (VpnSsoWebLogin *login,
+             const gchar    *phase)
+{
+    vpn_sso_progress_writer_phase_started (login->progress, phase);
+}
+
+static void
+phase_mark (VpnSsoWebLogin *login,
+            const gchar    *phase)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 ms = (now - login->last_mark) / 1000;
+
+    login->last_mark = now;
+    g_print ("  [time] %s: %" G_GINT64_FORMAT " ms\n", phase, ms);
+    vpn_sso_progress_writer_phase_done (login->progress, phase, ms);
+}
+
+static void
+stop_timers (VpnSsoWebLogin *login)
+{
+    g_clear_handle_id (&login->timeout_id, g_source_remove);
+    g_clear_handle_id (&login->autofill_id, g_source_remove);
+}
+
+static void
+finish_error (VpnSsoWebLogin *login,
+              GError         *error)
+{
+    g_autoptr(GTask) task = g_steal_pointer (&login->task);
+
+    if (!task) {
+        g_error_free (error);
+        return;
+    }
+
+    stop_timers (login);
+    g_task_return_error (task, error);
+}
+
+static void
+finish_credentials (VpnSsoWebLogin       *login,
+                    VpnSsoWebCredentials *credentials)
+{
+    g_autoptr(GTask) task = g_steal_pointer (&login->task);
+
+    if (!task) {
+        vpn_sso_web_credentials_free (credentials);
+        return;
+    }
+
+    stop_timers (login);
+    phase_mark (login, "callback");
+    g_print ("  [time] total: %" G_GINT64_FORMAT " ms\n",
+             (g_get_monotonic_time () - login->started_at) / 1000);
+
+    /* The user name we were given wins over the one the gateway reports */
+    if (login->username) {
+        g_free (credentials->username);
+        credentials->username = g_strdup (login->username);
+    }
+
+    g_task_return_pointer (task, credentials,
+                           (GDestroyNotify) vpn_sso_web_credentials_free);
+}
+
+static void
+flow_phase_cb (const gchar *phase,
+               gboolean     done,
+               gpointer     user_data)
+{
+    VpnSsoWebLogin *login = user_data;
+    gint64 ms;
+
+    if (!done) {
+        phase_begin (login, phase);
+        return;
+    }
+
+    /* Only the prelogin ends inside the flow; it overlaps the browser start */
+    ms = (g_get_monotonic_time () - login->started_at) / 1000;
+    g_print ("  [time] %s: %" G_GINT64_FORMAT " ms (in parallel)\n", phase, ms);
+    vpn_sso_progress_writer_phase_done (login->progress, phase, ms);
+}
+
+static void
+flow_done_cb (VpnSsoWebCredentials *credentials,
+              GError               *error,
+              gpointer              user_data)
+{
+    VpnSsoWebLogin *login = user_data;
+
+    if (error)
+        finish_error (login, error);
+    else
+        finish_credentials (login, credentials);
+}
+
+/* Autofill */
+
+static GVariant *
+selectors_variant (const gchar * const *selectors)
+{
+    return g_variant_new_strv (selectors, -1);
+}
+
+static void
+autofill_cb (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(JSCValue) value = NULL;
+    g_autofree gchar *done = NULL;
+    g_auto(GStrv) steps = NULL;
+    VpnSsoWebLogin *login;
+
+    value = webkit_web_view_call_async_javascript_function_finish (WEBKIT_WEB_VIEW (source),
+                                                                   result, &error);
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+    login = user_data;
+    login->autofill_pending = FALSE;
+
+    /* Fails while a page is being replaced; the next tick tries again */
+    if (!value)
+        return;
+    if (!jsc_value_is_string (value))
+        return;
+
+    done = jsc_value_to_string (value);
+    if (!*done)
+        return;
+
+    login->autofill_rounds++;
+    steps = g_strsplit (done, ",", -1);
+    for (gint i = 0; steps[i]; i++) {
+        g_print ("  -> Filled in %s\n", steps[i]);
+        if (g_strcmp0 (steps[i], "prompt") != 0)
+            phase_mark (login, steps[i]);
+    }
+}
+
+static gboolean
+autofill_tick (gpointer user_data)
+{
+    VpnSsoWebLogin *login = user_data;
+    g_autofree gchar *otp = NULL;
+    GVariantDict args;
+
+    if (login->autofill_rounds >= AUTOFILL_MAX_ROUNDS) {
+        g_print ("  -> Leaving the login form to the user\n");
+        login->autofill_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    if (login->autofill_pending || !login->portal_loaded ||
+        webkit_web_view_is_loading (login->web_view) ||
+        vpn_sso_web_flow_uri_on_gateway (login->flow, webkit_web_view_get_uri (login->web_view)))
+        return G_SOURCE_CONTINUE;
+
+    /* Recomputed each time, so a code is never stale by the time the
+     * form shows up */
+    if (login->totp_secret)
+        otp = vpn_sso_totp_generate (login->totp_secret, g_get_real_time () / G_USEC_PER_SEC);
+
+    g_variant_dict_init (&args, NULL);
+    g_variant_dict_insert (&args, "username", "s", login->username ? login->username : "");
+    g_variant_dict_insert (&args, "password", "s", login->password ? login->password : "");
+    g_variant_dict_insert (&args, "otp", "s", otp ? otp : "");
+    g_variant_dict_insert_value (&args, "usernameSelectors", selectors_variant (username_selectors));
+    g_variant_dict_insert_value (&args, "passwordSelectors", selectors_variant (password_selectors));
+    g_variant_dict_insert_value (&args, "otpSelectors", selectors_variant (otp_selectors));
+    g_variant_dict_insert_value (&args, "submitSelectors", selectors_variant (submit_selectors));
+
+    login->autofill_pending = TRUE;
+    webkit_web_view_call_async_javascript_function (login->web_view,
+                                                    autofill_js, -1,
+                                                    g_variant_dict_end (&args),
+                                                    NULL, NULL,
+                                                    login->cancellable,
+                                                    autofill_cb, login);
+
+    if (otp)
+        memset (otp, 0, strlen (otp));
+    return G_SOURCE_CONTINUE;
+}
+
+/* Window signals */
+
+static void
+on_load_changed (WebKitWebView   *web_view,
+                 WebKitLoadEvent  load_event,
+                 VpnSsoWebLogin  *login)
+{
+    if (load_event != WEBKIT_LOAD_FINISHED || login->portal_loaded || !login->task)
+        return;
+
+    login->portal_loaded = TRUE;
+    phase_mark (login, "portal");
+}
+
+static gboolean
+on_close_request (GtkWindow      *window,
+                  VpnSsoWebLogin *login)
+{
+    finish_error (login, g_error_new (VPN_SSO_WEB_FLOW_ERROR, VPN_SSO_WEB_FLOW_ERROR_LOGIN,
+                                      "Login window closed"));
+    return TRUE;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+    VpnSsoWebLogin *login = user_data;
+
+    login->timeout_id = 0;
+    finish_error (login, g_error_new (VPN_SSO_WEB_FLOW_ERROR, VPN_SSO_WEB_FLOW_ERROR_TIMEOUT,
+                                      "No VPN session after %d seconds",
+                                      login->headless ? LOGIN_TIMEOUT_HEADLESS_S : LOGIN_TIMEOUT_S));
+    return G_SOURCE_REMOVE;
+}
+
+static void
+setup_window (VpnSsoWebLogin *login)
+{
+    /* For GlobalProtect, the prelogin request goes out first and runs
+     * while WebKit starts */
+    login->flow = vpn_sso_web_flow_new (login->protocol, login->gateway,
+                                        flow_phase_cb, flow_done_cb, login);
+    login->web_view = vpn_sso_web_flow_get_web_view (login->flow);
+    g_signal_connect (login->web_view, "load-changed",
+                      G_CALLBACK (on_load_changed), login);
+
+    login->window = GTK_WINDOW (gtk_window_new ());
+    gtk_window_set_title (login->window, "VPN Authentication");
+    gtk_window_set_default_size (login->window, 800, 600);
+    gtk_window_set_child (login->window, GTK_WIDGET (login->web_view));
+    g_signal_connect (login->window, "close-request",
+                      G_CALLBACK (on_close_request), login);
+
+    /* Headless, the web view and its window are realized but never
+     * mapped: pages lay out and run scripts as usual, and nothing appears
+     * on screen */
+    if (login->headless)
+        gtk_widget_realize (GTK_WIDGET (login->web_view));
+    else
+        gtk_window_present (login->window);
+}
+
+/* Public API */
+
+VpnSsoWebLogin *
+vpn_sso_web_login_new (const gchar          *protocol,
+                       const gchar          *gateway,
+                       const gchar          *username,
+                       const gchar          *password,
+                       const gchar          *totp_secret,
+                       gboolean              headless,
+                       VpnSsoProgressWriter *progress)
+{
+    VpnSsoWebLogin *login;
+
+    g_return_val_if_fail (protocol != NULL, NULL);
+    g_return_val_if_fail (gateway != NULL, NULL);
+    g_return_val_if_fail (progress != NULL, NULL);
+
+    login = g_new0 (VpnSsoWebLogin, 1);
+    login->protocol = g_strdup (protocol);
+    login->gateway = g_strdup (gateway);
+    login->username = username && *username ? g_strdup (username) : NULL;
+    login->password = password && *password ? g_strdup (password) : NULL;
+    login->totp_secret = totp_secret && *totp_secret ? g_strdup (totp_secret) : NULL;
+    login->headless = headless;
+    login->progress = progress;
+    login->cancellable = g_cancellable_new ();
+
+    return login;
+}
+
+void
+vpn_sso_web_login_run_async (VpnSsoWebLogin      *login,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+    g_return_if_fail (login != NULL);
+    g_return_if_fail (login->task == NULL);
+
+    login->task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_source_tag (login->task, vpn_sso_web_login_run_async);
+    login->started_at = login->last_mark = g_get_monotonic_time ();
+
+    if (cancellable)
+        g_signal_connect_object (cancellable, "cancelled",
+                                 G_CALLBACK (g_cancellable_cancel), login->cancellable,
+                                 G_CONNECT_SWAPPED);
+
+    phase_begin (login, "browser");
+    setup_window (login);
+    phase_mark (login, "browser");
+
+    vpn_sso_web_flow_start (login->flow);
+    if (!login->task)
+        return;
+
+    login->timeout_id = g_timeout_add_seconds (login->headless ? LOGIN_TIMEOUT_HEADLESS_S
+                                                               : LOGIN_TIMEOUT_S,
+                                               on_timeout, login);
+    if (login->username || login->password || login->totp_secret)
+        login->autofill_id = g_timeout_add (AUTOFILL_INTERVAL_MS, autofill_tick, login);
+}
+
+VpnSsoWebCredentials *
+vpn_sso_web_login_run_finish (VpnSsoWebLogin  *login,
+                              GAsyncResult    *result,
+                              GError         **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+void
+vpn_sso_web_login_free (VpnSsoWebLogin *login)
+{
+    if (!login)
+        return;
+
+    stop_timers (login);
+    g_cancellable_cancel (login->cancellable);
+    if (login->task) {
+        g_task_return_new_error (login->task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                 "Login freed before it finished");
+        g_clear_object (&login->task);
+    }
+
+    if (login->web_view)
+        g_signal_handlers_disconnect_by_data (login->web_view, login);
+    if (login->window)
+        gtk_window_destroy (login->window);
+    g_clear_pointer (&login->flow, vpn_sso_web_flow_free);
+    g_clear_object (&login->cancellable);
+
+    g_free (login->protocol);
+    g_free (login->gateway);
+    g_free (login->username);
+    clear_secret (&login->password);
+    clear_secret (&login->totp_secret);
+    g_free (login);
+}
@@ -0,0 +1,92 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SSO_WEB_LOGIN_H__
+#define __SSO_WEB_LOGIN_H__
+
+#include <gio/gio.h>
+
+#include "progress-writer.h"
+#include "sso-web-flow.h"
+
+G_BEGIN_DECLS
+
+/**
+ * VpnSsoWebLogin:
+ *
+ * A SAML login to one GlobalProtect portal or AnyConnect gateway, run by
+ * a #VpnSsoWebFlow in a window of its own. With a password or TOTP secret,
+ * the IdP's username, password and one-time code forms are filled in;
+ * headless, the window is never shown.
+ */
+typedef struct _VpnSsoWebLogin VpnSsoWebLogin;
+
+/**
+ * vpn_sso_web_login_new:
+ * @protocol: "gp" or "anyconnect"
+ * @gateway: Gateway host name, optionally with a port
+ * @username: (nullable): User name for the IdP form
+ * @password: (nullable): Password for the IdP form
+ * @totp_secret: (nullable): Base32 TOTP secret for the one-time code form
+ * @headless: Whether to keep the window hidden
+ * @progress: Writer for phase events; must outlive the login
+ *
+ * GTK must have been initialized.
+ *
+ * Returns: (transfer full): A new login, not started yet
+ */
+VpnSsoWebLogin *vpn_sso_web_login_new (const gchar          *protocol,
+                                       const gchar          *gateway,
+                                       const gchar          *username,
+                                       const gchar          *password,
+                                       const gchar          *totp_secret,
+                                       gboolean              headless,
+                                       VpnSsoProgressWriter *progress);
+
+/**
+ * vpn_sso_web_login_run_async:
+ * @login: A #VpnSsoWebLogin
+ * @cancellable: (nullable): A #GCancellable
+ * @callback: Called when the login has finished
+ * @user_data: Data for @callback
+ *
+ * Starts the login. @login must stay alive until @callback has run.
+ */
+void vpn_sso_web_login_run_async (VpnSsoWebLogin      *login,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data);
+
+/**
+ * vpn_sso_web_login_run_finish:
+ * @login: A #VpnSsoWebLogin
+ * @result: The #GAsyncResult passed to the callback
+ * @error: Return location for a #GError in %VPN_SSO_WEB_FLOW_ERROR
+ *
+ * Returns: (transfer full) (nullable): The credentials, or %NULL on error
+ */
+VpnSsoWebCredentials *vpn_sso_web_login_run_finish (VpnSsoWebLogin  *login,
+                                                    GAsyncResult    *result,
+                                                    GError         **error);
+
+/**
+ * vpn_sso_web_login_free:
+ * @login: (nullable): A #VpnSsoWebLogin
+ *
+ * Destroys the web view and clears the secrets from memory.
+ */
+void vpn_sso_web_login_free (VpnSsoWebLogin *login);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (VpnSsoWebLogin, vpn_sso_web_login_free)
+
+G_END_DECLS
+
+#endif /* __SSO_WEB_LOGIN_H__ */
@@ -0,0 +1,102 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "config.h"
+#include "totp.h"
+
+#include <string.h>
+
+#define TOTP_PERIOD 30
+#define TOTP_DIGITS 6
+
+static void
+clear_key (GByteArray *key)
+{
+    memset (key->data, 0, key->len);
+    g_byte_array_unref (key);
+}
+
+static GByteArray *
+base32_decode (const gchar *text)
+{
+    GByteArray *out = g_byte_array_new ();
+    guint32 buffer = 0;
+    gint bits = 0;
+
+    for (const gchar *p = text; *p; p++) {
+        gchar c = g_ascii_toupper (*p);
+        gint value;
+
+        if (c == ' ' || c == '=' || c == '-')
+            continue;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= '2' && c <= '7')
+            value = c - '2' + 26;
+        else {
+            clear_key (out);
+            return NULL;
+        }
+
+        buffer = (buffer << 5) | value;
+        bits += 5;
+        if (bits >= 8) {
+            guint8 byte = (buffer >> (bits - 8)) & 0xff;
+
+            g_byte_array_append (out, &byte, 1);
+            bits -= 8;
+        }
+    }
+
+    return out;
+}
+
+gchar *
+vpn_sso_totp_generate (const gchar *secret,
+                       gint64       now)
+{
+    GByteArray *key;
+    g_autoptr(GHmac) hmac = NULL;
+    guint64 counter = now / TOTP_PERIOD;
+    guint8 message[8];
+    guint8 digest[20];
+    gsize digest_len = sizeof (digest);
+    guint32 code;
+    gint offset;
+
+    g_return_val_if_fail (secret != NULL, NULL);
+
+    key = base32_decode (secret);
+    if (!key)
+        return NULL;
+    if (key->len == 0) {
+        clear_key (key);
+        return NULL;
+    }
+
+    for (gint i = 7; i >= 0; i--) {
+        message[i] = counter & 0xff;
+        counter >>= 8;
+    }
+
+    hmac = g_hmac_new (G_CHECKSUM_SHA1, key->data, key->len);
+    clear_key (key);
+    g_hmac_update (hmac, message, sizeof (message));
+    g_hmac_get_digest (hmac, digest, &digest_len);
+
+    offset = digest[digest_len - 1] & 0x0f;
+    code = ((digest[offset] & 0x7f) << 24) |
+           (digest[offset + 1] << 16) |
+           (digest[offset + 2] << 8) |
+           digest[offset + 3];
+
+    return g_strdup_printf ("%0*u", TOTP_DIGITS, code % 1000000);
+}
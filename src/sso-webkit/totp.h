@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TOTP_H__
+#define __TOTP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * vpn_sso_totp_generate:
+ * @secret: Base32 secret, as shown by the IdP; spaces and padding are ignored
+ * @now: Seconds since the epoch
+ *
+ * Computes the RFC 6238 code (HMAC-SHA1, 6 digits, 30 second period) the
+ * Python helper's generate_totp() gives for the same secret.
+ *
+ * Returns: (transfer full) (nullable): The code, or %NULL if @secret is
+ *   not valid base32
+ */
+gchar *vpn_sso_totp_generate (const gchar *secret,
+                              gint64       now);
+
+G_END_DECLS
+
+#endif /* __TOTP_H__ */
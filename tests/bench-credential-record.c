@@ -0,0 +1,229 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Credential record microbenchmark: the versioned GVariant record against
+ * the JSON entries older versions wrote, for a typical GlobalProtect entry.
+ * JSON is parsed both with the GRegex-per-field reader older versions used
+ * ("json (regex)", the baseline) and with the single-pass reader that now
+ * handles legacy entries ("json"). Prints the time per serialize and parse
+ * and the record size of each:
+ *
+ *   meson test -C builddir --benchmark credential-record -v
+ */
+
+#include "config.h"
+#include "credential-record.h"
+
+#include <string.h>
+
+#define DEFAULT_ITERATIONS 200000
+
+/* What earlier versions stored and how they read it back, kept here as the
+ * baseline */
+static gchar *
+legacy_json_serialize (const gchar *gateway,
+                       const gchar *protocol,
+                       const gchar *username,
+                       const gchar *cookie,
+                       const gchar *fingerprint,
+                       const gchar *usergroup,
+                       gint64       created_at,
+                       gint64       expires_at)
+{
+    g_autoptr(GString) json = g_string_new ("{\n");
+
+    g_string_append_printf (json, "  \"gateway\": \"%s\",\n", gateway);
+    g_string_append_printf (json, "  \"protocol\": \"%s\",\n", protocol);
+    g_string_append_printf (json, "  \"created_at\": %" G_GINT64_FORMAT ",\n", created_at);
+    g_string_append_printf (json, "  \"expires_at\": %" G_GINT64_FORMAT, expires_at);
+
+#define ADD_STRING(name, value) \
+    if (value) { \
+        g_autofree gchar *escaped = g_strescape (value, NULL); \
+        g_string_append_printf (json, ",\n  \"" name "\": \"%s\"", escaped); \
+    }
+
+    ADD_STRING ("username", username);
+    ADD_STRING ("cookie", cookie);
+    ADD_STRING ("fingerprint", fingerprint);
+    ADD_STRING ("usergroup", usergroup);
+
+#undef ADD_STRING
+
+    g_string_append (json, "\n}");
+
+    return g_string_free (g_steal_pointer (&json), FALSE);
+}
+
+static gchar *
+legacy_json_string (const gchar *json, const gchar *key)
+{
+    g_autofree gchar *pattern = g_strdup_printf ("\"%s\"\\s*:\\s*\"", key);
+    g_autoptr(GRegex) regex = g_regex_new (pattern, 0, 0, NULL);
+    g_autoptr(GMatchInfo) match_info = NULL;
+    g_autofree gchar *escaped = NULL;
+    const gchar *value_start;
+    const gchar *p;
+    gint end;
+
+    if (!g_regex_match (regex, json, 0, &match_info))
+        return NULL;
+
+    g_match_info_fetch_pos (match_info, 0, NULL, &end);
+
+    /* Find the closing quote */
+    value_start = json + end;
+    p = value_start;
+    while (*p && *p != '"') {
+        if (*p == '\\' && *(p + 1))
+            p++;
+        p++;
+    }
+
+    if (*p != '"')
+        return NULL;
+
+    escaped = g_strndup (value_start, p - value_start);
+    return g_strcompress (escaped);
+}
+
+static gint64
+legacy_json_int64 (const gchar *json, const gchar *key)
+{
+    g_autofree gchar *pattern = g_strdup_printf ("\"%s\"\\s*:\\s*([0-9]+)", key);
+    g_autoptr(GRegex) regex = g_regex_new (pattern, 0, 0, NULL);
+    g_autoptr(GMatchInfo) match_info = NULL;
+    g_autofree gchar *value = NULL;
+
+    if (!g_regex_match (regex, json, 0, &match_info))
+        return 0;
+
+    value = g_match_info_fetch (match_info, 1);
+    return g_ascii_strtoll (value, NULL, 10);
+}
+
+static VpnSsoCachedCredential *
+legacy_json_deserialize (const gchar *json)
+{
+    VpnSsoCachedCredential *cred;
+
+    if (!json || !*json)
+        return NULL;
+
+    cred = g_new0 (VpnSsoCachedCredential, 1);
+    cred->gateway = legacy_json_string (json, "gateway");
+    cred->protocol = legacy_json_string (json, "protocol");
+    cred->username = legacy_json_string (json, "username");
+    cred->cookie = legacy_json_string (json, "cookie");
+    cred->fingerprint = legacy_json_string (json, "fingerprint");
+    cred->usergroup = legacy_json_string (json, "usergroup");
+    cred->created_at = legacy_json_int64 (json, "created_at");
+    cred->expires_at = legacy_json_int64 (json, "expires_at");
+
+    return cred;
+}
+
+typedef gchar *(*SerializeFunc) (const gchar *, const gchar *, const gchar *,
+                                 const gchar *, const gchar *, const gchar *,
+                                 gint64, gint64);
+typedef VpnSsoCachedCredential *(*ParseFunc) (const gchar *);
+
+static const gchar *cookie_value;
+
+static gdouble
+bench_serialize (SerializeFunc serialize, guint iterations)
+{
+    gint64 start = g_get_monotonic_time ();
+
+    for (guint i = 0; i < iterations; i++) {
+        gchar *record = serialize ("vpn.example.com", "globalprotect", "alice@example.com",
+                                   cookie_value, NULL, "portal:portal-userauthcookie",
+                                   1700000000, 1700028800);
+        g_free (record);
+    }
+
+    return (gdouble) (g_get_monotonic_time () - start) * 1000.0 / iterations;
+}
+
+static gdouble
+bench_parse (ParseFunc parse, const gchar *record, guint iterations)
+{
+    gint64 start = g_get_monotonic_time ();
+
+    for (guint i = 0; i < iterations; i++) {
+        VpnSsoCachedCredential *cred = parse (record);
+
+        vpn_sso_cached_credential_free (cred);
+    }
+
+    return (gdouble) (g_get_monotonic_time () - start) * 1000.0 / iterations;
+}
+
+/* Every row must decode to the same credential, or the timing is moot */
+static void
+check_round_trip (ParseFunc parse, const gchar *record)
+{
+    g_autoptr(VpnSsoCachedCredential) cred = parse (record);
+
+    g_assert_nonnull (cred);
+    g_assert_cmpstr (cred->gateway, ==, "vpn.example.com");
+    g_assert_cmpstr (cred->protocol, ==, "globalprotect");
+    g_assert_cmpstr (cred->username, ==, "alice@example.com");
+    g_assert_cmpstr (cred->cookie, ==, cookie_value);
+    g_assert_null (cred->fingerprint);
+    g_assert_cmpstr (cred->usergroup, ==, "portal:portal-userauthcookie");
+    g_assert_cmpint (cred->created_at, ==, 1700000000);
+    g_assert_cmpint (cred->expires_at, ==, 1700028800);
+}
+
+static void
+report (const gchar   *format,
+        SerializeFunc  serialize,
+        ParseFunc      parse,
+        guint          iterations)
+{
+    g_autofree gchar *record = serialize ("vpn.example.com", "globalprotect", "alice@example.com",
+                                          cookie_value, NULL, "portal:portal-userauthcookie",
+                                          1700000000, 1700028800);
+    gdouble serialize_ns;
+    gdouble parse_ns;
+
+    check_round_trip (parse, record);
+
+    serialize_ns = bench_serialize (serialize, iterations);
+    parse_ns = bench_parse (parse, record, iterations);
+
+    g_print ("%-12s  %6zu bytes  serialize %8.1f ns  parse %8.1f ns\n",
+             format, strlen (record), serialize_ns, parse_ns);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_autofree gchar *cookie = NULL;
+    guint iterations = DEFAULT_ITERATIONS;
+
+    if (argc > 1)
+        iterations = MAX (1, (guint) g_ascii_strtoull (argv[1], NULL, 10));
+
+    /* Portal cookies are around 200 characters of base64 */
+    cookie = g_strnfill (200, 'A');
+    cookie_value = cookie;
+
+    g_print ("%u iterations per measurement\n", iterations);
+    report ("gvariant", vpn_sso_credential_record_serialize,
+            vpn_sso_credential_record_parse, iterations);
+    report ("json (regex)", legacy_json_serialize, legacy_json_deserialize, iterations);
+    report ("json", legacy_json_serialize, vpn_sso_credential_record_parse, iterations);
+
+    return 0;
+}
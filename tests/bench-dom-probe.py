@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Browser round trips per login step: one-evaluation probes against locators.
+
+Runs the element lookups do_saml_auth makes on a sign-in page of the local
+mock IdP, with three extra iframes as Entra pages carry, in two ways: with
+core.auth._probe (one evaluation per frame) and with the locator loop it
+replaced (count() and is_visible() per frame and candidate). Both must
+agree on what they find. Prints the browser round trips and the median
+time for the whole set of lookups:
+
+  meson test -C builddir --benchmark dom-probe -v
+
+Exits with 77 (skipped) without Playwright's Chromium.
+"""
+
+from __future__ import annotations
+
+import statistics
+import sys
+import time
+from collections import Counter
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent))
+
+import mock_idp  # noqa: E402
+
+try:
+    from playwright.sync_api import sync_playwright
+
+    from core.auth import OTP_SELECTORS, PASSWORD_SELECTORS, USERNAME_SELECTORS, _probe
+except ImportError as exc:
+    print(f"Skipping: {exc}")
+    sys.exit(77)
+
+DEFAULT_RUNS = 20
+
+# (selectors, texts) of the lookups in do_saml_auth, in its order
+LOOKUPS = [
+    (USERNAME_SELECTORS + PASSWORD_SELECTORS, []),
+    ([], ["Pick an account", "Use another account", "Sign in with another account"]),
+    ([], ["Use another account", "Sign in with another account"]),
+    ([], [mock_idp.USERNAME]),
+    (USERNAME_SELECTORS, []),
+    ([], ["Next", "Weiter", "Suivant", "Avanti", "Weiter >", "Continue"]),
+    (PASSWORD_SELECTORS, []),
+    ([], ["Sign in", "Anmelden", "Connexion", "Accedi", "Continue", "Next"]),
+    (OTP_SELECTORS, []),
+    ([], ["Send notification", "Send push", "Approve", "Verify", "Continue"]),
+    ([], ["Use your password instead", "Use password instead"]),
+    ([], ["Yes", "No", "Stay signed in?"]),
+    (["input[id='idSIButton9']", "button#idSIButton9"], []),
+]
+
+# Hidden helper frames, as on Entra sign-in pages
+EXTRA_FRAMES_JS = """
+() => {
+    for (let i = 0; i < 3; i++) {
+        const f = document.createElement("iframe");
+        f.style.display = "none";
+        f.srcdoc = "<html><body><div>telemetry</div></body></html>";
+        document.body.appendChild(f);
+    }
+}
+"""
+
+
+class _CountingFrame:
+    def __init__(self, frame, calls: Counter) -> None:
+        self._frame = frame
+        self._calls = calls
+
+    def evaluate(self, *args):
+        self._calls["evaluate"] += 1
+        return self._frame.evaluate(*args)
+
+    def locator(self, selector: str):
+        return self._frame.locator(selector)
+
+
+class _CountingPage:
+    def __init__(self, page, calls: Counter) -> None:
+        self._page = page
+        self._calls = calls
+
+    @property
+    def frames(self):
+        return [_CountingFrame(f, self._calls) for f in self._page.frames]
+
+
+def probe_lookup(page, calls: Counter, selectors: list[str], texts: list[str]):
+    return _probe(_CountingPage(page, calls), selectors=selectors, texts=texts)
+
+
+def locator_lookup(page, calls: Counter, selectors: list[str], texts: list[str]):
+    """The lookup _probe replaced: selectors, then texts, frame by frame."""
+    for candidates, make in ((selectors, lambda f, s: f.locator(s)),
+                             (texts, lambda f, t: f.get_by_text(t, exact=False))):
+        for frame in page.frames:
+            for candidate in candidates:
+                loc = make(frame, candidate)
+                try:
+                    calls["count"] += 1
+                    if loc.count() > 0:
+                        calls["is_visible"] += 1
+                        if loc.first.is_visible():
+                            return loc.first
+                except Exception:
+                    continue
+    return None
+
+
+def run_lookups(page, lookup) -> tuple[float, Counter, list[bool]]:
+    calls: Counter = Counter()
+    start = time.monotonic()
+    found = [lookup(page, calls, selectors, texts) is not None for selectors, texts in LOOKUPS]
+    return time.monotonic() - start, calls, found
+
+
+def main() -> int:
+    runs = int(sys.argv[1]) if len(sys.argv) > 1 else DEFAULT_RUNS
+
+    with sync_playwright() as p, mock_idp.MockIdP() as idp:
+        try:
+            browser = p.chromium.launch(headless=True, args=["--no-sandbox"])
+        except Exception as exc:
+            print(f"Skipping: cannot start Chromium: {str(exc).splitlines()[0]}")
+            return 77
+
+        page = browser.new_page()
+        page.goto(idp.start())
+        page.evaluate(EXTRA_FRAMES_JS)
+        page.wait_for_function("() => window.frames.length >= 3")
+
+        print(f"{len(LOOKUPS)} lookups on a page with {len(page.frames)} frames, {runs} runs")
+        results = {}
+        for name, lookup in (("locators", locator_lookup), ("probe", probe_lookup)):
+            times = []
+            for _ in range(runs):
+                seconds, calls, found = run_lookups(page, lookup)
+                times.append(seconds)
+            results[name] = found
+            detail = ", ".join(f"{n} {call}" for call, n in sorted(calls.items()))
+            print(f"{name:9s}  {sum(calls.values()):4d} round trips ({detail})  "
+                  f"median {statistics.median(times) * 1000:7.1f} ms")
+        browser.close()
+
+    if results["locators"] != results["probe"]:
+        print(f"Lookups disagree: locators {results['locators']}, probe {results['probe']}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
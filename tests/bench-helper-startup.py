@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""Startup time and peak memory of the two SSO helpers.
+
+Runs vpn-sso-webkit and python/vpn-sso-auth.py headless against the local
+mock IdP as the AnyConnect gateway, the way the service starts them, with
+--progress-fd. Startup is the time from spawning the helper to its
+"portal" phase starting, when its browser is up and goes to the gateway;
+the helper is stopped a moment after that, once its first page load has
+run. Peak memory is the largest total RSS of the helper and every process
+under it (Playwright's driver and Chromium, or WebKit's web and network
+processes), sampled from /proc. Prints the medians per helper:
+
+  meson test -C builddir --benchmark helper-startup -v
+
+vpn-sso-webkit is only measured in builds with -Dwebkit_helper=true. A
+helper that cannot start its browser (no display for WebKit, no Chromium
+for Playwright) is skipped; with neither, exits with 77 (skipped).
+"""
+
+from __future__ import annotations
+
+import argparse
+import json
+import os
+import select
+import signal
+import statistics
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent))
+
+import mock_idp  # noqa: E402
+
+DEFAULT_RUNS = 5
+
+# Longest a helper may take to bring its browser up
+STARTUP_TIMEOUT_S = 60
+
+# How long the helper keeps running after the portal phase started
+SETTLE_S = 2.0
+
+SAMPLE_INTERVAL_S = 0.02
+
+PYTHON_HELPER = Path(__file__).resolve().parent.parent / "python" / "vpn-sso-auth.py"
+PAGE_SIZE = os.sysconf("SC_PAGE_SIZE")
+
+
+class HelperUnavailable(Exception):
+    pass
+
+
+def _tree_rss(root: int) -> int:
+    """Total resident bytes of root and its descendants."""
+    children: dict[int, list[int]] = {}
+    for entry in os.listdir("/proc"):
+        if not entry.isdigit():
+            continue
+        try:
+            with open(f"/proc/{entry}/stat") as f:
+                stat = f.read()
+        except OSError:
+            continue
+        # The command name may contain spaces and parentheses
+        ppid = int(stat[stat.rindex(")") + 2:].split()[1])
+        children.setdefault(ppid, []).append(int(entry))
+
+    total, pending = 0, [root]
+    while pending:
+        pid = pending.pop()
+        pending.extend(children.get(pid, []))
+        try:
+            with open(f"/proc/{pid}/statm") as f:
+                total += int(f.read().split()[1]) * PAGE_SIZE
+        except OSError:
+            continue
+    return total
+
+
+def _stop(proc: subprocess.Popen) -> None:
+    for sig in (signal.SIGTERM, signal.SIGKILL):
+        try:
+            os.killpg(proc.pid, sig)
+        except ProcessLookupError:
+            return
+        try:
+            proc.wait(timeout=5)
+            return
+        except subprocess.TimeoutExpired:
+            continue
+
+
+def run_once(command: list[str], gateway: str) -> tuple[float, int]:
+    """Return (seconds to the portal phase, peak RSS in bytes) for one start."""
+    read_fd, write_fd = os.pipe()
+    start = time.monotonic()
+    proc = subprocess.Popen(
+        command + ["--protocol", "anyconnect", "--gateway", gateway, "--headless",
+                   "--progress-fd", str(write_fd)],
+        pass_fds=(write_fd,), start_new_session=True,
+        stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+    )
+    os.close(write_fd)
+
+    startup, peak, buffer = None, 0, b""
+    try:
+        while True:
+            peak = max(peak, _tree_rss(proc.pid))
+            elapsed = time.monotonic() - start
+            if startup is not None and elapsed > startup + SETTLE_S:
+                break
+            if startup is None and elapsed > STARTUP_TIMEOUT_S:
+                raise HelperUnavailable(f"no portal phase after {STARTUP_TIMEOUT_S} s")
+
+            ready, _, _ = select.select([read_fd], [], [], SAMPLE_INTERVAL_S)
+            if not ready:
+                continue
+            chunk = os.read(read_fd, 4096)
+            if not chunk:
+                # The helper is gone; its first load may well have failed
+                if startup is None:
+                    raise HelperUnavailable(f"exited with {proc.wait()} before the portal phase")
+                break
+            buffer += chunk
+            while b"\n" in buffer:
+                line, buffer = buffer.split(b"\n", 1)
+                event = json.loads(line)
+                if event.get("event") == "phase-started" and event.get("phase") == "portal" and startup is None:
+                    startup = time.monotonic() - start
+                elif event.get("event") == "error" and startup is None:
+                    message = (event.get("message") or "").splitlines()[0]
+                    raise HelperUnavailable(f"{event.get('class')}: {message}")
+    finally:
+        os.close(read_fd)
+        _stop(proc)
+
+    return startup, peak
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--webkit", metavar="PATH", help="vpn-sso-webkit to measure")
+    parser.add_argument("runs", nargs="?", type=int, default=DEFAULT_RUNS)
+    args = parser.parse_args()
+
+    helpers = [("playwright", [sys.executable, str(PYTHON_HELPER)])]
+    if args.webkit:
+        helpers.insert(0, ("webkit", [args.webkit]))
+    else:
+        print("vpn-sso-webkit not built (-Dwebkit_helper=false), measuring the Python helper only")
+
+    measured = 0
+    with mock_idp.MockIdP("anyconnect") as idp:
+        gateway = f"{mock_idp.VPN_HOST}:{idp.port}"
+        print(f"{args.runs} headless starts per helper against {gateway}")
+        for name, command in helpers:
+            times, peaks = [], []
+            try:
+                for _ in range(args.runs):
+                    seconds, peak = run_once(command, gateway)
+                    times.append(seconds)
+                    peaks.append(peak)
+            except HelperUnavailable as exc:
+                print(f"{name:10s}  skipped: {exc}")
+                continue
+            measured += 1
+            print(f"{name:10s}  startup median {statistics.median(times) * 1000:6.0f} ms  "
+                  f"peak RSS median {statistics.median(peaks) / (1024 * 1024):6.1f} MiB")
+
+    return 0 if measured else 77
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Headless login time and bytes transferred, with and without the filter.
+
+Signs in to the local mock IdP in headless Chromium the way do_saml_auth
+does (the same selectors and DOM probes), once with core.request_filter
+installed and once without. Login pages pull in a background image, an
+illustration, a logo, a web font and a telemetry script, like real tenant
+pages; the telemetry host is mapped to the mock IdP. Prints the median
+login time and the bytes the mock IdP sent, by kind:
+
+  meson test -C builddir --benchmark request-filter -v
+
+Exits with 77 (skipped) without Playwright's Chromium.
+"""
+
+from __future__ import annotations
+
+import os
+import statistics
+import sys
+import time
+from collections import Counter
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent))
+
+import mock_idp  # noqa: E402
+from core.totp import generate_totp  # noqa: E402
+
+try:
+    from playwright.sync_api import sync_playwright
+
+    from core.auth import OTP_SELECTORS, PASSWORD_SELECTORS, USERNAME_SELECTORS, _probe
+    from core.request_filter import RequestFilter
+except ImportError as exc:
+    print(f"Skipping: {exc}")
+    sys.exit(77)
+
+DEFAULT_RUNS = 5
+
+
+def _fill(page, selectors: list[str], value: str) -> None:
+    loc = None
+    deadline = time.monotonic() + 10
+    while loc is None and time.monotonic() < deadline:
+        loc = _probe(page, selectors=selectors)
+        if loc is None:
+            page.wait_for_timeout(20)
+    if loc is None:
+        raise RuntimeError(f"no field for {selectors[0]}")
+    loc.fill(value)
+
+
+def _click(page, texts: list[str] = (), selectors: list[str] = ()) -> None:
+    loc = _probe(page, selectors=selectors, texts=texts)
+    if loc is None:
+        raise RuntimeError(f"nothing to click for {texts or selectors}")
+    loc.click()
+
+
+def login_once(browser, filtered: bool) -> tuple[float, Counter]:
+    """Return (seconds, bytes sent by kind) for one headless login."""
+    with mock_idp.MockIdP("anyconnect", assets=True) as idp:
+        context = browser.new_context()
+        req_filter = None
+        if filtered:
+            req_filter = RequestFilter(idp.vpn_hosts, config_path=os.devnull)
+            req_filter.install(context)
+        page = context.new_page()
+
+        start = time.monotonic()
+        page.goto(idp.start(), wait_until="commit")
+        _fill(page, USERNAME_SELECTORS, mock_idp.USERNAME)
+        _fill(page, PASSWORD_SELECTORS, mock_idp.PASSWORD)
+        _click(page, texts=["Sign in"])
+        _fill(page, OTP_SELECTORS, generate_totp(mock_idp.TOTP_SECRET))
+        _click(page, texts=["Verify"])
+        page.wait_for_selector("#idSIButton9")
+        _click(page, selectors=["input[id='idSIButton9']"])
+        page.wait_for_url(lambda url: url.startswith(idp.vpn_url))
+        elapsed = time.monotonic() - start
+
+        if not any(c["name"] == "webvpn" for c in context.cookies()):
+            raise RuntimeError("login ended without a webvpn cookie")
+        context.close()
+        if req_filter:
+            req_filter.summary()
+        return elapsed, Counter(idp.bytes_sent)
+
+
+def main() -> int:
+    runs = int(sys.argv[1]) if len(sys.argv) > 1 else DEFAULT_RUNS
+
+    with sync_playwright() as p:
+        try:
+            browser = p.chromium.launch(
+                headless=True,
+                args=["--no-sandbox", f"--host-resolver-rules=MAP {mock_idp.TELEMETRY_HOST} 127.0.0.1"],
+            )
+        except Exception as exc:
+            print(f"Skipping: cannot start Chromium: {str(exc).splitlines()[0]}")
+            return 77
+
+        print(f"{runs} headless logins per configuration")
+        for filtered in (False, True):
+            # The bytes are the same every run; the time is not
+            times, sent = [], Counter()
+            for _ in range(runs):
+                seconds, sent = login_once(browser, filtered)
+                times.append(seconds)
+            kinds = ", ".join(f"{kind} {n / 1024:.0f} KiB" for kind, n in sorted(sent.items()))
+            print(f"{'filtered' if filtered else 'unfiltered':10s}  "
+                  f"median {statistics.median(times) * 1000:6.0f} ms  "
+                  f"{sum(sent.values()) / 1024:6.0f} KiB ({kinds})")
+        browser.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,334 @@
+"""Local stand-in for an Entra ID tenant and the VPN server it signs in to.
+
+One HTTP server on 127.0.0.1 answers under two names: requests for
+localhost are the IdP, requests for 127.0.0.1 the VPN server, so the
+helpers see the IdP and the gateway as different hosts. The IdP pages
+carry the $Config object the browserless login reads, and the same steps
+as plain HTML forms for a browser:
+
+  ConvergedSignIn   GetCredentialType, then username and password
+  ConvergedTFA      BeginAuth / EndAuth with the TOTP code, then ProcessAuth
+  KmsiInterrupt     "Stay signed in?"
+
+followed by the auto-submitting SAMLResponse form. The VPN server answers
+an AnyConnect callback with a webvpn cookie and a GlobalProtect one with
+the prelogin-cookie and saml-username headers.
+
+Login pages can also pull in what real IdP pages do (a background image,
+a web font and a telemetry script from a telemetry host), which a browser
+reaches when it maps that host to 127.0.0.1. Bytes sent are counted per
+kind, for the benchmarks.
+"""
+
+from __future__ import annotations
+
+import base64
+import hashlib
+import hmac
+import html
+import json
+import struct
+import sys
+import threading
+import time
+import urllib.parse
+from collections import Counter
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+from typing import Optional
+
+# The helpers under test, for the tests that import this module
+sys.path.insert(0, str(Path(__file__).resolve().parent.parent / "python"))
+
+USERNAME = "alice@contoso.com"
+PASSWORD = "correct horse battery staple"
+TOTP_SECRET = "JBSWY3DPEHPK3PXP"
+
+IDP_HOST = "localhost"
+VPN_HOST = "127.0.0.1"
+TELEMETRY_HOST = "js.monitor.azure.com"
+
+WEBVPN_COOKIE = "3A1B2C@12288@9F8E@D7C6B5A4"
+PRELOGIN_COOKIE = "pZ0dAmlaF2l0sMk4LqH8xg"
+SAML_RESPONSE = base64.b64encode(b"<samlp:Response>signed assertion</samlp:Response>").decode()
+
+AC_START = "/+CSCOE+/saml/sp/login?tgname=DefaultWEBVPNGroup"
+AC_ACS = "/+CSCOE+/saml/sp/acs?tgname=DefaultWEBVPNGroup"
+GP_ACS = "/SAML20/SP/ACS"
+
+# What a typical tenant login page pulls in besides the form
+ASSETS = {
+    "/assets/illustration.jpg": ("image/jpeg", 180 * 1024),
+    "/assets/background.jpg": ("image/jpeg", 420 * 1024),
+    "/assets/segoeui.woff2": ("font/woff2", 96 * 1024),
+    "/assets/logo.png": ("image/png", 24 * 1024),
+}
+TELEMETRY_SCRIPT = ("/scripts/ai.2.min.js", "application/javascript", 140 * 1024)
+
+
+class MockIdP:
+    """The stand-in server, with knobs for the ways a login can go.
+
+    push_only offers only app notifications at the MFA step, error_code
+    puts an Entra error on the sign-in page, and federated hands the
+    sign-in to another IdP: GetCredentialType names it, and a browser
+    posting the form lands on a page that is not Entra's. With assets, login pages link
+    the images, font and telemetry script of ASSETS and TELEMETRY_SCRIPT.
+    """
+
+    def __init__(
+        self,
+        protocol: str = "anyconnect",
+        push_only: bool = False,
+        error_code: Optional[str] = None,
+        federated: bool = False,
+        assets: bool = False,
+    ) -> None:
+        self.protocol = protocol
+        self.push_only = push_only
+        self.error_code = error_code
+        self.federated = federated
+        self.assets = assets
+        self.lock = threading.Lock()
+        self.requests: list[tuple[str, str]] = []   # (Host, path)
+        self.bytes_sent: Counter = Counter()
+        self.server = ThreadingHTTPServer(("127.0.0.1", 0), _Handler)
+        self.server.daemon_threads = True
+        self.server.idp = self
+        self.port = self.server.server_address[1]
+        self.thread = threading.Thread(target=self.server.serve_forever, daemon=True)
+
+    def __enter__(self) -> MockIdP:
+        self.thread.start()
+        return self
+
+    def __exit__(self, *exc) -> None:
+        self.server.shutdown()
+        self.server.server_close()
+        self.thread.join()
+
+    @property
+    def idp_url(self) -> str:
+        return f"http://{IDP_HOST}:{self.port}"
+
+    @property
+    def vpn_url(self) -> str:
+        return f"http://{VPN_HOST}:{self.port}"
+
+    @property
+    def vpn_hosts(self) -> set[str]:
+        return {VPN_HOST}
+
+    def start(self) -> str:
+        """What the VPN server hands out to begin the login.
+
+        AnyConnect starts from a URL on the VPN server. GlobalProtect
+        prelogin returns a POST-binding form, base64-encoded in
+        saml-request; this returns it decoded, as the helper uses it.
+        """
+        if self.protocol == "anyconnect":
+            return self.vpn_url + AC_START
+        request = base64.b64encode(b"<samlp:AuthnRequest/>").decode()
+        return (
+            f'<html><body onload="document.forms[0].submit()">'
+            f'<form method="post" action="{self.idp_url}/contoso/saml2">'
+            f'<input type="hidden" name="SAMLRequest" value="{request}"/>'
+            f'<input type="hidden" name="RelayState" value="gp"/>'
+            f"</form></body></html>"
+        )
+
+    def record(self, kind: str, host: str, path: str, size: int) -> None:
+        with self.lock:
+            self.requests.append((host, path))
+            self.bytes_sent[kind] += size
+
+
+def _totp_ok(code: Optional[str]) -> bool:
+    """Accept the current and the previous code, as a real IdP does."""
+    key = base64.b32decode(TOTP_SECRET)
+    now = int(time.time() // 30)
+    for counter in (now, now - 1):
+        digest = hmac.new(key, struct.pack(">Q", counter), hashlib.sha1).digest()
+        offset = digest[-1] & 0x0F
+        value = (struct.unpack(">I", digest[offset:offset + 4])[0] & 0x7FFFFFFF) % 10 ** 6
+        if code == str(value).zfill(6):
+            return True
+    return False
+
+
+def _config_script(config: dict) -> str:
+    return f"<script>//<![CDATA[\n$Config={json.dumps(config)};\n//]]></script>"
+
+
+class _Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args) -> None:
+        pass
+
+    @property
+    def idp(self) -> MockIdP:
+        return self.server.idp
+
+    def _send(self, status: int, body: bytes = b"", content_type: str = "text/html; charset=utf-8",
+              headers: Optional[dict] = None, kind: str = "document") -> None:
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Cache-Control", "no-store")
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(body)
+        self.idp.record(kind, self.headers.get("Host", ""), self.path, len(body))
+
+    def _redirect(self, location: str) -> None:
+        self._send(302, headers={"Location": location})
+
+    def _form(self) -> dict[str, str]:
+        length = int(self.headers.get("Content-Length") or 0)
+        raw = self.rfile.read(length).decode() if length else ""
+        if self.headers.get("Content-Type", "").startswith("application/json"):
+            return json.loads(raw or "{}")
+        return {k: v[0] for k, v in urllib.parse.parse_qs(raw).items()}
+
+    def do_GET(self) -> None:
+        self._dispatch({})
+
+    def do_POST(self) -> None:
+        self._dispatch(self._form())
+
+    def _dispatch(self, form: dict) -> None:
+        host = (self.headers.get("Host") or "").rsplit(":", 1)[0]
+        path = urllib.parse.urlparse(self.path).path
+        if host == TELEMETRY_HOST:
+            self._telemetry()
+        elif path in ASSETS:
+            content_type, size = ASSETS[path]
+            kind = "font" if content_type.startswith("font/") else "image"
+            self._send(200, b"\0" * size, content_type, kind=kind)
+        elif host == VPN_HOST:
+            self._vpn(path, form)
+        else:
+            self._entra(path, form)
+
+    def _telemetry(self) -> None:
+        _, content_type, size = TELEMETRY_SCRIPT
+        self._send(200, b"/*" + b" " * (size - 4) + b"*/", content_type, kind="telemetry")
+
+    # -- VPN server --
+
+    def _vpn(self, path: str, form: dict) -> None:
+        if self.path == AC_START:
+            self._redirect(f"{self.idp.idp_url}/contoso/saml2?SAMLRequest=fZBbS8NAEIX%2F")
+        elif self.path == AC_ACS and form.get("SAMLResponse") == SAML_RESPONSE:
+            self._send(200, b"<html>Signed in</html>",
+                       headers={"Set-Cookie": f"webvpn={WEBVPN_COOKIE}; path=/; HttpOnly"})
+        elif path == GP_ACS and form.get("SAMLResponse") == SAML_RESPONSE:
+            self._send(200, b"<html><!-- <saml-auth-status>1</saml-auth-status> --></html>",
+                       headers={"prelogin-cookie": PRELOGIN_COOKIE, "saml-username": USERNAME})
+        else:
+            self._send(403, b"<html>Forbidden</html>")
+
+    # -- Entra ID --
+
+    def _page(self, config: dict, form_html: str) -> None:
+        extras = ""
+        if self.idp.assets:
+            port = self.idp.port
+            extras = (
+                f"<style>@font-face{{font-family:Segoe;src:url(/assets/segoeui.woff2)}}"
+                f"body{{font-family:Segoe;background:url(/assets/background.jpg)}}</style>"
+                f'<script src="http://{TELEMETRY_HOST}:{port}{TELEMETRY_SCRIPT[0]}"></script>'
+                f'<img src="/assets/logo.png" alt=""/><img src="/assets/illustration.jpg" alt=""/>'
+            )
+        body = f"<html><head>{_config_script(config)}{extras}</head><body>{form_html}</body></html>"
+        self._send(200, body.encode())
+
+    def _common(self, page: str, url_post: str) -> dict:
+        return {
+            "pgid": page, "urlPost": url_post, "sCtx": f"ctx-{page}", "sFT": f"ft-{page}",
+            "canary": "canary", "sessionId": "00000000-0000-0000-0000-000000000001",
+        }
+
+    def _entra(self, path: str, form: dict) -> None:
+        if path == "/contoso/saml2":
+            self._sign_in()
+        elif path == "/contoso/login":
+            if self.idp.federated:
+                self._send(200, b"<html><form method='post' action='/adfs/ls'>"
+                                b"<input name='UserName'/></form></html>")
+            elif form.get("login") == USERNAME and form.get("passwd") == PASSWORD:
+                self._tfa()
+            else:
+                self._sign_in(error="50126")
+        elif path == "/common/GetCredentialType":
+            credentials = {"PrefCredential": 1, "HasPassword": not self.idp.federated}
+            if self.idp.federated:
+                credentials["FederationRedirectUrl"] = "https://adfs.contoso.com/adfs/ls/?username=alice"
+            self._json({"Username": form.get("username"), "IfExistsResult": 0 if form.get("username") == USERNAME else 1,
+                        "Credentials": credentials})
+        elif path == "/common/SAS/BeginAuth":
+            self._json({"Success": True, "SessionId": "sas-1", "FlowToken": "ft-sas", "Ctx": "ctx-sas"})
+        elif path == "/common/SAS/EndAuth":
+            ok = _totp_ok(form.get("AdditionalAuthData"))
+            self._json({"Success": ok, "FlowToken": "ft-end", "Ctx": "ctx-end",
+                        "ResultValue": "Success" if ok else "OathCodeIncorrect"})
+        elif path == "/common/SAS/ProcessAuth":
+            if _totp_ok(form.get("otc")):
+                self._kmsi()
+            else:
+                self._tfa()
+        elif path == "/kmsi":
+            self._saml_response()
+        else:
+            self._send(404, b"<html>Not found</html>")
+
+    def _json(self, result: dict) -> None:
+        self._send(200, json.dumps(result).encode(), "application/json")
+
+    def _sign_in(self, error: Optional[str] = None) -> None:
+        config = self._common("ConvergedSignIn", "/contoso/login")
+        config["urlGetCredentialType"] = "/common/GetCredentialType"
+        if error or self.idp.error_code:
+            config["sErrorCode"] = error or self.idp.error_code
+        self._page(config, (
+            '<form method="post" action="/contoso/login">'
+            '<input type="email" name="login" autocomplete="username"/>'
+            '<input type="password" name="passwd" autocomplete="current-password"/>'
+            '<input type="hidden" name="type" value="11"/>'
+            '<input type="submit" value="Sign in"/>'
+            "</form>"
+        ))
+
+    def _tfa(self) -> None:
+        config = self._common("ConvergedTFA", "/common/SAS/ProcessAuth")
+        methods = ["PhoneAppNotification"] if self.idp.push_only else ["PhoneAppNotification", "PhoneAppOTP"]
+        config["arrUserProofs"] = [{"authMethodId": m, "isDefault": i == 0} for i, m in enumerate(methods)]
+        config["urlBeginAuth"] = "/common/SAS/BeginAuth"
+        config["urlEndAuth"] = "/common/SAS/EndAuth"
+        self._page(config, (
+            '<form method="post" action="/common/SAS/ProcessAuth">'
+            '<input type="tel" name="otc" autocomplete="one-time-code"/>'
+            '<input type="submit" value="Verify"/>'
+            "</form>"
+        ))
+
+    def _kmsi(self) -> None:
+        self._page(self._common("KmsiInterrupt", "/kmsi"), (
+            '<form method="post" action="/kmsi">'
+            '<input type="hidden" name="LoginOptions" value="1"/>'
+            '<input type="submit" id="idSIButton9" value="Yes"/>'
+            "</form>"
+        ))
+
+    def _saml_response(self) -> None:
+        acs = AC_ACS if self.idp.protocol == "anyconnect" else GP_ACS
+        body = (
+            f'<html><body onload="document.forms[0].submit()">'
+            f'<form method="post" action="{self.idp.vpn_url}{html.escape(acs)}">'
+            f'<input type="hidden" name="SAMLResponse" value="{SAML_RESPONSE}"/>'
+            f"</form></body></html>"
+        )
+        self._send(200, body.encode())
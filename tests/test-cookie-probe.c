@@ -0,0 +1,277 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Cookie probe against a local TLS stand-in for the gateway. The stand-in
+ * serves one canned response per test (or none, to exercise the deadline)
+ * with the self-signed certificate in stand-in-gateway.pem, which the test
+ * installs as the default TLS database so the probe's system validation
+ * accepts it.
+ */
+
+#include "config.h"
+#include "cookie-probe.h"
+
+#include <string.h>
+
+typedef struct {
+    GSocketService *service;
+    GTlsCertificate *certificate;
+    guint16 port;
+    gchar *gateway;
+    const gchar *response;      /* NULL = read the request, never answer */
+    GMutex lock;
+    GString *request;
+    gint connections;
+    gint active;                /* Handlers still running */
+} StandIn;
+
+typedef struct {
+    GMainLoop *loop;
+    VpnSsoCookieProbeResult result;
+} ProbeRun;
+
+static gboolean
+read_request (GInputStream *in, GString *request)
+{
+    gchar buf[1024];
+    gssize n;
+
+    while ((n = g_input_stream_read (in, buf, sizeof (buf), NULL, NULL)) > 0) {
+        const gchar *end;
+
+        g_string_append_len (request, buf, n);
+        end = strstr (request->str, "\r\n\r\n");
+        if (end) {
+            const gchar *length = strstr (request->str, "Content-Length: ");
+            gsize body = request->len - (end + 4 - request->str);
+
+            if (!length || body >= g_ascii_strtoull (length + 16, NULL, 10))
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+stand_in_serve (StandIn *gw, GSocketConnection *connection)
+{
+    g_autoptr(GIOStream) tls = NULL;
+    g_autoptr(GString) request = g_string_new (NULL);
+    GInputStream *in;
+    gchar buf[64];
+
+    tls = g_tls_server_connection_new (G_IO_STREAM (connection), gw->certificate, NULL);
+    if (!tls || !g_tls_connection_handshake (G_TLS_CONNECTION (tls), NULL, NULL))
+        return;
+
+    in = g_io_stream_get_input_stream (tls);
+    if (!read_request (in, request))
+        return;
+
+    g_mutex_lock (&gw->lock);
+    g_string_assign (gw->request, request->str);
+    g_mutex_unlock (&gw->lock);
+
+    if (!gw->response) {
+        /* Hold the connection until the client gives up */
+        while (g_input_stream_read (in, buf, sizeof (buf), NULL, NULL) > 0)
+            ;
+        return;
+    }
+
+    g_output_stream_write_all (g_io_stream_get_output_stream (tls),
+                               gw->response, strlen (gw->response),
+                               NULL, NULL, NULL);
+    g_io_stream_close (tls, NULL, NULL);
+}
+
+static gboolean
+stand_in_run_cb (GThreadedSocketService *service G_GNUC_UNUSED,
+                 GSocketConnection      *connection,
+                 GObject                *source G_GNUC_UNUSED,
+                 gpointer                user_data)
+{
+    StandIn *gw = user_data;
+
+    g_atomic_int_inc (&gw->connections);
+    g_atomic_int_inc (&gw->active);
+    stand_in_serve (gw, connection);
+    g_atomic_int_dec_and_test (&gw->active);
+
+    return TRUE;
+}
+
+static void
+stand_in_setup (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    g_autofree gchar *pem = g_test_build_filename (G_TEST_DIST, "stand-in-gateway.pem", NULL);
+    g_autoptr(GError) error = NULL;
+
+    gw->certificate = g_tls_certificate_new_from_file (pem, &error);
+    g_assert_no_error (error);
+
+    gw->service = g_threaded_socket_service_new (4);
+    gw->port = g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER (gw->service), NULL, &error);
+    g_assert_no_error (error);
+    g_signal_connect (gw->service, "run", G_CALLBACK (stand_in_run_cb), gw);
+    g_socket_service_start (gw->service);
+
+    gw->gateway = g_strdup_printf ("localhost:%u", gw->port);
+    g_mutex_init (&gw->lock);
+    gw->request = g_string_new (NULL);
+}
+
+static void
+stand_in_teardown (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    g_socket_service_stop (gw->service);
+    g_socket_listener_close (G_SOCKET_LISTENER (gw->service));
+    while (g_atomic_int_get (&gw->active) > 0)
+        g_usleep (10 * 1000);
+    g_object_unref (gw->service);
+    g_object_unref (gw->certificate);
+    g_free (gw->gateway);
+    g_string_free (gw->request, TRUE);
+    g_mutex_clear (&gw->lock);
+}
+
+static void
+probe_done_cb (GObject *source G_GNUC_UNUSED, GAsyncResult *result, gpointer user_data)
+{
+    ProbeRun *run = user_data;
+
+    run->result = vpn_sso_cookie_probe_finish (result, NULL);
+    g_main_loop_quit (run->loop);
+}
+
+static VpnSsoCookieProbeResult
+run_probe (StandIn     *gw,
+           const gchar *protocol,
+           const gchar *usergroup,
+           guint        timeout_ms)
+{
+    ProbeRun run = { g_main_loop_new (NULL, FALSE), VPN_SSO_COOKIE_PROBE_UNKNOWN };
+
+    vpn_sso_cookie_probe_async (gw->gateway, protocol, "alice", usergroup,
+                                "cached-cookie", timeout_ms, NULL,
+                                probe_done_cb, &run);
+    g_main_loop_run (run.loop);
+    g_main_loop_unref (run.loop);
+
+    return run.result;
+}
+
+static void
+test_gp_valid (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    gw->response = "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: application/xml\r\n"
+                   "\r\n"
+                   "<response><policy><gateways/></policy></response>";
+
+    g_assert_cmpint (run_probe (gw, "globalprotect", "portal:portal-userauthcookie", 3000),
+                     ==, VPN_SSO_COOKIE_PROBE_VALID);
+    g_assert_true (g_str_has_prefix (gw->request->str, "POST /global-protect/getconfig.esp "));
+    g_assert_nonnull (strstr (gw->request->str, "portal-userauthcookie=cached-cookie"));
+}
+
+static void
+test_gp_rejected (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    gw->response = "HTTP/1.1 512 Custom error\r\n\r\n";
+
+    g_assert_cmpint (run_probe (gw, "globalprotect", "portal:portal-userauthcookie", 3000),
+                     ==, VPN_SSO_COOKIE_PROBE_REJECTED);
+}
+
+static void
+test_gp_prelogin_not_probed (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    gw->response = "HTTP/1.1 512 Custom error\r\n\r\n";
+
+    g_assert_cmpint (run_probe (gw, "globalprotect", "portal:prelogin-cookie", 3000),
+                     ==, VPN_SSO_COOKIE_PROBE_UNKNOWN);
+    g_assert_cmpint (g_atomic_int_get (&gw->connections), ==, 0);
+}
+
+static void
+test_ac_valid (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    gw->response = "HTTP/1.1 200 OK\r\n\r\n<html></html>";
+
+    g_assert_cmpint (run_probe (gw, "anyconnect", NULL, 3000),
+                     ==, VPN_SSO_COOKIE_PROBE_VALID);
+    g_assert_nonnull (strstr (gw->request->str, "\r\nCookie: webvpn=cached-cookie\r\n"));
+}
+
+static void
+test_ac_rejected (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    gw->response = "HTTP/1.1 302 Found\r\n"
+                   "Location: /+webvpn+/index.html?logon\r\n"
+                   "\r\n";
+
+    g_assert_cmpint (run_probe (gw, "anyconnect", NULL, 3000),
+                     ==, VPN_SSO_COOKIE_PROBE_REJECTED);
+}
+
+static void
+test_deadline (StandIn *gw, gconstpointer data G_GNUC_UNUSED)
+{
+    gint64 start = g_get_monotonic_time ();
+    gint64 elapsed_ms;
+
+    gw->response = NULL;
+
+    g_assert_cmpint (run_probe (gw, "anyconnect", NULL, 250),
+                     ==, VPN_SSO_COOKIE_PROBE_UNKNOWN);
+
+    /* A socket timeout would round 250 ms up to a whole second */
+    elapsed_ms = (g_get_monotonic_time () - start) / 1000;
+    g_assert_cmpint (elapsed_ms, >=, 250);
+    g_assert_cmpint (elapsed_ms, <, 750);
+}
+
+int
+main (int argc, char **argv)
+{
+    g_autofree gchar *pem = NULL;
+    g_autoptr(GTlsDatabase) database = NULL;
+    g_autoptr(GError) error = NULL;
+
+    g_test_init (&argc, &argv, NULL);
+
+    if (!g_tls_backend_supports_tls (g_tls_backend_get_default ())) {
+        g_test_skip ("No TLS backend (glib-networking) available");
+        return g_test_run ();
+    }
+
+    pem = g_test_build_filename (G_TEST_DIST, "stand-in-gateway.pem", NULL);
+    database = g_tls_file_database_new (pem, &error);
+    g_assert_no_error (error);
+    g_tls_backend_set_default_database (g_tls_backend_get_default (), database);
+
+#define ADD_TEST(path, func) \
+    g_test_add (path, StandIn, NULL, stand_in_setup, func, stand_in_teardown)
+
+    ADD_TEST ("/cookie-probe/globalprotect/valid", test_gp_valid);
+    ADD_TEST ("/cookie-probe/globalprotect/rejected", test_gp_rejected);
+    ADD_TEST ("/cookie-probe/globalprotect/prelogin-not-probed", test_gp_prelogin_not_probed);
+    ADD_TEST ("/cookie-probe/anyconnect/valid", test_ac_valid);
+    ADD_TEST ("/cookie-probe/anyconnect/rejected", test_ac_rejected);
+    ADD_TEST ("/cookie-probe/deadline", test_deadline);
+
+#undef ADD_TEST
+
+    return g_test_run ();
+}
@@ -0,0 +1,309 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Copyright (C) 2024 GNOME VPN SSO Contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Cookie rejection detection on recorded openconnect output. Transcripts
+ * with a rejected cookie are replayed into a pipe at their recorded pace
+ * and read back through a pipe drain, as the service reads openconnect;
+ * the test measures the time from the rejection line being written to
+ * the service deciding to fall back to SSO, and checks that this happens
+ * on the rejection line and well before openconnect would have exited.
+ * Transcripts without a cookie rejection, proxy failures among them,
+ * must not match at all.
+ */
+
+#include "config.h"
+#include "cookie-rejection.h"
+#include "pipe-drain.h"
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Generous for a loaded machine; the drain hands lines over at once */
+#define MAX_FALLBACK_LATENCY_MS 250
+
+typedef struct {
+    guint delay_ms;             /* Since the previous line */
+    const gchar *line;
+} TranscriptLine;
+
+typedef struct {
+    const TranscriptLine *lines;
+    guint n_lines;
+    guint rejection;            /* Index of the line that must match */
+} Transcript;
+
+#define TRANSCRIPT(lines, rejection) { lines, G_N_ELEMENTS (lines), rejection }
+
+/* AnyConnect, cached webvpn cookie expired on the gateway */
+static const TranscriptLine ac_connect_401[] = {
+    {   0, "Connected to 192.0.2.10:443" },
+    {  40, "SSL negotiation with vpn.example.com" },
+    {  60, "Connected to HTTPS on vpn.example.com with ciphersuite (TLS1.3)-(ECDHE-SECP256R1)-(RSA-PSS-RSAE-SHA256)-(AES-256-GCM)" },
+    {  30, "Got inappropriate HTTP CONNECT response: HTTP/1.1 401 Unauthorized" },
+    {   0, "Creating SSL connection failed" },
+    { 400, "Cookie is no longer valid, ending session" },
+};
+
+/* AnyConnect, session ended on the gateway between logins */
+static const TranscriptLine ac_session_expired[] = {
+    {   0, "Connected to 192.0.2.10:443" },
+    {  40, "SSL negotiation with vpn.example.com" },
+    {  60, "Connected to HTTPS on vpn.example.com with ciphersuite (TLS1.3)-(ECDHE-SECP256R1)-(RSA-PSS-RSAE-SHA256)-(AES-256-GCM)" },
+    {  30, "VPN service unavailable; reason: Your session has expired" },
+    {   0, "Creating SSL connection failed" },
+    { 400, "Cookie was rejected by server; exiting." },
+};
+
+/* GlobalProtect, portal-userauthcookie refused on the tunnel GET */
+static const TranscriptLine gp_auth_failed[] = {
+    {   0, "Connected to 192.0.2.20:443" },
+    {  50, "SSL negotiation with gp.example.com" },
+    {  50, "Connected to HTTPS on gp.example.com with ciphersuite (TLS1.2)-(ECDHE-RSA-SECP256R1)-(AES-256-GCM)" },
+    {  20, "Tunnel timeout (rekey interval) is 180 minutes." },
+    {  30, "Got unexpected HTTP response: auth-failed" },
+    { 300, "Failed to connect ESP tunnel; using HTTPS instead." },
+    { 200, "Cookie was rejected by server; exiting." },
+};
+
+/* GlobalProtect with -v: getconfig.esp answers 512 */
+static const TranscriptLine gp_getconfig_512[] = {
+    {   0, "Attempting to connect to server 192.0.2.20:443" },
+    {  50, "Connected to 192.0.2.20:443" },
+    {  50, "SSL negotiation with gp.example.com" },
+    {  30, "POST https://gp.example.com/ssl-vpn/getconfig.esp" },
+    {  40, "Got HTTP response: HTTP/1.1 512 Custom error" },
+    {   0, "Content-Length: 0" },
+    { 450, "Cookie was rejected by server; exiting." },
+};
+
+static const Transcript rejected_transcripts[] = {
+    TRANSCRIPT (ac_connect_401, 3),
+    TRANSCRIPT (ac_session_expired, 3),
+    TRANSCRIPT (gp_auth_failed, 4),
+    TRANSCRIPT (gp_getconfig_512, 4),
+};
+
+/* Through an HTTP proxy that wants authentication */
+static const TranscriptLine proxy_auth_required[] = {
+    {   0, "Attempting to connect to server 198.51.100.3:3128" },
+    {  20, "Requesting HTTP proxy connection to vpn.example.com:443" },
+    {  20, "Got HTTP response: HTTP/1.1 407 Proxy Authentication Required" },
+    {   0, "Proxy-Authenticate: Basic realm=\"proxy\"" },
+    {  10, "Proxy CONNECT request failed: HTTP/1.1 401 Unauthorized" },
+    {   0, "Failed to connect to host vpn.example.com" },
+};
+
+/* Proxy that blocks the gateway */
+static const TranscriptLine proxy_forbidden[] = {
+    {   0, "Requesting HTTP proxy connection to vpn.example.com:443" },
+    {  20, "Got HTTP response: HTTP/1.1 403 Forbidden" },
+    {   0, "HTTP/1.1 403 Forbidden" },
+    {   0, "Unexpected 403 result from server" },
+    {   0, "Failed to open HTTPS connection to vpn.example.com" },
+};
+
+/* Gateway trouble that a new login would not fix */
+static const TranscriptLine gateway_unavailable[] = {
+    {   0, "Connected to 192.0.2.10:443" },
+    {  40, "Got inappropriate HTTP CONNECT response: HTTP/1.1 503 Service Unavailable" },
+    {   0, "VPN service unavailable; reason: Maximum number of sessions reached" },
+    {  10, "Server said: 401 unauthorized attempts are logged" },
+    {   0, "Session terminated by server; exiting." },
+};
+
+/* A working tunnel */
+static const TranscriptLine connected[] = {
+    {   0, "Connected to 192.0.2.20:443" },
+    {  50, "SSL negotiation with gp.example.com" },
+    {  50, "Connected to HTTPS on gp.example.com with ciphersuite (TLS1.2)-(ECDHE-RSA-SECP256R1)-(AES-256-GCM)" },
+    {  20, "ESP session established with server" },
+    {  10, "Configured as 10.1.2.3, with SSL connected and ESP established" },
+};
+
+static const Transcript clean_transcripts[] = {
+    TRANSCRIPT (proxy_auth_required, 0),
+    TRANSCRIPT (proxy_forbidden, 0),
+    TRANSCRIPT (gateway_unavailable, 0),
+    TRANSCRIPT (connected, 0),
+};
+
+typedef struct {
+    const Transcript *transcript;
+    gint fd;                    /* Write end */
+    GMutex lock;
+    gint64 rejection_written;   /* Monotonic µs, 0 until written */
+} Replay;
+
+typedef struct {
+    Replay *replay;
+    GMainLoop *loop;
+    guint lines;
+    gint matched;               /* Index of the matching line, -1 for none */
+    gint64 fallback_at;
+} Reader;
+
+static gpointer
+replay_thread (gpointer user_data)
+{
+    Replay *replay = user_data;
+    const Transcript *t = replay->transcript;
+
+    for (guint i = 0; i < t->n_lines; i++) {
+        g_autofree gchar *line = g_strconcat (t->lines[i].line, "\n", NULL);
+
+        g_usleep (t->lines[i].delay_ms * 1000);
+        /* The reader may be gone once it has fallen back */
+        if (write (replay->fd, line, strlen (line)) < 0)
+            break;
+
+        if (i == t->rejection) {
+            g_mutex_lock (&replay->lock);
+            replay->rejection_written = g_get_monotonic_time ();
+            g_mutex_unlock (&replay->lock);
+        }
+    }
+
+    close (replay->fd);
+    return NULL;
+}
+
+static gboolean
+reader_line_cb (const gchar *line, gpointer user_data)
+{
+    Reader *reader = user_data;
+
+    reader->lines++;
+    if (!vpn_sso_cookie_rejection_match (line))
+        return TRUE;
+
+    /* Where the service stops openconnect and starts SSO */
+    reader->fallback_at = g_get_monotonic_time ();
+    reader->matched = reader->lines - 1;
+    g_main_loop_quit (reader->loop);
+
+    return FALSE;
+}
+
+static gboolean
+reader_timeout_cb (gpointer user_data)
+{
+    Reader *reader = user_data;
+
+    g_main_loop_quit (reader->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+test_rejection_fallback (gconstpointer data)
+{
+    const Transcript *t = data;
+    Replay replay = { t, -1, };
+    Reader reader = { &replay, NULL, 0, -1, 0 };
+    VpnSsoPipeDrain *drain;
+    GThread *thread;
+    gint64 rejection_written;
+    gint64 latency_ms;
+    guint exit_after_ms = 0;
+    guint timeout_id;
+    gint fds[2];
+
+    g_assert_no_errno (pipe (fds));
+    replay.fd = fds[1];
+    g_mutex_init (&replay.lock);
+
+    reader.loop = g_main_loop_new (NULL, FALSE);
+    drain = vpn_sso_pipe_drain_new (fds[0], "recorded openconnect", NULL,
+                                    reader_line_cb, &reader);
+    timeout_id = g_timeout_add_seconds (5, reader_timeout_cb, &reader);
+
+    thread = g_thread_new ("replay", replay_thread, &replay);
+    g_main_loop_run (reader.loop);
+
+    g_source_remove (timeout_id);
+    vpn_sso_pipe_drain_free (drain);
+    g_thread_join (thread);
+    g_main_loop_unref (reader.loop);
+
+    g_assert_cmpint (reader.matched, ==, t->rejection);
+
+    g_mutex_lock (&replay.lock);
+    rejection_written = replay.rejection_written;
+    g_mutex_unlock (&replay.lock);
+    g_assert_cmpint (rejection_written, >, 0);
+
+    /* Stamped after write() returned, so the reader may have been quicker */
+    latency_ms = MAX (0, reader.fallback_at - rejection_written) / 1000;
+    for (guint i = t->rejection + 1; i < t->n_lines; i++)
+        exit_after_ms += t->lines[i].delay_ms;
+
+    g_test_message ("fallback %" G_GINT64_FORMAT " ms after the rejection line, "
+                    "%u ms before openconnect exits", latency_ms, exit_after_ms);
+    g_assert_cmpint (latency_ms, <, MAX_FALLBACK_LATENCY_MS);
+    g_assert_cmpint (latency_ms, <, exit_after_ms);
+
+    g_mutex_clear (&replay.lock);
+}
+
+static void
+test_no_rejection (gconstpointer data)
+{
+    const Transcript *t = data;
+
+    for (guint i = 0; i < t->n_lines; i++) {
+        const gchar *match = vpn_sso_cookie_rejection_match (t->lines[i].line);
+
+        if (match)
+            g_test_message ("\"%s\" matched as %s", t->lines[i].line, match);
+        g_assert_null (match);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    static const gchar * const rejected_names[] = {
+        "anyconnect-connect-401",
+        "anyconnect-session-expired",
+        "globalprotect-auth-failed",
+        "globalprotect-getconfig-512",
+    };
+    static const gchar * const clean_names[] = {
+        "proxy-auth-required",
+        "proxy-forbidden",
+        "gateway-unavailable",
+        "connected",
+    };
+
+    G_STATIC_ASSERT (G_N_ELEMENTS (rejected_names) == G_N_ELEMENTS (rejected_transcripts));
+    G_STATIC_ASSERT (G_N_ELEMENTS (clean_names) == G_N_ELEMENTS (clean_transcripts));
+
+    g_test_init (&argc, &argv, NULL);
+    /* The replay outlives a reader that has fallen back */
+    signal (SIGPIPE, SIG_IGN);
+
+    for (guint i = 0; i < G_N_ELEMENTS (rejected_transcripts); i++) {
+        g_autofree gchar *path = g_strdup_printf ("/cookie-rejection/fallback/%s",
+                                                  rejected_names[i]);
+
+        g_test_add_data_func (path, &rejected_transcripts[i], test_rejection_fallback);
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS (clean_transcripts); i++) {
+        g_autofree gchar *path = g_strdup_printf ("/cookie-rejection/no-match/%s",
+                                                  clean_names[i]);
+
+        g_test_add_data_func (path, &clean_transcripts[i], test_no_rejection);
+    }
+
+    return g_test_run ();
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Browserless Entra ID login against the local mock IdP.
+
+Runs core.http_login through the whole AnyConnect and GlobalProtect flows
+of mock_idp, checks what it returns and how long it takes, and how every
+way off the expected path ends: in FlowDeviation, so the helper falls back
+to the browser, while nothing was sent yet, and in LoginFailed or
+CredentialsRejected, without a second try, once the password or one-time
+code is out.
+"""
+
+from __future__ import annotations
+
+import ssl
+import sys
+import time
+import unittest
+import urllib.parse
+from pathlib import Path
+
+sys.path.insert(0, str(Path(__file__).resolve().parent))
+
+import mock_idp  # noqa: E402
+from core import http_login  # noqa: E402
+from core.http_login import CredentialsRejected, FlowDeviation, LoginFailed, http_saml_login  # noqa: E402
+
+# The fast path is there to beat a browser start by a wide margin
+MAX_LOGIN_SECONDS = 1.0
+
+
+class HttpLoginTest(unittest.TestCase):
+    def setUp(self) -> None:
+        # The mock IdP stands in for login.microsoftonline.com
+        self.saved_hosts = http_login.ENTRA_HOSTS
+        http_login.ENTRA_HOSTS = (mock_idp.IDP_HOST,)
+
+    def tearDown(self) -> None:
+        http_login.ENTRA_HOSTS = self.saved_hosts
+
+    def login(self, idp: mock_idp.MockIdP, password: str = mock_idp.PASSWORD,
+              totp_secret: str = mock_idp.TOTP_SECRET, username: str = mock_idp.USERNAME) -> dict:
+        return http_saml_login(
+            idp.start(), "gp" if idp.protocol == "gp" else "anyconnect", idp.vpn_hosts,
+            username, password, totp_secret,
+            ssl.create_default_context(), timeout=5,
+        )
+
+    def timed_login(self, idp: mock_idp.MockIdP) -> dict:
+        start = time.monotonic()
+        result = self.login(idp)
+        elapsed = time.monotonic() - start
+        print(f"  -> {idp.protocol} login: {elapsed * 1000:.0f} ms, {len(idp.requests)} requests")
+        self.assertLess(elapsed, MAX_LOGIN_SECONDS)
+        return result
+
+    def test_anyconnect(self) -> None:
+        with mock_idp.MockIdP("anyconnect") as idp:
+            result = self.timed_login(idp)
+        self.assertEqual(result["webvpn"], mock_idp.WEBVPN_COOKIE)
+        self.assertEqual(result["SAMLResponse"], mock_idp.SAML_RESPONSE)
+
+    def test_globalprotect(self) -> None:
+        with mock_idp.MockIdP("gp") as idp:
+            result = self.timed_login(idp)
+        self.assertEqual(result["prelogin-cookie"], mock_idp.PRELOGIN_COOKIE)
+        self.assertEqual(result["saml-username"], mock_idp.USERNAME)
+        self.assertEqual(result["SAMLResponse"], mock_idp.SAML_RESPONSE)
+
+    def test_steps(self) -> None:
+        with mock_idp.MockIdP("anyconnect") as idp:
+            self.login(idp)
+        paths = [urllib.parse.urlparse(path).path for _, path in idp.requests]
+        self.assertEqual(paths, [
+            "/+CSCOE+/saml/sp/login", "/contoso/saml2", "/common/GetCredentialType", "/contoso/login",
+            "/common/SAS/BeginAuth", "/common/SAS/EndAuth", "/common/SAS/ProcessAuth",
+            "/kmsi", "/+CSCOE+/saml/sp/acs",
+        ])
+
+    def test_wrong_password(self) -> None:
+        with mock_idp.MockIdP() as idp, self.assertRaisesRegex(CredentialsRejected, "50126.*password"):
+            self.login(idp, password="wrong")
+        # One failed sign-in, not two
+        self.assertEqual([path for _, path in idp.requests].count("/contoso/login"), 1)
+
+    def test_wrong_code(self) -> None:
+        with mock_idp.MockIdP() as idp, self.assertRaisesRegex(CredentialsRejected, "OathCodeIncorrect"):
+            self.login(idp, totp_secret="GEZDGNBVGY3TQOJQ")
+        self.assertEqual([path for _, path in idp.requests].count("/common/SAS/EndAuth"), 1)
+
+    def test_unknown_user(self) -> None:
+        with mock_idp.MockIdP() as idp, self.assertRaisesRegex(FlowDeviation, "unknown user"):
+            self.login(idp, username="bob@contoso.com")
+        self.assertNotIn("/contoso/login", [path for _, path in idp.requests])
+
+    def test_error_page(self) -> None:
+        with mock_idp.MockIdP(error_code="50058") as idp, self.assertRaisesRegex(FlowDeviation, "50058"):
+            self.login(idp)
+
+    def test_push_only(self) -> None:
+        with mock_idp.MockIdP(push_only=True) as idp, self.assertRaisesRegex(LoginFailed, "no TOTP method"):
+            self.login(idp)
+
+    def test_federated(self) -> None:
+        with mock_idp.MockIdP(federated=True) as idp, self.assertRaisesRegex(FlowDeviation, "federated to adfs"):
+            self.login(idp)
+        # The password never left for Entra
+        self.assertNotIn("/contoso/login", [path for _, path in idp.requests])
+
+    def test_unknown_idp(self) -> None:
+        http_login.ENTRA_HOSTS = ("login.microsoftonline.com",)
+        with mock_idp.MockIdP() as idp, self.assertRaisesRegex(FlowDeviation, "unknown page"):
+            self.login(idp)
+
+
+if __name__ == "__main__":
+    unittest.main(verbosity=2)